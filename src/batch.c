@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "parser.h"
+
+struct batch {
+    Session *session;
+    const char *name;
+    FILE *out, *err;
+    struct Instr instr;             /* reused for every line */
+    uint64_t global_version;
+    size_t line;
+    int failed;
+    int done;                       /* exit or quit seen */
+};
+
+/* Tokenize line in place and run it. */
+static void run_line(struct batch *b, char *line, size_t len) {
+    b->line++;
+    if (len && line[len - 1] == '\r') line[--len] = '\0';
+
+    char *args[PARSE_MAX_ARGS];
+    int argc = parse_tokenize(line, args, PARSE_MAX_ARGS);
+    if (argc == 0 || (argc > 0 && args[0][0] == '#')) return;
+    if (argc == 1 && (strcmp(args[0], "exit") == 0 || strcmp(args[0], "quit") == 0)) {
+        b->done = 1;
+        return;
+    }
+
+    if (argc < 0 || parse_args_into(&b->instr, argc, args, b->global_version) != 0) {
+        fprintf(b->err, "%s:%zu: Invalid command or arguments.\n", b->name, b->line);
+        b->failed++;
+        return;
+    }
+    if (decode_and_execute(b->session, &b->instr, b->out, b->err) != 0) {
+        fprintf(b->err, "%s:%zu: Error decoding and executing instruction.\n", b->name, b->line);
+        b->failed++;
+    }
+    b->global_version++;
+}
+
+int batch_run(Session *session, FILE *in, const char *name, FILE *out, FILE *err) {
+    if (!session || !in || !out || !err) return -1;
+    struct batch b = {.session = session, .name = name ? name : "-", .out = out, .err = err};
+
+    /* Whole chunks are read and split into lines in place; only a line cut
+     * off at the end of a chunk is moved. */
+    size_t cap = BATCH_CHUNK, len = 0;
+    char *buf = malloc(cap + 1);
+    if (!buf) return -1;
+    int eof = 0;
+    while (!b.done && !eof) {
+        if (len == cap) {
+            char *grown = realloc(buf, 2 * cap + 1);
+            if (!grown) break;
+            buf = grown;
+            cap *= 2;
+        }
+        size_t n = fread(buf + len, 1, cap - len, in);
+        eof = n < cap - len;
+        len += n;
+
+        char *start = buf, *end = buf + len, *nl;
+        while (!b.done && (nl = memchr(start, '\n', (size_t)(end - start)))) {
+            *nl = '\0';
+            run_line(&b, start, (size_t)(nl - start));
+            start = nl + 1;
+        }
+        len = (size_t)(end - start);
+        memmove(buf, start, len);
+    }
+    if (!b.done && len && eof) {
+        buf[len] = '\0';
+        run_line(&b, buf, len);
+    }
+    free(buf);
+    return ferror(in) || (!b.done && !eof) ? -1 : b.failed;
+}
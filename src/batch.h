@@ -0,0 +1,16 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "decode_and_execute.h"
+
+#define BATCH_CHUNK (1u << 20)      /* bytes read from the script at a time */
+
+/* Run a script of shell commands, one per line, without prompts: for
+ * replaying fixtures and piping. Blank lines and lines starting with # are
+ * skipped, and exit or quit ends the script. Errors go to err prefixed
+ * with name and the line number. Returns the number of commands that
+ * failed, or -1 when in could not be read. */
+int batch_run(Session *session, FILE *in, const char *name, FILE *out, FILE *err);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <stdint.h>
@@ -9,105 +10,206 @@
 #include "./storage/compactor.h"
 #include "./storage/deserializer.h"
 #include "./storage/serializer.h"
+#include "./storage/checksum.h"
 #include "./utils/visualiser.h"
-static int decode_and_execute_locked(VersionNode v_root, Instr instr) {
+#include "./utils/query.h"
+
+/* Matches go out as they are found, not gathered into one string. Once
+ * the output cannot be written, as when a client has gone, the walk stops. */
+static int print_match(void *ctx, const char *path, const char *value) {
+    return fprintf((FILE *)ctx, "%s: %s\n", path, value) < 0;
+}
+
+/* find asked for the value, so only paths go out. */
+static int print_path(void *ctx, const char *path, const char *value) {
+    (void)value;
+    return fprintf((FILE *)ctx, "%s\n", path) < 0;
+}
+
+/* root is the tree pinned for this instruction. */
+static int execute_pinned(Session *session, Document root, Instr instr, FILE *out, FILE *err) {
+    VersionNode v_root = session->root;
     if (!instr) return -1;
     int ret;
-    Document root = v_root->value;
     switch (instr->instr_type) {
 
-        case SET:
-
-            ret = document_set_field_path(
+        case SET: {
+            Value value;
+            if (value_parse(instr->set.type, instr->set.value, &value) != 0) {
+                fprintf(err, "Error: '%s' is not a %s\n", instr->set.value,
+                        value_type_name(instr->set.type));
+                return -1;
+            }
+            ret = index_set_set_value(
+                session->indexes,
                 root,
                 instr->set.path,
-                instr->set.value,
+                &value,
                 instr->global_version
             );
+            value_clear(&value);
             if (ret != 0) {
-                fprintf(stderr, "Error: document_set_field_path returned %d\n", ret);
+                fprintf(err, "Error: document_set_field_path returned %d\n", ret);
                 return ret;
             }
-            printf("OK\n");
+            fprintf(out, "OK\n");
             return 0;
+        }
+
+        case INCR: {
+            int64_t total = 0;
+            ret = index_set_incr(session->indexes, root, instr->incr.path, instr->incr.delta,
+                                 instr->global_version, &total);
+            if (ret == 1) {
+                fprintf(err, "Error: '%s' does not hold an int, or the sum overflows\n",
+                        instr->incr.path);
+                return ret;
+            }
+            if (ret != 0) {
+                fprintf(err, "Error: document_incr_path returned %d\n", ret);
+                return ret;
+            }
+            fprintf(out, "%lld\n", (long long)total);
+            return 0;
+        }
+
+        case APPEND: {
+            size_t length = 0;
+            ret = index_set_append(session->indexes, root, instr->append.path, instr->append.value,
+                                   strlen(instr->append.value), instr->global_version, &length);
+            if (ret == 1) {
+                fprintf(err, "Error: '%s' does not hold a string or bytes\n", instr->append.path);
+                return ret;
+            }
+            if (ret != 0) {
+                fprintf(err, "Error: document_append_path returned %d\n", ret);
+                return ret;
+            }
+            fprintf(out, "%zu\n", length);
+            return 0;
+        }
 
         case GET: {
             char *val = document_get_field(root, instr->get.path, instr->get.version);
 
             if (!val || val == (char*)1) {
-                printf("Value not found.\n");
+                fprintf(out, "Value not found.\n");
                 return 0;
             }
 
-            printf("%s\n", val);
+            fprintf(out, "%s\n", val);
             free(val);
             return 0;
         }
 
-        case DELETE:
-            ret = document_delete_path(root, instr->delete.path, instr->global_version);
+        case MGET: {
+            char *vals[INSTR_MAX_PATHS];
+            ret = document_get_fields(root, instr->mget.paths, (size_t)instr->mget.count,
+                                      (uint64_t)(int64_t)instr->mget.version, vals);
             if (ret != 0) {
-                fprintf(stderr, "Error in document_delete_path: %d\n", ret);
+                fprintf(err, "Error in document_get_fields: %d\n", ret);
                 return ret;
             }
-            printf("OK\n");
+            for (int i = 0; i < instr->mget.count; i++) {
+                fprintf(out, "%s\n", vals[i] ? vals[i] : "Value not found.");
+                free(vals[i]);
+            }
             return 0;
+        }
 
-        case VERSIONS:
-            ret = document_list_versions(root, instr->versions.path);
-            if (ret != 0) {
-                fprintf(stderr, "Error in document_list_versions: %d\n", ret);
+        case QUERY:
+            ret = document_query(root, instr->query.pattern, 0, print_match, out);
+            if (ret < 0) {
+                fprintf(err, "Error: bad pattern or failed query '%s'\n", instr->query.pattern);
                 return ret;
             }
             return 0;
 
-        
-        case COMPACT:
-            ret = compactor_compact_path(v_root, instr->compact.path);
+        case FIND:
+            ret = index_set_find(session->indexes, root, instr->find.pattern, instr->find.value,
+                                 print_path, out);
+            if (ret < 0) {
+                fprintf(err, "Error: bad pattern or failed find '%s'\n", instr->find.pattern);
+                return ret;
+            }
+            return 0;
+
+        case RANGE:
+            ret = index_set_range(session->indexes, root, instr->range.pattern, instr->range.lo,
+                                  instr->range.hi, (size_t)instr->range.limit, print_match, out);
+            if (ret < 0) {
+                fprintf(err, "Error: bad pattern or failed range '%s'\n", instr->range.pattern);
+                return ret;
+            }
+            return 0;
 
+        case CREATE_INDEX: {
+            if (!session->indexes) session->indexes = index_set_create();
+            size_t count = 0;
+            ret = index_set_add(session->indexes, root, instr->index.pattern,
+                                instr->index.range ? INDEX_RANGE : INDEX_EQUALITY, &count);
+            if (ret == 1) {
+                fprintf(err, "'%s' already has %s index\n", instr->index.pattern,
+                        instr->index.range ? "a range" : "an");
+                return ret;
+            }
             if (ret != 0) {
-                fprintf(stderr, "version_node_compact: %d\n", ret);
+                fprintf(err, "Error: could not index '%s'\n", instr->index.pattern);
                 return ret;
             }
-            printf("Compacted %s\n", instr->compact.path ? instr->compact.path : "");
+            fprintf(out, "Indexed %zu fields matching '%s'\n", count, instr->index.pattern);
             return 0;
-            
-        case COMPACT_DB:
-            //root is a vnode
+        }
 
-            ret = compactor_compact(v_root);
+        case DROP_INDEX:
+            if (index_set_drop(session->indexes, instr->index.pattern,
+                               instr->index.range ? INDEX_RANGE : INDEX_EQUALITY) != 0) {
+                fprintf(err, "No index on '%s'\n", instr->index.pattern);
+                return -1;
+            }
+            fprintf(out, "Dropped index on '%s'\n", instr->index.pattern);
+            return 0;
 
+        case DELETE:
+            ret = index_set_delete_field(session->indexes, root, instr->delete.path,
+                                         instr->global_version);
             if (ret != 0) {
-                fprintf(stderr, "Error in document_compact: %d\n", ret);
+                fprintf(err, "Error in document_delete_path: %d\n", ret);
                 return ret;
             }
-            printf("Compacted database\n");
+            fprintf(out, "OK\n");
             return 0;
 
-        case LOAD: {
-            // Deserialize into a temporary VersionNode pointer
-            VersionNode new_root = NULL;
-            int ret = deserialize_db(instr->load.path, &new_root);
-            if (ret != 0 || !new_root) {
-                fprintf(stderr, "Error in deserialize_db: %d\n", ret);
+        case VERSIONS:
+            ret = document_list_versions(root, instr->versions.path, out);
+            if (ret != 0) {
+                fprintf(err, "Error in document_list_versions: %d\n", ret);
                 return ret;
             }
+            return 0;
 
-            // Free old document
-            Document old_doc = (Document)v_root->value;
-            if (old_doc) document_free(old_doc);
-
-            // Replace current root document with loaded one
-            v_root->value = new_root->value;
-            new_root->value = NULL; // prevent double-free
-
-            // Free temporary VersionNode chain except the first node
-            version_node_free(new_root);
+        
+        case COMPACT:
+            ret = compactor_compact_path(v_root, instr->compact.path);
 
-            printf("Successfully loaded database from '%s'\n", instr->load.path);
+            if (ret != 0) {
+                fprintf(err, "version_node_compact: %d\n", ret);
+                return ret;
+            }
+            fprintf(out, "Compacted %s\n", instr->compact.path ? instr->compact.path : "");
             return 0;
-        }
+            
+        case COMPACT_DB:
+            /* Subtrees on a worker pool, each in bounded steps, so
+             * foreground commands only ever wait for one step's lock. */
+            ret = compactor_compact_parallel(v_root, session->retention, 0, NULL);
 
+            if (ret != 0) {
+                fprintf(err, "Error in document_compact: %d\n", ret);
+                return ret;
+            }
+            fprintf(out, "Compacted database\n");
+            return 0;
 
         case SAVE:
         //root, filename
@@ -125,42 +227,387 @@ static int decode_and_execute_locked(VersionNode v_root, Instr instr) {
             else
                 snprintf(fullpath, len, "%s/%s", path, file);
 
-            ret = serialize_db(v_root, fullpath);
+            SerializeOptions options = {.compress = instr->save.compress};
+            ret = serialize_db_with_options(v_root, fullpath, &options);
 
             free(fullpath);
 
             if (ret != 0) {
-                fprintf(stderr, "Error in serialize_db: %d\n", ret);
+                fprintf(err, "Error in serialize_db: %d\n", ret);
                 return ret;
             }
-            printf("Saved database to %s\n", instr->save.filename ? instr->save.filename : "");
+            fprintf(out, "Saved database to %s\n", instr->save.filename ? instr->save.filename : "");
             return 0;
 
         case DUMP:
-            visualize_db(v_root);
+            visualize_db(v_root, out);
         return 0;
 
         default:
-            fprintf(stderr, "Unknown instruction type.\n");
+            fprintf(err, "Unknown instruction type.\n");
             return -1;
     }
 }
 
-int decode_and_execute(VersionNode v_root, Instr instr) {
-    if (!v_root || !instr) return -1;
-    int ret;
-    if (instr->instr_type == LOAD) {
-        if (pthread_rwlock_wrlock(&v_root->lock) != 0) return -1;
-        ret = decode_and_execute_locked(v_root, instr);
-        pthread_rwlock_unlock(&v_root->lock);
+/* Cold reads: the mapped file is never loaded, so no root lock is needed. */
+static int decode_and_execute_snapshot(Snapshot snap, Instr instr, FILE *out, FILE *err) {
+    switch (instr->instr_type) {
+        case GET: {
+            char *val = NULL;
+            if (snapshot_get_field(snap, instr->get.path, instr->get.version, &val) != 0 ||
+                val == (char*)1) {
+                fprintf(out, "Value not found.\n");
+                return 0;
+            }
+            fprintf(out, "%s\n", val);
+            free(val);
+            return 0;
+        }
+
+        case MGET:
+            for (int i = 0; i < instr->mget.count; i++) {
+                char *val = NULL;
+                if (snapshot_get_field(snap, instr->mget.paths[i], instr->mget.version, &val) != 0 ||
+                    val == (char*)1) {
+                    fprintf(out, "Value not found.\n");
+                    continue;
+                }
+                fprintf(out, "%s\n", val);
+                free(val);
+            }
+            return 0;
+
+        case VERSIONS: {
+            int ret = snapshot_list_versions(snap, instr->versions.path, out);
+            if (ret != 0) {
+                fprintf(err, "Error in snapshot_list_versions: %d\n", ret);
+                return ret;
+            }
+            return 0;
+        }
+
+        case CLOSE_SNAPSHOT:
+            return 0;
+
+        case QUERY:
+        case FIND:
+        case RANGE:
+            fprintf(err, "%s reads the in-memory database; run close-snapshot first.\n",
+                    instr->instr_type == QUERY ? "query" : instr->instr_type == FIND ? "find" : "range");
+            return -1;
+
+        default:
+            fprintf(err, "A snapshot is open read-only; run close-snapshot first.\n");
+            return -1;
+    }
+}
+
+/* The file is parsed, and indexes are built over it, with no lock held,
+ * so readers and writers carry on against the old tree until it is
+ * published. Publishing takes the root lock for writing, which waits only
+ * for the writes in flight; readers pin the tree without the lock, never
+ * wait, and keep the old tree alive until they let go of it. The indexes
+ * are swapped in under the same lock, so no write to the old tree can
+ * slip into them and no find answers from the old tree afterwards. */
+static int execute_load(Session *session, const char *path, FILE *out, FILE *err) {
+    VersionNode v_root = session->root;
+    VersionNode new_root = NULL;
+    int ret = deserialize_db(path, &new_root);
+    if (ret != 0 || !new_root) {
+        fprintf(err, "Error in deserialize_db: %d\n", ret);
+        return ret ? ret : -1;
+    }
+    IndexSet staged = NULL;
+    if (index_set_stage(session->indexes, (Document)new_root->value, &staged) != 0) {
+        fprintf(err, "Error: could not index '%s'; nothing was loaded\n", path);
+        version_node_free(new_root);
+        return -1;
+    }
+
+    if (pthread_rwlock_wrlock(&v_root->lock) != 0) {
+        index_set_free(staged);
+        version_node_free(new_root);
+        return -1;
+    }
+    if (staged) ret = index_set_install(session->indexes, staged);
+    if (ret == 0) ret = document_publish_root(v_root, (Document)new_root->value);
+    pthread_rwlock_unlock(&v_root->lock);
+    if (ret == 0) new_root->value = NULL; // now owned by v_root
+    version_node_free(new_root);
+    if (ret != 0) {
+        fprintf(err, "Error: could not publish '%s'\n", path);
         return ret;
     }
-    if (instr->instr_type == COMPACT || instr->instr_type == COMPACT_DB ||
-        instr->instr_type == SAVE || instr->instr_type == DUMP) {
-        return decode_and_execute_locked(v_root, instr);
+    fprintf(out, "Successfully loaded database from '%s'\n", path);
+    return 0;
+}
+
+/* Only the subtree is read from the file. It replaces the live subtree as a
+ * new version, so the rest of the database and the old subtree's history
+ * are untouched. */
+static int execute_load_subtree(Session *session, Instr instr, FILE *out, FILE *err) {
+    VersionNode v_root = session->root;
+    Document subtree = NULL;
+    if (deserialize_subtree(instr->load.path, instr->load.subtree, &subtree) != 0) {
+        fprintf(err, "Error: '%s' has no subtree '%s'\n", instr->load.path,
+                instr->load.subtree);
+        return -1;
+    }
+    if (pthread_rwlock_rdlock(&v_root->lock) != 0) {
+        document_free(subtree);
+        return -1;
     }
-    if (pthread_rwlock_rdlock(&v_root->lock) != 0) return -1;
-    ret = decode_and_execute_locked(v_root, instr);
+    int ret = index_set_set_subdocument(session->indexes, (Document)v_root->value,
+                                        instr->load.subtree, subtree, instr->global_version);
     pthread_rwlock_unlock(&v_root->lock);
+    document_free(subtree);
+    if (ret != 0) {
+        fprintf(err, "Error in document_set_subdocument_path: %d\n", ret);
+        return ret;
+    }
+    fprintf(out, "Loaded '%s' from '%s'\n", instr->load.subtree, instr->load.path);
+    return 0;
+}
+
+static int execute_retain(Session *session, Instr instr, FILE *out, FILE *err) {
+    if (!session->retention) session->retention = retention_policy_create();
+    if (!session->retention) return -1;
+    if (instr->retain.clear) {
+        if (retention_policy_clear(session->retention, instr->retain.prefix) != 0) {
+            fprintf(err, "No retention rule for '%s'\n", instr->retain.prefix);
+            return -1;
+        }
+        fprintf(out, "Cleared retention for '%s'\n", instr->retain.prefix);
+        return 0;
+    }
+    RetentionRule rule = {
+        .keep_versions = instr->retain.versions,
+        .keep_after = instr->retain.after,
+        .keep_seconds = instr->retain.seconds,
+    };
+    if (retention_policy_set(session->retention, instr->retain.prefix, &rule) != 0) return -1;
+    fprintf(out, "OK\n");
+    return 0;
+}
+
+static int execute_autocompact(Session *session, Instr instr, FILE *out, FILE *err) {
+    if (instr->autocompact.mode == AUTOCOMPACT_STATUS) {
+        autocompact_print_status(session->autocompact, out);
+        return 0;
+    }
+    /* Turning it on again applies the new settings. */
+    autocompact_stop(session->autocompact);
+    session->autocompact = NULL;
+    if (instr->autocompact.mode == AUTOCOMPACT_OFF) {
+        fprintf(out, "Background compaction stopped\n");
+        return 0;
+    }
+
+    AutoCompactConfig config;
+    autocompact_config_defaults(&config);
+    if (instr->autocompact.versions >= 0)
+        config.max_history_versions = (uint64_t)instr->autocompact.versions;
+    if (instr->autocompact.bytes >= 0) config.max_history_bytes = (uint64_t)instr->autocompact.bytes;
+    if (instr->autocompact.interval > 0)
+        config.interval_millis = (uint64_t)instr->autocompact.interval;
+    session->autocompact = autocompact_start(session->root, session->retention, &config);
+    if (!session->autocompact) {
+        fprintf(err, "Error: could not start background compaction\n");
+        return -1;
+    }
+    fprintf(out, "Background compaction started\n");
+    return 0;
+}
+
+/* Reads only the file, so it is allowed whatever the session holds. */
+static int execute_verify(const char *path, FILE *out, FILE *err) {
+    VerifyReport report;
+    if (checksum_verify_file(path, &report) != 0) {
+        fprintf(err, "Error: could not verify '%s'\n", path);
+        return -1;
+    }
+    if (!report.has_checksums) {
+        fprintf(out, "%s: no checksums (written by an older version)\n", path);
+        return 0;
+    }
+    if (report.bad_chunks) {
+        fprintf(out, "%s: %llu of %llu chunks damaged, first at byte %llu\n", path,
+               (unsigned long long)report.bad_chunks, (unsigned long long)report.chunks,
+               (unsigned long long)(report.first_bad * report.chunk_size));
+        return -1;
+    }
+    fprintf(out, "%s: OK (%llu bytes, %llu chunks)\n", path,
+           (unsigned long long)report.bytes, (unsigned long long)report.chunks);
+    return 0;
+}
+
+int session_get(Session *session, const char *path, uint64_t local_version, char **value_out) {
+    if (!session || !session->root || !path || !value_out) return -1;
+    char *val = NULL;
+    if (session->snapshot) {
+        if (snapshot_get_field(session->snapshot, path, local_version, &val) != 0) val = NULL;
+    } else {
+        Document root = document_pin_root(session->root);
+        if (!root) return -1;
+        val = document_get_field(root, path, local_version);
+        document_free(root);
+    }
+    if (!val || val == (char *)DELETED) return 1;
+    *value_out = val;
+    return 0;
+}
+
+int session_mget(Session *session, const char *const *paths, size_t count,
+                 uint64_t local_version, char **values_out) {
+    if (!session || !session->root || (count && (!paths || !values_out))) return -1;
+    if (session->snapshot) {
+        for (size_t i = 0; i < count; i++) {
+            char *val = NULL;
+            if (snapshot_get_field(session->snapshot, paths[i], local_version, &val) != 0 ||
+                val == (char *)DELETED) {
+                val = NULL;
+            }
+            values_out[i] = val;
+        }
+        return 0;
+    }
+    Document root = document_pin_root(session->root);
+    if (!root) return -1;
+    int ret = document_get_fields(root, paths, count, local_version, values_out);
+    document_free(root);
+    return ret;
+}
+
+int session_get_value(Session *session, const char *path, uint64_t local_version, Value *out) {
+    if (!session || !session->root || !path || !out) return -1;
+    if (session->snapshot) return snapshot_get_value(session->snapshot, path, local_version, out);
+    Document root = document_pin_root(session->root);
+    if (!root) return -1;
+    int ret = document_get_value(root, path, local_version, out);
+    document_free(root);
+    return ret;
+}
+
+int session_set_locked(Session *session, const char *path, const char *value,
+                       uint64_t global_version) {
+    return index_set_set_field(session->indexes, (Document)session->root->value, path, value,
+                               global_version);
+}
+
+int session_set_value_locked(Session *session, const char *path, const Value *value,
+                             uint64_t global_version) {
+    return index_set_set_value(session->indexes, (Document)session->root->value, path, value,
+                               global_version);
+}
+
+int session_delete_locked(Session *session, const char *path, uint64_t global_version) {
+    return index_set_delete_field(session->indexes, (Document)session->root->value, path,
+                                  global_version);
+}
+
+int session_set(Session *session, const char *path, const char *value, uint64_t global_version) {
+    if (!session || !session->root || session->snapshot) return -1;
+    if (pthread_rwlock_rdlock(&session->root->lock) != 0) return -1;
+    int ret = session_set_locked(session, path, value, global_version);
+    pthread_rwlock_unlock(&session->root->lock);
+    return ret;
+}
+
+int session_set_value(Session *session, const char *path, const Value *value,
+                      uint64_t global_version) {
+    if (!session || !session->root || session->snapshot) return -1;
+    if (pthread_rwlock_rdlock(&session->root->lock) != 0) return -1;
+    int ret = session_set_value_locked(session, path, value, global_version);
+    pthread_rwlock_unlock(&session->root->lock);
+    return ret;
+}
+
+int session_delete(Session *session, const char *path, uint64_t global_version) {
+    if (!session || !session->root || session->snapshot) return -1;
+    if (pthread_rwlock_rdlock(&session->root->lock) != 0) return -1;
+    int ret = session_delete_locked(session, path, global_version);
+    pthread_rwlock_unlock(&session->root->lock);
+    return ret;
+}
+
+int session_incr(Session *session, const char *path, int64_t delta, uint64_t global_version,
+                 int64_t *value_out) {
+    if (!session || !session->root || session->snapshot) return -1;
+    if (pthread_rwlock_rdlock(&session->root->lock) != 0) return -1;
+    int ret = index_set_incr(session->indexes, (Document)session->root->value, path, delta,
+                             global_version, value_out);
+    pthread_rwlock_unlock(&session->root->lock);
+    return ret;
+}
+
+int session_append(Session *session, const char *path, const void *data, size_t length,
+                   uint64_t global_version, size_t *length_out) {
+    if (!session || !session->root || session->snapshot) return -1;
+    if (pthread_rwlock_rdlock(&session->root->lock) != 0) return -1;
+    int ret = index_set_append(session->indexes, (Document)session->root->value, path, data,
+                               length, global_version, length_out);
+    pthread_rwlock_unlock(&session->root->lock);
+    return ret;
+}
+
+static int instr_writes(INSTR_TYPE type) {
+    return type == SET || type == DELETE || type == INCR || type == APPEND ||
+           type == CREATE_INDEX;
+}
+
+int session_instr_exclusive(INSTR_TYPE type) {
+    return type == OPEN_SNAPSHOT || type == CLOSE_SNAPSHOT || type == RETAIN ||
+           type == AUTOCOMPACT || type == CREATE_INDEX || type == DROP_INDEX;
+}
+
+int decode_and_execute(Session *session, Instr instr, FILE *out, FILE *err) {
+    if (!session || !session->root || !instr || !out || !err) return -1;
+    VersionNode v_root = session->root;
+    int ret;
+    if (instr->instr_type == OPEN_SNAPSHOT) {
+        Snapshot snap = NULL;
+        if (snapshot_open(instr->open_snapshot.path, &snap) != 0) {
+            fprintf(err, "Error: '%s' is not a readable v2 snapshot\n",
+                    instr->open_snapshot.path);
+            return -1;
+        }
+        if (session->snapshot) snapshot_release(session->snapshot);
+        session->snapshot = snap;
+        fprintf(out, "Opened snapshot '%s' read-only\n", instr->open_snapshot.path);
+        return 0;
+    }
+    if (instr->instr_type == CLOSE_SNAPSHOT) {
+        if (!session->snapshot) {
+            fprintf(err, "No snapshot is open.\n");
+            return -1;
+        }
+        snapshot_release(session->snapshot);
+        session->snapshot = NULL;
+        fprintf(out, "Closed snapshot\n");
+        return 0;
+    }
+    if (instr->instr_type == VERIFY) return execute_verify(instr->verify.path, out, err);
+    if (instr->instr_type == RETAIN) return execute_retain(session, instr, out, err);
+    if (instr->instr_type == RETENTION) {
+        retention_policy_print(session->retention, out);
+        return 0;
+    }
+    if (instr->instr_type == AUTOCOMPACT) return execute_autocompact(session, instr, out, err);
+    if (session->snapshot) return decode_and_execute_snapshot(session->snapshot, instr, out, err);
+
+    if (instr->instr_type == LOAD) {
+        if (instr->load.subtree) return execute_load_subtree(session, instr, out, err);
+        return execute_load(session, instr->load.path, out, err);
+    }
+    /* Reads pin the tree and take no lock, so a load never waits for a
+     * long query or find. Writes, and index builds, hold the root lock for
+     * reading: the load takes it for writing, so none of them can land in
+     * a tree that is being replaced, or index it. */
+    int writes = instr_writes(instr->instr_type);
+    if (writes && pthread_rwlock_rdlock(&v_root->lock) != 0) return -1;
+    Document root = document_pin_root(v_root);
+    ret = root ? execute_pinned(session, root, instr, out, err) : -1;
+    document_free(root);
+    if (writes) pthread_rwlock_unlock(&v_root->lock);
     return ret;
 }
@@ -1,9 +1,62 @@
 #ifndef DECODE_AND_EXECUTE_H
 #define DECODE_AND_EXECUTE_H
 
+#include <stdio.h>
 #include "ir.h"
 #include "document.h"
+#include "./storage/snapshot.h"
+#include "./storage/retention.h"
+#include "./storage/autocompact.h"
+#include "./utils/value_index.h"
 
-int decode_and_execute(VersionNode root, Instr instr);
+/* Shell state that outlives a single instruction. While snapshot is set,
+ * reads are answered from that file and writes are refused. retention is
+ * what compact_db keeps; autocompact, when running, compacts in the
+ * background under the same policy. indexes, created by the first
+ * create-index, is kept current by every write the session makes. */
+typedef struct Session {
+    VersionNode root;
+    Snapshot snapshot;
+    RetentionPolicy retention;
+    AutoCompact autocompact;
+    IndexSet indexes;
+} Session;
+
+/* get, set and delete for callers that carry paths and values as bytes
+ * rather than command lines, such as the server's binary protocol. They
+ * follow the commands' rules: reads come from an open snapshot, and writes
+ * are refused while one is open. session_get returns 1 when there is no
+ * value, else 0 with *value_out caller-owned. */
+int session_get(Session *session, const char *path, uint64_t local_version, char **value_out);
+/* Many fields at once; values_out[i] is NULL where there is none. */
+int session_mget(Session *session, const char *const *paths, size_t count,
+                 uint64_t local_version, char **values_out);
+int session_set(Session *session, const char *path, const char *value, uint64_t global_version);
+/* Typed reads and writes; session_get_value returns as document_get_value. */
+int session_get_value(Session *session, const char *path, uint64_t local_version, Value *out);
+int session_set_value(Session *session, const char *path, const Value *value,
+                      uint64_t global_version);
+int session_delete(Session *session, const char *path, uint64_t global_version);
+/* Atomic read-modify-writes, returning as document_incr_path and
+ * document_append_path. */
+int session_incr(Session *session, const char *path, int64_t delta, uint64_t global_version,
+                 int64_t *value_out);
+int session_append(Session *session, const char *path, const void *data, size_t length,
+                   uint64_t global_version, size_t *length_out);
+/* The same two with the root lock already held for reading, for callers
+ * running several operations under one acquisition. */
+int session_set_locked(Session *session, const char *path, const char *value,
+                       uint64_t global_version);
+int session_set_value_locked(Session *session, const char *path, const Value *value,
+                             uint64_t global_version);
+int session_delete_locked(Session *session, const char *path, uint64_t global_version);
+
+/* Whether type replaces what the Session points to, so that callers
+ * sharing a Session between threads must run it alone. */
+int session_instr_exclusive(INSTR_TYPE type);
+
+/* Results go to out and error messages to err, which may be the same
+ * stream. Returns 0, or nonzero when the command failed. */
+int decode_and_execute(Session *session, Instr instr, FILE *out, FILE *err);
 
 #endif
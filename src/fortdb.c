@@ -1,19 +1,26 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "./utils/document.h"
 #include "./utils/version_node.h"
 #include "./utils/hash.h"
+#include "./utils/reclaim.h"
 #include "./storage/compactor.h"
 #include "./storage/deserializer.h"
 #include "./storage/serializer.h"
 #include "ir.h"
 #include "parser.h"
 #include "decode_and_execute.h"
+#include "server.h"
+#include "batch.h"
 
 
 #define INPUT_BUFFER_SIZE 1024
-#define MAX_ARGS 32
+#define OUTPUT_BUFFER_SIZE (1u << 20)   /* stdout buffer for scripts */
 
 static void print_help(void) {
     puts(
@@ -21,15 +28,43 @@ static void print_help(void) {
 "\n"
 "    Commands                      Examples                       Description\n"
 "  load <path>               load /home/me/db.fort          Load database from file\n"
+"  load <path> <subtree>     load db.fort tenants/acme      Restore one subtree from a file, keeping the rest\n"
 "  get <path> [--v=<V>]      get users/john/age             Fetch field value (optional local version V)\n"
+"  mget <path>... [--v=<V>]  mget users/john/age users/john/email\n"
+"                                                           Fetch many fields at once, one line each\n"
+"  query <pattern>           query users/*/age              Every field matching a pattern (* ** and globs)\n"
+"  create-index <pattern>    create-index users/*/status    Index fields matching a pattern by value\n"
+"       [--range]             create-index orders/*/total --range\n"
+"                                                           ...in numeric order, for range\n"
+"  drop-index <pattern> [--range]\n"
+"                            drop-index users/*/status      Remove an index\n"
+"  find <pattern> = <value>  find users/*/status = active   Paths of matching fields holding value; indexed patterns skip the walk\n"
+"  range <pattern> <lo> <hi> [--limit=<N>]\n"
+"                            range orders/*/total 100 500   Matching fields with numeric values in [lo, hi], ascending when range-indexed\n"
 "  set <path> <value>        set users/john/age 42          Insert or update field\n"
+"       [--type=<T>]          set users/john/age 42 --type=int\n"
+"                                                           ...stored as int, double, bool (true/false) or bytes (hex)\n"
+"  incr <path> [delta]       incr stats/hits                Add delta (default 1) to an int atomically; prints the sum\n"
+"  append <path> <value>     append logs/today \" done\"      Extend a string or bytes atomically; prints the length\n"
 "  delete <path>             delete users/john/age          Tombstone an entity\n"
 "  list-versions <path>      list-versions users/john/age   List all versions of an entity\n"
 "  compact <path>            compact users/john             Retain only latest versions, remove tombstones\n"
 "  compact_db                compact_db                     Compact entire database\n"
 "  save filename, <path>     save.db ./test/saves           Save current in-memory DB to file\n"
+"       [--compress]          save.db . --compress           ...in compressed blocks\n"
 "  exit, quit                exit                           Exit the interactive shell\n"
 "  dump                      dump                           Print the entire database state to the console\n"
+"  open-snapshot <file>      open-snapshot db.fort          Answer get/list-versions from a saved file without loading it\n"
+"  close-snapshot            close-snapshot                 Return to the in-memory database\n"
+"  verify <file>             verify db.fort                 Check a saved file against its checksums\n"
+"  retain <prefix> <N> [--after=<G>] [--window=<S>]\n"
+"                            retain audit 30                compact_db keeps N versions (or newer than G, or S seconds) under prefix\n"
+"  retain <prefix> --clear   retain audit --clear           Drop the rule for prefix\n"
+"  retention                 retention                      List retention rules\n"
+"  autocompact on [--versions=<N>] [--bytes=<B>] [--interval=<MS>]\n"
+"                            autocompact on --versions=5000 Compact in the background once N versions or B bytes of history build up\n"
+"  autocompact off           autocompact off                Stop background compaction\n"
+"  autocompact               autocompact                    Show history held, reclaimed bytes and progress\n"
 "  help, ?                   show this help message\n"
 "\n"
 "Key Features\n"
@@ -63,14 +98,8 @@ static void print_help(void) {
     );
 }
 
-int main(void) {
-    Document d_root = document_create();
-    VersionNode root = version_node_create(d_root, 0, 0, NULL, (void(*)(void *))document_free);
-    if (!root) {
-        fprintf(stderr, "Failed to initialize database.\n");
-        return 1;
-    }
-
+/* The interactive shell on stdin. */
+static void run_shell(Session *session) {
     printf("fortdb started. Type 'exit' to quit.\n");
 
     char input[INPUT_BUFFER_SIZE];
@@ -82,16 +111,14 @@ int main(void) {
         input[strcspn(input, "\n")] = '\0';
         if (strcmp(input, "exit") == 0 || strcmp(input, "quit") == 0) break;
 
-        // Tokenize input like a shell (space-delimited)
-        char *args[MAX_ARGS];
-        int argc = 0;
-        char *token = strtok(input, " ");
-        while (token && argc < MAX_ARGS) {
-            args[argc++] = token;
-            token = strtok(NULL, " ");
-        }
-
+        // Tokenize input like a shell, quotes and all
+        char *args[PARSE_MAX_ARGS];
+        int argc = parse_tokenize(input, args, PARSE_MAX_ARGS);
         if (argc == 0) continue;
+        if (argc < 0) {
+            fprintf(stderr, "Invalid command or arguments.\n");
+            continue;
+        }
 
         // Help short-circuit
         if (strcmp(args[0], "help") == 0 || strcmp(args[0], "?") == 0) {
@@ -100,22 +127,97 @@ int main(void) {
         }
 
         // Parse arguments into instruction
-        Instr instr = parse_args(argc, args, global_version);
-        if (!instr) {
+        struct Instr instr;
+        if (parse_args_into(&instr, argc, args, global_version) != 0) {
             fprintf(stderr, "Invalid command or arguments.\n");
             continue;
         }
-        
+
         // Decode and execute
-        int status = decode_and_execute(root, instr);
+        int status = decode_and_execute(session, &instr, stdout, stderr);
         if (status != 0) {
             fprintf(stderr, "Error decoding and executing instruction.\n");
         }
 
         global_version++;
     }
+}
 
-    version_node_free(root);
+/* Run a script from path, or stdin for "-", with stdout fully buffered.
+ * Exits nonzero when a command failed. */
+static int run_script(Session *session, const char *path) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "fortdb: cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    int failed = batch_run(session, in, path, stdout, stderr);
+    if (failed < 0) fprintf(stderr, "fortdb: cannot read %s: %s\n", path, strerror(errno));
+    if (in != stdin) fclose(in);
+    return failed != 0;
+}
+
+/* Serve clients until SIGINT or SIGTERM. The signals are blocked before any
+ * server thread starts, so only sigwait sees them. */
+static int run_server(Session *session, const char *address) {
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+    Server server = server_start(session, address, 0);
+    if (!server) {
+        fprintf(stderr, "fortdb: cannot listen on %s: %s\n", address, strerror(errno));
+        return 1;
+    }
+    if (server_port(server)) printf("fortdb listening on port %d\n", server_port(server));
+    else printf("fortdb listening on %s\n", address);
+    fflush(stdout);
+
+    int sig;
+    sigwait(&stop, &sig);
+    server_stop(server);
     return 0;
 }
 
+int main(int argc, char **argv) {
+    const char *address = NULL, *script = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            address = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            script = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--listen <port | host:port | socket path>] [-f <script | ->]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    /* Piped input is a script too: no prompts to print. */
+    if (!address && !script && !isatty(STDIN_FILENO)) script = "-";
+
+    Document d_root = document_create();
+    VersionNode root = version_node_create(d_root, 0, 0, NULL, (void(*)(void *))document_free);
+    if (!root) {
+        fprintf(stderr, "Failed to initialize database.\n");
+        return 1;
+    }
+    Session session = { .root = root, .snapshot = NULL, .retention = retention_policy_create(),
+                        .autocompact = NULL };
+
+    int status = 0;
+    if (address) status = run_server(&session, address);
+    else if (script) status = run_script(&session, script);
+    else run_shell(&session);
+
+    autocompact_stop(session.autocompact);
+    if (session.snapshot) snapshot_release(session.snapshot);
+    retention_policy_free(session.retention);
+    index_set_free(session.indexes);
+    version_node_free(root);
+    /* History compaction retired and nobody has freed yet. */
+    reclaim_barrier();
+    return status;
+}
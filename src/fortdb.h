@@ -0,0 +1,140 @@
+#ifndef FORTDB_H
+#define FORTDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* FortDB in-process: the public API of libfortdb.a and libfortdb.so.
+ *
+ * A handle owns one database, the root VersionNode the shell creates, and
+ * may be used from any number of threads at once. Paths are slash
+ * separated, as at the prompt. Every write is a new version, and reads can
+ * ask for any field's earlier versions. Functions return 0 on success and
+ * -1 on failure unless noted; values handed out are the caller's, to be
+ * released with fortdb_free. */
+typedef struct FortDB *FortDB;
+
+#define FORTDB_LATEST UINT64_MAX    /* the newest version of a field */
+#define FORTDB_NOT_FOUND 1          /* no value at that path or version */
+
+/* A database loaded from a file saved by the shell or fortdb_save, or an
+ * empty one when path is NULL. */
+int fortdb_open(const char *path, FortDB *db_out);
+
+/* Stop background work and free everything. The handle must be idle. */
+void fortdb_close(FortDB db);
+
+/* Save to path, in compressed blocks when compress is set. */
+int fortdb_save(FortDB db, const char *path, int compress);
+
+/* The value at path, or FORTDB_NOT_FOUND. fortdb_get_version reads the
+ * field's local version n, counted from 1 as list-versions shows them. */
+int fortdb_get(FortDB db, const char *path, char **value_out);
+int fortdb_get_version(FortDB db, const char *path, uint64_t version, char **value_out);
+
+/* The latest values at count paths, into values_out[i], NULL where there
+ * is none. Paths under a common parent are resolved together, so reading
+ * many fields of one record costs one traversal. */
+int fortdb_mget(FortDB db, const char *const *paths, size_t count, char **values_out);
+
+int fortdb_set(FortDB db, const char *path, const char *value);
+int fortdb_delete(FortDB db, const char *path);
+
+/* Values keep the type they were written with. fortdb_set writes strings;
+ * the calls below store numbers and booleans natively and bytes with their
+ * length, NULs included. Text reads such as fortdb_get and queries see an
+ * int in decimal, a double as it reads back, true or false, and bytes as
+ * 0x and hex digits. */
+typedef enum {
+    FORTDB_STRING = 1,
+    FORTDB_BYTES,
+    FORTDB_INT64,
+    FORTDB_DOUBLE,
+    FORTDB_BOOL
+} FortDBType;
+
+typedef struct FortDBValue {
+    FortDBType type;
+    int64_t i;                  /* FORTDB_INT64, and FORTDB_BOOL as 0 or 1 */
+    double d;                   /* FORTDB_DOUBLE */
+    char *data;                 /* FORTDB_STRING and FORTDB_BYTES, with a NUL
+                                 * after length bytes; freed with fortdb_free */
+    size_t length;
+} FortDBValue;
+
+int fortdb_set_int(FortDB db, const char *path, int64_t value);
+int fortdb_set_double(FortDB db, const char *path, double value);
+int fortdb_set_bool(FortDB db, const char *path, int value);
+int fortdb_set_bytes(FortDB db, const char *path, const void *data, size_t length);
+
+#define FORTDB_WRONG_TYPE 2         /* the field holds a value the op cannot take */
+
+/* Read-modify-writes done inside the database: the field's latest value is
+ * read and its next version written under one lock, so racing callers
+ * never lose an update. fortdb_incr adds delta to an int, or to a string
+ * holding one, counting an absent field as 0, and hands back the sum.
+ * fortdb_append extends a string or bytes, or writes a new string, and
+ * hands back the new length. Results may be NULL. Both return
+ * FORTDB_WRONG_TYPE for other values, and fortdb_incr when the sum would
+ * overflow. */
+int fortdb_incr(FortDB db, const char *path, int64_t delta, int64_t *value_out);
+int fortdb_append(FortDB db, const char *path, const void *data, size_t length,
+                  size_t *length_out);
+
+/* The value at path as written, at a local version or FORTDB_LATEST, or
+ * FORTDB_NOT_FOUND. */
+int fortdb_get_value(FortDB db, const char *path, uint64_t version, FortDBValue *value_out);
+
+/* Called with each field a query matches; path and value are valid only
+ * during the call. Calls never overlap but come in no particular order.
+ * Returning nonzero stops the query. */
+typedef int (*FortDBMatchFn)(void *ctx, const char *path, const char *value);
+
+/* Every live field whose path matches pattern: "*" is one component, "**"
+ * any number, and other components may be globs like "user-?". Large
+ * subtrees are searched on several threads, and matches reach fn as they
+ * are found. Returns 0, 1 when fn stopped it, or -1. fn must not run
+ * commands through fortdb_exec. */
+int fortdb_query(FortDB db, const char *pattern, FortDBMatchFn fn, void *ctx);
+
+/* The fields matching pattern whose latest value is value, to fn as for
+ * fortdb_query. After fortdb_exec(db, "create-index <pattern>", NULL) this
+ * costs time in proportion to the matches instead of a walk; every write
+ * keeps the index current. Same returns and rule for fn. */
+int fortdb_find(FortDB db, const char *pattern, const char *value, FortDBMatchFn fn, void *ctx);
+
+/* The fields matching pattern whose values are numbers in [lo, hi], at
+ * most limit of them (0: all). With "create-index <pattern> --range" this
+ * is O(log n + k) and fn gets them in ascending order; otherwise every
+ * match is parsed. Same returns and rule for fn. */
+int fortdb_range(FortDB db, const char *pattern, double lo, double hi, size_t limit,
+                 FortDBMatchFn fn, void *ctx);
+
+typedef enum {
+    FORTDB_OP_GET,
+    FORTDB_OP_SET,
+    FORTDB_OP_DELETE
+} FortDBOpType;
+
+typedef struct FortDBOp {
+    FortDBOpType type;
+    const char *path;
+    const char *value;          /* SET: the value to write */
+    uint64_t version;           /* GET: FORTDB_LATEST or a local version */
+    char *result;               /* GET: set on success, freed with fortdb_free */
+    int status;                 /* 0, FORTDB_NOT_FOUND or -1 */
+} FortDBOp;
+
+/* Run ops in order under a single lock acquisition, with the writes taking
+ * consecutive global versions. Each op's status says how it went. Returns
+ * the number of ops that failed; FORTDB_NOT_FOUND is not a failure. */
+int fortdb_batch(FortDB db, FortDBOp *ops, size_t count);
+
+/* Any shell command, such as "compact_db" or "retain audit 30", with its
+ * output written to out (NULL discards it). */
+int fortdb_exec(FortDB db, const char *command, FILE *out);
+
+void fortdb_free(char *value);
+
+#endif
@@ -2,6 +2,9 @@
 #define IR_H
 
 #include <stdint.h>
+#include "value.h"
+
+#define INSTR_MAX_PATHS 31      /* mget: every word after the command */
 
 typedef enum {
     SET,
@@ -12,9 +15,29 @@ typedef enum {
     COMPACT_DB,
     LOAD,
     SAVE,
-    DUMP
+    DUMP,
+    OPEN_SNAPSHOT,
+    CLOSE_SNAPSHOT,
+    VERIFY,
+    RETAIN,
+    RETENTION,
+    AUTOCOMPACT,
+    MGET,
+    QUERY,
+    CREATE_INDEX,
+    DROP_INDEX,
+    FIND,
+    RANGE,
+    INCR,
+    APPEND
 } INSTR_TYPE;
 
+typedef enum {
+    AUTOCOMPACT_STATUS,
+    AUTOCOMPACT_ON,
+    AUTOCOMPACT_OFF
+} AUTOCOMPACT_MODE;
+
 typedef struct Instr *Instr;
 struct Instr {
     INSTR_TYPE instr_type;
@@ -24,6 +47,7 @@ struct Instr {
         struct {
             char *value;
             const char *path;
+            ValueType type;         // --type=, VALUE_STRING by default
         } set;
 
         struct {
@@ -32,6 +56,42 @@ struct Instr {
             int version;
         } get;
 
+        struct {
+            const char *paths[INSTR_MAX_PATHS];
+            int count;
+            int version;
+        } mget;
+
+        struct {
+            const char *pattern;
+        } query;
+
+        struct {
+            const char *pattern;
+            int range;              // --range: ordered by number
+        } index;                    // create-index and drop-index
+
+        struct {
+            const char *pattern;
+            const char *value;
+        } find;
+
+        struct {
+            const char *pattern;
+            double lo, hi;
+            uint64_t limit;         // 0: no limit
+        } range;
+
+        struct {
+            const char *path;
+            int64_t delta;          // 1 when not given
+        } incr;
+
+        struct {
+            const char *path;
+            const char *value;
+        } append;
+
         struct {
             const char *path;
         } delete;
@@ -52,13 +112,38 @@ struct Instr {
 
         struct {
             const char *path;
+            const char *subtree;    // NULL loads the whole database
         } load;
 
         struct {
             char *filename;
             const char *path;
+            int compress;
         } save;
 
+        struct {
+            const char *path;
+        } open_snapshot;
+
+        struct {
+            const char *path;
+        } verify;
+
+        struct {
+            const char *prefix;
+            uint64_t versions;
+            uint64_t after;
+            uint64_t seconds;
+            int clear;
+        } retain;
+
+        struct {
+            AUTOCOMPACT_MODE mode;
+            int64_t versions;       // -1 keeps the default
+            int64_t bytes;
+            int64_t interval;
+        } autocompact;
+
     };
 };
 
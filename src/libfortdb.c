@@ -0,0 +1,284 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fortdb.h"
+#include "decode_and_execute.h"
+#include "parser.h"
+#include "./utils/document.h"
+#include "./utils/query.h"
+#include "./utils/reclaim.h"
+#include "./utils/version_node.h"
+#include "./storage/deserializer.h"
+#include "./storage/serializer.h"
+
+struct FortDB {
+    Session session;
+    atomic_uint_fast64_t global_version;
+    /* Commands that replace what the Session points to run alone. */
+    pthread_rwlock_t session_lock;
+};
+
+int fortdb_open(const char *path, FortDB *db_out) {
+    if (!db_out) return -1;
+    *db_out = NULL;
+    FortDB db = calloc(1, sizeof(*db));
+    if (!db) return -1;
+    if (pthread_rwlock_init(&db->session_lock, NULL) != 0) {
+        free(db);
+        return -1;
+    }
+
+    VersionNode root = NULL;
+    if (path) {
+        if (deserialize_db(path, &root) != 0) root = NULL;
+    } else {
+        Document doc = document_create();
+        root = doc ? version_node_create(doc, 0, 0, NULL, (void (*)(void *))document_free) : NULL;
+        if (doc && !root) document_free(doc);
+    }
+    db->session.root = root;
+    db->session.retention = retention_policy_create();
+    if (!root || !db->session.retention) {
+        fortdb_close(db);
+        return -1;
+    }
+    atomic_init(&db->global_version, root->global_version + 1);
+    *db_out = db;
+    return 0;
+}
+
+void fortdb_close(FortDB db) {
+    if (!db) return;
+    autocompact_stop(db->session.autocompact);
+    if (db->session.snapshot) snapshot_release(db->session.snapshot);
+    retention_policy_free(db->session.retention);
+    index_set_free(db->session.indexes);
+    if (db->session.root) version_node_free(db->session.root);
+    /* History compaction retired and nobody has freed yet. */
+    reclaim_barrier();
+    pthread_rwlock_destroy(&db->session_lock);
+    free(db);
+}
+
+int fortdb_save(FortDB db, const char *path, int compress) {
+    if (!db || !path) return -1;
+    SerializeOptions options = {.compress = compress};
+    return serialize_db_with_options(db->session.root, path, &options) == 0 ? 0 : -1;
+}
+
+int fortdb_get_version(FortDB db, const char *path, uint64_t version, char **value_out) {
+    if (!db || !path || !value_out) return -1;
+    *value_out = NULL;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = session_get(&db->session, path, version, value_out);
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret < 0 ? -1 : ret;
+}
+
+int fortdb_get(FortDB db, const char *path, char **value_out) {
+    return fortdb_get_version(db, path, FORTDB_LATEST, value_out);
+}
+
+int fortdb_mget(FortDB db, const char *const *paths, size_t count, char **values_out) {
+    if (!db) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = session_mget(&db->session, paths, count, FORTDB_LATEST, values_out);
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret == 0 ? 0 : -1;
+}
+
+int fortdb_query(FortDB db, const char *pattern, FortDBMatchFn fn, void *ctx) {
+    if (!db || !pattern || !fn) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = -1;
+    Document root = db->session.snapshot ? NULL : document_pin_root(db->session.root);
+    if (root) ret = document_query(root, pattern, 0, fn, ctx);
+    document_free(root);
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret;
+}
+
+int fortdb_find(FortDB db, const char *pattern, const char *value, FortDBMatchFn fn,
+                void *ctx) {
+    if (!db || !pattern || !value || !fn) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = -1;
+    Document root = db->session.snapshot ? NULL : document_pin_root(db->session.root);
+    if (root) ret = index_set_find(db->session.indexes, root, pattern, value, fn, ctx);
+    document_free(root);
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret;
+}
+
+int fortdb_range(FortDB db, const char *pattern, double lo, double hi, size_t limit,
+                 FortDBMatchFn fn, void *ctx) {
+    if (!db || !pattern || !fn) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = -1;
+    Document root = db->session.snapshot ? NULL : document_pin_root(db->session.root);
+    if (root) ret = index_set_range(db->session.indexes, root, pattern, lo, hi, limit, fn, ctx);
+    document_free(root);
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret;
+}
+
+int fortdb_set(FortDB db, const char *path, const char *value) {
+    if (!db || !path || !value) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = session_set(&db->session, path, value, atomic_fetch_add(&db->global_version, 1));
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret == 0 ? 0 : -1;
+}
+
+_Static_assert((int)FORTDB_STRING == VALUE_STRING && (int)FORTDB_BYTES == VALUE_BYTES &&
+               (int)FORTDB_INT64 == VALUE_INT64 && (int)FORTDB_DOUBLE == VALUE_DOUBLE &&
+               (int)FORTDB_BOOL == VALUE_BOOL, "FortDBType mirrors ValueType");
+
+static int set_value(FortDB db, const char *path, const Value *value) {
+    if (!db || !path) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = session_set_value(&db->session, path, value,
+                                atomic_fetch_add(&db->global_version, 1));
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret == 0 ? 0 : -1;
+}
+
+int fortdb_set_int(FortDB db, const char *path, int64_t value) {
+    return set_value(db, path, &(Value){.type = VALUE_INT64, .i = value});
+}
+
+int fortdb_set_double(FortDB db, const char *path, double value) {
+    return set_value(db, path, &(Value){.type = VALUE_DOUBLE, .d = value});
+}
+
+int fortdb_set_bool(FortDB db, const char *path, int value) {
+    return set_value(db, path, &(Value){.type = VALUE_BOOL, .b = value != 0});
+}
+
+int fortdb_set_bytes(FortDB db, const char *path, const void *data, size_t length) {
+    if (length && !data) return -1;
+    return set_value(db, path, &(Value){.type = VALUE_BYTES, .data = data, .length = length});
+}
+
+int fortdb_incr(FortDB db, const char *path, int64_t delta, int64_t *value_out) {
+    if (!db || !path) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = session_incr(&db->session, path, delta, atomic_fetch_add(&db->global_version, 1),
+                           value_out);
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret == 1 ? FORTDB_WRONG_TYPE : ret;
+}
+
+int fortdb_append(FortDB db, const char *path, const void *data, size_t length,
+                  size_t *length_out) {
+    if (!db || !path) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = session_append(&db->session, path, data, length,
+                             atomic_fetch_add(&db->global_version, 1), length_out);
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret == 1 ? FORTDB_WRONG_TYPE : ret;
+}
+
+int fortdb_get_value(FortDB db, const char *path, uint64_t version, FortDBValue *value_out) {
+    if (!db || !path || !value_out) return -1;
+    *value_out = (FortDBValue){0};
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    Value value;
+    int ret = session_get_value(&db->session, path, version, &value);
+    pthread_rwlock_unlock(&db->session_lock);
+    if (ret != 0) return ret < 0 ? -1 : FORTDB_NOT_FOUND;
+    value_out->type = (FortDBType)value.type;
+    if (value.type == VALUE_INT64) value_out->i = value.i;
+    else if (value.type == VALUE_BOOL) value_out->i = value.b;
+    else if (value.type == VALUE_DOUBLE) value_out->d = value.d;
+    value_out->data = (char *)value.data;
+    value_out->length = value.length;
+    return 0;
+}
+
+int fortdb_delete(FortDB db, const char *path) {
+    if (!db || !path) return -1;
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return -1;
+    int ret = session_delete(&db->session, path, atomic_fetch_add(&db->global_version, 1));
+    pthread_rwlock_unlock(&db->session_lock);
+    return ret == 0 ? 0 : -1;
+}
+
+/* One op against the live tree, with the root lock already held. */
+static int run_op(Session *session, FortDBOp *op, uint64_t global_version) {
+    Document root = (Document)session->root->value;
+    if (!op->path) return -1;
+    switch (op->type) {
+        case FORTDB_OP_GET: {
+            char *val = document_get_field(root, op->path, op->version);
+            if (!val || val == (char *)DELETED) return FORTDB_NOT_FOUND;
+            op->result = val;
+            return 0;
+        }
+        case FORTDB_OP_SET:
+            if (!op->value) return -1;
+            return session_set_locked(session, op->path, op->value, global_version) == 0 ? 0 : -1;
+        case FORTDB_OP_DELETE:
+            return session_delete_locked(session, op->path, global_version) == 0 ? 0 : -1;
+        default:
+            return -1;
+    }
+}
+
+/* With a snapshot open, reads go to the file and writes are refused, as
+ * for single calls. */
+static int run_op_snapshot(Session *session, FortDBOp *op) {
+    if (op->type != FORTDB_OP_GET || !op->path) return -1;
+    int ret = session_get(session, op->path, op->version, &op->result);
+    return ret < 0 ? -1 : ret;
+}
+
+int fortdb_batch(FortDB db, FortDBOp *ops, size_t count) {
+    if (!db || (!ops && count)) return -1;
+    for (size_t i = 0; i < count; i++) {
+        ops[i].result = NULL;
+        ops[i].status = -1;
+    }
+    if (pthread_rwlock_rdlock(&db->session_lock) != 0) return (int)count;
+
+    VersionNode root = db->session.root;
+    int snapshot = db->session.snapshot != NULL;
+    uint64_t base = atomic_fetch_add(&db->global_version, count);
+    if (snapshot) {
+        for (size_t i = 0; i < count; i++) ops[i].status = run_op_snapshot(&db->session, &ops[i]);
+    } else if (pthread_rwlock_rdlock(&root->lock) == 0) {
+        for (size_t i = 0; i < count; i++) ops[i].status = run_op(&db->session, &ops[i], base + i);
+        pthread_rwlock_unlock(&root->lock);
+    }
+    pthread_rwlock_unlock(&db->session_lock);
+
+    int failed = 0;
+    for (size_t i = 0; i < count; i++) failed += ops[i].status < 0;
+    return failed;
+}
+
+int fortdb_exec(FortDB db, const char *command, FILE *out) {
+    if (!db || !command) return -1;
+    char *line = strdup(command);
+    if (!line) return -1;
+    FILE *sink = out ? out : fopen("/dev/null", "w");
+    struct Instr instr;
+    int ret = -1;
+    if (sink && parse_line(&instr, line, atomic_fetch_add(&db->global_version, 1)) == 0) {
+        int exclusive = session_instr_exclusive(instr.instr_type);
+        int locked = exclusive ? pthread_rwlock_wrlock(&db->session_lock)
+                               : pthread_rwlock_rdlock(&db->session_lock);
+        if (locked == 0) {
+            ret = decode_and_execute(&db->session, &instr, sink, sink) == 0 ? 0 : -1;
+            pthread_rwlock_unlock(&db->session_lock);
+        }
+    }
+    if (sink && sink != out) fclose(sink);
+    free(line);
+    return ret;
+}
+
+void fortdb_free(char *value) {
+    free(value);
+}
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,80 +7,367 @@
 #include "parser.h"
 #include "ir.h"
 
-Instr parse_args(int argc, char *args[], uint64_t global_version) {
-    if (argc < 1) return NULL;
+/* Bytes that end a run of plain word bytes. */
+enum { PLAIN, BLANK, SPECIAL };
+static const unsigned char byte_class[256] = {
+    ['\0'] = SPECIAL, [' '] = BLANK, ['\t'] = BLANK, ['\r'] = BLANK, ['\n'] = BLANK,
+    ['"'] = SPECIAL, ['\''] = SPECIAL, ['\\'] = SPECIAL,
+};
+
+/* The bytes up to one of stop, shifted back to w unless nothing has
+ * shortened the line yet. */
+static void copy_run(char **w, char **r, int in_double_quotes) {
+    char *src = *r, *dst = *w;
+    if (in_double_quotes) {
+        if (dst == src) {
+            while (*src && *src != '"' && *src != '\\') src++;
+            dst = src;
+        } else {
+            while (*src && *src != '"' && *src != '\\') *dst++ = *src++;
+        }
+    } else if (dst == src) {
+        while (byte_class[(unsigned char)*src] == PLAIN) src++;
+        dst = src;
+    } else {
+        while (byte_class[(unsigned char)*src] == PLAIN) *dst++ = *src++;
+    }
+    *w = dst;
+    *r = src;
+}
+
+/* One pass over the line. Words are left where they are until a quote or
+ * escape makes one shorter than its text; w then trails r. */
+int parse_tokenize(char *line, char *args[], int max_args) {
+    if (!line || !args) return -1;
+    char *r = line, *w = line;
+    int argc = 0;
+    while (1) {
+        while (byte_class[(unsigned char)*r] == BLANK) r++;
+        if (!*r) return argc;
+        if (argc == max_args) return -1;
+        args[argc++] = w;
+
+        while (1) {
+            copy_run(&w, &r, 0);
+            if (*r == '\\') {
+                if (!r[1]) return -1;
+                *w++ = r[1];
+                r += 2;
+            } else if (*r == '\'') {
+                char *close = strchr(r + 1, '\'');
+                if (!close) return -1;
+                size_t n = (size_t)(close - r - 1);
+                memmove(w, r + 1, n);
+                w += n;
+                r = close + 1;
+            } else if (*r == '"') {
+                r++;
+                while (1) {
+                    copy_run(&w, &r, 1);
+                    if (*r == '"') break;
+                    if (!*r) return -1;
+                    switch (r[1]) {
+                        case 'n': *w++ = '\n'; break;
+                        case 't': *w++ = '\t'; break;
+                        case 'r': *w++ = '\r'; break;
+                        case '\\': case '"': *w++ = r[1]; break;
+                        default: return -1;
+                    }
+                    r += 2;
+                }
+                r++;
+            } else {
+                break;
+            }
+        }
+        if (*r) r++;
+        *w++ = '\0';
+    }
+}
 
+static const struct {
+    const char *name;
     INSTR_TYPE op;
-    if      (strcmp(args[0], "set") == 0)            op = SET;
-    else if (strcmp(args[0], "get") == 0)            op = GET;
-    else if (strcmp(args[0], "delete") == 0)         op = DELETE;
-    else if (strcmp(args[0], "list-versions") == 0)  op = VERSIONS;
-    else if (strcmp(args[0], "compact") == 0)        op = COMPACT;
-    else if (strcmp(args[0], "load") == 0)           op = LOAD;
-    else if (strcmp(args[0], "save") == 0)           op = SAVE;
-    else if (strcmp(args[0], "compact_db") == 0)     op = COMPACT_DB;
-    else if (strcmp(args[0], "dump") == 0)           op = DUMP;
-    else return NULL;
+} commands[] = {
+    {"set", SET}, {"get", GET},
+    {"load", LOAD}, {"save", SAVE}, {"mget", MGET}, {"dump", DUMP}, {"find", FIND},
+    {"incr", INCR},
+    {"query", QUERY}, {"range", RANGE},
+    {"delete", DELETE}, {"verify", VERIFY}, {"retain", RETAIN}, {"append", APPEND},
+    {"compact", COMPACT},
+    {"retention", RETENTION},
+    {"compact_db", COMPACT_DB}, {"drop-index", DROP_INDEX},
+    {"autocompact", AUTOCOMPACT},
+    {"create-index", CREATE_INDEX},
+    {"list-versions", VERSIONS}, {"open-snapshot", OPEN_SNAPSHOT},
+    {"close-snapshot", CLOSE_SNAPSHOT},
+};
+
+/* The only entry in commands that word can be: length and first byte tell
+ * every command apart, so a lookup costs one comparison. */
+static int command_index(const char *word, size_t len) {
+    switch (len) {
+        case 3:  return word[0] == 's' ? 0 : 1;
+        case 4:
+            return word[0] == 'l' ? 2 : word[0] == 's' ? 3 : word[0] == 'm' ? 4 : word[0] == 'd' ? 5
+                 : word[0] == 'i' ? 7 : 6;
+        case 5:  return word[0] == 'q' ? 8 : 9;
+        case 6:  return word[0] == 'd' ? 10 : word[0] == 'v' ? 11 : word[0] == 'a' ? 13 : 12;
+        case 7:  return 14;
+        case 9:  return 15;
+        case 10: return word[0] == 'c' ? 16 : 17;
+        case 11: return 18;
+        case 12: return 19;
+        case 13: return word[0] == 'l' ? 20 : 21;
+        case 14: return 22;
+        default: return -1;
+    }
+}
+
+static int lookup_op(const char *word, INSTR_TYPE *op) {
+    size_t len = strlen(word);
+    int i = command_index(word, len);
+    if (i < 0 || memcmp(word, commands[i].name, len) != 0) return -1;
+    *op = commands[i].op;
+    return 0;
+}
+
+/* A whole unsigned decimal count; -1 for anything else, so a typo cannot
+ * quietly become 0. */
+static int parse_count(const char *text, uint64_t *out) {
+    if (*text < '0' || *text > '9') return -1;
+    char *end = NULL;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (*end || errno == ERANGE) return -1;
+    *out = n;
+    return 0;
+}
+
+int parse_args_into(Instr instr, int argc, char *args[], uint64_t global_version) {
+    if (!instr || argc < 1) return -1;
+
+    INSTR_TYPE op;
+    if (lookup_op(args[0], &op) != 0) return -1;
 
-    Instr instr = malloc(sizeof *instr);
-    if (!instr) return NULL;
     instr->instr_type = op;
     instr->global_version = global_version;
 
     switch (op) {
       case SET:
-        if (argc != 3) { free(instr); return NULL; }
+        if (argc < 3 || argc > 4) return -1;
         instr->set.path = args[1];
-        instr->set.value = args[2]; // Interpret all data as a string
+        instr->set.value = args[2];
+        instr->set.type = VALUE_STRING;
+        if (argc == 4 && (strncmp(args[3], "--type=", 7) != 0 ||
+                          value_type_parse(args[3] + 7, &instr->set.type) != 0)) {
+            return -1;
+        }
         break;
 
       case GET:
-        if (argc < 2 || argc > 3) { free(instr); return NULL; }
+        if (argc < 2 || argc > 3) return -1;
         instr->get.path = args[1];
         instr->get.version = -1;
         if (argc == 3 && strncmp(args[2], "--v=", 4) == 0)
             instr->get.version = atoi(args[2] + 4);
         break;
 
+      case MGET:
+        if (argc - 1 > INSTR_MAX_PATHS) return -1;
+        instr->mget.count = 0;
+        instr->mget.version = -1;
+        for (int i = 1; i < argc; i++) {
+            if (strncmp(args[i], "--v=", 4) == 0) instr->mget.version = atoi(args[i] + 4);
+            else instr->mget.paths[instr->mget.count++] = args[i];
+        }
+        if (instr->mget.count == 0) return -1;
+        break;
+
+      case QUERY:
+        if (argc != 2) return -1;
+        instr->query.pattern = args[1];
+        break;
+
+      case CREATE_INDEX:
+      case DROP_INDEX:
+        if (argc < 2 || argc > 3) return -1;
+        if (argc == 3 && strcmp(args[2], "--range") != 0) return -1;
+        instr->index.pattern = args[1];
+        instr->index.range = argc == 3;
+        break;
+
+      case FIND:
+        if (argc != 4 || strcmp(args[2], "=") != 0) return -1;
+        instr->find.pattern = args[1];
+        instr->find.value = args[3];
+        break;
+
+      case RANGE: {
+        if (argc < 4 || argc > 5) return -1;
+        char *end_lo = NULL, *end_hi = NULL;
+        instr->range.pattern = args[1];
+        instr->range.lo = strtod(args[2], &end_lo);
+        instr->range.hi = strtod(args[3], &end_hi);
+        if (end_lo == args[2] || *end_lo || end_hi == args[3] || *end_hi) return -1;
+        instr->range.limit = 0;
+        if (argc == 5) {
+            if (strncmp(args[4], "--limit=", 8) != 0 ||
+                parse_count(args[4] + 8, &instr->range.limit) != 0) {
+                return -1;
+            }
+        }
+        break;
+      }
+
+      case INCR: {
+        if (argc < 2 || argc > 3) return -1;
+        instr->incr.path = args[1];
+        instr->incr.delta = 1;
+        if (argc == 3) {
+            char *end = NULL;
+            errno = 0;
+            instr->incr.delta = strtoll(args[2], &end, 10);
+            if (end == args[2] || *end || errno == ERANGE) return -1;
+        }
+        break;
+      }
+
+      case APPEND:
+        if (argc != 3) return -1;
+        instr->append.path = args[1];
+        instr->append.value = args[2];
+        break;
+
       case DELETE:
-        if (argc != 2) { free(instr); return NULL; }
+        if (argc != 2) return -1;
         instr->delete.path = args[1];
         break;
 
       case VERSIONS:
-        if (argc != 2) { free(instr); return NULL; }
+        if (argc != 2) return -1;
         instr->versions.path = args[1];
         break;
 
       case COMPACT:
-        if (argc != 2) { free(instr); return NULL; }
+        if (argc != 2) return -1;
         instr->compact.path = args[1];
         break;
 
       case COMPACT_DB:
-        if (argc != 1) { free(instr); return NULL; }
+        if (argc != 1) return -1;
         break;
 
       case LOAD:
-        if (argc != 2) { free(instr); return NULL; }
+        if (argc != 2 && argc != 3) return -1;
         instr->load.path = args[1];
+        instr->load.subtree = argc == 3 ? args[2] : NULL;
         break;
 
       case DUMP:
-        if (argc != 1) { free(instr); return NULL; }
+        if (argc != 1) return -1;
         break;
 
       case SAVE:
-        if (argc != 3) { free(instr); return NULL; }
+        if (argc < 3 || argc > 4) return -1;
+        if (argc == 4 && strcmp(args[3], "--compress") != 0) return -1;
         instr->save.filename = args[1];
         instr->save.path = args[2];
+        instr->save.compress = argc == 4;
+        break;
+
+      case OPEN_SNAPSHOT:
+        if (argc != 2) return -1;
+        instr->open_snapshot.path = args[1];
+        break;
+
+      case CLOSE_SNAPSHOT:
+        if (argc != 1) return -1;
+        break;
+
+      case VERIFY:
+        if (argc != 2) return -1;
+        instr->verify.path = args[1];
+        break;
+
+      case RETAIN:
+        if (argc < 3 || argc > 5) return -1;
+        instr->retain.prefix = args[1];
+        instr->retain.versions = 0;
+        instr->retain.after = 0;
+        instr->retain.seconds = 0;
+        instr->retain.clear = strcmp(args[2], "--clear") == 0;
+        if (instr->retain.clear) {
+            if (argc != 3) return -1;
+            break;
+        }
+        if (parse_count(args[2], &instr->retain.versions) != 0) return -1;
+        for (int i = 3; i < argc; i++) {
+            if (strncmp(args[i], "--after=", 8) == 0) {
+                if (parse_count(args[i] + 8, &instr->retain.after) != 0) return -1;
+            } else if (strncmp(args[i], "--window=", 9) == 0) {
+                if (parse_count(args[i] + 9, &instr->retain.seconds) != 0) return -1;
+            } else {
+                return -1;
+            }
+        }
+        break;
+
+      case RETENTION:
+        if (argc != 1) return -1;
+        break;
+
+      case AUTOCOMPACT:
+        instr->autocompact.mode = AUTOCOMPACT_STATUS;
+        instr->autocompact.versions = -1;
+        instr->autocompact.bytes = -1;
+        instr->autocompact.interval = -1;
+        if (argc == 1) break;
+        if (strcmp(args[1], "off") == 0 && argc == 2) {
+            instr->autocompact.mode = AUTOCOMPACT_OFF;
+            break;
+        }
+        if (strcmp(args[1], "on") != 0) return -1;
+        instr->autocompact.mode = AUTOCOMPACT_ON;
+        for (int i = 2; i < argc; i++) {
+            int64_t *field;
+            const char *text;
+            if (strncmp(args[i], "--versions=", 11) == 0) {
+                field = &instr->autocompact.versions;
+                text = args[i] + 11;
+            } else if (strncmp(args[i], "--bytes=", 8) == 0) {
+                field = &instr->autocompact.bytes;
+                text = args[i] + 8;
+            } else if (strncmp(args[i], "--interval=", 11) == 0) {
+                field = &instr->autocompact.interval;
+                text = args[i] + 11;
+            } else {
+                return -1;
+            }
+            uint64_t n;
+            if (parse_count(text, &n) != 0 || n > INT64_MAX) return -1;
+            *field = (int64_t)n;
+        }
         break;
 
       default:
-        free(instr);
-        return NULL;
+        return -1;
     }
 
+    return 0;
+}
+
+Instr parse_args(int argc, char *args[], uint64_t global_version) {
+    Instr instr = malloc(sizeof *instr);
+    if (instr && parse_args_into(instr, argc, args, global_version) != 0) {
+        free(instr);
+        instr = NULL;
+    }
     return instr;
 }
 
+int parse_line(Instr instr, char *line, uint64_t global_version) {
+    char *args[PARSE_MAX_ARGS];
+    int argc = parse_tokenize(line, args, PARSE_MAX_ARGS);
+    return argc < 1 ? -1 : parse_args_into(instr, argc, args, global_version);
+}
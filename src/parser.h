@@ -4,6 +4,24 @@
 #include "ir.h"
 #include <stdint.h>
 
+#define PARSE_MAX_ARGS 32
+
+/* Split line into words in place, storing up to max_args of them in args.
+ * Words are separated by blanks. Within "double quotes" \n \t \r \\ and \"
+ * are escapes, 'single quotes' are literal, and outside quotes a backslash
+ * takes the next byte as is. Returns the number of words, or -1 for an
+ * unterminated quote, a bad escape or too many words. */
+int parse_tokenize(char *line, char *args[], int max_args);
+
+/* Fill instr from a tokenized command line. The Instr points at the words
+ * in args, which must outlive it. Returns 0, or -1 for an unknown command or bad
+ * arguments. */
+int parse_args_into(Instr instr, int argc, char *args[], uint64_t global_version);
+
+/* parse_tokenize then parse_args_into; instr points into line. */
+int parse_line(Instr instr, char *line, uint64_t global_version);
+
+/* As parse_args_into, into a malloc'd Instr the caller frees. */
 Instr parse_args(int argc, char *args[], uint64_t global_version);
 
 #endif
@@ -0,0 +1,986 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "parser.h"
+#include "./utils/parallel.h"
+
+#define SERVER_MAX_UNSENT (4u << 20)    /* replies queued before reading pauses */
+#define SERVER_MAX_INFLIGHT 1024        /* binary requests per connection */
+#define SERVER_READ_CHUNK 4096
+#define SERVER_EVENTS 64
+
+enum { MODE_UNKNOWN, MODE_TEXT, MODE_BINARY };
+
+/* One request on its way through a worker. The worker fills reply with
+ * the whole framed response. */
+struct job {
+    struct conn *conn;
+    int mode;
+    int writes;                 /* frames that change the tree, run in order */
+    int piece;                  /* reply is part of a longer one, more to come */
+    char *request;              /* a line, NUL terminated, or frames */
+    size_t request_len;
+    char *reply;
+    size_t reply_len;
+    struct job *next;           /* in the job queue or the done list */
+};
+
+/* Owned by the loop thread. A text connection has at most one request in
+ * flight, so its replies keep their order. A binary connection runs its
+ * GETs side by side, but its writes as one job at a time with nothing
+ * else in flight, so they apply in the order they were sent. */
+struct conn {
+    int fd;
+    int mode;
+    char *in;                   /* received, not yet dispatched */
+    size_t in_len, in_cap;
+    char *out;                  /* framed replies not yet sent */
+    size_t out_len, out_sent, out_cap;
+    uint32_t events;            /* epoll interest; UINT32_MAX once removed */
+    size_t inflight;
+    int writing;                /* a job of writes is in flight */
+    /* Under the server lock, for workers streaming a reply: */
+    size_t unsent;              /* out_len - out_sent as the loop last saw it */
+    size_t in_transit;          /* pieces handed over, not yet queued */
+    int gone;                   /* hangup, as the loop last saw it */
+    int eof;                    /* peer sent everything; answer, then close */
+    int quit;                   /* exit or quit: close once flushed */
+    int hangup;                 /* peer gone or misbehaving: close now */
+    struct conn *prev, *next;   /* every open connection */
+};
+
+struct Server {
+    Session *session;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;                /* eventfd: replies are ready, or stop */
+    char *unix_path;
+    int port;
+    atomic_int stop;
+    atomic_uint_fast64_t global_version;
+    /* Commands that replace what the Session points to run alone. */
+    pthread_rwlock_t session_lock;
+
+    pthread_mutex_t lock;       /* jobs, done and quit */
+    pthread_cond_t ready;
+    pthread_cond_t drained;     /* a connection sent some of its replies */
+    struct job *jobs, *jobs_tail;
+    struct job *done;
+    int quit;
+    pthread_t *workers;
+    size_t nworkers;
+    pthread_t loop;
+    int loop_started;
+
+    struct conn *conns;         /* loop thread only */
+    struct conn *closed;        /* freed after each batch of events */
+};
+
+/* epoll data for the two descriptors that are not connections */
+static char listen_tag, wake_tag;
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0 ? -1 : 0;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+/* Run a command line as typed at the prompt, printing to out. */
+static int run_command(Server s, char *line, FILE *out) {
+    struct Instr instr;
+    if (parse_line(&instr, line, atomic_fetch_add(&s->global_version, 1)) != 0) {
+        fprintf(out, "Invalid command or arguments.\n");
+        return -1;
+    }
+    int status = -1;
+    int exclusive = session_instr_exclusive(instr.instr_type);
+    int locked = exclusive ? pthread_rwlock_wrlock(&s->session_lock)
+                           : pthread_rwlock_rdlock(&s->session_lock);
+    if (locked == 0) {
+        status = decode_and_execute(s->session, &instr, out, out);
+        pthread_rwlock_unlock(&s->session_lock);
+    }
+    return status;
+}
+
+static void execute_text(Server s, struct job *job) {
+    char *body = NULL;
+    size_t len = 0;
+    int status = -1;
+    FILE *out = open_memstream(&body, &len);
+    if (out) {
+        status = run_command(s, job->request, out);
+        if (fclose(out) != 0) status = -1;
+    }
+    if (!body) len = 0;
+    char header[48];
+    int n = snprintf(header, sizeof(header), "%s %zu\n", status == 0 ? "ok" : "err", len);
+    job->reply = malloc((size_t)n + len);
+    if (job->reply) {
+        memcpy(job->reply, header, (size_t)n);
+        if (len) memcpy(job->reply + n, body, len);
+        job->reply_len = (size_t)n + len;
+    }
+    free(body);
+}
+
+/* A string operand: copied out NUL terminated, and advanced past. */
+static char *take_string(const unsigned char **p, const unsigned char *end) {
+    if (end - *p < 4) return NULL;
+    uint32_t len = get_u32(*p);
+    if ((size_t)(end - *p - 4) < len || memchr(*p + 4, '\0', len)) return NULL;
+    char *str = malloc((size_t)len + 1);
+    if (!str) return NULL;
+    memcpy(str, *p + 4, len);
+    str[len] = '\0';
+    *p += 4 + (size_t)len;
+    return str;
+}
+
+/* A value operand: its type byte and its payload as a string. It points
+ * into the request, which outlives the write that copies it. */
+static int take_value(const unsigned char **p, const unsigned char *end, Value *out) {
+    if (end - *p < 5) return -1;
+    ValueType type = (ValueType)**p;
+    uint32_t len = get_u32(*p + 1);
+    const unsigned char *data = *p + 5;
+    if ((size_t)(end - data) < len) return -1;
+    *out = (Value){.type = type};
+    switch (type) {
+        case VALUE_STRING:
+            if (memchr(data, '\0', len)) return -1;
+            /* fall through */
+        case VALUE_BYTES:
+            out->data = data;
+            out->length = len;
+            break;
+        case VALUE_INT64:
+            if (len != 8) return -1;
+            out->i = (int64_t)get_u64(data);
+            break;
+        case VALUE_DOUBLE: {
+            if (len != 8) return -1;
+            uint64_t bits = get_u64(data);
+            memcpy(&out->d, &bits, sizeof(out->d));
+            if (out->d != out->d) return -1;
+            break;
+        }
+        case VALUE_BOOL:
+            if (len != 1 || data[0] > 1) return -1;
+            out->b = data[0];
+            break;
+        default:
+            return -1;
+    }
+    *p = data + len;
+    return 0;
+}
+
+/* A value as GET sends it: its type byte, then its payload as SET takes
+ * it, without the length, which the frame already gives. */
+static void write_value(const Value *v, FILE *out) {
+    unsigned char num[8];
+    fputc((int)v->type, out);
+    switch (v->type) {
+        case VALUE_STRING:
+        case VALUE_BYTES:
+            fwrite(v->data, 1, v->length, out);
+            break;
+        case VALUE_INT64:
+            put_u64(num, (uint64_t)v->i);
+            fwrite(num, 1, 8, out);
+            break;
+        case VALUE_DOUBLE: {
+            uint64_t bits;
+            memcpy(&bits, &v->d, sizeof(bits));
+            put_u64(num, bits);
+            fwrite(num, 1, 8, out);
+            break;
+        }
+        case VALUE_BOOL:
+            fputc(v->b != 0, out);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Operate on the decoded request, writing the payload to out. */
+static int execute_op(Server s, int op, const unsigned char *p, const unsigned char *end,
+                      FILE *out) {
+    uint64_t version = UINT64_MAX;
+    if (op == SERVER_OP_COMMAND) {
+        if (memchr(p, '\0', (size_t)(end - p))) goto bad;
+        char *line = strndup((const char *)p, (size_t)(end - p));
+        if (!line) return SERVER_STATUS_ERROR;
+        int ret = run_command(s, line, out);
+        free(line);
+        return ret == 0 ? SERVER_STATUS_OK : SERVER_STATUS_ERROR;
+    }
+    if (op != SERVER_OP_GET && op != SERVER_OP_SET && op != SERVER_OP_DELETE) {
+        fprintf(out, "Unknown op %d.\n", op);
+        return SERVER_STATUS_ERROR;
+    }
+    if (op == SERVER_OP_GET) {
+        if (end - p < 8) goto bad;
+        version = get_u64(p);
+        p += 8;
+    }
+    Value value;
+    char *path = take_string(&p, end);
+    if (!path || (op == SERVER_OP_SET && take_value(&p, end, &value) != 0) || p != end) {
+        free(path);
+        goto bad;
+    }
+
+    int status = SERVER_STATUS_ERROR;
+    if (pthread_rwlock_rdlock(&s->session_lock) == 0) {
+        Value val;
+        int ret;
+        switch (op) {
+            case SERVER_OP_GET:
+                ret = session_get_value(s->session, path, version, &val);
+                if (ret == 0) {
+                    write_value(&val, out);
+                    value_clear(&val);
+                }
+                status = ret == 0 ? SERVER_STATUS_OK
+                       : ret > 0  ? SERVER_STATUS_NOT_FOUND : SERVER_STATUS_ERROR;
+                break;
+            case SERVER_OP_SET:
+                ret = session_set_value(s->session, path, &value,
+                                        atomic_fetch_add(&s->global_version, 1));
+                status = ret == 0 ? SERVER_STATUS_OK : SERVER_STATUS_ERROR;
+                break;
+            case SERVER_OP_DELETE:
+                ret = session_delete(s->session, path, atomic_fetch_add(&s->global_version, 1));
+                status = ret == 0 ? SERVER_STATUS_OK : SERVER_STATUS_ERROR;
+                break;
+        }
+        if (status == SERVER_STATUS_ERROR) {
+            fprintf(out, s->session->snapshot ? "A snapshot is open read-only.\n" : "Failed.\n");
+        }
+        pthread_rwlock_unlock(&s->session_lock);
+    }
+    free(path);
+    return status;
+
+bad:
+    fprintf(out, "Malformed request.\n");
+    return SERVER_STATUS_ERROR;
+}
+
+static int buffer_reserve(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) return 0;
+    size_t grown = *cap ? *cap : SERVER_READ_CHUNK;
+    while (grown < need) grown *= 2;
+    char *p = realloc(*buf, grown);
+    if (!p) return -1;
+    *buf = p;
+    *cap = grown;
+    return 0;
+}
+
+/* A binary reply as it is written. The header is reserved first and
+ * filled in once the payload's length is known, so a value is copied once.
+ * A payload that outgrows SERVER_REPLY_CHUNK is handed to the loop in
+ * pieces, and the worker waits while the client is behind in reading. */
+struct stream {
+    Server s;
+    struct job *job;
+    uint32_t id;
+    char *buf;
+    size_t len, cap;
+};
+
+static int stream_reset(struct stream *st) {
+    st->buf = NULL;
+    st->len = st->cap = 0;
+    if (buffer_reserve(&st->buf, &st->cap, SERVER_WIRE_HEADER) != 0) return -1;
+    st->len = SERVER_WIRE_HEADER;
+    return 0;
+}
+
+/* Queue buf as part of job's reply, once the connection has room. Takes
+ * buf; fails when the connection or the server is going away. */
+static int stream_hand_over(Server s, struct job *job, char *buf, size_t len) {
+    struct job *piece = calloc(1, sizeof(*piece));
+    struct conn *c = job->conn;
+    pthread_mutex_lock(&s->lock);
+    while (piece && c->unsent + c->in_transit > SERVER_MAX_UNSENT && !c->gone && !s->quit) {
+        pthread_cond_wait(&s->drained, &s->lock);
+    }
+    if (!piece || c->gone || s->quit) {
+        pthread_mutex_unlock(&s->lock);
+        free(piece);
+        free(buf);
+        return -1;
+    }
+    *piece = (struct job){.conn = c, .mode = MODE_BINARY, .piece = 1, .reply = buf,
+                          .reply_len = len, .next = s->done};
+    c->in_transit += len;
+    s->done = piece;
+    uint64_t one = 1;
+    (void)!write(s->wake_fd, &one, sizeof(one));
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+/* Frame the payload so far as a MORE piece and send it on its way. Replies
+ * the job finished before it go first, to keep their order. */
+static int stream_piece(struct stream *st) {
+    struct job *job = st->job;
+    if (job->reply) {
+        char *done = job->reply;
+        job->reply = NULL;
+        if (stream_hand_over(st->s, job, done, job->reply_len) != 0) return -1;
+        job->reply_len = 0;
+    }
+    put_u32((unsigned char *)st->buf, (uint32_t)(st->len - 4));
+    put_u32((unsigned char *)st->buf + 4, st->id);
+    st->buf[8] = (char)SERVER_STATUS_MORE;
+    char *buf = st->buf;
+    size_t len = st->len;
+    st->buf = NULL;
+    if (stream_hand_over(st->s, job, buf, len) != 0) return -1;
+    return stream_reset(st);
+}
+
+static ssize_t stream_write(void *cookie, const char *data, size_t size) {
+    struct stream *st = cookie;
+    size_t left = size;
+    while (left) {
+        size_t room = SERVER_WIRE_HEADER + SERVER_REPLY_CHUNK - st->len;
+        size_t n = left < room ? left : room;
+        if (buffer_reserve(&st->buf, &st->cap, st->len + n) != 0) return -1;
+        memcpy(st->buf + st->len, data, n);
+        st->len += n;
+        data += n;
+        left -= n;
+        if (left && stream_piece(st) != 0) return -1;
+    }
+    return (ssize_t)size;
+}
+
+static int execute_frame(Server s, struct job *job, const unsigned char *req, size_t req_len,
+                         char **reply, size_t *reply_len) {
+    struct stream st = {.s = s, .job = job, .id = get_u32(req + 4)};
+    if (stream_reset(&st) != 0) return -1;
+    FILE *out = fopencookie(&st, "w", (cookie_io_functions_t){.write = stream_write});
+    if (!out) {
+        free(st.buf);
+        return -1;
+    }
+    int status = execute_op(s, req[8], req + SERVER_WIRE_HEADER, req + req_len, out);
+    if (fclose(out) != 0 || !st.buf) {
+        free(st.buf);
+        return -1;
+    }
+    put_u32((unsigned char *)st.buf, (uint32_t)(st.len - 4));
+    put_u32((unsigned char *)st.buf + 4, st.id);
+    st.buf[8] = (char)status;
+    *reply = st.buf;
+    *reply_len = st.len;
+    return 0;
+}
+
+/* The frames of a job run one after another, and their replies are sent
+ * together. */
+static void execute_binary(Server s, struct job *job) {
+    const unsigned char *req = (const unsigned char *)job->request;
+    const unsigned char *end = req + job->request_len;
+    while (req < end) {
+        size_t framed = 4 + (size_t)get_u32(req);
+        char *buf, *grown;
+        size_t len;
+        if (execute_frame(s, job, req, framed, &buf, &len) != 0) goto fail;
+        if (!job->reply) {
+            job->reply = buf;
+        } else if ((grown = realloc(job->reply, job->reply_len + len))) {
+            job->reply = grown;
+            memcpy(job->reply + job->reply_len, buf, len);
+            free(buf);
+        } else {
+            free(buf);
+            goto fail;
+        }
+        job->reply_len += len;
+        req += framed;
+    }
+    return;
+
+fail:
+    free(job->reply);
+    job->reply = NULL;
+}
+
+static void *worker_main(void *arg) {
+    Server s = arg;
+    pthread_mutex_lock(&s->lock);
+    while (1) {
+        while (!s->jobs && !s->quit) pthread_cond_wait(&s->ready, &s->lock);
+        if (s->quit) break;
+        struct job *job = s->jobs;
+        s->jobs = job->next;
+        if (!s->jobs) s->jobs_tail = NULL;
+        pthread_mutex_unlock(&s->lock);
+
+        if (job->mode == MODE_BINARY) execute_binary(s, job);
+        else execute_text(s, job);
+
+        pthread_mutex_lock(&s->lock);
+        job->next = s->done;
+        s->done = job;
+        uint64_t one = 1;
+        (void)!write(s->wake_fd, &one, sizeof(one));
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void job_free(struct job *job) {
+    free(job->request);
+    free(job->reply);
+    free(job);
+}
+
+static void jobs_free(struct job *job) {
+    while (job) {
+        struct job *next = job->next;
+        job_free(job);
+        job = next;
+    }
+}
+
+static void enqueue(Server s, struct job *job) {
+    pthread_mutex_lock(&s->lock);
+    job->next = NULL;
+    if (s->jobs_tail) s->jobs_tail->next = job;
+    else s->jobs = job;
+    s->jobs_tail = job;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int buffer_append(struct conn *c, const void *data, size_t len) {
+    if (buffer_reserve(&c->out, &c->out_cap, c->out_len + len) != 0) return -1;
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+static void conn_free(struct conn *c) {
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+static void conn_close(Server s, struct conn *c) {
+    if (c->events != UINT32_MAX) epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    if (c->prev) c->prev->next = c->next;
+    else s->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    c->next = s->closed;
+    s->closed = c;
+}
+
+static void conn_flush(struct conn *c) {
+    while (!c->hangup && c->out_sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->out_sent += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) c->hangup = 1;
+            return;
+        }
+    }
+    c->out_len = c->out_sent = 0;
+}
+
+static void conn_read(struct conn *c) {
+    while (c->in_len < SERVER_MAX_REQUEST) {
+        if (buffer_reserve(&c->in, &c->in_cap, c->in_len + SERVER_READ_CHUNK) != 0) {
+            c->hangup = 1;
+            return;
+        }
+        ssize_t n = recv(c->fd, c->in + c->in_len, SERVER_READ_CHUNK, 0);
+        if (n > 0) {
+            c->in_len += (size_t)n;
+        } else if (n == 0) {
+            c->eof = 1;
+            return;
+        } else if (errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) c->hangup = 1;
+            return;
+        }
+    }
+}
+
+static void consume(struct conn *c, size_t len) {
+    c->in_len -= len;
+    memmove(c->in, c->in + len, c->in_len);
+}
+
+/* Length of the next complete request in c->in: a line with its ending or
+ * a whole frame. Once the peer is done sending, whatever text is left is
+ * a last line without an ending. 0 when there is none yet. */
+static size_t next_request(const struct conn *c) {
+    if (c->mode == MODE_BINARY) {
+        if (c->in_len < 4) return 0;
+        size_t len = 4 + (size_t)get_u32((const unsigned char *)c->in);
+        return len <= c->in_len ? len : 0;
+    }
+    char *nl = c->in_len ? memchr(c->in, '\n', c->in_len) : NULL;
+    if (!nl) return c->eof ? c->in_len : 0;
+    return (size_t)(nl - c->in) + 1;
+}
+
+/* A connection's first bytes say which protocol it speaks. Returns 0 while
+ * they could still be the binary hello. */
+static int detect_mode(struct conn *c) {
+    size_t hello = sizeof(SERVER_WIRE_HELLO) - 1;
+    size_t n = c->in_len < hello ? c->in_len : hello;
+    if (memcmp(c->in, SERVER_WIRE_HELLO, n) != 0) {
+        c->mode = MODE_TEXT;
+    } else if (n == hello) {
+        c->mode = MODE_BINARY;
+        consume(c, hello);
+        if (buffer_append(c, SERVER_WIRE_HELLO, hello) != 0) c->hangup = 1;
+    } else if (c->eof) {
+        c->mode = MODE_TEXT;
+    }
+    return c->mode != MODE_UNKNOWN;
+}
+
+static int is_blank(const char *line) {
+    while (*line && isspace((unsigned char)*line)) line++;
+    return *line == '\0';
+}
+
+/* Whether the frame at p, whose length is checked, may change the tree. */
+static int frame_writes(const char *p) {
+    return (unsigned char)p[8] != SERVER_OP_GET;
+}
+
+/* The length of the run of complete write frames at the front of c->in,
+ * taken as one job. A bad frame ends the run, to be refused on its own. */
+static size_t write_run(const struct conn *c) {
+    size_t run = 0;
+    while (c->in_len - run >= 4) {
+        size_t framed = 4 + (size_t)get_u32((const unsigned char *)c->in + run);
+        if (framed < SERVER_WIRE_HEADER || framed > c->in_len - run ||
+            !frame_writes(c->in + run) || (run && run + framed > SERVER_MAX_REQUEST)) {
+            break;
+        }
+        run += framed;
+    }
+    return run;
+}
+
+/* Turn the next request into a job, or act on it here. Returns 0 when
+ * there was nothing more to take. */
+static int take_request(Server s, struct conn *c) {
+    int writes = 0;
+    if (c->mode == MODE_BINARY && c->in_len >= 4) {
+        size_t framed = 4 + (size_t)get_u32((const unsigned char *)c->in);
+        if (framed < SERVER_WIRE_HEADER || framed > SERVER_MAX_REQUEST) {
+            c->hangup = 1;
+            return 0;
+        }
+        /* Writes wait for everything sent before them, and everything
+         * after waits for them. */
+        if (c->writing) return 0;
+        writes = framed <= c->in_len && frame_writes(c->in);
+        if (writes && c->inflight) return 0;
+    }
+    size_t len = writes ? write_run(c) : next_request(c);
+    if (!len) {
+        /* A line that never ends is refused rather than buffered. */
+        if (c->in_len >= SERVER_MAX_REQUEST) c->hangup = 1;
+        return 0;
+    }
+    struct job *job = calloc(1, sizeof(*job));
+    char *request = malloc(len + 1);
+    if (!job || !request) {
+        free(job);
+        free(request);
+        c->hangup = 1;
+        return 0;
+    }
+    memcpy(request, c->in, len);
+    request[len] = '\0';
+    consume(c, len);
+    if (c->mode == MODE_TEXT) {
+        if (request[len - 1] == '\n') request[--len] = '\0';
+        if (len && request[len - 1] == '\r') request[--len] = '\0';
+        if (is_blank(request) || strcmp(request, "exit") == 0 || strcmp(request, "quit") == 0) {
+            c->quit = !is_blank(request);
+            free(request);
+            free(job);
+            return !c->quit;
+        }
+    }
+    *job = (struct job){.conn = c, .mode = c->mode, .writes = writes, .request = request,
+                        .request_len = len};
+    c->inflight++;
+    c->writing = writes;
+    enqueue(s, job);
+    return 1;
+}
+
+/* Tell workers streaming to c how far behind it is, waking them once it
+ * has caught up or gone. */
+static void conn_publish(Server s, struct conn *c) {
+    size_t unsent = c->out_len - c->out_sent;
+    if (unsent == c->unsent && c->hangup == c->gone) return;
+    pthread_mutex_lock(&s->lock);
+    if (unsent < c->unsent || c->hangup) pthread_cond_broadcast(&s->drained);
+    c->unsent = unsent;
+    c->gone = c->hangup;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* Dispatch what can be, then close or re-arm the connection. */
+static void conn_progress(Server s, struct conn *c) {
+    size_t limit = c->mode == MODE_BINARY ? SERVER_MAX_INFLIGHT : 1;
+    if (c->mode == MODE_UNKNOWN && c->in_len) detect_mode(c);
+    while (c->mode != MODE_UNKNOWN && c->inflight < limit && !c->quit && !c->hangup &&
+           c->out_len - c->out_sent < SERVER_MAX_UNSENT && take_request(s, c)) {
+    }
+    conn_flush(c);
+    if (c->inflight) conn_publish(s, c);
+
+    if (c->inflight && c->hangup) {
+        /* Closing waits for the workers to hand the requests back; until
+         * then a dead socket must not keep waking the loop. */
+        if (c->events != UINT32_MAX) epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+        c->events = UINT32_MAX;
+        return;
+    }
+    if (!c->inflight && (c->hangup || ((c->quit || (c->eof && !next_request(c))) &&
+                                       c->out_sent == c->out_len))) {
+        conn_close(s, c);
+        return;
+    }
+
+    uint32_t events = 0;
+    if (!c->eof && !c->quit && !c->hangup && c->in_len < SERVER_MAX_REQUEST) events |= EPOLLIN;
+    if (c->out_sent < c->out_len) events |= EPOLLOUT;
+    if (events != c->events) {
+        struct epoll_event ev = {.events = events, .data.ptr = c};
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == 0) c->events = events;
+    }
+}
+
+static void accept_all(Server s) {
+    while (1) {
+        int fd = accept(s->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        struct conn *c = calloc(1, sizeof(*c));
+        if (!c || set_nonblocking(fd) != 0) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        if (!s->unix_path) {
+            int one = 1;
+            /* Replies are small and pipelined; do not hold them back. */
+            (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        c->fd = fd;
+        c->events = EPOLLIN;
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->next = s->conns;
+        if (s->conns) s->conns->prev = c;
+        s->conns = c;
+    }
+}
+
+/* Queue the replies the workers finished and move those connections on. */
+static void finish_done(Server s) {
+    uint64_t count;
+    (void)!read(s->wake_fd, &count, sizeof(count));
+    pthread_mutex_lock(&s->lock);
+    /* Finished first, queued first: a reply's pieces stay in order. */
+    struct job *done = NULL;
+    while (s->done) {
+        struct job *job = s->done;
+        s->done = job->next;
+        job->next = done;
+        done = job;
+        if (job->piece) {
+            job->conn->in_transit -= job->reply_len;
+            job->conn->unsent += job->reply_len;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    while (done) {
+        struct job *job = done;
+        done = job->next;
+        struct conn *c = job->conn;
+        if (!job->piece) c->inflight--;
+        if (job->writes) c->writing = 0;
+        if (!job->reply || buffer_append(c, job->reply, job->reply_len) != 0) c->hangup = 1;
+        job_free(job);
+        conn_progress(s, c);
+    }
+}
+
+static void *loop_main(void *arg) {
+    Server s = arg;
+    struct epoll_event events[SERVER_EVENTS];
+    while (!atomic_load(&s->stop)) {
+        int n = epoll_wait(s->epoll_fd, events, SERVER_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &listen_tag) {
+                accept_all(s);
+            } else if (tag == &wake_tag) {
+                finish_done(s);
+            } else {
+                struct conn *c = tag;
+                if (c->fd < 0) continue;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) conn_read(c);
+                if (events[i].events & EPOLLOUT) conn_flush(c);
+                conn_progress(s, c);
+            }
+        }
+        while (s->closed) {
+            struct conn *c = s->closed;
+            s->closed = c->next;
+            conn_free(c);
+        }
+    }
+    return NULL;
+}
+
+static int listen_tcp(Server s, const char *host, const char *port) {
+    if (strlen(port) > 5 || strtoul(port, NULL, 10) > 65535) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return -1;
+
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *)&addr, &len) == 0) {
+        if (addr.ss_family == AF_INET) s->port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+        else if (addr.ss_family == AF_INET6) s->port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+    }
+    return fd;
+}
+
+static int listen_unix(Server s, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    /* A socket left behind by a server that did not stop cleanly. */
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    s->unix_path = strdup(path);
+    if (!s->unix_path) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+/* "8080" is a loopback port, "host:port" any address, anything else a path. */
+static int open_listener(Server s, const char *address) {
+    size_t digits = strspn(address, "0123456789");
+    if (digits > 0 && address[digits] == '\0') return listen_tcp(s, "127.0.0.1", address);
+    const char *colon = strrchr(address, ':');
+    if (colon && !strchr(address, '/') && colon[1] && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+        char *host = strndup(address, (size_t)(colon - address));
+        if (!host) return -1;
+        int fd = listen_tcp(s, host[0] ? host : NULL, colon + 1);
+        free(host);
+        return fd;
+    }
+    return listen_unix(s, address);
+}
+
+static void stop_workers(Server s) {
+    pthread_mutex_lock(&s->lock);
+    s->quit = 1;
+    pthread_cond_broadcast(&s->ready);
+    pthread_cond_broadcast(&s->drained);
+    pthread_mutex_unlock(&s->lock);
+    for (size_t i = 0; i < s->nworkers; i++) pthread_join(s->workers[i], NULL);
+    s->nworkers = 0;
+}
+
+static void server_free(Server s) {
+    jobs_free(s->jobs);
+    jobs_free(s->done);
+    while (s->conns) {
+        struct conn *c = s->conns;
+        s->conns = c->next;
+        close(c->fd);
+        conn_free(c);
+    }
+    if (s->listen_fd >= 0) close(s->listen_fd);
+    if (s->epoll_fd >= 0) close(s->epoll_fd);
+    if (s->wake_fd >= 0) close(s->wake_fd);
+    if (s->unix_path) unlink(s->unix_path);
+    free(s->unix_path);
+    free(s->workers);
+    pthread_cond_destroy(&s->ready);
+    pthread_cond_destroy(&s->drained);
+    pthread_mutex_destroy(&s->lock);
+    pthread_rwlock_destroy(&s->session_lock);
+    free(s);
+}
+
+Server server_start(Session *session, const char *address, size_t workers) {
+    if (!session || !session->root || !address || !*address) return NULL;
+    if (workers == 0) workers = parallel_default_workers();
+    Server s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->session = session;
+    s->listen_fd = s->epoll_fd = s->wake_fd = -1;
+    atomic_init(&s->stop, 0);
+    atomic_init(&s->global_version, 0);
+    if (pthread_rwlock_init(&s->session_lock, NULL) != 0) {
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->ready, NULL);
+    pthread_cond_init(&s->drained, NULL);
+
+    int saved = 0;
+    s->listen_fd = open_listener(s, address);
+    s->workers = calloc(workers, sizeof(*s->workers));
+    if (s->listen_fd < 0 || !s->workers || set_nonblocking(s->listen_fd) != 0 ||
+        listen(s->listen_fd, SOMAXCONN) != 0 ||
+        (s->epoll_fd = epoll_create1(0)) < 0 ||
+        (s->wake_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        saved = errno;
+        goto fail;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &listen_tag};
+    struct epoll_event wake = {.events = EPOLLIN, .data.ptr = &wake_tag};
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->listen_fd, &ev) != 0 ||
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->wake_fd, &wake) != 0) {
+        saved = errno;
+        goto fail;
+    }
+    for (; s->nworkers < workers; s->nworkers++) {
+        if (pthread_create(&s->workers[s->nworkers], NULL, worker_main, s) != 0) break;
+    }
+    if (s->nworkers == 0 || pthread_create(&s->loop, NULL, loop_main, s) != 0) {
+        saved = EAGAIN;
+        stop_workers(s);
+        goto fail;
+    }
+    s->loop_started = 1;
+    return s;
+
+fail:
+    server_free(s);
+    errno = saved;
+    return NULL;
+}
+
+int server_port(Server server) {
+    return server ? server->port : 0;
+}
+
+void server_stop(Server server) {
+    if (!server) return;
+    atomic_store(&server->stop, 1);
+    uint64_t one = 1;
+    (void)!write(server->wake_fd, &one, sizeof(one));
+    if (server->loop_started) pthread_join(server->loop, NULL);
+    /* Queued commands are dropped; running ones finish first. */
+    stop_workers(server);
+    while (server->closed) {
+        struct conn *c = server->closed;
+        server->closed = c->next;
+        conn_free(c);
+    }
+    server_free(server);
+}
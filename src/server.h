@@ -0,0 +1,83 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include "decode_and_execute.h"
+
+/* Network front end for the shell. One epoll loop does all the socket I/O
+ * and a pool of workers runs the commands. A connection speaks one of two
+ * protocols, chosen by its first bytes.
+ *
+ * Text: the commands typed at the fortdb> prompt, one per line. Each gets
+ * one reply, in order, held until the command is done:
+ *
+ *   ok <n>\n<n bytes of output>      or      err <n>\n<n bytes of output>
+ *
+ * Blank lines get no reply; exit or quit closes the connection.
+ *
+ * Binary: the client opens with the 4 bytes of SERVER_WIRE_HELLO, and the
+ * server echoes them. Then both sides send frames. Integers are little
+ * endian, and a string is a u32 length followed by that many bytes, with
+ * no terminator:
+ *
+ *   request:   u32 length of the rest, u32 id, u8 op, operands
+ *   response:  u32 length of the rest, u32 id, u8 status, payload
+ *
+ *   op        operands                   ok payload
+ *   GET       u64 version, string path   u8 type, the value's payload
+ *   SET       string path, value         -
+ *   DELETE    string path                -
+ *   COMMAND   a command line, to the end what the text reply would carry
+ *
+ * A value is a u8 ValueType (1 string, 2 bytes, 3 int, 4 double, 5 bool)
+ * and a string holding its payload: a string's text, the bytes as they
+ * are, an int or a double's IEEE 754 bits as a u64, or a bool as one byte,
+ * 0 or 1. GET answers with the same payload, its length given by the
+ * frame's. Nothing is re-encoded on either side.
+ *
+ * version UINT64_MAX is the latest. GETs on a connection may run
+ * concurrently and complete in any order; the id says which reply is
+ * which. SET, DELETE and COMMAND take effect in the order they were sent:
+ * each sees everything sent before it on its connection, and nothing sent
+ * after. An error's payload is a message. Paths and string values must
+ * not contain NUL bytes; bytes values may.
+ *
+ * A payload longer than SERVER_REPLY_CHUNK, such as a query's matches,
+ * is sent while it is produced: frames with status MORE carry its pieces
+ * in order, and the frame with the final status carries the rest. */
+typedef struct Server *Server;
+
+#define SERVER_WIRE_HELLO       "FDB\x01"
+#define SERVER_WIRE_HEADER      9           /* length, id, op or status */
+#define SERVER_MAX_REQUEST      (1u << 20)  /* bytes in a line or frame */
+#define SERVER_REPLY_CHUNK      (32u << 10) /* payload bytes in a MORE frame */
+
+enum {
+    SERVER_OP_GET = 1,
+    SERVER_OP_SET = 2,
+    SERVER_OP_DELETE = 3,
+    SERVER_OP_COMMAND = 4
+};
+
+enum {
+    SERVER_STATUS_OK = 0,
+    SERVER_STATUS_NOT_FOUND = 1,
+    SERVER_STATUS_ERROR = 2,
+    SERVER_STATUS_MORE = 3
+};
+
+/* Listen on address, which is a TCP port (bound to 127.0.0.1), host:port,
+ * or else the path of a Unix socket. workers == 0 means one per core.
+ * Commands run against session, which must outlive the server. Returns
+ * NULL when the address cannot be bound. */
+Server server_start(Session *session, const char *address, size_t workers);
+
+/* The TCP port bound, which is how to find one asked for as 0; 0 for a
+ * Unix socket. */
+int server_port(Server server);
+
+/* Stop accepting, close every connection and wait for the commands in
+ * flight. A Unix socket's file is removed. */
+void server_stop(Server server);
+
+#endif
@@ -0,0 +1,372 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "autocompact.h"
+#include "../utils/document.h"
+#include "../utils/hash.h"
+#include "../utils/reclaim.h"
+
+/* History held by one top-level subtree at a sample, and what was left of
+ * it after it was last compacted (retention keeps that much). */
+struct subtree {
+    char *key;
+    uint64_t versions;
+    uint64_t bytes;
+    uint64_t kept_versions;
+    uint64_t kept_bytes;
+};
+
+struct AutoCompact {
+    VersionNode root;           /* retained */
+    RetentionPolicy policy;
+    AutoCompactConfig config;
+    pthread_t thread;
+    pthread_mutex_t lock;       /* status, poked, stopping */
+    pthread_cond_t wake;
+    int poked;
+    atomic_int stopping;
+    AutoCompactStatus status;
+    struct subtree *kept;       /* by key, from the previous sample */
+    size_t nkept;
+};
+
+void autocompact_config_defaults(AutoCompactConfig *config) {
+    if (!config) return;
+    config->max_history_versions = AUTOCOMPACT_DEFAULT_VERSIONS;
+    config->max_history_bytes = AUTOCOMPACT_DEFAULT_BYTES;
+    config->interval_millis = AUTOCOMPACT_DEFAULT_INTERVAL;
+    config->subtrees_per_round = AUTOCOMPACT_DEFAULT_SUBTREES;
+    config->budget = (CompactBudget){COMPACT_DEFAULT_ENTRIES, COMPACT_DEFAULT_MICROS};
+}
+
+static void subtrees_free(struct subtree *s, size_t n) {
+    for (size_t i = 0; i < n; i++) free(s[i].key);
+    free(s);
+}
+
+static int by_key(const void *a, const void *b) {
+    return strcmp(((const struct subtree *)a)->key, ((const struct subtree *)b)->key);
+}
+
+static uint64_t excess(uint64_t have, uint64_t kept) {
+    return have > kept ? have - kept : 0;
+}
+
+static int by_reclaimable(const void *a, const void *b) {
+    const struct subtree *x = a, *y = b;
+    uint64_t xb = excess(x->bytes, x->kept_bytes), yb = excess(y->bytes, y->kept_bytes);
+    if (xb != yb) return xb < yb ? 1 : -1;
+    uint64_t xv = excess(x->versions, x->kept_versions);
+    uint64_t yv = excess(y->versions, y->kept_versions);
+    return xv < yv ? 1 : (xv > yv ? -1 : 0);
+}
+
+/* Add the history of doc and everything below it. Each Document is
+ * read-locked on its own while its counters and children are read. */
+static int sample_document(Document doc, uint64_t *versions, uint64_t *bytes) {
+    if (pthread_rwlock_rdlock(&doc->lock) != 0) return -1;
+    *versions += doc->fields->history_versions + doc->subdocuments->history_versions;
+    *bytes += doc->fields->history_bytes + doc->subdocuments->history_bytes;
+    size_t n = 0;
+    Document *children = malloc((doc->subdocuments->size + 1) * sizeof(*children));
+    for (uint64_t i = 0; children && i < doc->subdocuments->bucket_count; i++) {
+        for (Entry e = doc->subdocuments->buckets[i]; e && n < doc->subdocuments->size; e = e->next) {
+            VersionNode chain = (VersionNode)e->value;
+            if (!chain || !chain->value || chain->value == DELETED) continue;
+            Document child = document_retain((Document)chain->value);
+            if (child) children[n++] = child;
+        }
+    }
+    pthread_rwlock_unlock(&doc->lock);
+    if (!children) return -1;
+
+    int ret = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (ret == 0) ret = sample_document(children[i], versions, bytes);
+        document_free(children[i]);
+    }
+    free(children);
+    return ret;
+}
+
+/* One entry per top-level subtree, sorted by key. A subtree's own chain in
+ * the root Document counts towards it. */
+static int sample(AutoCompact ac, struct subtree **out, size_t *count) {
+    *out = NULL;
+    *count = 0;
+    if (pthread_rwlock_rdlock(&ac->root->lock) != 0) return -1;
+    Document root = ac->root->value ? document_retain((Document)ac->root->value) : NULL;
+    pthread_rwlock_unlock(&ac->root->lock);
+    if (!root) return 0;
+
+    Document *children = NULL;
+    struct subtree *s = NULL;
+    size_t n = 0;
+    if (pthread_rwlock_rdlock(&root->lock) != 0) goto fail;
+    size_t cap = root->subdocuments->size + 1;
+    s = calloc(cap, sizeof(*s));
+    children = calloc(cap, sizeof(*children));
+    if (!s || !children || !(s[0].key = strdup(""))) {
+        pthread_rwlock_unlock(&root->lock);
+        goto fail;
+    }
+    s[0].versions = root->fields->history_versions;
+    s[0].bytes = root->fields->history_bytes;
+    n = 1;
+    int ret = 0;
+    for (uint64_t i = 0; ret == 0 && i < root->subdocuments->bucket_count; i++) {
+        for (Entry e = root->subdocuments->buckets[i]; e && n < cap; e = e->next) {
+            VersionNode chain = (VersionNode)e->value;
+            if (!(s[n].key = strdup(e->key))) {
+                ret = -1;
+                break;
+            }
+            reclaim_enter();
+            for (VersionNode v = chain ? chain->prev : NULL; v; v = v->prev) s[n].versions++;
+            s[n].bytes = chain ? hashmap_account_history(NULL, chain->prev, 0) : 0;
+            reclaim_exit();
+            if (chain && chain->value && chain->value != DELETED) {
+                children[n] = document_retain((Document)chain->value);
+            }
+            n++;
+        }
+    }
+    pthread_rwlock_unlock(&root->lock);
+
+    for (size_t i = 1; i < n; i++) {
+        if (ret == 0 && children[i]) ret = sample_document(children[i], &s[i].versions, &s[i].bytes);
+        document_free(children[i]);
+    }
+    free(children);
+    children = NULL;
+    if (ret != 0) goto fail;
+    document_free(root);
+
+    /* Carry over what the last compaction of each subtree left behind; it
+     * can only have shrunk since. */
+    qsort(s, n, sizeof(*s), by_key);
+    for (size_t i = 0, j = 0; i < n && j < ac->nkept;) {
+        int c = strcmp(s[i].key, ac->kept[j].key);
+        if (c < 0) {
+            i++;
+        } else if (c > 0) {
+            j++;
+        } else {
+            s[i].kept_versions = ac->kept[j].kept_versions < s[i].versions ? ac->kept[j].kept_versions
+                                                                            : s[i].versions;
+            s[i].kept_bytes = ac->kept[j].kept_bytes < s[i].bytes ? ac->kept[j].kept_bytes
+                                                                  : s[i].bytes;
+            i++;
+            j++;
+        }
+    }
+    *out = s;
+    *count = n;
+    return 0;
+
+fail:
+    if (children) {
+        for (size_t i = 0; i < n; i++) document_free(children[i]);
+        free(children);
+    }
+    subtrees_free(s, n);
+    document_free(root);
+    return -1;
+}
+
+static int over_threshold(const AutoCompactConfig *config, uint64_t versions, uint64_t bytes) {
+    if (config->max_history_versions && versions >= config->max_history_versions) return 1;
+    return config->max_history_bytes && bytes >= config->max_history_bytes;
+}
+
+/* Returns -1 when interrupted by autocompact_stop or on error. */
+static int compact_subtree(AutoCompact ac, struct subtree *s) {
+    CompactCursor cursor = compactor_cursor_create_subtree(ac->root, s->key, ac->policy);
+    if (!cursor) return -1;
+    pthread_mutex_lock(&ac->lock);
+    snprintf(ac->status.current, sizeof(ac->status.current), "%s", *s->key ? s->key : "/");
+    pthread_mutex_unlock(&ac->lock);
+
+    int ret;
+    while ((ret = compactor_step(cursor, &ac->config.budget)) == 0) {
+        if (atomic_load(&ac->stopping)) {
+            ret = -1;
+            break;
+        }
+        sched_yield();
+    }
+    const CompactStats *stats = compactor_cursor_stats(cursor);
+    s->kept_versions = excess(s->versions, stats->versions_freed);
+    s->kept_bytes = excess(s->bytes, stats->bytes_freed);
+
+    pthread_mutex_lock(&ac->lock);
+    ac->status.current[0] = '\0';
+    ac->status.subtrees += ret > 0;
+    ac->status.versions_freed += stats->versions_freed;
+    ac->status.bytes_freed += stats->bytes_freed;
+    if (stats->max_hold_micros > ac->status.max_hold_micros) {
+        ac->status.max_hold_micros = stats->max_hold_micros;
+    }
+    pthread_mutex_unlock(&ac->lock);
+    compactor_cursor_free(cursor);
+    return ret < 0 ? -1 : 0;
+}
+
+static void round_run(AutoCompact ac) {
+    struct subtree *s = NULL;
+    size_t n = 0;
+    if (sample(ac, &s, &n) != 0) return;
+
+    uint64_t versions = 0, bytes = 0, extra_versions = 0, extra_bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        versions += s[i].versions;
+        bytes += s[i].bytes;
+        extra_versions += excess(s[i].versions, s[i].kept_versions);
+        extra_bytes += excess(s[i].bytes, s[i].kept_bytes);
+    }
+    int run = over_threshold(&ac->config, extra_versions, extra_bytes);
+    if (run) {
+        qsort(s, n, sizeof(*s), by_reclaimable);
+        size_t limit = ac->config.subtrees_per_round ? ac->config.subtrees_per_round : n;
+        for (size_t i = 0; i < n && i < limit; i++) {
+            if (!excess(s[i].versions, s[i].kept_versions)) break;
+            if (compact_subtree(ac, &s[i]) != 0) break;
+        }
+        qsort(s, n, sizeof(*s), by_key);
+    }
+
+    /* Published once the round is over, so a sample is never reported
+     * ahead of the compaction it triggered. */
+    pthread_mutex_lock(&ac->lock);
+    ac->status.samples++;
+    ac->status.rounds += run;
+    ac->status.history_versions = versions;
+    ac->status.history_bytes = bytes;
+    ac->status.reclaimable_versions = extra_versions;
+    ac->status.reclaimable_bytes = extra_bytes;
+    pthread_mutex_unlock(&ac->lock);
+    subtrees_free(ac->kept, ac->nkept);
+    ac->kept = s;
+    ac->nkept = n;
+}
+
+static void *autocompact_main(void *arg) {
+    AutoCompact ac = arg;
+    pthread_mutex_lock(&ac->lock);
+    while (!atomic_load(&ac->stopping)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        uint64_t ns = (uint64_t)deadline.tv_nsec + (ac->config.interval_millis % 1000) * 1000000u;
+        deadline.tv_sec += (time_t)(ac->config.interval_millis / 1000 + ns / 1000000000u);
+        deadline.tv_nsec = (long)(ns % 1000000000u);
+        while (!atomic_load(&ac->stopping) && !ac->poked &&
+               pthread_cond_timedwait(&ac->wake, &ac->lock, &deadline) != ETIMEDOUT) {
+        }
+        if (atomic_load(&ac->stopping)) break;
+        ac->poked = 0;
+        pthread_mutex_unlock(&ac->lock);
+        round_run(ac);
+        pthread_mutex_lock(&ac->lock);
+    }
+    pthread_mutex_unlock(&ac->lock);
+    return NULL;
+}
+
+AutoCompact autocompact_start(VersionNode root, RetentionPolicy policy,
+                              const AutoCompactConfig *config) {
+    if (!root) return NULL;
+    AutoCompact ac = calloc(1, sizeof(*ac));
+    if (!ac) return NULL;
+    if (config) ac->config = *config;
+    else autocompact_config_defaults(&ac->config);
+    ac->policy = policy;
+    atomic_init(&ac->stopping, 0);
+
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) != 0) {
+        free(ac);
+        return NULL;
+    }
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int cond = pthread_cond_init(&ac->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (cond != 0) {
+        free(ac);
+        return NULL;
+    }
+    if (pthread_mutex_init(&ac->lock, NULL) != 0) {
+        pthread_cond_destroy(&ac->wake);
+        free(ac);
+        return NULL;
+    }
+    ac->root = version_node_retain(root);
+    ac->status.running = 1;
+    if (!ac->root || pthread_create(&ac->thread, NULL, autocompact_main, ac) != 0) {
+        version_node_release(ac->root);
+        pthread_mutex_destroy(&ac->lock);
+        pthread_cond_destroy(&ac->wake);
+        free(ac);
+        return NULL;
+    }
+    return ac;
+}
+
+void autocompact_stop(AutoCompact ac) {
+    if (!ac) return;
+    pthread_mutex_lock(&ac->lock);
+    atomic_store(&ac->stopping, 1);
+    pthread_cond_signal(&ac->wake);
+    pthread_mutex_unlock(&ac->lock);
+    pthread_join(ac->thread, NULL);
+
+    subtrees_free(ac->kept, ac->nkept);
+    version_node_release(ac->root);
+    pthread_mutex_destroy(&ac->lock);
+    pthread_cond_destroy(&ac->wake);
+    free(ac);
+}
+
+void autocompact_poke(AutoCompact ac) {
+    if (!ac) return;
+    pthread_mutex_lock(&ac->lock);
+    ac->poked = 1;
+    pthread_cond_signal(&ac->wake);
+    pthread_mutex_unlock(&ac->lock);
+}
+
+void autocompact_status(AutoCompact ac, AutoCompactStatus *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    if (!ac) return;
+    pthread_mutex_lock(&ac->lock);
+    *out = ac->status;
+    pthread_mutex_unlock(&ac->lock);
+}
+
+void autocompact_print_status(AutoCompact ac, FILE *out) {
+    if (!ac) {
+        fprintf(out, "autocompact: off\n");
+        return;
+    }
+    AutoCompactStatus s;
+    autocompact_status(ac, &s);
+    fprintf(out, "autocompact: on, every %llu ms, thresholds %llu versions / %llu bytes\n",
+            (unsigned long long)ac->config.interval_millis,
+            (unsigned long long)ac->config.max_history_versions,
+            (unsigned long long)ac->config.max_history_bytes);
+    fprintf(out, "history: %llu versions, %llu bytes (%llu versions, %llu bytes reclaimable)\n",
+            (unsigned long long)s.history_versions, (unsigned long long)s.history_bytes,
+            (unsigned long long)s.reclaimable_versions, (unsigned long long)s.reclaimable_bytes);
+    fprintf(out, "samples: %llu, rounds: %llu, subtrees compacted: %llu\n",
+            (unsigned long long)s.samples, (unsigned long long)s.rounds,
+            (unsigned long long)s.subtrees);
+    fprintf(out, "reclaimed: %llu versions, %llu bytes, longest lock hold %llu us\n",
+            (unsigned long long)s.versions_freed, (unsigned long long)s.bytes_freed,
+            (unsigned long long)s.max_hold_micros);
+    if (s.current[0]) fprintf(out, "compacting: %s\n", s.current);
+}
@@ -0,0 +1,61 @@
+#ifndef AUTOCOMPACT_H
+#define AUTOCOMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "compactor.h"
+#include "retention.h"
+#include "version_node.h"
+
+/* Background compaction. A thread samples, every interval, how much history
+ * each top-level subtree holds, from the counters every Hashmap keeps. Once
+ * the history that has built up since a subtree was last compacted crosses
+ * a threshold in total, the subtrees holding the most of it are compacted
+ * with budgeted incremental steps, so readers and writers only ever wait
+ * for one step. What the retention policy keeps is not counted again. The
+ * root Document's own fields count as the subtree "". */
+typedef struct AutoCompactConfig {
+    uint64_t max_history_versions;  /* 0: no version threshold */
+    uint64_t max_history_bytes;     /* 0: no byte threshold */
+    uint64_t interval_millis;
+    size_t subtrees_per_round;      /* 0: every subtree with history */
+    CompactBudget budget;
+} AutoCompactConfig;
+
+#define AUTOCOMPACT_DEFAULT_VERSIONS 100000
+#define AUTOCOMPACT_DEFAULT_BYTES    (64u * 1024u * 1024u)
+#define AUTOCOMPACT_DEFAULT_INTERVAL 1000
+#define AUTOCOMPACT_DEFAULT_SUBTREES 4
+
+void autocompact_config_defaults(AutoCompactConfig *config);
+
+typedef struct AutoCompactStatus {
+    int running;
+    uint64_t samples;
+    uint64_t rounds;                /* samples that crossed a threshold */
+    uint64_t subtrees;              /* subtrees compacted */
+    uint64_t history_versions;      /* in memory, at the last sample */
+    uint64_t history_bytes;
+    uint64_t reclaimable_versions;  /* of which not kept last time */
+    uint64_t reclaimable_bytes;
+    uint64_t versions_freed;        /* totals since start */
+    uint64_t bytes_freed;
+    uint64_t max_hold_micros;       /* longest single lock hold */
+    char current[128];              /* subtree being compacted, "" when idle */
+} AutoCompactStatus;
+
+typedef struct AutoCompact *AutoCompact;
+
+/* Start the thread on root; policy may be NULL and must outlive it. config
+ * NULL takes the defaults. Returns NULL on failure. */
+AutoCompact autocompact_start(VersionNode root, RetentionPolicy policy,
+                              const AutoCompactConfig *config);
+/* Interrupts a round in progress between steps, joins and frees. */
+void autocompact_stop(AutoCompact ac);
+/* Sample now instead of at the end of the interval. */
+void autocompact_poke(AutoCompact ac);
+void autocompact_status(AutoCompact ac, AutoCompactStatus *out);
+void autocompact_print_status(AutoCompact ac, FILE *out);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h> // htonl, ntohl
+
+#include "blocks.h"
+#include "format.h"
+#include "lz.h"
+#include "parallel.h"
+
+#ifndef htobe64
+#define htobe64(x) (__builtin_bswap64((uint64_t)(x)))
+#endif
+#ifndef be64toh
+#define be64toh(x) (__builtin_bswap64((uint64_t)(x)))
+#endif
+
+static void put_be64(unsigned char *p, uint64_t v) {
+    uint64_t be = htobe64(v);
+    memcpy(p, &be, sizeof(be));
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+    uint32_t be = htonl(v);
+    memcpy(p, &be, sizeof(be));
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+    uint64_t be;
+    memcpy(&be, p, sizeof(be));
+    return be64toh(be);
+}
+
+static uint32_t get_be32(const unsigned char *p) {
+    uint32_t be;
+    memcpy(&be, p, sizeof(be));
+    return ntohl(be);
+}
+
+/* Writer: every block is compressed into its own buffer, then the buffers
+ * are written out in order. */
+struct block_job {
+    const unsigned char *image;
+    size_t size;
+    uint32_t block_size;
+    unsigned char **out;
+    uint32_t *lengths;
+    uint32_t *flags;
+};
+
+static int compress_block(void *ctx, size_t worker, size_t index) {
+    (void)worker;
+    struct block_job *job = ctx;
+    size_t start = index * (size_t)job->block_size;
+    size_t len = job->size - start < job->block_size ? job->size - start : job->block_size;
+    const unsigned char *src = job->image + start;
+
+    unsigned char *dst = malloc(len);
+    if (!dst) return -1;
+    /* Anything that does not fit in len bytes is stored raw. */
+    size_t n = len ? lz_compress(src, len, dst, len - 1) : 0;
+    if (n == 0) {
+        memcpy(dst, src, len);
+        n = len;
+        job->flags[index] = BLOCKS_FLAG_RAW;
+    }
+    job->out[index] = dst;
+    job->lengths[index] = (uint32_t)n;
+    return 0;
+}
+
+int blocks_write(FILE *out, const unsigned char *image, size_t size, uint32_t block_size) {
+    if (!out || (!image && size)) return -1;
+    if (block_size == 0) block_size = BLOCKS_DEFAULT_SIZE;
+    if (block_size < BLOCKS_MIN_SIZE || block_size > BLOCKS_MAX_SIZE) return -1;
+
+    size_t count = size / block_size + (size % block_size != 0);
+    struct block_job job = {
+        .image = image,
+        .size = size,
+        .block_size = block_size,
+        .out = calloc(count ? count : 1, sizeof(*job.out)),
+        .lengths = calloc(count ? count : 1, sizeof(*job.lengths)),
+        .flags = calloc(count ? count : 1, sizeof(*job.flags)),
+    };
+    unsigned char *index = calloc(count ? count : 1, BLOCKS_INDEX_ENTRY_SIZE);
+    int ret = -1;
+    if (!job.out || !job.lengths || !job.flags || !index) goto done;
+    if (parallel_for(count, 0, compress_block, &job) != 0) goto done;
+
+    unsigned char header[BLOCKS_HEADER_SIZE] = {0};
+    memcpy(header, MAGIC_BLOCKS, 4);
+    put_be32(header + 4, BLOCKS_VERSION);
+    put_be32(header + 8, block_size);
+    if (fwrite(header, sizeof(header), 1, out) != 1) goto done;
+
+    uint64_t offset = BLOCKS_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        if (fwrite(job.out[i], 1, job.lengths[i], out) != job.lengths[i]) goto done;
+        unsigned char *entry = index + i * BLOCKS_INDEX_ENTRY_SIZE;
+        put_be64(entry, offset);
+        put_be32(entry + 8, job.lengths[i]);
+        put_be32(entry + 12, job.flags[i]);
+        offset += job.lengths[i];
+    }
+    if (count && fwrite(index, BLOCKS_INDEX_ENTRY_SIZE, count, out) != count) goto done;
+
+    unsigned char trailer[BLOCKS_TRAILER_SIZE];
+    put_be64(trailer, size);
+    put_be64(trailer + 8, count);
+    put_be64(trailer + 16, offset);
+    if (fwrite(trailer, sizeof(trailer), 1, out) != 1) goto done;
+    ret = 0;
+
+done:
+    for (size_t i = 0; job.out && i < count; i++) free(job.out[i]);
+    free(job.out);
+    free(job.lengths);
+    free(job.flags);
+    free(index);
+    return ret;
+}
+
+static int blocks_validate(BlockImage img) {
+    size_t file_size = img->file->size;
+    if (file_size < BLOCKS_HEADER_SIZE + BLOCKS_TRAILER_SIZE) return -1;
+    const unsigned char *f = file_image_range(img->file, 0, BLOCKS_HEADER_SIZE);
+    if (!f || memcmp(f, MAGIC_BLOCKS, 4) != 0 || get_be32(f + 4) != BLOCKS_VERSION) return -1;
+    img->block_size = get_be32(f + 8);
+    if (img->block_size < BLOCKS_MIN_SIZE || img->block_size > BLOCKS_MAX_SIZE) return -1;
+
+    uint64_t index_end = file_size - BLOCKS_TRAILER_SIZE;
+    const unsigned char *trailer = file_image_range(img->file, index_end, BLOCKS_TRAILER_SIZE);
+    if (!trailer) return -1;
+    uint64_t image_size = get_be64(trailer);
+    uint64_t count = get_be64(trailer + 8);
+    uint64_t index_offset = get_be64(trailer + 16);
+    if (index_offset < BLOCKS_HEADER_SIZE || index_offset > index_end) return -1;
+    if (count != (index_end - index_offset) / BLOCKS_INDEX_ENTRY_SIZE ||
+        (index_end - index_offset) % BLOCKS_INDEX_ENTRY_SIZE != 0) {
+        return -1;
+    }
+    if (image_size > SIZE_MAX || count != image_size / img->block_size +
+                                         (image_size % img->block_size != 0)) {
+        return -1;
+    }
+    const unsigned char *index = file_image_range(img->file, index_offset, index_end - index_offset);
+    if (!index) return -1;
+    img->size = (size_t)image_size;
+    img->block_count = count;
+
+    img->offsets = calloc(count ? count : 1, sizeof(*img->offsets));
+    img->lengths = calloc(count ? count : 1, sizeof(*img->lengths));
+    img->flags = calloc(count ? count : 1, sizeof(*img->flags));
+    img->ready = calloc(count ? count : 1, sizeof(*img->ready));
+    if (!img->offsets || !img->lengths || !img->flags || !img->ready) return -1;
+    for (uint64_t i = 0; i < count; i++) {
+        const unsigned char *entry = index + i * BLOCKS_INDEX_ENTRY_SIZE;
+        img->offsets[i] = get_be64(entry);
+        img->lengths[i] = get_be32(entry + 8);
+        img->flags[i] = get_be32(entry + 12);
+        uint64_t raw = i + 1 < count ? img->block_size : image_size - i * img->block_size;
+        if (img->offsets[i] < BLOCKS_HEADER_SIZE || img->offsets[i] > index_offset ||
+            img->lengths[i] > index_offset - img->offsets[i]) {
+            return -1;
+        }
+        if ((img->flags[i] & BLOCKS_FLAG_RAW) && img->lengths[i] != raw) return -1;
+    }
+    /* malloc leaves large untouched pages unbacked; blocks fill it lazily. */
+    img->data = malloc(img->size ? img->size : 1);
+    return img->data ? 0 : -1;
+}
+
+int blocks_open(const char *filename, BlockImage *out) {
+    if (!filename || !out) return -1;
+    *out = NULL;
+
+    BlockImage img = calloc(1, sizeof(*img));
+    if (!img) return -1;
+    for (size_t i = 0; i < BLOCKS_LOCK_STRIPES; i++) {
+        if (pthread_mutex_init(&img->locks[i], NULL) != 0) {
+            while (i-- > 0) pthread_mutex_destroy(&img->locks[i]);
+            free(img);
+            return -1;
+        }
+    }
+    if (file_image_open(filename, &img->file) != 0 || blocks_validate(img) != 0) {
+        blocks_close(img);
+        return -1;
+    }
+    *out = img;
+    return 0;
+}
+
+static int blocks_fill(BlockImage img, uint64_t i) {
+    if (atomic_load_explicit(&img->ready[i], memory_order_acquire)) return 0;
+    pthread_mutex_t *lock = &img->locks[i % BLOCKS_LOCK_STRIPES];
+    if (pthread_mutex_lock(lock) != 0) return -1;
+    int ret = 0;
+    if (!atomic_load_explicit(&img->ready[i], memory_order_relaxed)) {
+        size_t start = (size_t)(i * img->block_size);
+        size_t len = img->size - start < img->block_size ? img->size - start : img->block_size;
+        const unsigned char *src = file_image_range(img->file, img->offsets[i], img->lengths[i]);
+        if (!src) {
+            ret = -1;
+        } else if (img->flags[i] & BLOCKS_FLAG_RAW) {
+            memcpy(img->data + start, src, len);
+        } else {
+            ret = lz_decompress(src, img->lengths[i], img->data + start, len);
+        }
+        if (ret == 0) atomic_store_explicit(&img->ready[i], 1, memory_order_release);
+    }
+    pthread_mutex_unlock(lock);
+    return ret;
+}
+
+const unsigned char *blocks_range(BlockImage img, uint64_t offset, uint64_t len) {
+    if (!img || offset > img->size || len > img->size - offset) return NULL;
+    if (len > 0) {
+        for (uint64_t i = offset / img->block_size; i <= (offset + len - 1) / img->block_size; i++) {
+            if (blocks_fill(img, i) != 0) return NULL;
+        }
+    }
+    return img->data + offset;
+}
+
+static int fill_block(void *ctx, size_t worker, size_t index) {
+    (void)worker;
+    return blocks_fill(ctx, index);
+}
+
+int blocks_load_all(BlockImage img) {
+    if (!img) return -1;
+    return parallel_for(img->block_count, 0, fill_block, img);
+}
+
+void blocks_close(BlockImage img) {
+    if (!img) return;
+    file_image_close(img->file);
+    for (size_t i = 0; i < BLOCKS_LOCK_STRIPES; i++) pthread_mutex_destroy(&img->locks[i]);
+    free(img->data);
+    free(img->offsets);
+    free(img->lengths);
+    free(img->flags);
+    free(img->ready);
+    free(img);
+}
@@ -0,0 +1,52 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "checksum.h"
+
+/* Compressed block container around a snapshot image (see format.h). */
+
+typedef struct BlockImage *BlockImage;
+
+/* Block i is filled under locks[i % BLOCKS_LOCK_STRIPES]. */
+#define BLOCKS_LOCK_STRIPES 64
+
+/* A container opened for reading. data has room for the whole image but a
+ * block is only decompressed into it on first access, so untouched blocks
+ * cost neither disk reads nor resident memory. */
+struct BlockImage {
+    unsigned char *data;
+    size_t size;
+    FileImage file;                 /* mapped container, checked on access */
+    uint32_t block_size;
+    uint64_t block_count;
+    uint64_t *offsets;
+    uint32_t *lengths;
+    uint32_t *flags;
+    atomic_uchar *ready;
+    pthread_mutex_t locks[BLOCKS_LOCK_STRIPES];
+};
+
+/* Compress size bytes of image into out as a container. block_size 0 picks
+ * BLOCKS_DEFAULT_SIZE. Blocks are compressed in parallel. Returns 0 on
+ * success, -1 on failure. */
+int blocks_write(FILE *out, const unsigned char *image, size_t size, uint32_t block_size);
+
+/* Map a container and validate its index. Returns 0 on success. */
+int blocks_open(const char *filename, BlockImage *out);
+
+/* Make image bytes [offset, offset + len) available and return a pointer to
+ * them, or NULL when the range is out of bounds or a block is corrupt.
+ * Safe to call from many threads. */
+const unsigned char *blocks_range(BlockImage img, uint64_t offset, uint64_t len);
+
+/* Decompress every block, in parallel. Returns 0 on success. */
+int blocks_load_all(BlockImage img);
+
+void blocks_close(BlockImage img);
+
+#endif /* BLOCKS_H */
@@ -0,0 +1,315 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <arpa/inet.h> // htonl, ntohl
+
+#include "checksum.h"
+#include "crc32c.h"
+#include "format.h"
+#include "parallel.h"
+
+#ifndef htobe64
+#define htobe64(x) (__builtin_bswap64((uint64_t)(x)))
+#endif
+#ifndef be64toh
+#define be64toh(x) (__builtin_bswap64((uint64_t)(x)))
+#endif
+
+#define CHECKSUM_MIN_CHUNK (4u * 1024u)
+#define CHECKSUM_MAX_CHUNK (16u * 1024u * 1024u)
+#define VERIFY_BUFFER_SIZE (4u * 1024u * 1024u)
+
+struct footer {
+    uint64_t image_size;
+    uint32_t chunk_size;
+    uint32_t table_crc;
+    uint64_t chunk_count;
+};
+
+static void put_be32(unsigned char *p, uint32_t v) {
+    uint32_t be = htonl(v);
+    memcpy(p, &be, sizeof(be));
+}
+
+static uint32_t get_be32(const unsigned char *p) {
+    uint32_t be;
+    memcpy(&be, p, sizeof(be));
+    return ntohl(be);
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+    uint64_t be;
+    memcpy(&be, p, sizeof(be));
+    return be64toh(be);
+}
+
+static int pread_full(int fd, unsigned char *buf, size_t len, off_t offset) {
+    while (len) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+/* Returns 1 when the file ends in a well-formed footer, 0 when it has none
+ * and -1 when one is present but inconsistent with the file size. */
+static int parse_footer(const unsigned char *tail, uint64_t file_size, struct footer *out) {
+    if (file_size < CHECKSUM_FOOTER_SIZE) return 0;
+    if (memcmp(tail + CHECKSUM_FOOTER_SIZE - 4, MAGIC_CHECKSUM, 4) != 0) return 0;
+    out->image_size = get_be64(tail);
+    out->chunk_size = get_be32(tail + 8);
+    out->table_crc = get_be32(tail + 12);
+    if (out->chunk_size < CHECKSUM_MIN_CHUNK || out->chunk_size > CHECKSUM_MAX_CHUNK) return -1;
+    if (out->image_size > file_size) return -1;
+    out->chunk_count = out->image_size / out->chunk_size + (out->image_size % out->chunk_size != 0);
+    if (out->chunk_count > (file_size - out->image_size) / 4 ||
+        out->image_size + out->chunk_count * 4 + CHECKSUM_FOOTER_SIZE != file_size) {
+        return -1;
+    }
+    return 1;
+}
+
+static int table_matches(const unsigned char *table, const unsigned char *tail,
+                         const struct footer *footer) {
+    uint32_t crc = crc32c(0, table, footer->chunk_count * 4);
+    return crc32c(crc, tail, 12) == footer->table_crc;
+}
+
+static size_t chunk_length(uint64_t size, uint32_t chunk_size, uint64_t i) {
+    uint64_t start = i * chunk_size;
+    return size - start < chunk_size ? (size_t)(size - start) : chunk_size;
+}
+
+/* Writer: the image is read back through pread, chunks spread over a pool
+ * of threads. It was just written, so the reads come from the page cache. */
+struct append_job {
+    int fd;
+    uint64_t size;
+    unsigned char *table;
+    unsigned char **buffers;
+};
+
+static int append_chunk(void *ctx, size_t worker, size_t index) {
+    struct append_job *job = ctx;
+    if (!job->buffers[worker]) {
+        job->buffers[worker] = malloc(CHECKSUM_CHUNK_SIZE);
+        if (!job->buffers[worker]) return -1;
+    }
+    size_t len = chunk_length(job->size, CHECKSUM_CHUNK_SIZE, index);
+    if (pread_full(job->fd, job->buffers[worker], len, (off_t)(index * CHECKSUM_CHUNK_SIZE)) != 0) {
+        return -1;
+    }
+    put_be32(job->table + index * 4, crc32c(0, job->buffers[worker], len));
+    return 0;
+}
+
+int checksum_append(FILE *f) {
+    if (!f || fflush(f) != 0) return -1;
+    off_t end = ftello(f);
+    if (end < 0) return -1;
+
+    uint64_t size = (uint64_t)end;
+    uint64_t count = size / CHECKSUM_CHUNK_SIZE + (size % CHECKSUM_CHUNK_SIZE != 0);
+    size_t workers = parallel_default_workers();
+    struct append_job job = {
+        .fd = fileno(f),
+        .size = size,
+        .table = malloc(count * 4 + 1),
+        .buffers = calloc(workers, sizeof(*job.buffers)),
+    };
+    int ret = -1;
+    if (!job.table || !job.buffers) goto done;
+    if (parallel_for(count, workers, append_chunk, &job) != 0) goto done;
+
+    unsigned char tail[CHECKSUM_FOOTER_SIZE] = {0};
+    uint64_t be = htobe64(size);
+    memcpy(tail, &be, sizeof(be));
+    put_be32(tail + 8, CHECKSUM_CHUNK_SIZE);
+    put_be32(tail + 12, crc32c(crc32c(0, job.table, count * 4), tail, 12));
+    memcpy(tail + CHECKSUM_FOOTER_SIZE - 4, MAGIC_CHECKSUM, 4);
+    if (count && fwrite(job.table, 4, count, f) != count) goto done;
+    if (fwrite(tail, sizeof(tail), 1, f) != 1) goto done;
+    ret = 0;
+
+done:
+    for (size_t i = 0; job.buffers && i < workers; i++) free(job.buffers[i]);
+    free(job.buffers);
+    free(job.table);
+    return ret;
+}
+
+int file_image_open(const char *filename, FileImage *out) {
+    if (!filename || !out) return -1;
+    *out = NULL;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    FileImage img = calloc(1, sizeof(*img));
+    if (!img) {
+        munmap(data, (size_t)st.st_size);
+        return -1;
+    }
+    img->data = data;
+    img->file_size = (size_t)st.st_size;
+    img->size = img->file_size;
+    img->filename = strdup(filename);
+    if (!img->filename) goto fail;
+
+    struct footer footer;
+    const unsigned char *tail = img->data + img->file_size - CHECKSUM_FOOTER_SIZE;
+    int found = parse_footer(tail, img->file_size, &footer);
+    if (found < 0 || (found && !table_matches(img->data + footer.image_size, tail, &footer))) {
+        fprintf(stderr, "%s: damaged checksum footer\n", filename);
+        goto fail;
+    }
+    if (found) {
+        const unsigned char *table = img->data + footer.image_size;
+        img->size = (size_t)footer.image_size;
+        img->chunk_size = footer.chunk_size;
+        img->chunk_count = footer.chunk_count;
+        img->crcs = table;
+        img->verified = calloc(footer.chunk_count ? footer.chunk_count : 1, sizeof(*img->verified));
+        if (!img->verified) goto fail;
+    }
+    *out = img;
+    return 0;
+
+fail:
+    file_image_close(img);
+    return -1;
+}
+
+/* verified[i] is CHUNK_UNCHECKED until the first read of chunk i. A bad
+ * chunk is reported once and refused from then on. */
+enum { CHUNK_UNCHECKED, CHUNK_GOOD, CHUNK_BAD };
+
+static int verify_chunk(FileImage img, uint64_t i) {
+    unsigned char state = atomic_load_explicit(&img->verified[i], memory_order_acquire);
+    if (state != CHUNK_UNCHECKED) return state == CHUNK_GOOD ? 0 : -1;
+    size_t len = chunk_length(img->size, img->chunk_size, i);
+    uint32_t crc = crc32c(0, img->data + i * img->chunk_size, len);
+    if (crc != get_be32(img->crcs + i * 4)) {
+        unsigned char expected = CHUNK_UNCHECKED;
+        if (atomic_compare_exchange_strong(&img->verified[i], &expected, CHUNK_BAD)) {
+            fprintf(stderr, "%s: checksum mismatch in bytes %llu-%llu\n", img->filename,
+                    (unsigned long long)(i * img->chunk_size),
+                    (unsigned long long)(i * img->chunk_size + len - 1));
+        }
+        return -1;
+    }
+    atomic_store_explicit(&img->verified[i], CHUNK_GOOD, memory_order_release);
+    return 0;
+}
+
+const unsigned char *file_image_range(FileImage img, uint64_t offset, uint64_t len) {
+    if (!img || offset > img->size || len > img->size - offset) return NULL;
+    if (img->crcs && len > 0) {
+        for (uint64_t i = offset / img->chunk_size; i <= (offset + len - 1) / img->chunk_size; i++) {
+            if (verify_chunk(img, i) != 0) return NULL;
+        }
+    }
+    return img->data + offset;
+}
+
+static int verify_one(void *ctx, size_t worker, size_t index) {
+    (void)worker;
+    return verify_chunk(ctx, index);
+}
+
+int file_image_verify_all(FileImage img) {
+    if (!img) return -1;
+    if (!img->crcs) return 0;
+    return parallel_for(img->chunk_count, 0, verify_one, img);
+}
+
+void file_image_close(FileImage img) {
+    if (!img) return;
+    if (img->data) munmap((void *)img->data, img->file_size);
+    free(img->verified);
+    free(img->filename);
+    free(img);
+}
+
+int checksum_verify_file(const char *filename, VerifyReport *report) {
+    if (!filename || !report) return -1;
+    memset(report, 0, sizeof(*report));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    unsigned char *table = NULL, *buf = NULL;
+    int ret = -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) goto done;
+    uint64_t file_size = (uint64_t)st.st_size;
+
+    unsigned char tail[CHECKSUM_FOOTER_SIZE];
+    struct footer footer;
+    int found = 0;
+    if (file_size >= CHECKSUM_FOOTER_SIZE) {
+        if (pread_full(fd, tail, sizeof(tail), (off_t)(file_size - sizeof(tail))) != 0) goto done;
+        found = parse_footer(tail, file_size, &footer);
+    }
+    if (found < 0) goto done;
+    if (!found) {
+        report->bytes = file_size;
+        ret = 0;
+        goto done;
+    }
+
+    table = malloc(footer.chunk_count * 4 + 1);
+    if (!table) goto done;
+    if (pread_full(fd, table, footer.chunk_count * 4, (off_t)footer.image_size) != 0) goto done;
+    if (!table_matches(table, tail, &footer)) goto done;
+    report->has_checksums = 1;
+    report->chunk_size = footer.chunk_size;
+
+    /* Whole chunks per read, sequentially, so the kernel can read ahead. */
+    size_t per_read = VERIFY_BUFFER_SIZE / footer.chunk_size;
+    if (per_read == 0) per_read = 1;
+    size_t buf_size = per_read * footer.chunk_size;
+    buf = malloc(buf_size);
+    if (!buf) goto done;
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    uint64_t chunk = 0;
+    while (chunk < footer.chunk_count) {
+        uint64_t start = chunk * footer.chunk_size;
+        size_t want = footer.image_size - start < buf_size ? (size_t)(footer.image_size - start)
+                                                           : buf_size;
+        if (pread_full(fd, buf, want, (off_t)start) != 0) goto done;
+        for (size_t off = 0; off < want; off += footer.chunk_size, chunk++) {
+            size_t len = want - off < footer.chunk_size ? want - off : footer.chunk_size;
+            if (crc32c(0, buf + off, len) != get_be32(table + chunk * 4)) {
+                if (report->bad_chunks++ == 0) report->first_bad = chunk;
+            }
+        }
+        report->bytes += want;
+    }
+    report->chunks = footer.chunk_count;
+    ret = 0;
+
+done:
+    free(table);
+    free(buf);
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,59 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Checksum footer (see format.h): written after every snapshot image and
+ * checked as the image is read. */
+
+typedef struct FileImage *FileImage;
+
+/* A mapped snapshot file. Readers see size bytes of image; with a footer,
+ * each chunk is verified the first time any part of it is read. */
+struct FileImage {
+    char *filename;
+    const unsigned char *data;
+    size_t size;
+    size_t file_size;
+    uint32_t chunk_size;
+    uint64_t chunk_count;
+    const unsigned char *crcs;      /* NULL for files without a footer */
+    atomic_uchar *verified;
+};
+
+/* Results of checksum_verify_file. */
+typedef struct VerifyReport {
+    int has_checksums;
+    uint64_t bytes;
+    uint64_t chunks;
+    uint32_t chunk_size;
+    uint64_t bad_chunks;
+    uint64_t first_bad;             /* chunk index, valid when bad_chunks */
+} VerifyReport;
+
+/* Append the footer for everything written to f so far. f must be backed by
+ * a readable file descriptor. Returns 0 on success, -1 on failure. */
+int checksum_append(FILE *f);
+
+/* Map filename and validate its footer, if any. Returns 0 on success, -1
+ * when the file cannot be mapped or its footer is damaged. */
+int file_image_open(const char *filename, FileImage *out);
+
+/* Return a pointer to image bytes [offset, offset + len) once the chunks
+ * they cover are verified, or NULL when out of bounds or corrupt. */
+const unsigned char *file_image_range(FileImage img, uint64_t offset, uint64_t len);
+
+/* Verify every chunk, in parallel. Returns 0 when all match. */
+int file_image_verify_all(FileImage img);
+
+void file_image_close(FileImage img);
+
+/* Stream filename with sequential reads and check every chunk. Returns 0
+ * when the file was read (see report for the outcome), -1 on I/O errors or
+ * a damaged footer. */
+int checksum_verify_file(const char *filename, VerifyReport *report);
+
+#endif /* CHECKSUM_H */
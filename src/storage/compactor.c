@@ -1,92 +1,753 @@
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "compactor.h"
 #include "../utils/document.h"
 #include "../utils/version_node.h"
 #include "../utils/hash.h"
+#include "../utils/parallel.h"
+#include "../utils/reclaim.h"
 
-/* The caller must hold doc->lock for writing. Every version chain and map
- * entry below is stable for the complete traversal. */
-static int compact_document_locked(Document doc) {
-    if (!doc) return 1;
+/* Chains are cut under the Document's read lock, so readers and writers of
+ * other keys never wait on compaction. The cut-off history is retired to
+ * reclaim.h and freed once no reader can still be walking it. */
 
-    for (uint64_t i = 0; i < doc->fields->bucket_count; i++) {
-        for (Entry e = doc->fields->buckets[i]; e; e = e->next) {
-            if (version_node_compact_locked((VersionNode)e->value) != 0) return 1;
-        }
+/* A field whose whole remaining chain is its deletion can go: no version
+ * of it is left for any reader to find. */
+static int is_dead_field(VersionNode chain) {
+    return !chain || (chain->value == DELETED && !chain->prev);
+}
+
+/* One Document on the cursor's stack. Its maps are walked fields first,
+ * bucket by bucket; when a map is rehashed between steps its walk restarts,
+ * which only revisits chains that are already short. */
+struct compact_frame {
+    Document doc;               /* retained */
+    Document parent;            /* held by the frame below, or the anchor */
+    char *key;                  /* doc's key in parent */
+    char *path;                 /* only tracked with a policy */
+    int started;
+    int keep_history;
+    int fields_only;            /* the root Document of a "" subtree cursor */
+    int subdocuments;
+    int shrink;                 /* finished with sparse maps */
+    uint64_t bucket;
+    uint64_t bucket_count;
+};
+
+struct CompactCursor {
+    VersionNode root;           /* retained */
+    char *subtree;              /* path to restrict the walk to */
+    int root_fields;            /* the "" subtree: root Document fields only */
+    int missing;                /* the subtree's path was not found */
+    Document anchor;            /* retained parent of the subtree's Document */
+    RetentionPolicy policy;
+    uint64_t now;               /* wall-clock seconds at the step's start */
+    char *scratch;              /* path of the chain being compacted */
+    size_t scratch_cap;
+    unsigned clock_checks;      /* budget checks since the clock was read */
+    int root_done;
+    struct compact_frame *stack;
+    size_t depth;
+    size_t cap;
+    CompactStats stats;
+};
+
+static uint64_t now_micros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static int cursor_push(CompactCursor cursor, Document doc, char *path) {
+    if (cursor->depth == cursor->cap) {
+        size_t cap = cursor->cap ? cursor->cap * 2 : 16;
+        struct compact_frame *stack = realloc(cursor->stack, cap * sizeof(*stack));
+        if (!stack) return -1;
+        cursor->stack = stack;
+        cursor->cap = cap;
     }
+    cursor->stack[cursor->depth++] = (struct compact_frame){.doc = doc, .path = path};
+    return 0;
+}
 
-    for (uint64_t i = 0; i < doc->subdocuments->bucket_count; i++) {
-        for (Entry e = doc->subdocuments->buckets[i]; e; e = e->next) {
-            VersionNode chain = (VersionNode)e->value;
-            if (version_node_compact_locked(chain) != 0) return 1;
-
-            Document child = chain ? (Document)chain->value : NULL;
-            if (!child) continue;
-            if (pthread_rwlock_wrlock(&child->lock) != 0) return 1;
-            int ret = compact_document_locked(child);
-            pthread_rwlock_unlock(&child->lock);
-            if (ret != 0) return ret;
-        }
+/* Entries unlinked under a write lock, freed once it is dropped. */
+struct compact_garbage {
+    VersionNode *chains;
+    size_t count;
+    size_t cap;
+};
+
+static int garbage_reserve(struct compact_garbage *g) {
+    if (g->count < g->cap) return 0;
+    size_t cap = g->cap ? g->cap * 2 : 64;
+    VersionNode *chains = realloc(g->chains, cap * sizeof(*chains));
+    if (!chains) return -1;
+    g->chains = chains;
+    g->cap = cap;
+    return 0;
+}
+
+static void garbage_free(struct compact_garbage *g) {
+    for (size_t i = 0; i < g->count; i++) version_node_free(g->chains[i]);
+    g->count = 0;
+}
+
+/* Keys of fields found dead under the read lock. */
+struct dead_fields {
+    char **keys;
+    size_t count;
+    size_t cap;
+};
+
+static int dead_fields_add(struct dead_fields *d, const char *key) {
+    if (d->count == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 16;
+        char **keys = realloc(d->keys, cap * sizeof(*keys));
+        if (!keys) return -1;
+        d->keys = keys;
+        d->cap = cap;
     }
+    if (!(d->keys[d->count] = strdup(key))) return -1;
+    d->count++;
     return 0;
 }
 
-int compactor_compact(VersionNode root) {
-    if (!root) return 1;
+static void dead_fields_clear(struct dead_fields *d) {
+    while (d->count > 0) free(d->keys[--d->count]);
+}
 
-    if (pthread_rwlock_wrlock(&root->lock) != 0) return 1;
+static void note_hold(CompactCursor cursor, uint64_t locked) {
+    uint64_t held = now_micros() - locked;
+    if (held > cursor->stats.max_hold_micros) cursor->stats.max_hold_micros = held;
+}
 
-    Document doc = (Document)root->value;
-    if (!doc || pthread_rwlock_wrlock(&doc->lock) != 0) {
-        pthread_rwlock_unlock(&root->lock);
-        return 1;
+/* Cut whatever the policy lets go of below head, a chain of map (NULL for
+ * the root); path is NULL without a policy. The caller holds the chain's
+ * Document for reading and is inside a reclaim section. */
+static int detach_history(CompactCursor cursor, Hashmap map, VersionNode head,
+                          const char *path) {
+    if (!head || !head->prev) return 0;
+    RetentionRule rule;
+    if (path && retention_policy_match(cursor->policy, path, &rule)) {
+        head = retention_last_kept(&rule, head, cursor->now);
+    }
+    /* A concurrent compactor cutting the same chain gets NULL or a disjoint
+     * part of it; each tail is retired exactly once. */
+    VersionNode tail = atomic_exchange(&head->prev, NULL);
+    if (!tail) return 0;
+    uint64_t versions = 0;
+    for (VersionNode v = tail; v; v = v->prev) versions++;
+    uint64_t bytes = hashmap_account_history(map, tail, 0);
+    if (reclaim_retire(tail) != 0) {
+        atomic_store(&head->prev, tail);
+        hashmap_account_history(map, tail, 1);
+        return -1;
     }
+    cursor->stats.versions_freed += versions;
+    cursor->stats.bytes_freed += bytes;
+    return 0;
+}
+
+/* Unlink an entry, chain and all; its chain is freed with the garbage. The
+ * caller holds the map's Document for writing. */
+static int purge_entry(CompactCursor cursor, struct compact_garbage *g, Hashmap map, Entry *link) {
+    if (garbage_reserve(g) != 0) return -1;
+    g->chains[g->count++] = hashmap_unlink(map, link);
+    cursor->stats.entries_purged++;
+    return 0;
+}
 
-    int ret = version_node_compact_locked(root);
-    if (ret == 0) ret = compact_document_locked(doc);
+/* Remove the fields of doc named by keys that are still dead; a writer may
+ * have revived one since the read lock was dropped. */
+static int purge_fields(CompactCursor cursor, struct compact_garbage *g, Document doc,
+                        char **keys, size_t count) {
+    if (count == 0) return 0;
+    if (pthread_rwlock_wrlock(&doc->lock) != 0) return -1;
+    uint64_t locked = now_micros();
+    int ret = 0;
+    for (size_t i = 0; ret == 0 && i < count; i++) {
+        Entry *link = hashmap_find_link(doc->fields, keys[i]);
+        if (*link && is_dead_field((VersionNode)(*link)->value)) {
+            ret = purge_entry(cursor, g, doc->fields, link);
+        }
+    }
+    note_hold(cursor, locked);
     pthread_rwlock_unlock(&doc->lock);
-    pthread_rwlock_unlock(&root->lock);
     return ret;
 }
 
-int compactor_compact_path(VersionNode root, const char *path) {
-    if (!root || !path) return 1;
+static int shrink_document(CompactCursor cursor, Document doc) {
+    if (pthread_rwlock_wrlock(&doc->lock) != 0) return -1;
+    uint64_t locked = now_micros();
+    int ret = document_shrink_locked(doc);
+    note_hold(cursor, locked);
+    pthread_rwlock_unlock(&doc->lock);
+    return ret;
+}
 
-    if (pthread_rwlock_rdlock(&root->lock) != 0) return 1;
+/* "<parent>/<key>" in the cursor's scratch buffer, or NULL without a policy. */
+static const char *entry_path(CompactCursor cursor, const char *parent, const char *key) {
+    if (!cursor->policy) return NULL;
+    size_t plen = strlen(parent), klen = strlen(key);
+    size_t need = plen + klen + 2;
+    if (need > cursor->scratch_cap) {
+        char *grown = realloc(cursor->scratch, need * 2);
+        if (!grown) return NULL;
+        cursor->scratch = grown;
+        cursor->scratch_cap = need * 2;
+    }
+    if (plen) {
+        memcpy(cursor->scratch, parent, plen);
+        cursor->scratch[plen++] = '/';
+    }
+    memcpy(cursor->scratch + plen, key, klen + 1);
+    return cursor->scratch;
+}
+
+CompactCursor compactor_cursor_create(VersionNode root, RetentionPolicy policy) {
+    if (!root) return NULL;
+    CompactCursor cursor = calloc(1, sizeof(*cursor));
+    if (!cursor) return NULL;
+    cursor->policy = policy;
+    cursor->root = version_node_retain(root);
+    if (!cursor->root) {
+        free(cursor);
+        return NULL;
+    }
+    return cursor;
+}
+
+static CompactCursor cursor_create_path(VersionNode root, const char *path,
+                                        RetentionPolicy policy) {
+    CompactCursor cursor = compactor_cursor_create(root, policy);
+    if (!cursor) return NULL;
+    if (!*path) {
+        cursor->root_fields = 1;
+        return cursor;
+    }
+    cursor->subtree = strdup(path);
+    if (!cursor->subtree) {
+        compactor_cursor_free(cursor);
+        return NULL;
+    }
+    return cursor;
+}
+
+CompactCursor compactor_cursor_create_subtree(VersionNode root, const char *key,
+                                              RetentionPolicy policy) {
+    if (!key || strchr(key, '/')) return NULL;
+    return cursor_create_path(root, key, policy);
+}
+
+const CompactStats *compactor_cursor_stats(CompactCursor cursor) {
+    return cursor ? &cursor->stats : NULL;
+}
+
+void compactor_cursor_free(CompactCursor cursor) {
+    if (!cursor) return;
+    for (size_t i = 0; i < cursor->depth; i++) {
+        document_free(cursor->stack[i].doc);
+        free(cursor->stack[i].key);
+        free(cursor->stack[i].path);
+    }
+    free(cursor->stack);
+    free(cursor->scratch);
+    free(cursor->subtree);
+    document_free(cursor->anchor);
+    version_node_release(cursor->root);
+    free(cursor);
+}
+
+/* Reading the clock costs more than a bucket of small documents, so it is
+ * only read on every BUDGET_CLOCK_STRIDE-th check. */
+#define BUDGET_CLOCK_STRIDE 16
+
+static int budget_spent(CompactCursor cursor, const CompactBudget *budget, size_t entries,
+                        uint64_t start) {
+    if (budget->max_entries && entries >= budget->max_entries) return 1;
+    if (!budget->max_micros || ++cursor->clock_checks < BUDGET_CLOCK_STRIDE) return 0;
+    cursor->clock_checks = 0;
+    return now_micros() - start >= budget->max_micros;
+}
+
+/* Work on the top frame with its Document read-locked. Returns 1 when the
+ * frame is finished, 0 when it stopped for the budget or to descend into
+ * children (pushed above it), -1 on error. Dead fields are only noted. */
+struct compact_child {
+    Document doc;
+    char *key;
+    char *path;
+};
+
+/* What one pass collects for the caller to act on after unlocking. */
+struct compact_scratch {
+    struct compact_garbage g;
+    struct dead_fields dead;
+    struct compact_child *children;
+    size_t nchildren;
+    size_t children_cap;
+};
+
+static void scratch_free(struct compact_scratch *s) {
+    while (s->nchildren > 0) {
+        s->nchildren--;
+        document_free(s->children[s->nchildren].doc);
+        free(s->children[s->nchildren].key);
+        free(s->children[s->nchildren].path);
+    }
+    free(s->children);
+    dead_fields_clear(&s->dead);
+    free(s->dead.keys);
+    garbage_free(&s->g);
+    free(s->g.chains);
+}
+
+static int compact_frame(CompactCursor cursor, struct compact_frame *frame,
+                         const CompactBudget *budget, uint64_t start,
+                         size_t *entries, struct compact_scratch *s) {
+    Document doc = frame->doc;
+    if (!frame->started) {
+        /* Unloaded history is never decoded, unless the policy keeps some
+         * of it (then it was loaded already). */
+        if (!frame->keep_history) document_drop_history_locked(doc);
+        frame->started = 1;
+        frame->bucket_count = doc->fields->bucket_count;
+    }
+    while (1) {
+        Hashmap map = frame->subdocuments ? doc->subdocuments : doc->fields;
+        if (map->bucket_count != frame->bucket_count) {
+            frame->bucket = 0;
+            frame->bucket_count = map->bucket_count;
+        }
+        if (frame->bucket >= frame->bucket_count) {
+            if (frame->subdocuments || frame->fields_only) {
+                /* Amortised over the removals that emptied the buckets. */
+                frame->shrink = document_wants_shrink(doc);
+                return 1;
+            }
+            frame->subdocuments = 1;
+            frame->bucket = 0;
+            frame->bucket_count = doc->subdocuments->bucket_count;
+            continue;
+        }
+        if (budget_spent(cursor, budget, *entries, start)) return 0;
+
+        for (Entry e = map->buckets[frame->bucket]; e; e = e->next) {
+            VersionNode chain = (VersionNode)e->value;
+            const char *path = entry_path(cursor, frame->path, e->key);
+            if (cursor->policy && !path) return -1;
+            if (detach_history(cursor, map, chain, path) != 0) return -1;
+            (*entries)++;
+            if (!frame->subdocuments) {
+                if (is_dead_field(chain) && dead_fields_add(&s->dead, e->key) != 0) return -1;
+                continue;
+            }
+            if (!chain || !chain->value || chain->value == DELETED) continue;
+            if (s->nchildren == s->children_cap) {
+                size_t cap = s->children_cap ? s->children_cap * 2 : 8;
+                struct compact_child *grown = realloc(s->children, cap * sizeof(*grown));
+                if (!grown) return -1;
+                s->children = grown;
+                s->children_cap = cap;
+            }
+            char *child_path = path ? strdup(path) : NULL;
+            char *child_key = strdup(e->key);
+            Document child = document_retain((Document)chain->value);
+            if (!child || !child_key || (path && !child_path)) {
+                document_free(child);
+                free(child_key);
+                free(child_path);
+                if (!child) continue;
+                return -1;
+            }
+            s->children[s->nchildren++] = (struct compact_child){child, child_key, child_path};
+        }
+        frame->bucket++;
+        if (s->nchildren) return 0;
+    }
+}
+
+/* A finished Document left empty is unlinked from its parent, but only
+ * while its parent's chain and this frame are all that reference it: a
+ * reader or writer that resolved it, or a pinned older version, keeps it. */
+static int purge_if_empty(CompactCursor cursor, struct compact_frame *frame,
+                          struct compact_garbage *g) {
+    if (!frame->parent) return 0;
+    Document parent = frame->parent;
+    if (pthread_rwlock_wrlock(&parent->lock) != 0) return -1;
+    uint64_t locked = now_micros();
+    int ret = 0;
+    Entry *link = hashmap_find_link(parent->subdocuments, frame->key);
+    VersionNode chain = *link ? (VersionNode)(*link)->value : NULL;
+    /* History kept below the head keeps the entry. */
+    if (chain && chain->value == frame->doc && !chain->prev &&
+        document_is_disposable(frame->doc, 2)) {
+        ret = purge_entry(cursor, g, parent->subdocuments, link);
+    }
+    note_hold(cursor, locked);
+    pthread_rwlock_unlock(&parent->lock);
+    return ret;
+}
+
+/* First step of a subtree cursor: the chain at the cursor's path is cut
+ * like any other, then the Document it holds is walked with the path's
+ * parent as anchor; a dead field there is purged. The "" subtree is the
+ * root Document's own fields. */
+static int cursor_start_subtree(CompactCursor cursor, struct compact_garbage *g) {
+    VersionNode root = cursor->root;
+    if (pthread_rwlock_rdlock(&root->lock) != 0) return -1;
+    Document doc = root->value ? document_retain((Document)root->value) : NULL;
+    pthread_rwlock_unlock(&root->lock);
+    if (!doc) {
+        cursor->missing = 1;
+        return 0;
+    }
+    if (cursor->root_fields) {
+        char *path = cursor->policy ? strdup("") : NULL;
+        if ((cursor->policy && !path) || cursor_push(cursor, doc, path) != 0) {
+            free(path);
+            document_free(doc);
+            return -1;
+        }
+        cursor->stack[cursor->depth - 1].fields_only = 1;
+        return 0;
+    }
 
-    Document doc = (Document)root->value;
     Document parent = NULL;
     char *key = NULL;
-    if (!doc || resolve_parent_and_key(doc, path, &parent, &key, 0, 0) != 0) {
-        pthread_rwlock_unlock(&root->lock);
-        return 1;
+    int ret = resolve_parent_and_key(doc, cursor->subtree, &parent, &key, 0, 0);
+    document_free(doc);
+    if (ret != 0) {
+        cursor->missing = 1;
+        return 0;
+    }
+    /* Unloaded history must not reappear below a chain that was cut. */
+    if (document_materialize_history(parent) != 0 || pthread_rwlock_rdlock(&parent->lock) != 0) {
+        document_free(parent);
+        free(key);
+        return -1;
+    }
+    Hashmap map = parent->subdocuments;
+    Entry *link = hashmap_find_link(map, key);
+    if (!*link) {
+        map = parent->fields;
+        link = hashmap_find_link(map, key);
     }
+    VersionNode chain = *link ? (VersionNode)(*link)->value : NULL;
+    ret = detach_history(cursor, map, chain, cursor->policy ? cursor->subtree : NULL);
+    Document child = NULL;
+    int dead = 0;
+    if (!*link) {
+        cursor->missing = 1;
+    } else if (map == parent->fields) {
+        dead = is_dead_field(chain);
+    } else if (chain && chain->value && chain->value != DELETED) {
+        child = document_retain((Document)chain->value);
+    }
+    pthread_rwlock_unlock(&parent->lock);
 
-    if (pthread_rwlock_wrlock(&parent->lock) != 0) {
+    if (ret == 0 && dead) ret = purge_fields(cursor, g, parent, &key, 1);
+    char *path = child && cursor->policy ? strdup(cursor->subtree) : NULL;
+    if (ret != 0 || !child || (cursor->policy && !path) || cursor_push(cursor, child, path) != 0) {
+        if (ret == 0 && child) ret = -1;
+        free(path);
+        document_free(child);
         document_free(parent);
         free(key);
-        pthread_rwlock_unlock(&root->lock);
-        return 1;
+        return ret;
+    }
+    cursor->stack[cursor->depth - 1].parent = parent;
+    cursor->stack[cursor->depth - 1].key = key;
+    cursor->anchor = parent;
+    return 0;
+}
+
+/* Cut the root chain and hand back its head Document, retained (NULL when
+ * there is none), and the path a policy knows it by. */
+static int cut_root(CompactCursor cursor, Document *doc_out, char **path_out) {
+    VersionNode root = cursor->root;
+    *doc_out = NULL;
+    *path_out = cursor->policy ? strdup("") : NULL;
+    if ((cursor->policy && !*path_out) || pthread_rwlock_rdlock(&root->lock) != 0) {
+        free(*path_out);
+        *path_out = NULL;
+        return -1;
+    }
+    int ret = detach_history(cursor, NULL, root, *path_out);
+    if (ret == 0 && root->value) *doc_out = document_retain((Document)root->value);
+    pthread_rwlock_unlock(&root->lock);
+    return ret;
+}
+
+static int cursor_start_root(CompactCursor cursor) {
+    Document doc = NULL;
+    char *path = NULL;
+    int ret = cut_root(cursor, &doc, &path);
+    if (ret == 0 && doc && cursor_push(cursor, doc, path) == 0) return 0;
+    if (doc) ret = -1;
+    document_free(doc);
+    free(path);
+    return ret;
+}
+
+/* Walk frame under its read lock until the budget is spent, children turn
+ * up or it is finished; then purge and shrink what that found under a brief
+ * write lock. Returns as compact_frame. */
+static int compact_pass(CompactCursor cursor, struct compact_frame *frame,
+                        const CompactBudget *budget, uint64_t start, size_t *entries,
+                        struct compact_scratch *s) {
+    if (!frame->started && cursor->policy &&
+        retention_policy_keeps_history(cursor->policy, frame->path)) {
+        /* History the policy keeps must be in memory before it is cut. */
+        if (document_materialize_history(frame->doc) != 0) return -1;
+        frame->keep_history = 1;
+    }
+    if (pthread_rwlock_rdlock(&frame->doc->lock) != 0) return -1;
+    int finished = compact_frame(cursor, frame, budget, start, entries, s);
+    pthread_rwlock_unlock(&frame->doc->lock);
+    if (finished >= 0 && purge_fields(cursor, &s->g, frame->doc, s->dead.keys, s->dead.count) != 0) {
+        finished = -1;
+    }
+    dead_fields_clear(&s->dead);
+    if (finished > 0 && frame->shrink && shrink_document(cursor, frame->doc) != 0) {
+        finished = -1;
+    }
+    garbage_free(&s->g);
+    return finished;
+}
+
+static void frame_release(struct compact_frame *frame) {
+    document_free(frame->doc);
+    free(frame->key);
+    free(frame->path);
+}
+
+static int compact_steps(CompactCursor cursor, const CompactBudget *budget,
+                         struct compact_scratch *s) {
+    uint64_t start = now_micros();
+    size_t entries = 0;
+    int ret = 0;
+    if (!cursor->root_done) {
+        ret = cursor->subtree || cursor->root_fields ? cursor_start_subtree(cursor, &s->g)
+                                                     : cursor_start_root(cursor);
+        garbage_free(&s->g);
+        if (ret != 0) return -1;
+        cursor->root_done = 1;
+    }
+
+    while (cursor->depth > 0 && !budget_spent(cursor, budget, entries, start)) {
+        struct compact_frame *frame = &cursor->stack[cursor->depth - 1];
+        int finished = compact_pass(cursor, frame, budget, start, &entries, s);
+        if (finished < 0) {
+            ret = -1;
+            break;
+        }
+        Document parent = frame->doc;
+        if (finished) {
+            ret = purge_if_empty(cursor, frame, &s->g);
+            garbage_free(&s->g);
+            frame_release(frame);
+            cursor->depth--;
+            cursor->stats.documents++;
+            if (ret != 0) break;
+        }
+        for (; s->nchildren > 0; s->nchildren--) {
+            struct compact_child *child = &s->children[s->nchildren - 1];
+            if (cursor_push(cursor, child->doc, child->path) != 0) {
+                ret = -1;
+                break;
+            }
+            cursor->stack[cursor->depth - 1].parent = parent;
+            cursor->stack[cursor->depth - 1].key = child->key;
+        }
+        if (ret != 0) break;
+    }
+    cursor->stats.entries += entries;
+    return ret;
+}
+
+int compactor_step(CompactCursor cursor, const CompactBudget *budget) {
+    if (!cursor) return -1;
+    CompactBudget defaults = {COMPACT_DEFAULT_ENTRIES, COMPACT_DEFAULT_MICROS};
+    if (!budget) budget = &defaults;
+    struct compact_scratch s = {0};
+    cursor->stats.steps++;
+    cursor->now = (uint64_t)time(NULL);
+
+    reclaim_enter();
+    int ret = compact_steps(cursor, budget, &s);
+    scratch_free(&s);
+    reclaim_exit();
+    /* Outside the section, so this step's own cuts are not held back. */
+    (void)reclaim_collect();
+
+    if (ret != 0) return -1;
+    return cursor->root_done && cursor->depth == 0 ? 1 : 0;
+}
+
+/* Parallel compaction: every Document is a task. A task walks its own maps
+ * in budgeted passes and spawns its children; the last of a task and its
+ * children to finish purges it if empty and passes on to its parent. */
+struct compact_task {
+    struct compact_frame frame;
+    struct compact_task *up;        /* holds frame.parent; NULL at the top */
+    atomic_size_t pending;          /* own walk plus unfinished children */
+};
+
+struct compact_pool {
+    CompactCursor *cursors;         /* per worker: policy, scratch path, stats */
+    size_t workers;
+    atomic_int failed;
+    atomic_int started;
+};
+
+static void task_release(struct compact_pool *p, CompactCursor cursor,
+                         struct compact_task *task) {
+    while (task && atomic_fetch_sub(&task->pending, 1) == 1) {
+        struct compact_task *up = task->up;
+        if (!atomic_load(&p->failed)) {
+            struct compact_garbage g = {0};
+            if (purge_if_empty(cursor, &task->frame, &g) != 0) atomic_store(&p->failed, 1);
+            garbage_free(&g);
+            free(g.chains);
+            cursor->stats.documents++;
+        }
+        frame_release(&task->frame);
+        free(task);
+        task = up;
     }
+}
 
-    Entry field = hashmap_find_entry(parent->fields, key);
-    Entry sub = hashmap_find_entry(parent->subdocuments, key);
-    VersionNode chain = field ? (VersionNode)field->value :
-                         (sub ? (VersionNode)sub->value : NULL);
-    int ret = chain ? version_node_compact_locked(chain) : 1;
+static int compact_task_run(void *ctx, ParallelPool pool, size_t worker, void *arg) {
+    struct compact_pool *p = ctx;
+    struct compact_task *task = arg;
+    CompactCursor cursor = p->cursors[worker];
+    CompactBudget budget = {COMPACT_DEFAULT_ENTRIES, COMPACT_DEFAULT_MICROS};
+    struct compact_scratch s = {0};
+    int finished = 0;
+    atomic_store(&p->started, 1);
 
-    if (ret == 0 && sub && chain && chain->value) {
-        Document child = (Document)chain->value;
-        if (pthread_rwlock_wrlock(&child->lock) != 0) {
-            ret = 1;
+    reclaim_enter();
+    while (finished == 0 && !atomic_load(&p->failed)) {
+        size_t entries = 0;
+        cursor->stats.steps++;
+        finished = compact_pass(cursor, &task->frame, &budget, now_micros(), &entries, &s);
+        cursor->stats.entries += entries;
+        for (; finished >= 0 && s.nchildren > 0; s.nchildren--) {
+            struct compact_child *c = &s.children[s.nchildren - 1];
+            struct compact_task *child = malloc(sizeof(*child));
+            if (!child) {
+                finished = -1;
+                break;
+            }
+            child->frame = (struct compact_frame){.doc = c->doc, .parent = task->frame.doc,
+                                                  .key = c->key, .path = c->path};
+            child->up = task;
+            atomic_init(&child->pending, 1);
+            atomic_fetch_add(&task->pending, 1);
+            /* Run here what nobody could steal or the deque has no room for. */
+            if (p->workers == 1 || parallel_spawn(pool, worker, child) != 0) {
+                (void)compact_task_run(ctx, pool, worker, child);
+            }
+        }
+        if (finished < 0) atomic_store(&p->failed, 1);
+    }
+    reclaim_exit();
+    scratch_free(&s);
+    task_release(p, cursor, task);
+    return finished < 0 ? -1 : 0;
+}
+
+int compactor_compact_parallel(VersionNode root, RetentionPolicy policy, size_t workers,
+                               CompactStats *stats_out) {
+    if (!root) return -1;
+    if (workers == 0) workers = parallel_default_workers();
+    struct compact_pool p = {0};
+    atomic_init(&p.failed, 0);
+    atomic_init(&p.started, 0);
+    p.workers = workers;
+    p.cursors = calloc(workers, sizeof(*p.cursors));
+    if (!p.cursors) return -1;
+    int ret = 0;
+    uint64_t now = (uint64_t)time(NULL);
+    for (size_t i = 0; i < workers; i++) {
+        p.cursors[i] = compactor_cursor_create(root, policy);
+        if (!p.cursors[i]) ret = -1;
+        else p.cursors[i]->now = now;
+    }
+
+    struct compact_task *top = NULL;
+    if (ret == 0) {
+        Document doc = NULL;
+        char *path = NULL;
+        reclaim_enter();
+        ret = cut_root(p.cursors[0], &doc, &path);
+        reclaim_exit();
+        if (ret == 0 && doc && !(top = calloc(1, sizeof(*top)))) ret = -1;
+        if (top) {
+            top->frame = (struct compact_frame){.doc = doc, .path = path};
+            atomic_init(&top->pending, 1);
         } else {
-            ret = compact_document_locked(child);
-            pthread_rwlock_unlock(&child->lock);
+            document_free(doc);
+            free(path);
+        }
+    }
+    if (top && parallel_run((void **)&top, 1, workers, compact_task_run, &p) != 0) {
+        ret = -1;
+        if (!atomic_load(&p.started)) {
+            frame_release(&top->frame);
+            free(top);
         }
     }
+    (void)reclaim_collect();
 
-    pthread_rwlock_unlock(&parent->lock);
-    document_free(parent);
-    free(key);
-    pthread_rwlock_unlock(&root->lock);
+    CompactStats total = {0};
+    for (size_t i = 0; i < workers; i++) {
+        if (!p.cursors[i]) continue;
+        const CompactStats *st = &p.cursors[i]->stats;
+        total.steps += st->steps;
+        total.entries += st->entries;
+        total.documents += st->documents;
+        total.versions_freed += st->versions_freed;
+        total.bytes_freed += st->bytes_freed;
+        total.entries_purged += st->entries_purged;
+        if (st->max_hold_micros > total.max_hold_micros) total.max_hold_micros = st->max_hold_micros;
+        compactor_cursor_free(p.cursors[i]);
+    }
+    free(p.cursors);
+    if (stats_out) *stats_out = total;
     return ret;
 }
+
+int compactor_compact_incremental(VersionNode root, RetentionPolicy policy,
+                                  const CompactBudget *budget, CompactStats *stats_out) {
+    CompactCursor cursor = compactor_cursor_create(root, policy);
+    if (!cursor) return -1;
+    int ret;
+    while ((ret = compactor_step(cursor, budget)) == 0) sched_yield();
+    if (stats_out) *stats_out = cursor->stats;
+    compactor_cursor_free(cursor);
+    return ret < 0 ? -1 : 0;
+}
+
+int compactor_compact(VersionNode root) {
+    CompactBudget unlimited = {0, 0};
+    return compactor_compact_incremental(root, NULL, &unlimited, NULL) == 0 ? 0 : 1;
+}
+
+int compactor_compact_path(VersionNode root, const char *path) {
+    if (!root || !path || !*path) return 1;
+    CompactCursor cursor = cursor_create_path(root, path, NULL);
+    if (!cursor) return 1;
+    CompactBudget unlimited = {0, 0};
+    int ret;
+    while ((ret = compactor_step(cursor, &unlimited)) == 0) {
+    }
+    if (cursor->missing) ret = -1;
+    compactor_cursor_free(cursor);
+    return ret < 0 ? 1 : 0;
+}
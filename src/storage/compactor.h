@@ -1,11 +1,65 @@
 #ifndef COMPACTOR_H
 #define COMPACTOR_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "version_node.h"
+#include "retention.h"
 
 // Recursively compact the entire database tree,
 // starting at the given root VersionNode
 int compactor_compact(VersionNode root);
+/* Compact the chain at path and, for a subdocument, everything below it.
+ * Returns 1 when path does not exist. */
 int compactor_compact_path(VersionNode root, const char *path);
 
+/* Incremental compaction works through the tree one hash bucket at a time
+ * and stops once a step's budget is spent, releasing every lock; the cursor
+ * resumes where it stopped. History is cut under the Document's read lock
+ * and freed by reclaim.h once no reader can still be walking it; the write
+ * lock is taken only briefly, to unlink dead entries and shrink maps.
+ * Chains keep what the retention policy asks for (only heads when it is
+ * NULL). A limit of 0 means unlimited. */
+typedef struct CompactBudget {
+    size_t max_entries;         /* chains visited per step */
+    uint64_t max_micros;        /* wall time per step */
+} CompactBudget;
+
+#define COMPACT_DEFAULT_ENTRIES 1024
+#define COMPACT_DEFAULT_MICROS  1000
+
+typedef struct CompactStats {
+    uint64_t steps;
+    uint64_t entries;           /* chains visited */
+    uint64_t documents;         /* documents finished */
+    uint64_t versions_freed;    /* history nodes detached */
+    uint64_t bytes_freed;       /* their approximate heap bytes */
+    uint64_t entries_purged;    /* dead fields and empty subdocuments removed */
+    uint64_t max_hold_micros;   /* longest single write-lock hold */
+} CompactStats;
+
+typedef struct CompactCursor *CompactCursor;
+
+CompactCursor compactor_cursor_create(VersionNode root, RetentionPolicy policy);
+/* Only the top-level subdocument key: its chain and everything below it.
+ * The key "" covers the root Document's own fields. */
+CompactCursor compactor_cursor_create_subtree(VersionNode root, const char *key,
+                                              RetentionPolicy policy);
+/* Returns 1 once the whole tree is done, 0 when work remains, -1 on error. */
+int compactor_step(CompactCursor cursor, const CompactBudget *budget);
+const CompactStats *compactor_cursor_stats(CompactCursor cursor);
+void compactor_cursor_free(CompactCursor cursor);
+
+/* Step to completion, yielding the CPU between steps. budget may be NULL
+ * for the defaults; stats_out, when given, receives the totals. */
+int compactor_compact_incremental(VersionNode root, RetentionPolicy policy,
+                                  const CompactBudget *budget, CompactStats *stats_out);
+
+/* Compact the whole tree on up to `workers` threads (0: one per core).
+ * Subtrees are shared out through a work-stealing pool, so a few huge ones
+ * do not leave the other workers idle. Locks are taken per Document and per
+ * default budget, never for the whole run. Returns 0, or -1 on error. */
+int compactor_compact_parallel(VersionNode root, RetentionPolicy policy, size_t workers,
+                               CompactStats *stats_out);
+
 #endif
@@ -8,6 +8,12 @@
 #include "version_node.h"
 #include "document.h"
 #include "hash.h"
+#include "format.h"
+#include "parallel.h"
+#include "snapshot.h"
+#include "packed.h"
+#include "blocks.h"
+#include "checksum.h"
 
 #ifndef be64toh
 #define be64toh(x) (__builtin_bswap64((uint64_t)(x)))
@@ -16,9 +22,6 @@
 #define htobe64(x) (__builtin_bswap64((uint64_t)(x)))
 #endif
 
-#define MAGIC "DBV1"
-static const uint32_t FORMAT_VER = 1;
-
 static int read_be64(FILE *f, uint64_t *out) {
     uint64_t be;
     if (fread(&be, sizeof(be), 1, f) != 1) return -1;
@@ -29,54 +32,282 @@ static int read_be64(FILE *f, uint64_t *out) {
 /* Forward declarations */
 int deserialize_version_node(VersionNode *ver_out, FILE *file);
 int deserialize_document(Document *doc_out, FILE *file);
+static int deserialize_entry(FILE *file, char **key_out, VersionNode *head_out);
+static int deserialize_entries(Hashmap map, FILE *file);
+
+/* Top-level subtrees listed in the segment trailer, decoded by a pool of
+ * workers. Each worker reads the mapped (or decompressed) image through its
+ * own memory stream so seeks never contend. */
+struct segment_load {
+    const unsigned char *image;
+    size_t image_size;
+    uint64_t *offsets;
+    uint64_t *lengths;
+    size_t count;
+    size_t workers;             /* 0: one per core */
+    FILE **files;
+    char **keys;
+    VersionNode *heads;
+};
+
+static int decode_version_node(VersionNode *ver_out, FILE *file,
+                               struct segment_load *load);
+
+static void segment_load_free(struct segment_load *load, size_t workers) {
+    for (size_t i = 0; load->files && i < workers; i++) {
+        if (load->files[i]) fclose(load->files[i]);
+    }
+    for (size_t i = 0; i < load->count; i++) {
+        if (load->keys) free(load->keys[i]);
+        if (load->heads) version_node_free(load->heads[i]);
+    }
+    free(load->files);
+    free(load->keys);
+    free(load->heads);
+    free(load->offsets);
+    free(load->lengths);
+    memset(load, 0, sizeof(*load));
+}
 
-int deserialize_db(const char *filename, VersionNode *root_out) {
-    if (!filename || !root_out) return -1;
-    *root_out = NULL;
+static int read_segment_table(FILE *f, struct segment_load *load) {
+    off_t data_start = ftello(f);
+    if (data_start < 0 || fseeko(f, -8, SEEK_END) != 0) return -1;
+    off_t trailer = ftello(f);
+    uint64_t table_offset, count;
+    if (trailer < 0 || read_be64(f, &table_offset) != 0) return -1;
+    if (table_offset < (uint64_t)data_start || table_offset >= (uint64_t)trailer) return -1;
+    if (fseeko(f, (off_t)table_offset, SEEK_SET) != 0) return -1;
+    if (read_be64(f, &count) != 0) return -1;
+    if (count > ((uint64_t)trailer - table_offset) / 16) return -1;
+
+    load->count = (size_t)count;
+    load->offsets = calloc(load->count ? load->count : 1, sizeof(*load->offsets));
+    load->lengths = calloc(load->count ? load->count : 1, sizeof(*load->lengths));
+    if (!load->offsets || !load->lengths) return -1;
+    for (size_t i = 0; i < load->count; i++) {
+        if (read_be64(f, &load->offsets[i]) != 0) return -1;
+        if (read_be64(f, &load->lengths[i]) != 0) return -1;
+        if (load->offsets[i] < (uint64_t)data_start ||
+            load->lengths[i] > table_offset - load->offsets[i]) return -1;
+    }
+    return fseeko(f, data_start, SEEK_SET);
+}
 
-    FILE *f = fopen(filename, "rb");
-    if (!f) return -1;
+static FILE *segment_open(const struct segment_load *load) {
+    return fmemopen((void *)load->image, load->image_size, "rb");
+}
 
-    char magic[4];
-    uint32_t be32;
+static int load_segment(void *ctx, size_t worker, size_t index) {
+    struct segment_load *load = ctx;
+    FILE *f = load->files[worker];
+    if (!f) {
+        f = segment_open(load);
+        if (!f) return -1;
+        load->files[worker] = f;
+    }
+    if (fseeko(f, (off_t)load->offsets[index], SEEK_SET) != 0) return -1;
+    if (deserialize_entry(f, &load->keys[index], &load->heads[index]) != 0) return -1;
+    off_t end = ftello(f);
+    return end >= 0 && (uint64_t)end == load->offsets[index] + load->lengths[index] ? 0 : -1;
+}
+
+/* Decode the head root Document: fields inline, subdocument entries from the
+ * segment table in parallel, then attach them in file order. */
+static int deserialize_root_document(Document *doc_out, FILE *file,
+                                     struct segment_load *load) {
+    *doc_out = document_create();
+    if (!*doc_out) return -1;
+    Document doc = *doc_out;
+
+    size_t workers = load->workers ? load->workers : parallel_default_workers();
+    if (workers > load->count) workers = load->count;
+    uint64_t sub_count;
+    if (deserialize_entries(doc->fields, file) != 0) goto fail;
+    if (read_be64(file, &sub_count) != 0 || sub_count != load->count) goto fail;
+    if (load->count == 0) return 0;
+
+    load->files = calloc(workers, sizeof(*load->files));
+    load->keys = calloc(load->count, sizeof(*load->keys));
+    load->heads = calloc(load->count, sizeof(*load->heads));
+    if (!load->files || !load->keys || !load->heads) goto fail;
+    if (parallel_for(load->count, workers, load_segment, load) != 0) goto fail;
+
+    for (size_t i = 0; i < load->count; i++) {
+        if (hashmap_set_raw(doc->subdocuments, load->keys[i], load->heads[i]) != 0) goto fail;
+        load->heads[i] = NULL;
+    }
+
+    /* Continue the main stream after the last segment. */
+    uint64_t end = load->offsets[load->count - 1] + load->lengths[load->count - 1];
+    if (fseeko(file, (off_t)end, SEEK_SET) != 0) goto fail;
+    segment_load_free(load, workers);
+    return 0;
 
-    if (fread(magic, 1, 4, f) != 4) goto fail;
-    if (memcmp(magic, MAGIC, 4) != 0) goto fail;
+fail:
+    segment_load_free(load, workers);
+    document_free(doc);
+    *doc_out = NULL;
+    return -1;
+}
+
+/* Format v2 is mapped rather than read; Documents decode on first access. */
+static int deserialize_db_v2(const char *filename, VersionNode *root_out) {
+    Snapshot snap = NULL;
+    if (snapshot_open(filename, &snap) != 0) return -1;
+    int ret = snapshot_load_root(snap, root_out);
+    snapshot_release(snap);
+    return ret;
+}
+
+/* Format v1 after its magic. Consumes load. */
+static int deserialize_stream(FILE *f, struct segment_load *load, VersionNode *root_out) {
+    VersionNode head = NULL;
+    VersionNode tail = NULL;
+    uint32_t be32, flags;
 
     if (fread(&be32, sizeof(be32), 1, f) != 1) goto fail;
     if (ntohl(be32) != FORMAT_VER) goto fail;
 
-    if (fread(&be32, sizeof(be32), 1, f) != 1) goto fail; // reserved
+    if (fread(&be32, sizeof(be32), 1, f) != 1) goto fail;
+    flags = ntohl(be32);
 
     uint64_t ver_count;
     if (read_be64(f, &ver_count) != 0) goto fail;
-
-    VersionNode head = NULL;
-    VersionNode tail = NULL;
+    int segmented = (flags & SNAPSHOT_FLAG_SEGMENTS) && ver_count > 0;
+    if (segmented && read_segment_table(f, load) != 0) goto fail;
 
     for (uint64_t i = 0; i < ver_count; i++) {
         VersionNode ver = NULL;
-        if (deserialize_version_node(&ver, f) != 0) goto fail;
+        if (i == 0 && segmented) {
+            if (decode_version_node(&ver, f, load) != 0) goto fail;
+        } else if (deserialize_version_node(&ver, f) != 0) {
+            goto fail;
+        }
         ver->prev = NULL;
 
         if (!head) head = tail = ver;
         else { tail->prev = ver; tail = ver; }
     }
 
-    fclose(f);
+    segment_load_free(load, 0);
     *root_out = head;
     return 0;
 
 fail:
-    if (f) fclose(f);
+    segment_load_free(load, 0);
     version_node_free(head);
     *root_out = NULL;
     return -1;
 }
 
-/* Deserialize a VersionNode */
-int deserialize_version_node(VersionNode *ver_out, FILE *file) {
-    if (!ver_out || !file) return -1;
+/* Format v1 is verified in full, then read from the mapping through memory
+ * streams. */
+static int deserialize_db_v1(const char *filename, size_t workers, VersionNode *root_out) {
+    FileImage img = NULL;
+    if (file_image_open(filename, &img) != 0) return -1;
+    int ret = -1;
+    if (file_image_verify_all(img) == 0) {
+        struct segment_load load = {.image = img->data, .image_size = img->size,
+                                    .workers = workers};
+        FILE *f = segment_open(&load);
+        if (f && fseeko(f, 4, SEEK_SET) == 0) ret = deserialize_stream(f, &load, root_out);
+        if (f) fclose(f);
+    }
+    file_image_close(img);
+    return ret;
+}
+
+/* A block container. A v2 image stays lazy and decompresses on access; the
+ * stream formats are decompressed up front, in parallel, and decoded from
+ * memory. */
+static int deserialize_db_blocks(const char *filename, size_t workers, VersionNode *root_out) {
+    BlockImage img = NULL;
+    if (blocks_open(filename, &img) != 0) return -1;
+    const unsigned char *magic = blocks_range(img, 0, 4);
+    int ret = -1;
+    if (!magic) goto done;
+    if (memcmp(magic, MAGIC_V2, 4) == 0) {
+        blocks_close(img);
+        return deserialize_db_v2(filename, root_out);
+    }
+    if (blocks_load_all(img) != 0) goto done;
+    if (memcmp(magic, MAGIC_V3, 4) == 0) {
+        ret = packed_load_image(img->data, img->size, root_out);
+    } else if (memcmp(magic, MAGIC, 4) == 0) {
+        struct segment_load load = {.image = img->data, .image_size = img->size,
+                                    .workers = workers};
+        FILE *f = segment_open(&load);
+        if (f && fseeko(f, 4, SEEK_SET) == 0) ret = deserialize_stream(f, &load, root_out);
+        if (f) fclose(f);
+    }
+
+done:
+    blocks_close(img);
+    return ret;
+}
+
+/* The magic of the image in filename, looking inside a block container. */
+static int read_magic(const char *filename, char magic[4], int *in_blocks) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return -1;
+    size_t n = fread(magic, 1, 4, f);
+    fclose(f);
+    if (n != 4) return -1;
+    *in_blocks = memcmp(magic, MAGIC_BLOCKS, 4) == 0;
+    if (!*in_blocks) return 0;
+
+    BlockImage img = NULL;
+    if (blocks_open(filename, &img) != 0) return -1;
+    const unsigned char *inner = blocks_range(img, 0, 4);
+    if (inner) memcpy(magic, inner, 4);
+    blocks_close(img);
+    return inner ? 0 : -1;
+}
+
+int deserialize_db(const char *filename, VersionNode *root_out) {
+    return deserialize_db_with_workers(filename, 0, root_out);
+}
+
+int deserialize_db_with_workers(const char *filename, size_t workers, VersionNode *root_out) {
+    if (!filename || !root_out) return -1;
+    *root_out = NULL;
+
+    char magic[4];
+    int in_blocks;
+    if (read_magic(filename, magic, &in_blocks) != 0) return -1;
+    if (in_blocks) return deserialize_db_blocks(filename, workers, root_out);
+    if (memcmp(magic, MAGIC, 4) == 0) return deserialize_db_v1(filename, workers, root_out);
+    if (memcmp(magic, MAGIC_V2, 4) == 0) return deserialize_db_v2(filename, root_out);
+    if (memcmp(magic, MAGIC_V3, 4) == 0) return packed_load(filename, root_out);
+    return -1;
+}
+
+int deserialize_subtree(const char *filename, const char *path, Document *doc_out) {
+    if (!filename || !path || !doc_out) return -1;
+    *doc_out = NULL;
+
+    char magic[4];
+    int in_blocks;
+    if (read_magic(filename, magic, &in_blocks) != 0) return -1;
+    if (memcmp(magic, MAGIC_V2, 4) == 0) {
+        Snapshot snap = NULL;
+        if (snapshot_open(filename, &snap) != 0) return -1;
+        int ret = snapshot_get_subdocument(snap, path, doc_out);
+        snapshot_release(snap);
+        return ret;
+    }
+
+    VersionNode root = NULL;
+    if (deserialize_db(filename, &root) != 0 || !root) return -1;
+    *doc_out = document_get_subdocument_path((Document)root->value, path);
+    version_node_free(root);
+    return *doc_out ? 0 : -1;
+}
+
+/* Deserialize a VersionNode. A non-NULL load decodes a Document payload as
+ * the segmented head root. */
+static int decode_version_node(VersionNode *ver_out, FILE *file,
+                               struct segment_load *load) {
     *ver_out = NULL;
 
     uint64_t global_version, local_version;
@@ -89,9 +320,12 @@ int deserialize_version_node(VersionNode *ver_out, FILE *file) {
     void *value = NULL;
     void (*free_value)(void *) = NULL;
 
+    Value scalar = {.type = snapshot_value_type(type)};
+    uint64_t bits;
     switch (type) {
         case 0: value = DELETED; free_value = NULL; break;
-        case 1: { // string
+        case SNAPSHOT_TYPE_STRING:
+        case SNAPSHOT_TYPE_BYTES: {
             uint64_t len;
             if (read_be64(file, &len) != 0) return -1;
             if (len == UINT64_MAX || len > SIZE_MAX - 1) return -1;
@@ -99,13 +333,30 @@ int deserialize_version_node(VersionNode *ver_out, FILE *file) {
             if (!str) return -1;
             if (len && fread(str, 1, len, file) != len) { free(str); return -1; }
             str[len] = '\0';
-            value = str;
-            free_value = free;
-            break;
+            *ver_out = version_node_create_buffer(scalar.type, str, len, global_version,
+                                                  local_version, NULL);
+            if (!*ver_out) free(str);
+            return *ver_out ? 0 : -1;
+        }
+        case SNAPSHOT_TYPE_INT64:
+        case SNAPSHOT_TYPE_DOUBLE:
+            if (read_be64(file, &bits) != 0) return -1;
+            if (type == SNAPSHOT_TYPE_INT64) scalar.i = (int64_t)bits;
+            else memcpy(&scalar.d, &bits, sizeof(bits));
+            *ver_out = version_node_create_value(&scalar, global_version, local_version, NULL);
+            return *ver_out ? 0 : -1;
+        case SNAPSHOT_TYPE_BOOL: {
+            uint8_t b;
+            if (fread(&b, sizeof(b), 1, file) != 1 || b > 1) return -1;
+            scalar.b = b;
+            *ver_out = version_node_create_value(&scalar, global_version, local_version, NULL);
+            return *ver_out ? 0 : -1;
         }
         case 2: { // subdocument
             Document doc = NULL;
-            if (deserialize_document(&doc, file) != 0) return -1;
+            int rc = load ? deserialize_root_document(&doc, file, load)
+                          : deserialize_document(&doc, file);
+            if (rc != 0) return -1;
             value = doc;
             free_value = (void(*)(void *))document_free;
             break;
@@ -115,7 +366,6 @@ int deserialize_version_node(VersionNode *ver_out, FILE *file) {
 
     *ver_out = version_node_create(value, global_version, local_version, NULL, free_value);
     if (!*ver_out) {
-        if (type == 1 && value) free(value);
         if (type == 2 && value) document_free((Document)value);
         return -1;
     }
@@ -123,86 +373,71 @@ int deserialize_version_node(VersionNode *ver_out, FILE *file) {
     return 0;
 }
 
-/* Deserialize a Document */
-int deserialize_document(Document *doc_out, FILE *file) {
-    if (!doc_out || !file) return -1;
-    *doc_out = document_create();
-    if (!*doc_out) return -1;
+int deserialize_version_node(VersionNode *ver_out, FILE *file) {
+    if (!ver_out || !file) return -1;
+    return decode_version_node(ver_out, file, NULL);
+}
 
-    uint64_t count;
-    if (read_be64(file, &count) != 0) goto fail;
+/* Deserialize one map entry: key, version count and the chain newest-first. */
+static int deserialize_entry(FILE *file, char **key_out, VersionNode *head_out) {
+    *key_out = NULL;
+    *head_out = NULL;
 
-    // Fields
-    for (uint64_t i = 0; i < count; i++) {
-        uint64_t key_len;
-        if (read_be64(file, &key_len) != 0) goto fail;
-        if (key_len == UINT64_MAX || key_len > SIZE_MAX - 1) goto fail;
-        char *key = malloc(key_len + 1);
-        if (!key) goto fail;
-        if (key_len && fread(key, 1, key_len, file) != key_len) { free(key); goto fail; }
-        key[key_len] = '\0';
-
-        uint64_t ver_count;
-        if (read_be64(file, &ver_count) != 0) { free(key); goto fail; }
-
-        VersionNode head = NULL, tail = NULL;
-        for (uint64_t v = 0; v < ver_count; v++) {
-            VersionNode ver = NULL;
-            if (deserialize_version_node(&ver, file) != 0) {
-                free(key);
-                version_node_free(head);
-                goto fail;
-            }
-            ver->prev = NULL;
-            if (!head) head = tail = ver;
-            else { tail->prev = ver; tail = ver; }
-        }
+    uint64_t key_len;
+    if (read_be64(file, &key_len) != 0) return -1;
+    if (key_len == UINT64_MAX || key_len > SIZE_MAX - 1) return -1;
+    char *key = malloc(key_len + 1);
+    if (!key) return -1;
+    if (key_len && fread(key, 1, key_len, file) != key_len) { free(key); return -1; }
+    key[key_len] = '\0';
 
-        if (hashmap_set_raw((*doc_out)->fields, key, head) != 0) {
+    uint64_t ver_count;
+    if (read_be64(file, &ver_count) != 0) { free(key); return -1; }
+
+    VersionNode head = NULL, tail = NULL;
+    for (uint64_t v = 0; v < ver_count; v++) {
+        VersionNode ver = NULL;
+        if (deserialize_version_node(&ver, file) != 0) {
             free(key);
             version_node_free(head);
-            goto fail;
+            return -1;
         }
-        head = NULL;
-        free(key);
+        ver->prev = NULL;
+        if (!head) head = tail = ver;
+        else { tail->prev = ver; tail = ver; }
     }
 
-    // Subdocuments
-    if (read_be64(file, &count) != 0) goto fail;
-    for (uint64_t i = 0; i < count; i++) {
-        uint64_t key_len;
-        if (read_be64(file, &key_len) != 0) goto fail;
-        if (key_len == UINT64_MAX || key_len > SIZE_MAX - 1) goto fail;
-        char *key = malloc(key_len + 1);
-        if (!key) goto fail;
-        if (key_len && fread(key, 1, key_len, file) != key_len) { free(key); goto fail; }
-        key[key_len] = '\0';
-
-        uint64_t ver_count;
-        if (read_be64(file, &ver_count) != 0) { free(key); goto fail; }
-
-        VersionNode head = NULL, tail = NULL;
-        for (uint64_t v = 0; v < ver_count; v++) {
-            VersionNode ver = NULL;
-            if (deserialize_version_node(&ver, file) != 0) {
-                free(key);
-                version_node_free(head);
-                goto fail;
-            }
-            ver->prev = NULL;
-            if (!head) head = tail = ver;
-            else { tail->prev = ver; tail = ver; }
-        }
+    *key_out = key;
+    *head_out = head;
+    return 0;
+}
 
-        if (hashmap_set_raw((*doc_out)->subdocuments, key, head) != 0) {
+static int deserialize_entries(Hashmap map, FILE *file) {
+    uint64_t count;
+    if (read_be64(file, &count) != 0) return -1;
+    (void)hashmap_reserve(map, count);
+    for (uint64_t i = 0; i < count; i++) {
+        char *key = NULL;
+        VersionNode head = NULL;
+        if (deserialize_entry(file, &key, &head) != 0) return -1;
+        if (hashmap_set_raw(map, key, head) != 0) {
             free(key);
             version_node_free(head);
-            goto fail;
+            return -1;
         }
-        head = NULL;
         free(key);
     }
+    return 0;
+}
+
+/* Deserialize a Document */
+int deserialize_document(Document *doc_out, FILE *file) {
+    if (!doc_out || !file) return -1;
+    *doc_out = document_create();
+    if (!*doc_out) return -1;
 
+    if (deserialize_entries((*doc_out)->fields, file) != 0) goto fail;
+    if (deserialize_entries((*doc_out)->subdocuments, file) != 0) goto fail;
     return 0;
 
 fail:
@@ -15,6 +15,30 @@
  */
 int deserialize_db(const char *filename, VersionNode *root_out);
 
+/**
+ * As deserialize_db, decoding the top-level subtrees of a v1 file on up to
+ * workers threads. deserialize_db passes 0, one per core.
+ *
+ * @param filename Path to the serialized file.
+ * @param workers Threads for the segment table; 0 for one per core.
+ * @param root_out Pointer to a VersionNode* that will be overwritten with the root chain.
+ * @return 0 on success, -1 on failure.
+ */
+int deserialize_db_with_workers(const char *filename, size_t workers, VersionNode *root_out);
+
+/**
+ * Deserialize only the subdocument at path, following the latest versions of
+ * its parents. The subtree keeps its own history. Format v2 finds it through
+ * its key directories and decodes nothing else; stream formats are decoded
+ * in full first.
+ *
+ * @param filename Path to the serialized file.
+ * @param path Slash-separated path of the subdocument.
+ * @param doc_out Set to the retained subdocument; release with document_free().
+ * @return 0 on success, -1 on failure or when path is not a subdocument.
+ */
+int deserialize_subtree(const char *filename, const char *path, Document *doc_out);
+
 /**
  * Deserialize a single VersionNode from a file.
  * 
@@ -0,0 +1,154 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+#include "value.h"
+
+/* On-disk constants shared by the serializer and deserializer.
+ *
+ * Header: MAGIC, u32 FORMAT_VER, u32 flags, u64 root version count, then the
+ * root VersionNode chain. All integers are big-endian.
+ */
+#define MAGIC "DBV1"
+#define FORMAT_VER 1u
+
+/* The head root Document's subdocument entries are indexed by a trailer so
+ * they can be decoded independently:
+ *   u64 segment_count, segment_count * { u64 offset, u64 length },
+ *   u64 table_offset                      <- last 8 bytes of the file
+ * Each segment is one complete subdocument entry (key, version count, chain).
+ * Readers that ignore the flag still see a valid stream. */
+#define SNAPSHOT_FLAG_SEGMENTS 0x1u
+
+/* Format v2 is laid out for mmap: every record is addressed by its absolute
+ * file offset, so a reader can decode any Document without touching the rest
+ * of the file.
+ *
+ * Header (16 bytes): MAGIC_V2, u32 FORMAT_VER_V2, u32 flags, u32 reserved
+ * Records:
+ *   String   u64 length, bytes
+ *   Chain    u64 count, count * { u64 global_version, u64 local_version,
+ *                                 u64 type, u64 payload }
+ *            newest first; payload is a String offset for SNAPSHOT_TYPE_STRING
+ *            and SNAPSHOT_TYPE_BYTES, a Document offset for
+ *            SNAPSHOT_TYPE_DOCUMENT, the value itself for SNAPSHOT_TYPE_INT64
+ *            (two's complement), SNAPSHOT_TYPE_DOUBLE (IEEE 754 bits) and
+ *            SNAPSHOT_TYPE_BOOL (0 or 1), and 0 otherwise
+ *   Document u64 field_count, u64 sub_count,
+ *            (field_count + sub_count) * { u64 key_offset, u64 key_length,
+ *                                          u64 chain_offset }
+ *            fields then subdocuments, each sorted by key bytes
+ * Trailer: u64 offset of the root Chain (last 8 bytes of the file)
+ *
+ * Records are written children first, so every offset a record refers to is
+ * smaller than the record's own offset. Readers rely on this to reject cycles.
+ */
+#define MAGIC_V2 "DBV2"
+#define FORMAT_VER_V2 2u
+#define SNAPSHOT_V2_HEADER_SIZE 16u
+#define SNAPSHOT_V2_VERSION_SIZE 32u
+#define SNAPSHOT_V2_DIRENT_SIZE 24u
+
+/* Version types, shared by every format. In v1 the type is a byte, and a
+ * value's payload follows it: a String as u64 length and bytes, a Document
+ * inline, an int64 or a double's bits as u64, a bool as one byte. */
+#define SNAPSHOT_TYPE_DELETED  0u
+#define SNAPSHOT_TYPE_STRING   1u
+#define SNAPSHOT_TYPE_DOCUMENT 2u
+#define SNAPSHOT_TYPE_INT64    3u
+#define SNAPSHOT_TYPE_DOUBLE   4u
+#define SNAPSHOT_TYPE_BOOL     5u
+#define SNAPSHOT_TYPE_BYTES    6u
+
+/* The version type of a field value of type, and back; anything else maps
+ * to VALUE_NONE and 0. */
+static inline uint64_t snapshot_type_of(ValueType type) {
+    switch (type) {
+        case VALUE_STRING: return SNAPSHOT_TYPE_STRING;
+        case VALUE_BYTES:  return SNAPSHOT_TYPE_BYTES;
+        case VALUE_INT64:  return SNAPSHOT_TYPE_INT64;
+        case VALUE_DOUBLE: return SNAPSHOT_TYPE_DOUBLE;
+        case VALUE_BOOL:   return SNAPSHOT_TYPE_BOOL;
+        default:           return 0;
+    }
+}
+
+static inline ValueType snapshot_value_type(uint64_t type) {
+    switch (type) {
+        case SNAPSHOT_TYPE_STRING: return VALUE_STRING;
+        case SNAPSHOT_TYPE_BYTES:  return VALUE_BYTES;
+        case SNAPSHOT_TYPE_INT64:  return VALUE_INT64;
+        case SNAPSHOT_TYPE_DOUBLE: return VALUE_DOUBLE;
+        case SNAPSHOT_TYPE_BOOL:   return VALUE_BOOL;
+        default:                   return VALUE_NONE;
+    }
+}
+
+/* Format v3 ("packed") is the v1 stream with the metadata squeezed out. All
+ * body integers are unsigned LEB128 varints.
+ *
+ * Header (12 bytes): MAGIC_V3, u32 FORMAT_VER_V3, u32 flags
+ * Body:
+ *   Chain    count, count * { gv, lv, tag, payload } newest first. The first
+ *            gv/lv are absolute; later ones are zigzag(previous - current).
+ *            tag = type | length << 2, where length is the String byte count;
+ *            a String payload is its bytes, a Document payload follows inline.
+ *            The other value types have tag = PACKED_TYPE_OTHER | type << 2:
+ *            an int64 is a zigzag varint, a double its 8 bytes of IEEE 754
+ *            bits little endian, a bool a varint 0 or 1, and bytes a varint
+ *            length and the bytes
+ *   Document field_count, field_count * { key_id, Chain },
+ *            sub_count, sub_count * { key_id, Chain }
+ * Trailer:
+ *   Keys     key_count, key_count * { key_id, shared, suffix_length, suffix }
+ *            sorted by key bytes; each key shares `shared` leading bytes with
+ *            the one before it
+ *   Segments (SNAPSHOT_FLAG_SEGMENTS) count, count * { offset, length } for
+ *            the head root Document's subdocument entries
+ *   u64 big-endian offset of the trailer (last 8 bytes of the file)
+ */
+#define MAGIC_V3 "DBV3"
+#define FORMAT_VER_V3 3u
+#define PACKED_HEADER_SIZE 12u
+#define PACKED_TYPE_OTHER 3u
+
+/* Any of the formats above can be wrapped in a block container. The file
+ * image is cut into fixed-size blocks that are compressed independently
+ * (utils/lz.h), so a reader can decompress just the blocks it touches.
+ *
+ * Header (16 bytes): MAGIC_BLOCKS, u32 BLOCKS_VERSION, u32 block_size,
+ *                    u32 reserved
+ * Blocks: block_count stored blocks, back to back
+ * Index:  block_count * { u64 offset, u32 stored_length, u32 flags }
+ * Trailer (24 bytes): u64 image_size, u64 block_count, u64 index_offset
+ *
+ * Block i holds image bytes [i * block_size, (i + 1) * block_size), the last
+ * one possibly short. BLOCKS_FLAG_RAW marks a block stored uncompressed
+ * because compression did not shrink it.
+ */
+#define MAGIC_BLOCKS "DBZ1"
+#define BLOCKS_VERSION 1u
+#define BLOCKS_HEADER_SIZE 16u
+#define BLOCKS_INDEX_ENTRY_SIZE 16u
+#define BLOCKS_TRAILER_SIZE 24u
+#define BLOCKS_DEFAULT_SIZE (64u * 1024u)
+#define BLOCKS_MIN_SIZE (4u * 1024u)
+#define BLOCKS_MAX_SIZE (16u * 1024u * 1024u)
+#define BLOCKS_FLAG_RAW 0x1u
+
+/* Every file written by serialize_db_with_options ends in a checksum footer
+ * covering the bytes before it (the "image"), whatever its format:
+ *
+ *   u32 crc[chunk_count]   CRC32C of each CHECKSUM_CHUNK_SIZE chunk of the
+ *                          image, the last one possibly short
+ *   u64 image_size, u32 chunk_size,
+ *   u32 table_crc          CRC32C of the crc table and the two fields above
+ *   u32 reserved, MAGIC_CHECKSUM (last 4 bytes of the file)
+ *
+ * Format readers see only the image, so their own trailers still sit at the
+ * end of what they read. Files without the footer load unverified. */
+#define MAGIC_CHECKSUM "FCRC"
+#define CHECKSUM_CHUNK_SIZE (64u * 1024u)
+#define CHECKSUM_FOOTER_SIZE 24u
+
+#endif /* FORMAT_H */
@@ -0,0 +1,642 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h> // htonl, ntohl
+#include <pthread.h>
+
+#include "packed.h"
+#include "checksum.h"
+#include "format.h"
+#include "document.h"
+#include "hash.h"
+#include "parallel.h"
+#include "version_node.h"
+
+#ifndef htobe64
+#define htobe64(x) (__builtin_bswap64((uint64_t)(x)))
+#endif
+#ifndef be64toh
+#define be64toh(x) (__builtin_bswap64((uint64_t)(x)))
+#endif
+
+#define PACKED_BUFFER_SIZE (64u * 1024u)
+#define PACKED_TAG_BITS 2u
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* Writer */
+
+/* Every distinct key gets an id on first use; the table is written sorted
+ * and front-coded in the trailer once all ids are known. */
+struct key_dict {
+    char **keys;
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t *slots;      /* id + 1, 0 marks an empty slot */
+    uint64_t slot_count;  /* power of two */
+};
+
+struct packed_writer {
+    FILE *f;
+    unsigned char buf[PACKED_BUFFER_SIZE];
+    size_t len;
+    uint64_t offset;      /* file offset of buf[0] */
+    struct key_dict dict;
+    uint64_t *seg_offsets;
+    uint64_t *seg_lengths;
+    size_t seg_count;
+    size_t seg_capacity;
+};
+
+static uint64_t key_hash(const char *key) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h = (h ^ *p) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static int dict_grow(struct key_dict *d) {
+    uint64_t slot_count = d->slot_count ? d->slot_count * 2 : 256;
+    uint64_t *slots = calloc(slot_count, sizeof(*slots));
+    if (!slots) return -1;
+    for (uint64_t id = 0; id < d->count; id++) {
+        uint64_t i = key_hash(d->keys[id]) & (slot_count - 1);
+        while (slots[i]) i = (i + 1) & (slot_count - 1);
+        slots[i] = id + 1;
+    }
+    free(d->slots);
+    d->slots = slots;
+    d->slot_count = slot_count;
+    return 0;
+}
+
+static int dict_intern(struct key_dict *d, const char *key, uint64_t *id_out) {
+    if ((d->count + 1) * 2 > d->slot_count && dict_grow(d) != 0) return -1;
+    uint64_t i = key_hash(key) & (d->slot_count - 1);
+    for (; d->slots[i]; i = (i + 1) & (d->slot_count - 1)) {
+        if (strcmp(d->keys[d->slots[i] - 1], key) == 0) {
+            *id_out = d->slots[i] - 1;
+            return 0;
+        }
+    }
+    if (d->count == d->capacity) {
+        uint64_t capacity = d->capacity ? d->capacity * 2 : 128;
+        char **keys = realloc(d->keys, capacity * sizeof(*keys));
+        if (!keys) return -1;
+        d->keys = keys;
+        d->capacity = capacity;
+    }
+    d->keys[d->count] = strdup(key);
+    if (!d->keys[d->count]) return -1;
+    d->slots[i] = d->count + 1;
+    *id_out = d->count++;
+    return 0;
+}
+
+static void dict_free(struct key_dict *d) {
+    for (uint64_t i = 0; i < d->count; i++) free(d->keys[i]);
+    free(d->keys);
+    free(d->slots);
+}
+
+static int pw_flush(struct packed_writer *w) {
+    if (w->len && fwrite(w->buf, 1, w->len, w->f) != w->len) return -1;
+    w->offset += w->len;
+    w->len = 0;
+    return 0;
+}
+
+static int pw_bytes(struct packed_writer *w, const void *data, size_t len) {
+    if (len > sizeof(w->buf) - w->len) {
+        if (pw_flush(w) != 0) return -1;
+        if (len > sizeof(w->buf)) {
+            if (fwrite(data, 1, len, w->f) != len) return -1;
+            w->offset += len;
+            return 0;
+        }
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    return 0;
+}
+
+static int pw_varint(struct packed_writer *w, uint64_t v) {
+    unsigned char tmp[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        tmp[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    tmp[n++] = (unsigned char)v;
+    return pw_bytes(w, tmp, n);
+}
+
+static uint64_t pw_tell(const struct packed_writer *w) {
+    return w->offset + w->len;
+}
+
+static int pw_segment(struct packed_writer *w, uint64_t offset, uint64_t length) {
+    if (w->seg_count == w->seg_capacity) {
+        size_t next = w->seg_capacity ? w->seg_capacity * 2 : 16;
+        uint64_t *offsets = realloc(w->seg_offsets, next * sizeof(*offsets));
+        if (!offsets) return -1;
+        w->seg_offsets = offsets;
+        uint64_t *lengths = realloc(w->seg_lengths, next * sizeof(*lengths));
+        if (!lengths) return -1;
+        w->seg_lengths = lengths;
+        w->seg_capacity = next;
+    }
+    w->seg_offsets[w->seg_count] = offset;
+    w->seg_lengths[w->seg_count] = length;
+    w->seg_count++;
+    return 0;
+}
+
+static int pw_document(struct packed_writer *w, Document doc, int segmented);
+
+/* A value of a type the tag's bits have no room for. */
+static int pw_other(struct packed_writer *w, VersionNode v) {
+    if (pw_varint(w, PACKED_TYPE_OTHER | snapshot_type_of(v->type) << PACKED_TAG_BITS) != 0) {
+        return -1;
+    }
+    switch (v->type) {
+        case VALUE_INT64:
+            return pw_varint(w, zigzag(v->payload.i));
+        case VALUE_BOOL:
+            return pw_varint(w, (uint64_t)v->payload.i);
+        case VALUE_DOUBLE: {
+            uint64_t bits;
+            unsigned char le[8];
+            memcpy(&bits, &v->payload.d, sizeof(bits));
+            for (int i = 0; i < 8; i++) le[i] = (unsigned char)(bits >> (8 * i));
+            return pw_bytes(w, le, sizeof(le));
+        }
+        default:
+            if (pw_varint(w, v->payload.length) != 0) return -1;
+            return pw_bytes(w, v->value, v->payload.length);
+    }
+}
+
+static int pw_versions(struct packed_writer *w, VersionNode *chain, size_t count,
+                       int segmented) {
+    if (pw_varint(w, count) != 0) return -1;
+
+    uint64_t gv = 0, lv = 0;
+    for (size_t i = 0; i < count; i++) {
+        VersionNode v = chain[i];
+        if (i == 0) {
+            if (pw_varint(w, v->global_version) != 0) return -1;
+            if (pw_varint(w, v->local_version) != 0) return -1;
+        } else {
+            if (pw_varint(w, zigzag((int64_t)(gv - v->global_version))) != 0) return -1;
+            if (pw_varint(w, zigzag((int64_t)(lv - v->local_version))) != 0) return -1;
+        }
+        gv = v->global_version;
+        lv = v->local_version;
+
+        if (v->value == DELETED) {
+            if (pw_varint(w, SNAPSHOT_TYPE_DELETED) != 0) return -1;
+        } else if (v->type == VALUE_STRING) {
+            size_t len = v->payload.length;
+            if (pw_varint(w, SNAPSHOT_TYPE_STRING | (uint64_t)len << PACKED_TAG_BITS) != 0) return -1;
+            if (pw_bytes(w, v->value, len) != 0) return -1;
+        } else if (v->type != VALUE_NONE) {
+            if (pw_other(w, v) != 0) return -1;
+        } else {
+            if (pw_varint(w, SNAPSHOT_TYPE_DOCUMENT) != 0) return -1;
+            /* Only the head root version is segmented. */
+            if (pw_document(w, (Document)v->value, segmented && i == 0) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static int pw_chain(struct packed_writer *w, VersionNode head, int segmented) {
+    size_t count = 0;
+    VersionNode *chain = version_node_collect(head, &count);
+    if (!chain) return -1;
+    int ret = pw_versions(w, chain, count, segmented);
+    free(chain);
+    return ret;
+}
+
+static int pw_entries(struct packed_writer *w, Hashmap map, int segmented) {
+    if (pw_varint(w, map->size) != 0) return -1;
+    for (uint64_t i = 0; i < map->bucket_count; i++) {
+        for (Entry e = map->buckets[i]; e; e = e->next) {
+            uint64_t start = pw_tell(w), id;
+            if (dict_intern(&w->dict, e->key, &id) != 0) return -1;
+            if (pw_varint(w, id) != 0) return -1;
+            if (pw_chain(w, (VersionNode)e->value, 0) != 0) return -1;
+            if (segmented && pw_segment(w, start, pw_tell(w) - start) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static int pw_document(struct packed_writer *w, Document doc, int segmented) {
+    if (!doc) return -1;
+    if (document_materialize_history(doc) != 0) return -1;
+    if (pthread_rwlock_rdlock(&doc->lock) != 0) return -1;
+    int ret = -1;
+    if (pw_entries(w, doc->fields, 0) != 0) goto done;
+    if (pw_entries(w, doc->subdocuments, segmented) != 0) goto done;
+    ret = 0;
+done:
+    pthread_rwlock_unlock(&doc->lock);
+    return ret;
+}
+
+struct dict_key {
+    const char *key;
+    uint64_t id;
+};
+
+static int dict_key_cmp(const void *a, const void *b) {
+    return strcmp(((const struct dict_key *)a)->key, ((const struct dict_key *)b)->key);
+}
+
+static int pw_trailer(struct packed_writer *w) {
+    struct key_dict *d = &w->dict;
+    struct dict_key *order = malloc((d->count ? d->count : 1) * sizeof(*order));
+    if (!order) return -1;
+    for (uint64_t i = 0; i < d->count; i++) {
+        order[i].key = d->keys[i];
+        order[i].id = i;
+    }
+    qsort(order, d->count, sizeof(*order), dict_key_cmp);
+
+    uint64_t trailer = pw_tell(w);
+    int ret = -1;
+    if (pw_varint(w, d->count) != 0) goto done;
+    const char *prev = "";
+    for (uint64_t i = 0; i < d->count; i++) {
+        const char *key = order[i].key;
+        size_t shared = 0;
+        while (prev[shared] && prev[shared] == key[shared]) shared++;
+        size_t suffix = strlen(key + shared);
+        if (pw_varint(w, order[i].id) != 0 || pw_varint(w, shared) != 0 ||
+            pw_varint(w, suffix) != 0 || pw_bytes(w, key + shared, suffix) != 0) {
+            goto done;
+        }
+        prev = key;
+    }
+    if (pw_varint(w, w->seg_count) != 0) goto done;
+    for (size_t i = 0; i < w->seg_count; i++) {
+        if (pw_varint(w, w->seg_offsets[i]) != 0) goto done;
+        if (pw_varint(w, w->seg_lengths[i]) != 0) goto done;
+    }
+    uint64_t be = htobe64(trailer);
+    ret = pw_bytes(w, &be, sizeof(be));
+
+done:
+    free(order);
+    return ret;
+}
+
+int packed_write(VersionNode root, FILE *f) {
+    if (!root || !f) return -1;
+    struct packed_writer *w = calloc(1, sizeof(*w));
+    if (!w) return -1;
+    w->f = f;
+
+    int ret = -1;
+    uint32_t header[2] = {htonl(FORMAT_VER_V3), htonl(SNAPSHOT_FLAG_SEGMENTS)};
+    if (pw_bytes(w, MAGIC_V3, 4) != 0 || pw_bytes(w, header, sizeof(header)) != 0) goto done;
+    if (pw_chain(w, root, 1) != 0) goto done;
+    if (pw_trailer(w) != 0) goto done;
+    ret = pw_flush(w);
+
+done:
+    dict_free(&w->dict);
+    free(w->seg_offsets);
+    free(w->seg_lengths);
+    free(w);
+    return ret;
+}
+
+/* Reader: the file is mapped and decoded straight from memory. */
+
+struct packed_reader {
+    const unsigned char *data;
+    size_t size;
+    char **keys;
+    uint64_t key_count;
+    uint64_t body_end;    /* trailer offset */
+};
+
+struct cursor {
+    const unsigned char *p;
+    const unsigned char *end;
+};
+
+static int pr_varint(struct cursor *c, uint64_t *out) {
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (c->p == c->end) return -1;
+        unsigned char b = *c->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Count is bounded by the bytes left, so corrupt input cannot ask for huge
+ * allocations. */
+static int pr_count(struct cursor *c, uint64_t *out) {
+    if (pr_varint(c, out) != 0) return -1;
+    return *out <= (uint64_t)(c->end - c->p) ? 0 : -1;
+}
+
+struct packed_segments;
+static int pr_document(struct packed_reader *r, struct cursor *c, Document *doc_out);
+static int pr_root_document(struct packed_reader *r, struct cursor *c,
+                            struct packed_segments *s, Document *doc_out);
+
+/* The value pw_other wrote, of version type `type`. */
+static int pr_other(struct cursor *c, uint64_t type, uint64_t gv, uint64_t lv,
+                    VersionNode *ver_out) {
+    Value value = {.type = snapshot_value_type(type)};
+    uint64_t n;
+    switch (type) {
+        case SNAPSHOT_TYPE_INT64:
+            if (pr_varint(c, &n) != 0) return -1;
+            value.i = unzigzag(n);
+            break;
+        case SNAPSHOT_TYPE_BOOL:
+            if (pr_varint(c, &n) != 0 || n > 1) return -1;
+            value.b = (int)n;
+            break;
+        case SNAPSHOT_TYPE_DOUBLE: {
+            uint64_t bits = 0;
+            if (c->end - c->p < 8) return -1;
+            for (int i = 0; i < 8; i++) bits |= (uint64_t)c->p[i] << (8 * i);
+            memcpy(&value.d, &bits, sizeof(bits));
+            c->p += 8;
+            break;
+        }
+        case SNAPSHOT_TYPE_BYTES:
+            if (pr_varint(c, &n) != 0 || n > (uint64_t)(c->end - c->p)) return -1;
+            value.data = c->p;
+            value.length = n;
+            c->p += n;
+            break;
+        default:
+            return -1;
+    }
+    *ver_out = version_node_create_value(&value, gv, lv, NULL);
+    return *ver_out ? 0 : -1;
+}
+
+/* Decode record `index` of a chain; gv and lv carry the previous record's
+ * versions. A non-NULL s decodes a Document payload as the segmented head
+ * root. */
+static int pr_record(struct packed_reader *r, struct cursor *c, uint64_t index,
+                     uint64_t *gv, uint64_t *lv, struct packed_segments *s,
+                     VersionNode *ver_out) {
+    uint64_t a, b, tag;
+    if (pr_varint(c, &a) != 0 || pr_varint(c, &b) != 0 || pr_varint(c, &tag) != 0) return -1;
+    *gv = index == 0 ? a : *gv - (uint64_t)unzigzag(a);
+    *lv = index == 0 ? b : *lv - (uint64_t)unzigzag(b);
+
+    void *value;
+    void (*free_value)(void *) = NULL;
+    uint64_t type = tag & ((1u << PACKED_TAG_BITS) - 1);
+    uint64_t len = tag >> PACKED_TAG_BITS;
+    if (type == SNAPSHOT_TYPE_DELETED && len == 0) {
+        value = DELETED;
+    } else if (type == SNAPSHOT_TYPE_STRING) {
+        if (len > (uint64_t)(c->end - c->p)) return -1;
+        char *str = malloc(len + 1);
+        if (!str) return -1;
+        memcpy(str, c->p, len);
+        str[len] = '\0';
+        c->p += len;
+        *ver_out = version_node_create_buffer(VALUE_STRING, str, len, *gv, *lv, NULL);
+        if (!*ver_out) free(str);
+        return *ver_out ? 0 : -1;
+    } else if (type == PACKED_TYPE_OTHER) {
+        return pr_other(c, len, *gv, *lv, ver_out);
+    } else if (type == SNAPSHOT_TYPE_DOCUMENT && len == 0) {
+        Document doc = NULL;
+        int rc = s ? pr_root_document(r, c, s, &doc) : pr_document(r, c, &doc);
+        if (rc != 0) return -1;
+        value = doc;
+        free_value = (void (*)(void *))document_free;
+    } else {
+        return -1;
+    }
+
+    *ver_out = version_node_create(value, *gv, *lv, NULL, free_value);
+    if (!*ver_out) {
+        if (free_value) free_value(value);
+        return -1;
+    }
+    return 0;
+}
+
+static int pr_chain(struct packed_reader *r, struct cursor *c, struct packed_segments *s,
+                    VersionNode *head_out) {
+    *head_out = NULL;
+    uint64_t count;
+    if (pr_count(c, &count) != 0) return -1;
+
+    VersionNode head = NULL, tail = NULL;
+    uint64_t gv = 0, lv = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        VersionNode ver = NULL;
+        if (pr_record(r, c, i, &gv, &lv, i == 0 ? s : NULL, &ver) != 0) {
+            version_node_free(head);
+            return -1;
+        }
+        if (!head) head = tail = ver;
+        else { tail->prev = ver; tail = ver; }
+    }
+    *head_out = head;
+    return 0;
+}
+
+static int pr_entry(struct packed_reader *r, struct cursor *c, const char **key_out,
+                    VersionNode *head_out) {
+    uint64_t id;
+    if (pr_varint(c, &id) != 0 || id >= r->key_count) return -1;
+    *key_out = r->keys[id];
+    return pr_chain(r, c, NULL, head_out);
+}
+
+static int pr_entries(struct packed_reader *r, struct cursor *c, Hashmap map) {
+    uint64_t count;
+    if (pr_count(c, &count) != 0) return -1;
+    (void)hashmap_reserve(map, count);
+    for (uint64_t i = 0; i < count; i++) {
+        const char *key;
+        VersionNode head = NULL;
+        if (pr_entry(r, c, &key, &head) != 0) return -1;
+        if (hashmap_set_raw(map, key, head) != 0) {
+            version_node_free(head);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int pr_document(struct packed_reader *r, struct cursor *c, Document *doc_out) {
+    Document doc = document_create();
+    if (!doc) return -1;
+    if (pr_entries(r, c, doc->fields) != 0 || pr_entries(r, c, doc->subdocuments) != 0) {
+        document_free(doc);
+        return -1;
+    }
+    *doc_out = doc;
+    return 0;
+}
+
+/* Head root subdocument entries decoded on a pool of threads. */
+struct packed_segments {
+    struct packed_reader *r;
+    uint64_t *offsets;
+    uint64_t *lengths;
+    size_t count;
+    const char **keys;
+    VersionNode *heads;
+};
+
+static int pr_segment(void *ctx, size_t worker, size_t index) {
+    (void)worker;
+    struct packed_segments *s = ctx;
+    struct cursor c = {
+        s->r->data + s->offsets[index],
+        s->r->data + s->offsets[index] + s->lengths[index],
+    };
+    if (pr_entry(s->r, &c, &s->keys[index], &s->heads[index]) != 0) return -1;
+    return c.p == c.end ? 0 : -1;
+}
+
+static int pr_root_document(struct packed_reader *r, struct cursor *c,
+                            struct packed_segments *s, Document *doc_out) {
+    Document doc = document_create();
+    if (!doc) return -1;
+    uint64_t sub_count;
+    if (pr_entries(r, c, doc->fields) != 0) goto fail;
+    if (pr_varint(c, &sub_count) != 0 || sub_count != s->count) goto fail;
+    if (s->count > 0) {
+        if (s->offsets[0] != (uint64_t)(c->p - r->data)) goto fail;
+        s->keys = calloc(s->count, sizeof(*s->keys));
+        s->heads = calloc(s->count, sizeof(*s->heads));
+        if (!s->keys || !s->heads) goto fail;
+        if (parallel_for(s->count, 0, pr_segment, s) != 0) goto fail;
+        for (size_t i = 0; i < s->count; i++) {
+            if (hashmap_set_raw(doc->subdocuments, s->keys[i], s->heads[i]) != 0) goto fail;
+            s->heads[i] = NULL;
+        }
+        c->p = r->data + s->offsets[s->count - 1] + s->lengths[s->count - 1];
+    }
+    *doc_out = doc;
+    return 0;
+
+fail:
+    document_free(doc);
+    return -1;
+}
+
+static int pr_trailer(struct packed_reader *r, struct packed_segments *s) {
+    uint64_t be;
+    memcpy(&be, r->data + r->size - 8, sizeof(be));
+    r->body_end = be64toh(be);
+    if (r->body_end < PACKED_HEADER_SIZE || r->body_end > r->size - 8) return -1;
+    struct cursor c = {r->data + r->body_end, r->data + r->size - 8};
+
+    if (pr_count(&c, &r->key_count) != 0) return -1;
+    r->keys = calloc(r->key_count ? r->key_count : 1, sizeof(*r->keys));
+    if (!r->keys) return -1;
+    const char *prev = "";
+    size_t prev_len = 0;
+    for (uint64_t i = 0; i < r->key_count; i++) {
+        uint64_t id, shared, suffix;
+        if (pr_varint(&c, &id) != 0 || id >= r->key_count || r->keys[id]) return -1;
+        if (pr_varint(&c, &shared) != 0 || shared > prev_len) return -1;
+        if (pr_varint(&c, &suffix) != 0 || suffix > (uint64_t)(c.end - c.p)) return -1;
+        char *key = malloc(shared + suffix + 1);
+        if (!key) return -1;
+        memcpy(key, prev, shared);
+        memcpy(key + shared, c.p, suffix);
+        key[shared + suffix] = '\0';
+        c.p += suffix;
+        r->keys[id] = key;
+        prev = key;
+        prev_len = shared + suffix;
+    }
+
+    uint64_t count;
+    if (pr_count(&c, &count) != 0) return -1;
+    s->count = (size_t)count;
+    s->offsets = calloc(count ? count : 1, sizeof(*s->offsets));
+    s->lengths = calloc(count ? count : 1, sizeof(*s->lengths));
+    if (!s->offsets || !s->lengths) return -1;
+    uint64_t next = PACKED_HEADER_SIZE;
+    for (size_t i = 0; i < s->count; i++) {
+        if (pr_varint(&c, &s->offsets[i]) != 0 || pr_varint(&c, &s->lengths[i]) != 0) return -1;
+        /* Segments are back to back, inside the body. */
+        if (s->offsets[i] < next || s->lengths[i] > r->body_end - s->offsets[i]) return -1;
+        if (i > 0 && s->offsets[i] != next) return -1;
+        next = s->offsets[i] + s->lengths[i];
+    }
+    return 0;
+}
+
+int packed_load_image(const unsigned char *data, size_t size, VersionNode *root_out) {
+    if (!data || !root_out) return -1;
+    *root_out = NULL;
+    if (size < PACKED_HEADER_SIZE + 8) return -1;
+
+    struct packed_reader r = {.data = data, .size = size};
+    struct packed_segments s = {.r = &r};
+    int ret = -1;
+    uint32_t header[2];
+    memcpy(header, r.data + 4, sizeof(header));
+    if (memcmp(r.data, MAGIC_V3, 4) != 0 || ntohl(header[0]) != FORMAT_VER_V3) goto done;
+    if (pr_trailer(&r, &s) != 0) goto done;
+    int segmented = (ntohl(header[1]) & SNAPSHOT_FLAG_SEGMENTS) && s.count > 0;
+    struct cursor c = {r.data + PACKED_HEADER_SIZE, r.data + r.body_end};
+    if (pr_chain(&r, &c, segmented ? &s : NULL, root_out) != 0) goto done;
+    if (c.p != c.end) {
+        version_node_free(*root_out);
+        *root_out = NULL;
+        goto done;
+    }
+    ret = 0;
+
+done:
+    for (size_t i = 0; s.heads && i < s.count; i++) version_node_free(s.heads[i]);
+    free(s.heads);
+    free(s.keys);
+    free(s.offsets);
+    free(s.lengths);
+    for (uint64_t i = 0; r.keys && i < r.key_count; i++) free(r.keys[i]);
+    free(r.keys);
+    return ret;
+}
+
+int packed_load(const char *filename, VersionNode *root_out) {
+    if (!filename || !root_out) return -1;
+    *root_out = NULL;
+
+    /* Every byte gets decoded, so check them all up front. */
+    FileImage img = NULL;
+    if (file_image_open(filename, &img) != 0) return -1;
+    int ret = file_image_verify_all(img) == 0
+        ? packed_load_image(img->data, img->size, root_out) : -1;
+    file_image_close(img);
+    return ret;
+}
@@ -0,0 +1,20 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "version_node.h"
+
+/* Format v3: the v1 stream with varint integers and a shared key dictionary
+ * (see format.h). Sequential like v1, including the parallel segment table,
+ * but typically a fraction of the size. */
+
+/* Write the whole root chain to f, header included. Returns 0 on success. */
+int packed_write(VersionNode root, FILE *f);
+
+/* Decode a complete v3 file. Returns 0 on success, -1 on failure. */
+int packed_load(const char *filename, VersionNode *root_out);
+/* As packed_load, from a v3 image already in memory. */
+int packed_load_image(const unsigned char *data, size_t size, VersionNode *root_out);
+
+#endif /* PACKED_H */
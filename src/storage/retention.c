@@ -0,0 +1,193 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "retention.h"
+
+struct retention_entry {
+    char *prefix;               /* no leading or trailing '/' */
+    RetentionRule rule;
+};
+
+/* Few rules are expected, so lookups scan them. The lock lets the shell
+ * change rules while a background compaction reads them. */
+struct RetentionPolicy {
+    pthread_rwlock_t lock;
+    struct retention_entry *entries;
+    size_t count;
+    size_t cap;
+};
+
+RetentionPolicy retention_policy_create(void) {
+    RetentionPolicy policy = calloc(1, sizeof(*policy));
+    if (!policy) return NULL;
+    if (pthread_rwlock_init(&policy->lock, NULL) != 0) {
+        free(policy);
+        return NULL;
+    }
+    return policy;
+}
+
+void retention_policy_free(RetentionPolicy policy) {
+    if (!policy) return;
+    for (size_t i = 0; i < policy->count; i++) free(policy->entries[i].prefix);
+    free(policy->entries);
+    pthread_rwlock_destroy(&policy->lock);
+    free(policy);
+}
+
+static char *normalize_prefix(const char *prefix) {
+    while (*prefix == '/') prefix++;
+    size_t len = strlen(prefix);
+    while (len > 0 && prefix[len - 1] == '/') len--;
+    return strndup(prefix, len);
+}
+
+/* prefix covers path when it is empty, equal, or a whole leading component
+ * run: "audit" covers "audit/x" but not "auditing". */
+static int covers(const char *prefix, const char *path) {
+    size_t len = strlen(prefix);
+    if (len == 0) return 1;
+    return strncmp(prefix, path, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+static int keeps_history(const RetentionRule *rule) {
+    return rule->keep_versions > 1 || rule->keep_after || rule->keep_seconds;
+}
+
+static struct retention_entry *find_locked(RetentionPolicy policy, const char *prefix) {
+    for (size_t i = 0; i < policy->count; i++) {
+        if (strcmp(policy->entries[i].prefix, prefix) == 0) return &policy->entries[i];
+    }
+    return NULL;
+}
+
+static int grow_locked(RetentionPolicy policy) {
+    if (policy->count < policy->cap) return 0;
+    size_t cap = policy->cap ? policy->cap * 2 : 4;
+    struct retention_entry *entries = realloc(policy->entries, cap * sizeof(*entries));
+    if (!entries) return -1;
+    policy->entries = entries;
+    policy->cap = cap;
+    return 0;
+}
+
+int retention_policy_set(RetentionPolicy policy, const char *prefix, const RetentionRule *rule) {
+    if (!policy || !prefix || !rule) return -1;
+    char *key = normalize_prefix(prefix);
+    if (!key) return -1;
+    if (pthread_rwlock_wrlock(&policy->lock) != 0) {
+        free(key);
+        return -1;
+    }
+    int ret = 0;
+    struct retention_entry *entry = find_locked(policy, key);
+    if (entry) {
+        entry->rule = *rule;
+        free(key);
+    } else if (grow_locked(policy) != 0) {
+        free(key);
+        ret = -1;
+    } else {
+        policy->entries[policy->count++] = (struct retention_entry){key, *rule};
+    }
+    pthread_rwlock_unlock(&policy->lock);
+    return ret;
+}
+
+int retention_policy_clear(RetentionPolicy policy, const char *prefix) {
+    if (!policy || !prefix) return -1;
+    char *key = normalize_prefix(prefix);
+    if (!key) return -1;
+    if (pthread_rwlock_wrlock(&policy->lock) != 0) {
+        free(key);
+        return -1;
+    }
+    struct retention_entry *entry = find_locked(policy, key);
+    if (entry) {
+        free(entry->prefix);
+        *entry = policy->entries[--policy->count];
+    }
+    pthread_rwlock_unlock(&policy->lock);
+    free(key);
+    return entry ? 0 : -1;
+}
+
+int retention_policy_match(RetentionPolicy policy, const char *path, RetentionRule *rule_out) {
+    *rule_out = (RetentionRule){.keep_versions = 1};
+    if (!policy || !path) return 0;
+    while (*path == '/') path++;
+    if (pthread_rwlock_rdlock(&policy->lock) != 0) return 0;
+    const struct retention_entry *best = NULL;
+    size_t best_len = 0;
+    for (size_t i = 0; i < policy->count; i++) {
+        const struct retention_entry *e = &policy->entries[i];
+        size_t len = strlen(e->prefix);
+        if (covers(e->prefix, path) && (!best || len > best_len)) {
+            best = e;
+            best_len = len;
+        }
+    }
+    if (best) *rule_out = best->rule;
+    pthread_rwlock_unlock(&policy->lock);
+    return best != NULL;
+}
+
+int retention_policy_keeps_history(RetentionPolicy policy, const char *path) {
+    if (!policy || !path) return 0;
+    while (*path == '/') path++;
+    RetentionRule rule;
+    if (retention_policy_match(policy, path, &rule) && keeps_history(&rule)) return 1;
+    if (pthread_rwlock_rdlock(&policy->lock) != 0) return 1;
+    int found = 0;
+    for (size_t i = 0; i < policy->count && !found; i++) {
+        found = covers(path, policy->entries[i].prefix) && keeps_history(&policy->entries[i].rule);
+    }
+    pthread_rwlock_unlock(&policy->lock);
+    return found;
+}
+
+VersionNode retention_last_kept(const RetentionRule *rule, VersionNode head, uint64_t now) {
+    if (!head || !rule) return head;
+    /* Each limit keeps a newest-first run of the chain, so their union is
+     * a run too and the walk can stop at the first node none of them keeps. */
+    VersionNode last = head;
+    uint64_t position = 1;
+    for (VersionNode v = head->prev; v; v = v->prev) {
+        position++;
+        int keep = position <= rule->keep_versions ||
+                   (rule->keep_after && v->global_version > rule->keep_after) ||
+                   (rule->keep_seconds && now >= v->created && now - v->created < rule->keep_seconds);
+        if (!keep) break;
+        last = v;
+    }
+    return last;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+    const struct retention_entry *x = a, *y = b;
+    size_t lx = strlen(x->prefix), ly = strlen(y->prefix);
+    if (lx != ly) return lx < ly ? -1 : 1;
+    return strcmp(x->prefix, y->prefix);
+}
+
+void retention_policy_print(RetentionPolicy policy, FILE *out) {
+    if (!policy || pthread_rwlock_wrlock(&policy->lock) != 0) return;
+    qsort(policy->entries, policy->count, sizeof(*policy->entries), entry_cmp);
+    if (policy->count == 0) fprintf(out, "No retention rules; compaction keeps only the latest version.\n");
+    for (size_t i = 0; i < policy->count; i++) {
+        const struct retention_entry *e = &policy->entries[i];
+        uint64_t keep = e->rule.keep_versions ? e->rule.keep_versions : 1;
+        fprintf(out, "/%s: keep %llu version%s", e->prefix, (unsigned long long)keep,
+                keep == 1 ? "" : "s");
+        if (e->rule.keep_after) {
+            fprintf(out, ", after global version %llu", (unsigned long long)e->rule.keep_after);
+        }
+        if (e->rule.keep_seconds) {
+            fprintf(out, ", from the last %llu seconds", (unsigned long long)e->rule.keep_seconds);
+        }
+        fputc('\n', out);
+    }
+    pthread_rwlock_unlock(&policy->lock);
+}
@@ -0,0 +1,43 @@
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "version_node.h"
+
+/* How much history compaction keeps. A rule keeps a version when any of its
+ * limits does: it is one of the newest keep_versions, its global_version is
+ * above keep_after, or it was created within keep_seconds. The head always
+ * stays. Rules apply per path prefix and the longest matching prefix wins;
+ * paths no rule covers keep only the head. */
+typedef struct RetentionRule {
+    uint64_t keep_versions;
+    uint64_t keep_after;        /* 0: off */
+    uint64_t keep_seconds;      /* 0: off */
+} RetentionRule;
+
+typedef struct RetentionPolicy *RetentionPolicy;
+
+RetentionPolicy retention_policy_create(void);
+void retention_policy_free(RetentionPolicy policy);
+
+/* Set or replace the rule for prefix. "" (or "/") covers the whole
+ * database. Returns 0 on success, -1 on failure. */
+int retention_policy_set(RetentionPolicy policy, const char *prefix, const RetentionRule *rule);
+/* Remove the rule for prefix. Returns -1 when there was none. */
+int retention_policy_clear(RetentionPolicy policy, const char *prefix);
+
+/* Copy the rule governing path into *rule_out. Returns 1 when a rule
+ * matched, 0 when path keeps only its head. policy may be NULL. */
+int retention_policy_match(RetentionPolicy policy, const char *path, RetentionRule *rule_out);
+/* 1 when some rule for path or anything below it keeps more than heads. */
+int retention_policy_keeps_history(RetentionPolicy policy, const char *path);
+
+/* The oldest node of head's chain that rule keeps; everything after it may
+ * be detached. */
+VersionNode retention_last_kept(const RetentionRule *rule, VersionNode head, uint64_t now);
+
+/* One line per rule, longest prefix last. */
+void retention_policy_print(RetentionPolicy policy, FILE *out);
+
+#endif /* RETENTION_H */
@@ -34,11 +34,19 @@
 #include "version_node.h"
 #include "document.h"
 #include "hash.h"
-
-#define MAGIC "DBV1"
-static const uint32_t FORMAT_VER = 1;
-
-
+#include "format.h"
+#include "packed.h"
+#include "blocks.h"
+#include "reclaim.h"
+#include "checksum.h"
+
+/* Byte ranges of the head root Document's subdocument entries. */
+struct segment_table {
+    uint64_t *offsets;
+    uint64_t *lengths;
+    size_t count;
+    size_t capacity;
+};
 
 /* Helper: write a 64-bit integer in big-endian */
 static int write_be64(FILE *f, uint64_t val) {
@@ -64,14 +72,34 @@ int serialize_version_node(VersionNode ver, FILE *file) {
     if (ver->value == DELETED) {
         uint8_t type = 0;
         if (fwrite(&type, sizeof(type), 1, file) != 1) return -1;
-    } else if (ver->free_value == free) { // string
-        uint8_t type = 1;
+    } else if (ver->type != VALUE_NONE) { // field value
+        Value value;
+        if (version_node_value(ver, &value) != 0) return -1;
+        uint8_t type = (uint8_t)snapshot_type_of(value.type);
         if (fwrite(&type, sizeof(type), 1, file) != 1) return -1;
 
-        char *str = (char*)ver->value;
-        uint64_t len = strlen(str);
-        if (write_be64(file, len) != 0) return -1;
-        if (len && fwrite(str, 1, len, file) != len) return -1;
+        uint64_t bits;
+        switch (value.type) {
+            case VALUE_STRING:
+            case VALUE_BYTES:
+                if (write_be64(file, value.length) != 0) return -1;
+                if (value.length && fwrite(value.data, 1, value.length, file) != value.length) {
+                    return -1;
+                }
+                break;
+            case VALUE_INT64:
+                if (write_be64(file, (uint64_t)value.i) != 0) return -1;
+                break;
+            case VALUE_DOUBLE:
+                memcpy(&bits, &value.d, sizeof(bits));
+                if (write_be64(file, bits) != 0) return -1;
+                break;
+            default: {
+                uint8_t b = (uint8_t)value.b;
+                if (fwrite(&b, sizeof(b), 1, file) != 1) return -1;
+                break;
+            }
+        }
     } else { // subdocument
         uint8_t type = 2;
         if (fwrite(&type, sizeof(type), 1, file) != 1) return -1;
@@ -81,8 +109,44 @@ int serialize_version_node(VersionNode ver, FILE *file) {
     return 0;
 }
 
-/* Serialize a Document */
-static int serialize_document_locked(Document doc, FILE *file) {
+/* Serialize one map entry: key, version count and the chain newest-first. */
+static int serialize_entry(Entry e, FILE *file) {
+    uint64_t key_len = strlen(e->key);
+    if (write_be64(file, key_len) != 0) return -1;
+    if (key_len && fwrite(e->key, 1, key_len, file) != key_len) return -1;
+
+    size_t ver_count = 0;
+    VersionNode *chain = version_node_collect((VersionNode)e->value, &ver_count);
+    if (!chain) return -1;
+    int ret = write_be64(file, ver_count);
+    for (size_t i = 0; ret == 0 && i < ver_count; i++) {
+        ret = serialize_version_node(chain[i], file);
+    }
+    free(chain);
+    return ret;
+}
+
+static int segment_table_add(struct segment_table *t, uint64_t offset, uint64_t length) {
+    if (t->count == t->capacity) {
+        size_t next = t->capacity ? t->capacity * 2 : 16;
+        uint64_t *offsets = realloc(t->offsets, next * sizeof(*offsets));
+        if (!offsets) return -1;
+        t->offsets = offsets;
+        uint64_t *lengths = realloc(t->lengths, next * sizeof(*lengths));
+        if (!lengths) return -1;
+        t->lengths = lengths;
+        t->capacity = next;
+    }
+    t->offsets[t->count] = offset;
+    t->lengths[t->count] = length;
+    t->count++;
+    return 0;
+}
+
+/* Serialize a Document. When segments is non-NULL the byte range of every
+ * subdocument entry is recorded so the loader can decode them in parallel. */
+static int serialize_document_locked(Document doc, FILE *file,
+                                     struct segment_table *segments) {
     if (!doc || !file) return -1;
 
     // 1. Fields
@@ -91,22 +155,7 @@ static int serialize_document_locked(Document doc, FILE *file) {
 
     for (uint64_t i = 0; i < doc->fields->bucket_count; i++) {
         for (Entry e = doc->fields->buckets[i]; e; e = e->next) {
-            char *key = e->key;
-            VersionNode chain = (VersionNode)e->value;
-
-            uint64_t key_len = strlen(key);
-            if (write_be64(file, key_len) != 0) return -1;
-            if (key_len && fwrite(key, 1, key_len, file) != key_len) return -1;
-
-            // Count version nodes in chain
-            size_t ver_count = 0;
-            for (VersionNode v = chain; v; v = v->prev) ver_count++;
-            if (write_be64(file, ver_count) != 0) return -1;
-
-            // Serialize version nodes
-            for (VersionNode v = chain; v; v = v->prev) {
-                if (serialize_version_node(v, file) != 0) return -1;
-            }
+            if (serialize_entry(e, file) != 0) return -1;
         }
     }
 
@@ -116,37 +165,283 @@ static int serialize_document_locked(Document doc, FILE *file) {
 
     for (uint64_t i = 0; i < doc->subdocuments->bucket_count; i++) {
         for (Entry e = doc->subdocuments->buckets[i]; e; e = e->next) {
-            char *key = e->key;
-            VersionNode chain = (VersionNode)e->value;
+            long start = segments ? ftell(file) : 0;
+            if (start < 0) return -1;
+            if (serialize_entry(e, file) != 0) return -1;
+            if (!segments) continue;
+            long end = ftell(file);
+            if (end < start) return -1;
+            if (segment_table_add(segments, (uint64_t)start,
+                                  (uint64_t)(end - start)) != 0) return -1;
+        }
+    }
 
-            uint64_t key_len = strlen(key);
-            if (write_be64(file, key_len) != 0) return -1;
-            if (key_len && fwrite(key, 1, key_len, file) != key_len) return -1;
+    return 0;
+}
 
-            size_t ver_count = 0;
-            for (VersionNode v = chain; v; v = v->prev) ver_count++;
-            if (write_be64(file, ver_count) != 0) return -1;
+int serialize_document(Document doc, FILE *file) {
+    if (!doc || !file) return -1;
+    if (document_materialize_history(doc) != 0) return -1;
+    if (pthread_rwlock_rdlock(&doc->lock) != 0) return -1;
+    reclaim_enter();
+    int ret = serialize_document_locked(doc, file, NULL);
+    reclaim_exit();
+    pthread_rwlock_unlock(&doc->lock);
+    return ret;
+}
 
-            for (VersionNode v = chain; v; v = v->prev) {
-                if (serialize_version_node(v, file) != 0) return -1;
+/* The head root version is written like any other Document VersionNode, but
+ * its subdocument entries are recorded in the segment table. */
+static int serialize_root_head(VersionNode ver, FILE *file,
+                               struct segment_table *segments) {
+    if (ver->value == DELETED || ver->type != VALUE_NONE || !ver->value) {
+        return serialize_version_node(ver, file);
+    }
+    if (write_be64(file, ver->global_version) != 0) return -1;
+    if (write_be64(file, ver->local_version) != 0) return -1;
+    uint8_t type = 2;
+    if (fwrite(&type, sizeof(type), 1, file) != 1) return -1;
+
+    Document doc = (Document)ver->value;
+    if (document_materialize_history(doc) != 0) return -1;
+    if (pthread_rwlock_rdlock(&doc->lock) != 0) return -1;
+    int ret = serialize_document_locked(doc, file, segments);
+    pthread_rwlock_unlock(&doc->lock);
+    return ret;
+}
+
+static int write_segment_table(FILE *file, const struct segment_table *segments) {
+    long table_offset = ftell(file);
+    if (table_offset < 0) return -1;
+    if (write_be64(file, segments->count) != 0) return -1;
+    for (size_t i = 0; i < segments->count; i++) {
+        if (write_be64(file, segments->offsets[i]) != 0) return -1;
+        if (write_be64(file, segments->lengths[i]) != 0) return -1;
+    }
+    return write_be64(file, (uint64_t)table_offset);
+}
+
+/* Format v1: a sequential stream plus the segment trailer. */
+static int write_snapshot_v1(VersionNode root, FILE *f) {
+    struct segment_table segments = {0};
+    VersionNode *versions = NULL;
+    int ret = -1;
+
+    // Magic
+    if (fwrite(MAGIC, 1, 4, f) != 4) goto done;
+
+    // Format version
+    uint32_t be32 = htonl(FORMAT_VER);
+    if (fwrite(&be32, sizeof(be32), 1, f) != 1) goto done;
+
+    // Flags
+    be32 = htonl(SNAPSHOT_FLAG_SEGMENTS);
+    if (fwrite(&be32, sizeof(be32), 1, f) != 1) goto done;
+
+    // Count root versions
+    size_t count = 0;
+    versions = version_node_collect(root, &count);
+    if (!versions || write_be64(f, count) != 0) goto done;
+
+    // Serialize root versions; only the head is segmented
+    if (serialize_root_head(root, f, &segments) != 0) goto done;
+    for (size_t i = 1; i < count; i++) {
+        if (serialize_version_node(versions[i], f) != 0) goto done;
+    }
+    ret = write_segment_table(f, &segments);
+
+done:
+    free(versions);
+    free(segments.offsets);
+    free(segments.lengths);
+    return ret;
+}
+
+/* Format v2: see format.h. Records are emitted children first. */
+struct v2_entry {
+    const char *key;
+    VersionNode chain;
+};
+
+static int v2_tell(FILE *f, uint64_t *out) {
+    off_t pos = ftello(f);
+    if (pos < 0) return -1;
+    *out = (uint64_t)pos;
+    return 0;
+}
+
+static uint64_t v2_type(VersionNode v) {
+    if (v->value == DELETED) return SNAPSHOT_TYPE_DELETED;
+    if (v->type != VALUE_NONE) return snapshot_type_of(v->type);
+    return SNAPSHOT_TYPE_DOCUMENT;
+}
+
+static int v2_entry_cmp(const void *a, const void *b) {
+    return strcmp(((const struct v2_entry *)a)->key, ((const struct v2_entry *)b)->key);
+}
+
+static int v2_write_document(Document doc, FILE *f, uint64_t *offset_out);
+
+static int v2_write_chain(VersionNode head, FILE *f, uint64_t *offset_out) {
+    size_t count = 0;
+    VersionNode *chain = version_node_collect(head, &count);
+    if (!chain) return -1;
+    uint64_t *payloads = calloc(count ? count : 1, sizeof(*payloads));
+    if (!payloads) {
+        free(chain);
+        return -1;
+    }
+
+    int ret = -1;
+    for (size_t i = 0; i < count; i++) {
+        VersionNode v = chain[i];
+        switch (v2_type(v)) {
+            case SNAPSHOT_TYPE_STRING:
+            case SNAPSHOT_TYPE_BYTES: {
+                uint64_t len = v->payload.length;
+                if (v2_tell(f, &payloads[i]) != 0) goto done;
+                if (write_be64(f, len) != 0) goto done;
+                if (len && fwrite(v->value, 1, len, f) != len) goto done;
+                break;
             }
+            /* Scalars need no record: the payload column holds them. */
+            case SNAPSHOT_TYPE_INT64:
+            case SNAPSHOT_TYPE_BOOL:
+                payloads[i] = (uint64_t)v->payload.i;
+                break;
+            case SNAPSHOT_TYPE_DOUBLE:
+                memcpy(&payloads[i], &v->payload.d, sizeof(payloads[i]));
+                break;
+            case SNAPSHOT_TYPE_DOCUMENT:
+                if (v2_write_document((Document)v->value, f, &payloads[i]) != 0) goto done;
+                break;
+            default:
+                break;
         }
     }
 
-    return 0;
+    if (v2_tell(f, offset_out) != 0) goto done;
+    if (write_be64(f, count) != 0) goto done;
+    for (size_t i = 0; i < count; i++) {
+        VersionNode v = chain[i];
+        if (write_be64(f, v->global_version) != 0) goto done;
+        if (write_be64(f, v->local_version) != 0) goto done;
+        if (write_be64(f, v2_type(v)) != 0) goto done;
+        if (write_be64(f, payloads[i]) != 0) goto done;
+    }
+    ret = 0;
+
+done:
+    free(payloads);
+    free(chain);
+    return ret;
 }
 
-int serialize_document(Document doc, FILE *file) {
-    if (!doc || !file) return -1;
+static struct v2_entry *v2_collect(Hashmap map) {
+    struct v2_entry *entries = calloc(map->size ? map->size : 1, sizeof(*entries));
+    if (!entries) return NULL;
+    size_t n = 0;
+    for (uint64_t i = 0; i < map->bucket_count; i++) {
+        for (Entry e = map->buckets[i]; e && n < map->size; e = e->next) {
+            entries[n].key = e->key;
+            entries[n].chain = (VersionNode)e->value;
+            n++;
+        }
+    }
+    qsort(entries, n, sizeof(*entries), v2_entry_cmp);
+    return entries;
+}
+
+static int v2_write_document(Document doc, FILE *f, uint64_t *offset_out) {
+    if (!doc) return -1;
+    if (document_materialize_history(doc) != 0) return -1;
     if (pthread_rwlock_rdlock(&doc->lock) != 0) return -1;
-    int ret = serialize_document_locked(doc, file);
+
+    size_t nfields = doc->fields->size;
+    size_t total = nfields + doc->subdocuments->size;
+    struct v2_entry *fields = v2_collect(doc->fields);
+    struct v2_entry *subs = v2_collect(doc->subdocuments);
+    uint64_t *chains = calloc(total ? total : 1, sizeof(*chains));
+    uint64_t *keys = calloc(total ? total : 1, sizeof(*keys));
+    int ret = -1;
+    if (!fields || !subs || !chains || !keys) goto done;
+
+    for (size_t i = 0; i < total; i++) {
+        struct v2_entry *e = i < nfields ? &fields[i] : &subs[i - nfields];
+        if (v2_write_chain(e->chain, f, &chains[i]) != 0) goto done;
+    }
+    for (size_t i = 0; i < total; i++) {
+        const char *key = i < nfields ? fields[i].key : subs[i - nfields].key;
+        size_t len = strlen(key);
+        if (v2_tell(f, &keys[i]) != 0) goto done;
+        if (len && fwrite(key, 1, len, f) != len) goto done;
+    }
+
+    if (v2_tell(f, offset_out) != 0) goto done;
+    if (write_be64(f, nfields) != 0) goto done;
+    if (write_be64(f, total - nfields) != 0) goto done;
+    for (size_t i = 0; i < total; i++) {
+        const char *key = i < nfields ? fields[i].key : subs[i - nfields].key;
+        if (write_be64(f, keys[i]) != 0) goto done;
+        if (write_be64(f, strlen(key)) != 0) goto done;
+        if (write_be64(f, chains[i]) != 0) goto done;
+    }
+    ret = 0;
+
+done:
     pthread_rwlock_unlock(&doc->lock);
+    free(fields);
+    free(subs);
+    free(chains);
+    free(keys);
+    return ret;
+}
+
+static int write_snapshot_v2(VersionNode root, FILE *f) {
+    if (fwrite(MAGIC_V2, 1, 4, f) != 4) return -1;
+    uint32_t header[3] = {htonl(FORMAT_VER_V2), 0, 0};
+    if (fwrite(header, sizeof(header), 1, f) != 1) return -1;
+
+    uint64_t root_offset;
+    if (v2_write_chain(root, f, &root_offset) != 0) return -1;
+    return write_be64(f, root_offset);
+}
+
+static int write_snapshot(VersionNode root, FILE *f, uint32_t format_version) {
+    if (format_version == FORMAT_VER) return write_snapshot_v1(root, f);
+    if (format_version == FORMAT_VER_V3) return packed_write(root, f);
+    return write_snapshot_v2(root, f);
+}
+
+/* The image is built in memory, then cut into blocks that are compressed in
+ * parallel; only the compressed bytes reach the disk. */
+static int write_compressed(VersionNode root, FILE *f, uint32_t format_version,
+                            uint32_t block_size) {
+    char *image = NULL;
+    size_t size = 0;
+    FILE *mem = open_memstream(&image, &size);
+    if (!mem) return -1;
+    int ret = write_snapshot(root, mem, format_version);
+    if (fclose(mem) != 0) ret = -1;
+    if (ret == 0) ret = blocks_write(f, (const unsigned char *)image, size, block_size);
+    free(image);
     return ret;
 }
 
 /* Serialize DB root */
 int serialize_db(VersionNode root, const char *filename) {
+    return serialize_db_with_options(root, filename, NULL);
+}
+
+int serialize_db_with_options(VersionNode root, const char *filename,
+                              const SerializeOptions *options) {
     if (!root || !filename) return -1;
+    uint32_t format_version = options && options->format_version ? options->format_version
+                                                                  : FORMAT_VER_V2;
+    if (format_version != FORMAT_VER && format_version != FORMAT_VER_V2 &&
+        format_version != FORMAT_VER_V3) {
+        return -1;
+    }
 
     size_t temp_len = strlen(filename) + sizeof(".tmp.XXXXXX");
     char *temp_name = malloc(temp_len);
@@ -169,33 +464,14 @@ int serialize_db(VersionNode root, const char *filename) {
         return -1;
     }
 
-    if (pthread_rwlock_rdlock(&root->lock) != 0) {
-        fclose(f);
-        unlink(temp_name);
-        free(temp_name);
-        return -1;
-    }
-
-    // Magic
-    if (fwrite(MAGIC, 1, 4, f) != 4) goto fail;
-
-    // Format version
-    uint32_t be32 = htonl(FORMAT_VER);
-    if (fwrite(&be32, sizeof(be32), 1, f) != 1) goto fail;
-
-    // Reserved flags
-    be32 = 0;
-    if (fwrite(&be32, sizeof(be32), 1, f) != 1) goto fail;
-
-    // Count root versions
-    size_t count = 0;
-    for (VersionNode v = root; v; v = v->prev) count++;
-    if (write_be64(f, count) != 0) goto fail;
-
-    // Serialize root versions
-    for (VersionNode v = root; v; v = v->prev) {
-        if (serialize_version_node(v, f) != 0) goto fail;
-    }
+    /* History compaction cuts meanwhile, and a tree a load replaces, stay
+     * readable until we are done. */
+    reclaim_enter();
+    int written = options && options->compress
+        ? write_compressed(root, f, format_version, options->block_size)
+        : write_snapshot(root, f, format_version);
+    reclaim_exit();
+    if (written != 0 || checksum_append(f) != 0) goto fail;
 
     if (fflush(f) != 0 || fsync(fileno(f)) != 0) goto fail;
     if (fclose(f) != 0) {
@@ -224,17 +500,14 @@ int serialize_db(VersionNode root, const char *filename) {
     if (dir_fd < 0 || fsync(dir_fd) != 0) {
         if (dir_fd >= 0) close(dir_fd);
         free(temp_name);
-        pthread_rwlock_unlock(&root->lock);
-        return -1;
+            return -1;
     }
     close(dir_fd);
     free(temp_name);
-    pthread_rwlock_unlock(&root->lock);
     return 0;
 
 fail:
     if (f) fclose(f);
-    pthread_rwlock_unlock(&root->lock);
     unlink(temp_name);
     free(temp_name);
     return -1;
@@ -243,6 +516,5 @@ fail_after_close:
     unlink(temp_name);
 fail_after_rename:
     free(temp_name);
-    pthread_rwlock_unlock(&root->lock);
     return -1;
 }
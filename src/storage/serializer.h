@@ -14,10 +14,22 @@ typedef struct Document *Document;
 extern void * const DELETED;
 #endif
 
+/* Snapshot layout written by serialize_db_with_options. */
+typedef struct SerializeOptions {
+    uint32_t format_version;   /* 1: sequential stream, 2: indexed for mmap,
+                                  3: packed stream (varints, key dictionary),
+                                  0: the default (2) */
+    int compress;              /* wrap the image in compressed blocks */
+    uint32_t block_size;       /* bytes per block; 0 picks the default */
+} SerializeOptions;
+
 /* Serialize the entire database root (VersionNode containing Document) to file atomically.
- * Returns 0 on success, -1 on failure.
+ * Writes format v2. Returns 0 on success, -1 on failure.
  */
 int serialize_db(VersionNode root, const char *filename);
+/* As serialize_db; NULL options selects the defaults. */
+int serialize_db_with_options(VersionNode root, const char *filename,
+                              const SerializeOptions *options);
 
 /* Serialize a Document to an open FILE*.
  * Returns 0 on success, -1 on failure.
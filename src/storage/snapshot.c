@@ -0,0 +1,583 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h> // ntohl
+
+#include "snapshot.h"
+#include "blocks.h"
+#include "format.h"
+#include "document.h"
+#include "hash.h"
+#include "version_node.h"
+
+#ifndef be64toh
+#define be64toh(x) (__builtin_bswap64((uint64_t)(x)))
+#endif
+
+/* Per-Document state kept until the Document is fully materialized. */
+struct snapshot_doc {
+    Snapshot snap;
+    uint64_t offset;
+    /* Retained chain heads with older versions still on disk, in directory
+     * order, and the Chain records they came from. */
+    VersionNode *heads;
+    uint64_t *chains;
+    size_t count;
+    size_t nfields;     /* heads[0..nfields) are fields, the rest subdocuments */
+};
+
+static int snapshot_load_entries(Document doc, void *ctx, int *has_history);
+static int snapshot_load_history(Document doc, void *ctx);
+static void snapshot_doc_release(void *ctx);
+
+static const struct DocumentSource snapshot_source = {
+    .load_entries = snapshot_load_entries,
+    .load_history = snapshot_load_history,
+    .release = snapshot_doc_release,
+};
+
+/* Every read of the image goes through here, so a compressed snapshot only
+ * decompresses the blocks a lookup actually covers. */
+static const unsigned char *snap_bytes(Snapshot snap, uint64_t offset, uint64_t len) {
+    if (offset > snap->size || len > snap->size - offset) return NULL;
+    if (snap->blocks) return blocks_range(snap->blocks, offset, len);
+    return file_image_range(snap->file, offset, len);
+}
+
+static int snap_u64(Snapshot snap, uint64_t offset, uint64_t *out) {
+    const unsigned char *p = snap_bytes(snap, offset, sizeof(uint64_t));
+    if (!p) return -1;
+    uint64_t be;
+    memcpy(&be, p, sizeof(be));
+    *out = be64toh(be);
+    return 0;
+}
+
+/* Map a plain file, or open a block container holding a v2 image. Either
+ * way the bytes are verified against the checksum footer as they are read. */
+static int snapshot_map(const char *filename, Snapshot snap) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    char magic[4];
+    if (read(fd, magic, sizeof(magic)) != (ssize_t)sizeof(magic)) {
+        close(fd);
+        return -1;
+    }
+    if (memcmp(magic, MAGIC_BLOCKS, 4) == 0) {
+        close(fd);
+        if (blocks_open(filename, &snap->blocks) != 0) return -1;
+        snap->data = snap->blocks->data;
+        snap->size = snap->blocks->size;
+        return 0;
+    }
+    close(fd);
+    if (file_image_open(filename, &snap->file) != 0) return -1;
+    snap->data = snap->file->data;
+    snap->size = snap->file->size;
+    return 0;
+}
+
+int snapshot_open(const char *filename, Snapshot *snap_out) {
+    if (!filename || !snap_out) return -1;
+    *snap_out = NULL;
+
+    Snapshot snap = calloc(1, sizeof(*snap));
+    if (!snap) return -1;
+    snap->references = 1;
+    if (pthread_mutex_init(&snap->ref_lock, NULL) != 0) {
+        free(snap);
+        return -1;
+    }
+    if (snapshot_map(filename, snap) != 0) {
+        snapshot_release(snap);
+        return -1;
+    }
+
+    const unsigned char *header = snap_bytes(snap, 0, SNAPSHOT_V2_HEADER_SIZE);
+    uint32_t be32 = 0, version = 0;
+    if (header) {
+        memcpy(&be32, header + 4, sizeof(be32));
+        version = ntohl(be32);
+        memcpy(&be32, header + 8, sizeof(be32));
+        snap->flags = ntohl(be32);
+    }
+    if (!header || memcmp(header, MAGIC_V2, 4) != 0 || version != FORMAT_VER_V2 ||
+        snap->size < SNAPSHOT_V2_HEADER_SIZE + 8 ||
+        snap_u64(snap, snap->size - 8, &snap->root_offset) != 0 ||
+        snap->root_offset < SNAPSHOT_V2_HEADER_SIZE || snap->root_offset >= snap->size - 8) {
+        snapshot_release(snap);
+        return -1;
+    }
+
+    *snap_out = snap;
+    return 0;
+}
+
+Snapshot snapshot_retain(Snapshot snap) {
+    if (!snap) return NULL;
+    if (pthread_mutex_lock(&snap->ref_lock) != 0) return NULL;
+    snap->references++;
+    pthread_mutex_unlock(&snap->ref_lock);
+    return snap;
+}
+
+void snapshot_release(Snapshot snap) {
+    if (!snap) return;
+    if (pthread_mutex_lock(&snap->ref_lock) != 0) return;
+    size_t remaining = --snap->references;
+    pthread_mutex_unlock(&snap->ref_lock);
+    if (remaining != 0) return;
+
+    blocks_close(snap->blocks);
+    file_image_close(snap->file);
+    pthread_mutex_destroy(&snap->ref_lock);
+    free(snap);
+}
+
+static Document snapshot_document(Snapshot snap, uint64_t offset, int drop_history) {
+    struct snapshot_doc *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) return NULL;
+    ctx->snap = snapshot_retain(snap);
+    ctx->offset = offset;
+    Document doc = document_create_lazy(&snapshot_source, ctx);
+    if (!doc) {
+        snapshot_doc_release(ctx);
+        return NULL;
+    }
+    /* Not yet shared, so the lock requirement is trivially met. */
+    if (drop_history) document_drop_history_locked(doc);
+    return doc;
+}
+
+/* The field value of type in the version record at `record`, borrowing
+ * a string's or bytes' data from the mapping. */
+static int snapshot_value(Snapshot snap, uint64_t record, uint64_t type, uint64_t payload,
+                          Value *out) {
+    *out = (Value){.type = snapshot_value_type(type)};
+    switch (type) {
+        case SNAPSHOT_TYPE_STRING:
+        case SNAPSHOT_TYPE_BYTES: {
+            uint64_t len;
+            if (payload >= record || snap_u64(snap, payload, &len) != 0) return -1;
+            if (len > record - payload - 8) return -1;
+            out->data = snap_bytes(snap, payload + 8, len);
+            out->length = len;
+            return out->data ? 0 : -1;
+        }
+        case SNAPSHOT_TYPE_INT64:
+            out->i = (int64_t)payload;
+            return 0;
+        case SNAPSHOT_TYPE_DOUBLE:
+            memcpy(&out->d, &payload, sizeof(payload));
+            return 0;
+        case SNAPSHOT_TYPE_BOOL:
+            out->b = payload != 0;
+            return payload <= 1 ? 0 : -1;
+        default:
+            return -1;
+    }
+}
+
+/* Decode the version record at `record`. Payloads must precede the record. */
+static int snapshot_version(Snapshot snap, uint64_t record, int drop_history,
+                            VersionNode *ver_out) {
+    uint64_t global_version, local_version, type, payload;
+    *ver_out = NULL;
+    if (snap_u64(snap, record, &global_version) != 0 ||
+        snap_u64(snap, record + 8, &local_version) != 0 ||
+        snap_u64(snap, record + 16, &type) != 0 ||
+        snap_u64(snap, record + 24, &payload) != 0) {
+        return -1;
+    }
+
+    void *value = NULL;
+    void (*free_value)(void *) = NULL;
+    switch (type) {
+        case SNAPSHOT_TYPE_DELETED:
+            value = DELETED;
+            break;
+        case SNAPSHOT_TYPE_DOCUMENT:
+            if (payload < SNAPSHOT_V2_HEADER_SIZE || payload >= record) return -1;
+            value = snapshot_document(snap, payload, drop_history);
+            if (!value) return -1;
+            free_value = (void (*)(void *))document_free;
+            break;
+        default: {
+            Value field;
+            if (snapshot_value(snap, record, type, payload, &field) != 0) return -1;
+            *ver_out = version_node_create_value(&field, global_version, local_version, NULL);
+            return *ver_out ? 0 : -1;
+        }
+    }
+
+    *ver_out = version_node_create(value, global_version, local_version, NULL, free_value);
+    if (!*ver_out) {
+        if (free_value) free_value(value);
+        return -1;
+    }
+    return 0;
+}
+
+/* Decode versions [first, count) of the Chain at `chain` into a linked list. */
+static int snapshot_chain(Snapshot snap, uint64_t chain, uint64_t first,
+                          int drop_history, VersionNode *head_out) {
+    uint64_t count;
+    *head_out = NULL;
+    if (snap_u64(snap, chain, &count) != 0) return -1;
+    if (count > (snap->size - chain - 8) / SNAPSHOT_V2_VERSION_SIZE) return -1;
+
+    VersionNode head = NULL, tail = NULL;
+    for (uint64_t i = first; i < count; i++) {
+        VersionNode ver = NULL;
+        uint64_t record = chain + 8 + i * SNAPSHOT_V2_VERSION_SIZE;
+        if (snapshot_version(snap, record, drop_history, &ver) != 0) {
+            version_node_free(head);
+            return -1;
+        }
+        if (!head) head = tail = ver;
+        else { tail->prev = ver; tail = ver; }
+    }
+    *head_out = head;
+    return 0;
+}
+
+/* Undo a partial load_entries so a later attempt starts from empty maps. */
+static void snapshot_doc_reset(Document doc, struct snapshot_doc *sd) {
+    for (size_t i = 0; sd->heads && i < sd->count; i++) version_node_release(sd->heads[i]);
+    free(sd->heads);
+    free(sd->chains);
+    sd->heads = NULL;
+    sd->chains = NULL;
+    sd->count = 0;
+
+    Hashmap fields = hashmap_create(doc->fields->bucket_count);
+    Hashmap subs = hashmap_create(doc->subdocuments->bucket_count);
+    if (!fields || !subs) {
+        hashmap_free(fields);
+        hashmap_free(subs);
+        return;
+    }
+    hashmap_free(doc->fields);
+    hashmap_free(doc->subdocuments);
+    doc->fields = fields;
+    doc->subdocuments = subs;
+}
+
+static int snapshot_load_entries(Document doc, void *ctx, int *has_history) {
+    struct snapshot_doc *sd = ctx;
+    Snapshot snap = sd->snap;
+    int drop = (atomic_load(&doc->pending) & DOCUMENT_HISTORY_DROPPED) != 0;
+    uint64_t nfields, nsubs;
+    *has_history = 0;
+
+    if (snap_u64(snap, sd->offset, &nfields) != 0 ||
+        snap_u64(snap, sd->offset + 8, &nsubs) != 0) {
+        return -1;
+    }
+    uint64_t room = (snap->size - sd->offset - 16) / SNAPSHOT_V2_DIRENT_SIZE;
+    if (nfields > room || nsubs > room - nfields) return -1;
+
+    size_t total = (size_t)(nfields + nsubs);
+    if (!drop && total) {
+        sd->heads = calloc(total, sizeof(*sd->heads));
+        sd->chains = calloc(total, sizeof(*sd->chains));
+        if (!sd->heads || !sd->chains) {
+            snapshot_doc_reset(doc, sd);
+            return -1;
+        }
+        sd->count = total;
+        sd->nfields = (size_t)nfields;
+    }
+    (void)hashmap_reserve(doc->fields, nfields);
+    (void)hashmap_reserve(doc->subdocuments, nsubs);
+
+    char *key = NULL;
+    size_t key_cap = 0;
+    for (size_t i = 0; i < total; i++) {
+        uint64_t dirent = sd->offset + 16 + (uint64_t)i * SNAPSHOT_V2_DIRENT_SIZE;
+        uint64_t key_offset, key_len, chain, count;
+        if (snap_u64(snap, dirent, &key_offset) != 0 ||
+            snap_u64(snap, dirent + 8, &key_len) != 0 ||
+            snap_u64(snap, dirent + 16, &chain) != 0 ||
+            key_offset > sd->offset || key_len > sd->offset - key_offset ||
+            chain >= sd->offset || snap_u64(snap, chain, &count) != 0 ||
+            count > (sd->offset - chain - 8) / SNAPSHOT_V2_VERSION_SIZE) {
+            goto fail;
+        }
+        if (count == 0) continue;
+
+        if (key_len + 1 > key_cap) {
+            char *next = realloc(key, key_len + 1);
+            if (!next) goto fail;
+            key = next;
+            key_cap = key_len + 1;
+        }
+        const unsigned char *key_bytes = snap_bytes(snap, key_offset, key_len);
+        if (!key_bytes) goto fail;
+        memcpy(key, key_bytes, key_len);
+        key[key_len] = '\0';
+
+        /* Only the head is decoded here; older versions stay on disk. */
+        VersionNode head = NULL;
+        if (snapshot_version(snap, chain + 8, drop, &head) != 0) goto fail;
+
+        Hashmap map = i < nfields ? doc->fields : doc->subdocuments;
+        if (hashmap_set_raw(map, key, head) != 0) {
+            version_node_free(head);
+            goto fail;
+        }
+        if (count > 1 && !drop) {
+            sd->heads[i] = version_node_retain(head);
+            sd->chains[i] = chain;
+            *has_history = 1;
+        }
+    }
+    free(key);
+    return 0;
+
+fail:
+    free(key);
+    snapshot_doc_reset(doc, sd);
+    return -1;
+}
+
+static int snapshot_load_history(Document doc, void *ctx) {
+    struct snapshot_doc *sd = ctx;
+    VersionNode *older = calloc(sd->count ? sd->count : 1, sizeof(*older));
+    if (!older) return -1;
+
+    /* Decode everything first so a failure leaves the chains untouched. */
+    for (size_t i = 0; i < sd->count; i++) {
+        if (!sd->heads || !sd->heads[i]) continue;
+        if (snapshot_chain(sd->snap, sd->chains[i], 1, 0, &older[i]) != 0) {
+            for (size_t j = 0; j < i; j++) version_node_free(older[j]);
+            free(older);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < sd->count; i++) {
+        if (!older[i]) continue;
+        sd->heads[i]->prev = older[i];
+        hashmap_account_history(i < sd->nfields ? doc->fields : doc->subdocuments, older[i], 1);
+    }
+    free(older);
+    return 0;
+}
+
+static void snapshot_doc_release(void *ctx) {
+    struct snapshot_doc *sd = ctx;
+    if (!sd) return;
+    for (size_t i = 0; sd->heads && i < sd->count; i++) version_node_release(sd->heads[i]);
+    free(sd->heads);
+    free(sd->chains);
+    snapshot_release(sd->snap);
+    free(sd);
+}
+
+int snapshot_load_root(Snapshot snap, VersionNode *root_out) {
+    if (!snap || !root_out) return -1;
+    return snapshot_chain(snap, snap->root_offset, 0, 0, root_out);
+}
+
+/* Cold reads walk the key directories in place; nothing is materialized and
+ * only the records along the requested path are touched. */
+
+/* Binary search one directory of the Document record at doc. */
+static int snapshot_find(Snapshot snap, uint64_t doc, int subdocuments,
+                         const char *key, size_t key_len, uint64_t *chain_out) {
+    uint64_t nfields, nsubs;
+    if (snap_u64(snap, doc, &nfields) != 0 || snap_u64(snap, doc + 8, &nsubs) != 0) return -1;
+    uint64_t room = (snap->size - doc - 16) / SNAPSHOT_V2_DIRENT_SIZE;
+    if (nfields > room || nsubs > room - nfields) return -1;
+
+    uint64_t lo = subdocuments ? nfields : 0;
+    uint64_t hi = subdocuments ? nfields + nsubs : nfields;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        uint64_t dirent = doc + 16 + mid * SNAPSHOT_V2_DIRENT_SIZE;
+        uint64_t entry_offset, entry_len;
+        if (snap_u64(snap, dirent, &entry_offset) != 0 ||
+            snap_u64(snap, dirent + 8, &entry_len) != 0 ||
+            entry_offset > doc || entry_len > doc - entry_offset) {
+            return -1;
+        }
+        size_t n = key_len < entry_len ? key_len : (size_t)entry_len;
+        const unsigned char *entry_key = snap_bytes(snap, entry_offset, n);
+        if (!entry_key) return -1;
+        int cmp = memcmp(key, entry_key, n);
+        if (cmp == 0) cmp = key_len < entry_len ? -1 : (key_len > entry_len ? 1 : 0);
+        if (cmp == 0) {
+            if (snap_u64(snap, dirent + 16, chain_out) != 0 || *chain_out >= doc) return -1;
+            return 0;
+        }
+        if (cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return -1;
+}
+
+/* Pick the version record matching local_version (0 or UINT64_MAX: latest),
+ * following the same rules as hashmap_get. */
+static int snapshot_select(Snapshot snap, uint64_t chain, uint64_t local_version,
+                           uint64_t *record_out) {
+    uint64_t count;
+    if (snap_u64(snap, chain, &count) != 0 || count == 0) return -1;
+    if (count > (snap->size - chain - 8) / SNAPSHOT_V2_VERSION_SIZE) return -1;
+    if (local_version == 0 || local_version == UINT64_MAX) {
+        *record_out = chain + 8;
+        return 0;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t record = chain + 8 + i * SNAPSHOT_V2_VERSION_SIZE, lv;
+        if (snap_u64(snap, record + 8, &lv) != 0) return -1;
+        if (lv < local_version) break;
+        if (lv == local_version) {
+            *record_out = record;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Resolve every component but the last through the latest subdocuments.
+ * *key_out points into path. */
+static int snapshot_resolve(Snapshot snap, const char *path, uint64_t *doc_out,
+                            const char **key_out, size_t *key_len_out) {
+    uint64_t type, doc;
+    if (snap_u64(snap, snap->root_offset + 8 + 16, &type) != 0 ||
+        type != SNAPSHOT_TYPE_DOCUMENT ||
+        snap_u64(snap, snap->root_offset + 8 + 24, &doc) != 0) {
+        return -1;
+    }
+
+    const char *p = path;
+    while (*p == '/') p++;
+    if (!*p) return -1;
+    while (1) {
+        size_t len = strcspn(p, "/");
+        const char *next = p + len;
+        while (*next == '/') next++;
+        if (!*next) {
+            *doc_out = doc;
+            *key_out = p;
+            *key_len_out = len;
+            return 0;
+        }
+        uint64_t chain, record;
+        if (snapshot_find(snap, doc, 1, p, len, &chain) != 0 ||
+            snapshot_select(snap, chain, 0, &record) != 0 ||
+            snap_u64(snap, record + 16, &type) != 0 || type != SNAPSHOT_TYPE_DOCUMENT ||
+            snap_u64(snap, record + 24, &doc) != 0 || doc >= record) {
+            return -1;
+        }
+        p = next;
+    }
+}
+
+static int snapshot_string(Snapshot snap, uint64_t record, char **value_out) {
+    uint64_t type, payload;
+    if (snap_u64(snap, record + 16, &type) != 0 || snap_u64(snap, record + 24, &payload) != 0) {
+        return -1;
+    }
+    if (type == SNAPSHOT_TYPE_DELETED) {
+        *value_out = (char *)DELETED;
+        return 0;
+    }
+    Value field;
+    if (snapshot_value(snap, record, type, payload, &field) != 0) return -1;
+    *value_out = value_format(&field);
+    return *value_out ? 0 : -1;
+}
+
+int snapshot_get_field(Snapshot snap, const char *path, uint64_t local_version,
+                       char **value_out) {
+    if (!snap || !path || !value_out) return -1;
+    *value_out = NULL;
+    uint64_t doc, chain, record;
+    const char *key;
+    size_t key_len;
+    if (snapshot_resolve(snap, path, &doc, &key, &key_len) != 0) return -1;
+    if (snapshot_find(snap, doc, 0, key, key_len, &chain) != 0) return -1;
+    if (snapshot_select(snap, chain, local_version, &record) != 0) return -1;
+    return snapshot_string(snap, record, value_out);
+}
+
+int snapshot_get_value(Snapshot snap, const char *path, uint64_t local_version, Value *out) {
+    if (!snap || !path || !out) return -1;
+    *out = (Value){.type = VALUE_NONE};
+    uint64_t doc, chain, record, type, payload;
+    const char *key;
+    size_t key_len;
+    if (snapshot_resolve(snap, path, &doc, &key, &key_len) != 0 ||
+        snapshot_find(snap, doc, 0, key, key_len, &chain) != 0 ||
+        snapshot_select(snap, chain, local_version, &record) != 0 ||
+        snap_u64(snap, record + 16, &type) != 0 || snap_u64(snap, record + 24, &payload) != 0) {
+        return 1;
+    }
+    if (type == SNAPSHOT_TYPE_DELETED) return 1;
+    Value field;
+    if (snapshot_value(snap, record, type, payload, &field) != 0) return -1;
+    *out = field;
+    if (field.type == VALUE_STRING || field.type == VALUE_BYTES) {
+        char *copy = malloc(field.length + 1);
+        if (!copy) {
+            *out = (Value){.type = VALUE_NONE};
+            return -1;
+        }
+        memcpy(copy, field.data, field.length);
+        copy[field.length] = '\0';
+        out->data = copy;
+    }
+    return 0;
+}
+
+int snapshot_list_versions(Snapshot snap, const char *path, FILE *out) {
+    if (!snap || !path || !out) return -1;
+    uint64_t doc, chain, count;
+    const char *key;
+    size_t key_len;
+    if (snapshot_resolve(snap, path, &doc, &key, &key_len) != 0 ||
+        snapshot_find(snap, doc, 0, key, key_len, &chain) != 0 ||
+        snap_u64(snap, chain, &count) != 0 ||
+        count > (snap->size - chain - 8) / SNAPSHOT_V2_VERSION_SIZE) {
+        fprintf(stderr, "snapshot_list_versions: field not found: %s\n", path);
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t record = chain + 8 + i * SNAPSHOT_V2_VERSION_SIZE, lv;
+        char *value = NULL;
+        if (snap_u64(snap, record + 8, &lv) != 0 ||
+            snapshot_string(snap, record, &value) != 0) {
+            return -1;
+        }
+        if (value == (char *)DELETED) {
+            fprintf(out, "v%llu: <deleted>\n", (unsigned long long)lv);
+        } else {
+            fprintf(out, "v%llu: %s\n", (unsigned long long)lv, value);
+            free(value);
+        }
+    }
+    return 0;
+}
+
+int snapshot_get_subdocument(Snapshot snap, const char *path, Document *doc_out) {
+    if (!snap || !path || !doc_out) return -1;
+    *doc_out = NULL;
+    uint64_t doc, chain, record, type, payload;
+    const char *key;
+    size_t key_len;
+    if (snapshot_resolve(snap, path, &doc, &key, &key_len) != 0 ||
+        snapshot_find(snap, doc, 1, key, key_len, &chain) != 0 ||
+        snapshot_select(snap, chain, 0, &record) != 0 ||
+        snap_u64(snap, record + 16, &type) != 0 || type != SNAPSHOT_TYPE_DOCUMENT ||
+        snap_u64(snap, record + 24, &payload) != 0 ||
+        payload < SNAPSHOT_V2_HEADER_SIZE || payload >= record) {
+        return -1;
+    }
+    *doc_out = snapshot_document(snap, payload, 0);
+    return *doc_out ? 0 : -1;
+}
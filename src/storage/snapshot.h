@@ -0,0 +1,53 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdio.h>
+#include "version_node.h"
+#include "document.h"
+#include "blocks.h"
+
+typedef struct Snapshot *Snapshot;
+
+/* A read-only mapping of a format v2 file (see format.h). Lazily loaded
+ * Documents hold a reference, so the mapping lives until the last of them is
+ * materialized or freed. Bytes are read through file, which checks them
+ * against the file's checksums, or through blocks for a v2 image inside a
+ * block container, which also decompresses on demand. */
+struct Snapshot {
+    const unsigned char *data;
+    size_t size;
+    FileImage file;
+    BlockImage blocks;
+    uint32_t flags;
+    uint64_t root_offset;
+    pthread_mutex_t ref_lock;
+    size_t references;
+};
+
+/* Map filename and validate its header. Returns 0 on success, -1 on failure. */
+int snapshot_open(const char *filename, Snapshot *snap_out);
+Snapshot snapshot_retain(Snapshot snap);
+void snapshot_release(Snapshot snap);
+
+/* Decode the root VersionNode chain. Its Documents are returned
+ * unmaterialized and decode themselves on first access. */
+int snapshot_load_root(Snapshot snap, VersionNode *root_out);
+
+/* Cold reads answer directly from the mapping without building Documents.
+ * Intermediate path components use the latest subdocuments; local_version
+ * selects the field version as document_get_field does. *value_out is a
+ * caller-owned string or DELETED. Returns -1 when the field is absent. */
+int snapshot_get_field(Snapshot snap, const char *path, uint64_t local_version,
+                       char **value_out);
+/* The same field as written, as document_get_value returns it. */
+int snapshot_get_value(Snapshot snap, const char *path, uint64_t local_version, Value *out);
+/* Prints the field's versions to out newest first, like document_list_versions. */
+int snapshot_list_versions(Snapshot snap, const char *path, FILE *out);
+/* The latest subdocument at path, unmaterialized and with its history, found
+ * through the key directories alone. Returns -1 when it is absent. */
+int snapshot_get_subdocument(Snapshot snap, const char *path, Document *doc_out);
+
+#endif /* SNAPSHOT_H */
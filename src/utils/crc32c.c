@@ -0,0 +1,85 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78u   /* reflected Castagnoli polynomial */
+
+static uint32_t table[8][256];
+static int use_hardware;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+        }
+    }
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    use_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        v ^= crc;   /* the low 4 bytes take the running crc */
+        crc = table[7][v & 0xff] ^ table[6][(v >> 8) & 0xff] ^
+              table[5][(v >> 16) & 0xff] ^ table[4][(v >> 24) & 0xff] ^
+              table[3][(v >> 32) & 0xff] ^ table[2][(v >> 40) & 0xff] ^
+              table[1][(v >> 48) & 0xff] ^ table[0][v >> 56];
+    }
+#endif
+    while (len--) crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = crc;
+    while (len && ((uintptr_t)p & 7)) {
+        c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+        len--;
+    }
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = __builtin_ia32_crc32di(c, v);
+    }
+    while (len--) c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+    return (uint32_t)c;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&init_once, crc32c_init);
+    crc = ~crc;
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (use_hardware) return ~crc32c_sse42(crc, data, len);
+#endif
+    return ~crc32c_table(crc, data, len);
+}
+
+uint32_t crc32c_portable(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&init_once, crc32c_init);
+    return ~crc32c_table(~crc, data, len);
+}
+
+int crc32c_hardware(void) {
+    pthread_once(&init_once, crc32c_init);
+    return use_hardware;
+}
@@ -0,0 +1,18 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+ * it and a slicing-by-8 table otherwise; both give identical results.
+ * Chain calls by passing the previous result as crc; start from 0. */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/* The table implementation, whatever the CPU supports. */
+uint32_t crc32c_portable(uint32_t crc, const void *data, size_t len);
+
+/* 1 when the hardware path is in use. */
+int crc32c_hardware(void);
+
+#endif /* CRC32C_H */
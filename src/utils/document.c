@@ -13,6 +13,7 @@
 
 #include "hash.h"
 #include "document.h"
+#include "reclaim.h"
 #include "version_node.h"
 
 #ifndef DELETED
@@ -41,6 +42,7 @@ static int document_reaches(Document current, Document target,
     }
     (*seen)[(*seen_count)++] = current;
 
+    if (document_materialize(current) != 0) return 1;
     if (pthread_rwlock_rdlock(&current->lock) != 0) return 1;
     for (uint64_t i = 0; i < current->subdocuments->bucket_count; i++) {
         for (Entry e = current->subdocuments->buckets[i]; e; e = e->next) {
@@ -91,9 +93,107 @@ Document document_create(void) {
         return NULL;
     }
 
+    doc->source = NULL;
+    doc->source_ctx = NULL;
+    atomic_init(&doc->pending, 0);
     return doc;
 }
 
+Document document_create_lazy(const struct DocumentSource *source, void *ctx) {
+    if (!source || !source->load_entries || !source->load_history) return NULL;
+    Document doc = document_create();
+    if (!doc) return NULL;
+    doc->source = source;
+    doc->source_ctx = ctx;
+    atomic_store(&doc->pending, DOCUMENT_PENDING_ENTRIES | DOCUMENT_PENDING_HISTORY);
+    return doc;
+}
+
+/* Caller holds doc->lock for writing, or has just cleared the last pending
+ * bit under the read lock. */
+static void document_release_source_locked(Document doc) {
+    if (doc->source && doc->source->release) doc->source->release(doc->source_ctx);
+    doc->source = NULL;
+    doc->source_ctx = NULL;
+}
+
+int document_materialize(Document doc) {
+    if (!doc) return -1;
+    if (!(atomic_load_explicit(&doc->pending, memory_order_acquire) &
+          DOCUMENT_PENDING_ENTRIES)) {
+        return 0;
+    }
+    if (pthread_rwlock_wrlock(&doc->lock) != 0) return -1;
+    int rc = 0;
+    unsigned pending = atomic_load(&doc->pending);
+    if (pending & DOCUMENT_PENDING_ENTRIES) {
+        int has_history = 0;
+        rc = doc->source->load_entries(doc, doc->source_ctx, &has_history);
+        if (rc == 0) {
+            unsigned clear = DOCUMENT_PENDING_ENTRIES;
+            if (!has_history || (pending & DOCUMENT_HISTORY_DROPPED)) {
+                clear |= DOCUMENT_PENDING_HISTORY;
+            }
+            pending = atomic_fetch_and(&doc->pending, ~clear) & ~clear;
+            if (!(pending & DOCUMENT_PENDING_HISTORY)) document_release_source_locked(doc);
+        }
+    }
+    pthread_rwlock_unlock(&doc->lock);
+    return rc;
+}
+
+int document_materialize_history(Document doc) {
+    if (document_materialize(doc) != 0) return -1;
+    if (!(atomic_load_explicit(&doc->pending, memory_order_acquire) &
+          DOCUMENT_PENDING_HISTORY)) {
+        return 0;
+    }
+    if (pthread_rwlock_wrlock(&doc->lock) != 0) return -1;
+    int rc = 0;
+    if (atomic_load(&doc->pending) & DOCUMENT_PENDING_HISTORY) {
+        rc = doc->source->load_history(doc, doc->source_ctx);
+        if (rc == 0) {
+            atomic_fetch_and(&doc->pending, ~DOCUMENT_PENDING_HISTORY);
+            document_release_source_locked(doc);
+        }
+    }
+    pthread_rwlock_unlock(&doc->lock);
+    return rc;
+}
+
+void document_drop_history_locked(Document doc) {
+    if (!doc) return;
+    unsigned pending = atomic_fetch_or(&doc->pending, DOCUMENT_HISTORY_DROPPED);
+    if (!(pending & DOCUMENT_PENDING_HISTORY)) return;
+    /* Entries still have to come from the source; they will load as heads. */
+    if (pending & DOCUMENT_PENDING_ENTRIES) return;
+    /* Two compactors may both get here under the read lock; one releases. */
+    pending = atomic_fetch_and(&doc->pending, ~DOCUMENT_PENDING_HISTORY);
+    if (pending & DOCUMENT_PENDING_HISTORY) document_release_source_locked(doc);
+}
+
+int document_shrink_locked(Document doc) {
+    if (!doc) return -1;
+    if (hashmap_shrink(doc->fields, DEFAULT_BUCKET_COUNT) != 0) return -1;
+    return hashmap_shrink(doc->subdocuments, DEFAULT_BUCKET_COUNT);
+}
+
+int document_wants_shrink(Document doc) {
+    return doc && (hashmap_wants_shrink(doc->fields, DEFAULT_BUCKET_COUNT) ||
+                   hashmap_wants_shrink(doc->subdocuments, DEFAULT_BUCKET_COUNT));
+}
+
+int document_is_disposable(Document doc, size_t holders) {
+    if (!doc || (atomic_load(&doc->pending) & DOCUMENT_PENDING_ENTRIES)) return 0;
+    if (pthread_mutex_lock(&doc->lifecycle_lock) != 0) return 0;
+    int unused = doc->references == holders;
+    pthread_mutex_unlock(&doc->lifecycle_lock);
+    if (!unused || pthread_rwlock_rdlock(&doc->lock) != 0) return 0;
+    int empty = doc->fields->size == 0 && doc->subdocuments->size == 0;
+    pthread_rwlock_unlock(&doc->lock);
+    return empty;
+}
+
 Document document_retain(Document doc) {
     if (!doc) return NULL;
     if (pthread_mutex_lock(&doc->lifecycle_lock) != 0) return NULL;
@@ -121,6 +221,7 @@ void document_free(Document doc) {
     }
     pthread_mutex_unlock(&doc->lifecycle_lock);
 
+    if (doc->source && doc->source->release) doc->source->release(doc->source_ctx);
     hashmap_free(doc->fields);       
     hashmap_free(doc->subdocuments); 
     pthread_rwlock_destroy(&doc->lock);
@@ -128,6 +229,27 @@ void document_free(Document doc) {
     free(doc);
 }
 
+Document document_pin_root(VersionNode root) {
+    if (!root) return NULL;
+    reclaim_enter();
+    Document doc = document_retain(__atomic_load_n((Document *)&root->value, __ATOMIC_ACQUIRE));
+    reclaim_exit();
+    return doc;
+}
+
+int document_publish_root(VersionNode root, Document doc) {
+    if (!root || !doc) return -1;
+    VersionNode retired = version_node_create(NULL, 0, 0, NULL, (void (*)(void *))document_free);
+    if (!retired) return -1;
+    retired->value = __atomic_exchange_n((Document *)&root->value, doc, __ATOMIC_ACQ_REL);
+    if (reclaim_retire(retired) != 0) {
+        /* Nowhere to queue it: wait out the readers here instead. */
+        reclaim_barrier();
+        version_node_free(retired);
+    }
+    return 0;
+}
+
 // Path traversal helpers
 int resolve_parent_and_key(Document root,
                                   const char *path,
@@ -145,6 +267,7 @@ int resolve_parent_and_key(Document root,
     char *token = strtok_r(tmp, "/", &saveptr);
     if (!token) { free(tmp); return -1; }
 
+    if (document_materialize(root) != 0) { free(tmp); return -1; }
     Document current = document_retain(root);
     if (!current) { free(tmp); return -1; }
     char *next = NULL;
@@ -173,16 +296,9 @@ int resolve_parent_and_key(Document root,
                 free(tmp);
                 return -1;
             }
-            /* The map now owns its retained reference; release the creator's
-             * reference before keeping the traversal pin below. */
-            document_free(child);
-            /* The version chain now owns the created document. Keep this
-             * traversal reference as a separate pin. */
-            if (!document_retain(child)) {
-                document_free(current);
-                free(tmp);
-                return -1;
-            }
+            /* The map holds its own reference now; the creator's one is kept
+             * as the traversal pin. Dropping it first would let compaction
+             * purge the still-empty document in between. */
         }
         if (!child) {
             /* missing and not creating */
@@ -209,30 +325,24 @@ char *document_get_field(Document doc, const char *key_or_path, uint64_t local_v
 
     if (!parent) { free(final_key); return NULL; }
 
-    if (pthread_rwlock_rdlock(&parent->lock) != 0) {
+    if (local_version != UINT64_MAX && local_version != 0 &&
+        document_materialize_history(parent) != 0) {
         document_free(parent);
         free(final_key);
         return NULL;
     }
-
-    if (local_version == UINT64_MAX) {
-        Entry e = hashmap_find_entry(parent->fields, final_key);
-        char *val = NULL;
-        char *copy = NULL;
-        if (e) {
-            VersionNode head = (VersionNode)e->value;
-            val = head ? (char *)head->value : NULL;
-        }
-        if (val && val != DELETED) copy = strdup(val);
-        pthread_rwlock_unlock(&parent->lock);
+    if (pthread_rwlock_rdlock(&parent->lock) != 0) {
         document_free(parent);
         free(final_key);
-        if (!val || val == DELETED) return val;
-        return copy;
+        return NULL;
     }
 
-    char *val = (char *)hashmap_get(parent->fields, final_key, local_version);
-    char *copy = (val && val != DELETED) ? strdup(val) : NULL;
+    /* Older versions may be cut by compaction while we copy them. */
+    reclaim_enter();
+    VersionNode node = hashmap_get_node(parent->fields, final_key, local_version);
+    void *val = node ? node->value : NULL;
+    char *copy = val && val != DELETED ? version_node_text(node) : NULL;
+    reclaim_exit();
     pthread_rwlock_unlock(&parent->lock);
     document_free(parent);
     free(final_key);
@@ -240,22 +350,193 @@ char *document_get_field(Document doc, const char *key_or_path, uint64_t local_v
     return copy;
 }
 
+int document_get_value(Document doc, const char *path, uint64_t local_version, Value *out) {
+    if (!doc || !path || !out) return -1;
+    *out = (Value){.type = VALUE_NONE};
+
+    Document parent = NULL;
+    char *final_key = NULL;
+    if (resolve_parent_and_key(doc, path, &parent, &final_key, 0, 0) != 0) return 1;
+    int historical = local_version != UINT64_MAX && local_version != 0;
+    if ((historical && document_materialize_history(parent) != 0) ||
+        pthread_rwlock_rdlock(&parent->lock) != 0) {
+        document_free(parent);
+        free(final_key);
+        return -1;
+    }
+
+    reclaim_enter();
+    Value found;
+    int ret = version_node_value(hashmap_get_node(parent->fields, final_key, local_version),
+                                 &found) == 0 ? 0 : 1;
+    if (ret == 0) {
+        *out = found;
+        if (found.type == VALUE_STRING || found.type == VALUE_BYTES) {
+            char *copy = malloc(found.length + 1);
+            if (copy) memcpy(copy, found.data, found.length + 1);
+            else ret = -1;
+            out->data = copy;
+        }
+    }
+    reclaim_exit();
+    pthread_rwlock_unlock(&parent->lock);
+    document_free(parent);
+    free(final_key);
+    if (ret != 0) *out = (Value){.type = VALUE_NONE};
+    return ret;
+}
+
+
+/* One requested path, split into its parent's path and its key. */
+struct field_request {
+    const char *path;
+    size_t parent_len;      /* bytes of path before the key's '/' */
+    const char *key;
+    size_t key_len;
+    size_t index;           /* in the caller's arrays */
+};
+
+/* Parents in byte order, so paths under one parent are adjacent and
+ * neighbouring parents share their leading components. */
+static int compare_parents(const void *a, const void *b) {
+    const struct field_request *x = a, *y = b;
+    size_t n = x->parent_len < y->parent_len ? x->parent_len : y->parent_len;
+    int c = memcmp(x->path, y->path, n);
+    if (c != 0) return c;
+    return (x->parent_len > y->parent_len) - (x->parent_len < y->parent_len);
+}
+
+struct traversal_level {
+    Document doc;           /* retained */
+    const char *name;       /* the component leading here, in some path */
+    size_t name_len;
+};
+
+/* Move the traversal to the parent of req, keeping the levels it shares
+ * with the one before. Returns the parent, or NULL when it does not exist;
+ * *depth is the number of levels below the root that stay usable. */
+static Document descend_to_parent(struct traversal_level *levels, size_t *depth,
+                                  const struct field_request *req, char *scratch) {
+    const char *p = req->path, *end = req->path + req->parent_len;
+    size_t level = 0;
+    while (1) {
+        while (p < end && *p == '/') p++;
+        if (p == end) return levels[level].doc;
+        const char *slash = memchr(p, '/', (size_t)(end - p));
+        size_t len = (size_t)((slash ? slash : end) - p);
+        if (level < *depth && levels[level + 1].name_len == len &&
+            memcmp(levels[level + 1].name, p, len) == 0) {
+            level++;
+            p += len;
+            continue;
+        }
+        while (*depth > level) document_free(levels[(*depth)--].doc);
+        memcpy(scratch, p, len);
+        scratch[len] = '\0';
+        Document child = document_get_subdocument(levels[level].doc, scratch, 0);
+        if (!child) return NULL;
+        levels[++level] = (struct traversal_level){child, p, len};
+        *depth = level;
+        p += len;
+    }
+}
+
+int document_get_fields(Document root, const char *const *paths, size_t count,
+                        uint64_t local_version, char **values_out) {
+    if (!root || (count && (!paths || !values_out))) return -1;
+    for (size_t i = 0; i < count; i++) values_out[i] = NULL;
+    if (count == 0) return 0;
+
+    struct field_request *reqs = malloc(count * sizeof(*reqs));
+    size_t max_len = 0, max_depth = 0;
+    if (!reqs) return -1;
+    for (size_t i = 0; i < count; i++) {
+        const char *path = paths[i] ? paths[i] : "";
+        size_t len = strlen(path), parts = 0;
+        while (len && path[len - 1] == '/') len--;
+        const char *slash = memrchr(path, '/', len);
+        size_t key_start = slash ? (size_t)(slash - path) + 1 : 0;
+        reqs[i] = (struct field_request){path, slash ? (size_t)(slash - path) : 0,
+                                         path + key_start, len - key_start, i};
+        for (size_t j = 0; j < len; j++) parts += path[j] == '/';
+        if (len > max_len) max_len = len;
+        if (parts > max_depth) max_depth = parts;
+    }
+    qsort(reqs, count, sizeof(*reqs), compare_parents);
+
+    char *scratch = malloc(max_len + 1);
+    struct traversal_level *levels = malloc((max_depth + 1) * sizeof(*levels));
+    int historical = local_version != UINT64_MAX && local_version != 0;
+    if (!scratch || !levels || document_materialize(root) != 0 ||
+        !(levels[0].doc = document_retain(root))) {
+        free(scratch);
+        free(levels);
+        free(reqs);
+        return -1;
+    }
+
+    size_t depth = 0;
+    int ret = 0;
+    for (size_t i = 0; i < count && ret == 0;) {
+        size_t group = i + 1;
+        while (group < count && compare_parents(&reqs[i], &reqs[group]) == 0) group++;
+        Document parent = descend_to_parent(levels, &depth, &reqs[i], scratch);
+        if (parent && historical && document_materialize_history(parent) != 0) parent = NULL;
+        if (parent && pthread_rwlock_rdlock(&parent->lock) == 0) {
+            /* One lock for every key under this parent. */
+            reclaim_enter();
+            for (; i < group; i++) {
+                if (reqs[i].key_len == 0) continue;
+                memcpy(scratch, reqs[i].key, reqs[i].key_len);
+                scratch[reqs[i].key_len] = '\0';
+                VersionNode node = hashmap_get_node(parent->fields, scratch, local_version);
+                if (!node || !node->value || node->value == DELETED) continue;
+                if (!(values_out[reqs[i].index] = version_node_text(node))) ret = -1;
+            }
+            reclaim_exit();
+            pthread_rwlock_unlock(&parent->lock);
+        }
+        i = group;
+    }
+
+    while (depth > 0) document_free(levels[depth--].doc);
+    document_free(levels[0].doc);
+    free(scratch);
+    free(levels);
+    free(reqs);
+    if (ret != 0) {
+        for (size_t i = 0; i < count; i++) {
+            free(values_out[i]);
+            values_out[i] = NULL;
+        }
+    }
+    return ret;
+}
 
 // set a string value at key
 int document_set_field(Document doc, const char *key, const char *value, uint64_t global_version) {
+    if (!value) return -1;
+    Value string = {.type = VALUE_STRING, .data = value, .length = strlen(value)};
+    return document_set_value(doc, key, &string, global_version);
+}
+
+int document_set_value(Document doc, const char *key, const Value *value,
+                       uint64_t global_version) {
     if (!doc || !key || !value) return -1;
 
-    char *dup = strdup(value);
-    if (!dup) return -1;
+    if (document_materialize(doc) != 0) return -1;
+    /* Built outside the lock; hashmap_put_node sets its version and prev. */
+    VersionNode node = version_node_create_value(value, global_version, 1, NULL);
+    if (!node) return -1;
 
     if (pthread_rwlock_wrlock(&doc->lock) != 0) {
-        free(dup);
+        version_node_free(node);
         return -1;
     }
-    int rc = hashmap_put(doc->fields, key, dup, global_version, free);
+    int rc = hashmap_put_node(doc->fields, key, node);
     pthread_rwlock_unlock(&doc->lock);
     if (rc != 0) {
-        free(dup);
+        version_node_free(node);
         return -1;
     }
     return 0;
@@ -267,6 +548,13 @@ int document_set_field_cstr(Document doc, const char *key, const char *value, ui
 }
 
 int document_set_field_path(Document root, const char *path, const char *value, uint64_t global_version) {
+    if (!value) return -1;
+    Value string = {.type = VALUE_STRING, .data = value, .length = strlen(value)};
+    return document_set_value_path(root, path, &string, global_version);
+}
+
+int document_set_value_path(Document root, const char *path, const Value *value,
+                            uint64_t global_version) {
     if (!root || !path || !value) return -1;
 
     Document parent = NULL;
@@ -280,7 +568,150 @@ int document_set_field_path(Document root, const char *path, const char *value,
         return -1;
     }
 
-    int rc = document_set_field(parent, final_key, value, global_version);
+    int rc = document_set_value(parent, final_key, value, global_version);
+    document_free(parent);
+    free(final_key);
+    return rc;
+}
+
+/* Run build on the latest version of the field at path and link what it
+ * returns, both under the parent's write lock. */
+static int update_field(Document root, const char *path, HashmapBuildFn build, void *ctx,
+                        uint64_t global_version) {
+    if (!root || !path) return -1;
+
+    Document parent = NULL;
+    char *final_key = NULL;
+    if (resolve_parent_and_key(root, path, &parent, &final_key, 1, global_version) != 0) {
+        return -1;
+    }
+    int rc = -1;
+    if (parent && final_key && document_materialize(parent) == 0 &&
+        pthread_rwlock_wrlock(&parent->lock) == 0) {
+        rc = hashmap_update(parent->fields, final_key, build, ctx);
+        pthread_rwlock_unlock(&parent->lock);
+    }
+    document_free(parent);
+    free(final_key);
+    return rc;
+}
+
+struct incr {
+    VersionNode node;       /* made outside the lock, filled in under it */
+    int64_t delta;
+    int64_t result;         /* the sum, recorded while the lock is held */
+    int mismatch;
+};
+
+static VersionNode incr_build(VersionNode head, void *ctx) {
+    struct incr *op = ctx;
+    int64_t current = 0;
+    if (head && head->value != DELETED) {
+        Value text;
+        if (head->type == VALUE_INT64) {
+            current = head->payload.i;
+        } else if (head->type == VALUE_STRING &&
+                   !memchr(head->value, '\0', head->payload.length) &&
+                   value_parse(VALUE_INT64, head->value, &text) == 0) {
+            current = text.i;
+        } else {
+            op->mismatch = 1;
+            return NULL;
+        }
+    }
+    if ((op->delta > 0 && current > INT64_MAX - op->delta) ||
+        (op->delta < 0 && current < INT64_MIN - op->delta)) {
+        op->mismatch = 1;
+        return NULL;
+    }
+    op->result = current + op->delta;
+    op->node->payload.i = op->result;
+    return op->node;
+}
+
+int document_incr_path(Document root, const char *path, int64_t delta,
+                       uint64_t global_version, int64_t *value_out) {
+    struct incr op = {.delta = delta};
+    op.node = version_node_create_value(&(Value){.type = VALUE_INT64}, global_version, 1, NULL);
+    if (!op.node) return -1;
+    if (update_field(root, path, incr_build, &op, global_version) != 0) {
+        version_node_free(op.node);
+        return op.mismatch ? 1 : -1;
+    }
+    /* op.node is in the tree now, and may be cut and freed at any time. */
+    if (value_out) *value_out = op.result;
+    return 0;
+}
+
+struct append {
+    const void *data;
+    size_t length;
+    uint64_t global_version;
+    size_t total;
+    int mismatch;
+};
+
+static VersionNode append_build(VersionNode head, void *ctx) {
+    struct append *op = ctx;
+    ValueType type = VALUE_STRING;
+    size_t old = 0;
+    if (head && head->value != DELETED) {
+        if (head->type != VALUE_STRING && head->type != VALUE_BYTES) {
+            op->mismatch = 1;
+            return NULL;
+        }
+        type = head->type;
+        old = head->payload.length;
+    }
+    if (op->length >= SIZE_MAX - old) return NULL;
+    char *buf = malloc(old + op->length + 1);
+    if (!buf) return NULL;
+    if (old) memcpy(buf, head->value, old);
+    if (op->length) memcpy(buf + old, op->data, op->length);
+    buf[old + op->length] = '\0';
+    VersionNode node = version_node_create_buffer(type, buf, old + op->length,
+                                                  op->global_version, 1, NULL);
+    if (!node) {
+        free(buf);
+        return NULL;
+    }
+    op->total = old + op->length;
+    return node;
+}
+
+int document_append_path(Document root, const char *path, const void *data, size_t length,
+                         uint64_t global_version, size_t *length_out) {
+    if (length && !data) return -1;
+    struct append op = {.data = data, .length = length, .global_version = global_version};
+    if (update_field(root, path, append_build, &op, global_version) != 0) {
+        return op.mismatch ? 1 : -1;
+    }
+    if (length_out) *length_out = op.total;
+    return 0;
+}
+
+Document document_get_subdocument_path(Document root, const char *path) {
+    if (!root || !path) return NULL;
+
+    Document parent = NULL;
+    char *final_key = NULL;
+    if (resolve_parent_and_key(root, path, &parent, &final_key, 0, 0) != 0) return NULL;
+    Document subdoc = document_get_subdocument(parent, final_key, UINT64_MAX);
+    document_free(parent);
+    free(final_key);
+    return subdoc;
+}
+
+int document_set_subdocument_path(Document root, const char *path, Document subdoc,
+                                  uint64_t global_version) {
+    if (!root || !path || !subdoc) return -1;
+
+    Document parent = NULL;
+    char *final_key = NULL;
+    if (resolve_parent_and_key(root, path, &parent, &final_key, 1, global_version) != 0) {
+        return -1;
+    }
+    int rc = document_set_subdocument(parent, final_key, subdoc, global_version);
     document_free(parent);
     free(final_key);
     return rc;
@@ -288,16 +719,28 @@ int document_set_field_path(Document root, const char *path, const char *value,
 
 Document document_get_subdocument(Document doc, const char *key, uint64_t local_version) {
     if (!doc || !key) return NULL;
+    int historical = local_version != UINT64_MAX && local_version != 0;
+    if ((historical ? document_materialize_history(doc) : document_materialize(doc)) != 0) {
+        return NULL;
+    }
     if (pthread_rwlock_rdlock(&doc->lock) != 0) return NULL;
+    reclaim_enter();
     Document subdoc = (Document)hashmap_get_version(doc->subdocuments, key, local_version);
     if (subdoc == (Document)DELETED) subdoc = NULL;
     if (subdoc) subdoc = document_retain(subdoc);
+    reclaim_exit();
     pthread_rwlock_unlock(&doc->lock);
+    /* Lazily loaded subtrees are decoded on first access. */
+    if (subdoc && document_materialize(subdoc) != 0) {
+        document_free(subdoc);
+        return NULL;
+    }
     return subdoc;
 }
 
 int document_set_subdocument(Document doc, const char *key, Document subdoc, uint64_t global_version) {
     if (!doc || !key || !subdoc || doc == subdoc) return -1;
+    if (document_materialize(doc) != 0) return -1;
     if (pthread_mutex_lock(&topology_lock) != 0) return -1;
     Document *seen = NULL;
     size_t seen_count = 0, seen_capacity = 0;
@@ -369,14 +812,14 @@ int document_delete_path(Document doc, const char *path, uint64_t global_version
 
 /*
  * List versions for a field at `path`.
- * Prints lines like:
+ * Prints lines to `out` like:
  *   v1: <value>
  *   v2: <value>
  *
- * Assumes values are printable C-strings (or DELETED sentinel).
+ * Typed values are printed as value_format writes them.
  */
-int document_list_versions(Document doc, const char *path) {
-    if (!doc || !path) return -1;
+int document_list_versions(Document doc, const char *path, FILE *out) {
+    if (!doc || !path || !out) return -1;
 
     Document parent = NULL;
     char *final_key = NULL;
@@ -387,7 +830,8 @@ int document_list_versions(Document doc, const char *path) {
 
     if (!parent) { free(final_key); return -1; }
 
-    if (pthread_rwlock_rdlock(&parent->lock) != 0) {
+    if (document_materialize_history(parent) != 0 ||
+        pthread_rwlock_rdlock(&parent->lock) != 0) {
         document_free(parent);
         free(final_key);
         return -1;
@@ -403,18 +847,21 @@ int document_list_versions(Document doc, const char *path) {
     }
 
     /* e->value is the head VersionNode for that key (hashmap stores VersionNode chains) */
+    reclaim_enter();
     VersionNode curr = (VersionNode)e->value;
     while (curr) {
         /* print 1-based "v1, v2" numbering and a space after colon to match README/tests */
         if (curr->value == DELETED) {
-            printf("v%llu: <deleted>\n", (unsigned long long)(curr->local_version));
+            fprintf(out, "v%llu: <deleted>\n", (unsigned long long)(curr->local_version));
         } else {
-            char *s = (char *)curr->value;
-            if (s) printf("v%llu: %s\n", (unsigned long long)(curr->local_version), s);
-            else printf("v%llu: <nil>\n", (unsigned long long)(curr->local_version));
+            char *s = version_node_text(curr);
+            if (s) fprintf(out, "v%llu: %s\n", (unsigned long long)(curr->local_version), s);
+            else fprintf(out, "v%llu: <nil>\n", (unsigned long long)(curr->local_version));
+            free(s);
         }
         curr = curr->prev;
     }
+    reclaim_exit();
     pthread_rwlock_unlock(&parent->lock);
     document_free(parent);
 
@@ -430,37 +877,41 @@ char *document_get_path(Document doc, const char *path, uint64_t local_version)
     if (resolve_parent_and_key(doc, path, &parent, &final_key, 0, 0) != 0) return NULL;
     if (!parent) { free(final_key); return NULL; }
 
+    if (local_version != UINT64_MAX && local_version != 0 &&
+        document_materialize_history(parent) != 0) {
+        document_free(parent);
+        free(final_key);
+        return NULL;
+    }
     if (pthread_rwlock_rdlock(&parent->lock) != 0) {
         document_free(parent);
         free(final_key);
         return NULL;
     }
 
-    void *field_val = hashmap_get_version(parent->fields, final_key, local_version);
+    reclaim_enter();
+    VersionNode field = hashmap_get_node(parent->fields, final_key, local_version);
+    void *field_val = field ? field->value : NULL;
+    char *copy = field_val && field_val != DELETED ? version_node_text(field) : NULL;
+    Document sub = field_val ? NULL :
+        (Document)hashmap_get_version(parent->subdocuments, final_key, local_version);
+    if (sub == (Document)DELETED) sub = NULL;
+    if (sub) sub = document_retain(sub);
+    reclaim_exit();
     if (field_val) {
-        char *copy = field_val == DELETED ? NULL : strdup((char *)field_val);
         pthread_rwlock_unlock(&parent->lock);
         document_free(parent);
         free(final_key);
         if (field_val == DELETED) return (char*)1; /* deleted sentinel */
         return copy;
     }
-
-    Document sub = (Document)hashmap_get_version(parent->subdocuments, final_key, local_version);
-    if (!sub || sub == (Document)DELETED) {
-        pthread_rwlock_unlock(&parent->lock);
-        document_free(parent);
-        free(final_key);
-        return NULL;
-    }
-
-    if (!document_retain(sub)) {
+    if (!sub) {
         pthread_rwlock_unlock(&parent->lock);
         document_free(parent);
         free(final_key);
         return NULL;
     }
-    if (pthread_rwlock_rdlock(&sub->lock) != 0) {
+    if (document_materialize(sub) != 0 || pthread_rwlock_rdlock(&sub->lock) != 0) {
         pthread_rwlock_unlock(&parent->lock);
         document_free(sub);
         document_free(parent);
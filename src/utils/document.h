@@ -6,7 +6,9 @@
 #else
 #include <pthread.h>
 #endif
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "hash.h"
 
 #ifndef DELETED
@@ -15,12 +17,30 @@
 
 typedef struct Document *Document;
 
+/* Lazily loaded documents are filled in by their source on first access.
+ * Both callbacks run with doc->lock held for writing. load_entries installs
+ * the head of every chain and reports whether older versions remain;
+ * load_history links those older versions below the installed heads. */
+struct DocumentSource {
+    int (*load_entries)(Document doc, void *ctx, int *has_history);
+    int (*load_history)(Document doc, void *ctx);
+    void (*release)(void *ctx);
+};
+
+#define DOCUMENT_PENDING_ENTRIES  0x1u
+#define DOCUMENT_PENDING_HISTORY  0x2u
+/* History was discarded by compaction before it was loaded. */
+#define DOCUMENT_HISTORY_DROPPED  0x4u
+
 struct Document {
     pthread_rwlock_t lock;
     pthread_mutex_t lifecycle_lock;
     size_t references;
     Hashmap fields;          // char* → Entry(VersionNode(char*))
     Hashmap subdocuments;    // char* → Entry(VersionNode(Document))
+    const struct DocumentSource *source;
+    void *source_ctx;
+    atomic_uint pending;     // DOCUMENT_PENDING_* / DOCUMENT_HISTORY_DROPPED
 };
 
 // Memory management
@@ -29,13 +49,58 @@ Document document_retain(Document doc);
 /* Releases one ownership/reference count held for doc. */
 void document_free(Document doc);
 
+// Lazy materialization
+/* Takes ownership of ctx; source->release is called when it is no longer needed. */
+Document document_create_lazy(const struct DocumentSource *source, void *ctx);
+/* Both must be called without doc->lock held. They are no-ops for documents
+ * that are already materialized. */
+int document_materialize(Document doc);
+int document_materialize_history(Document doc);
+/* Caller holds doc->lock, read or write. Discards history that was never loaded. */
+void document_drop_history_locked(Document doc);
+/* Caller holds doc->lock for writing. Gives back bucket space after removals. */
+int document_shrink_locked(Document doc);
+/* 1 when document_shrink_locked would rehash; caller holds doc->lock. */
+int document_wants_shrink(Document doc);
+/* 1 when doc is loaded, has no entries and exactly holders references, so
+ * no reader or writer can be using it. The caller must hold the write lock
+ * of the Document linking to it, so no new reference can be taken. */
+int document_is_disposable(Document doc, size_t holders);
+
 // Field getters/setters 
-// For convenience, we only set strings as our values
-/* Returned strings are caller-owned. DELETED is returned as a sentinel. */
+/* Returned strings are caller-owned, typed values as value_format writes
+ * them. DELETED is returned as a sentinel. */
 char *document_get_field(Document doc, const char *key, uint64_t local_version);
+/* The fields at count paths, at one local version, into values_out[i];
+ * NULL where there is no value (no DELETED sentinel). Paths are grouped by
+ * parent so each shared Document is looked up once and each parent's lock
+ * taken once. Returns 0, or -1 on allocation failure with nothing set. */
+int document_get_fields(Document root, const char *const *paths, size_t count,
+                        uint64_t local_version, char **values_out);
+/* The field at path as written, with a string's or bytes' data a copy
+ * for value_clear. Returns 0, 1 when there is no value there (or it is
+ * deleted), -1 on failure. */
+int document_get_value(Document doc, const char *path, uint64_t local_version, Value *out);
 int document_set_field(Document doc, const char *key, const char *value, uint64_t global_version);
+/* Typed writes; document_set_field stores a VALUE_STRING. */
+int document_set_value(Document doc, const char *key, const Value *value,
+                       uint64_t global_version);
+int document_set_value_path(Document root, const char *path, const Value *value,
+                            uint64_t global_version);
 int document_set_field_cstr(Document doc, const char *key, const char *value, uint64_t global_version);
 int document_set_field_path(Document root, const char *path, const char *value, uint64_t global_version);
+/* Read-modify-writes: the field's latest value is read and its next
+ * version linked under one write lock, so racing calls never lose an
+ * update. incr adds delta to an int, or to a string holding one, with an
+ * absent or deleted field counting as 0, and stores an int. append extends
+ * a string or bytes, keeping the type, or writes a new string. Both return
+ * 0 with the result in *value_out or *length_out (may be NULL), 1 when the
+ * field holds another type or the sum would overflow, -1 on failure.
+ * Missing parents are created as for document_set_field_path. */
+int document_incr_path(Document root, const char *path, int64_t delta,
+                       uint64_t global_version, int64_t *value_out);
+int document_append_path(Document root, const char *path, const void *data, size_t length,
+                         uint64_t global_version, size_t *length_out);
 
 // Subdocument getters/setters
 /* The returned document is retained; release it with document_free().
@@ -46,13 +111,30 @@ int document_set_subdocument(Document doc, const char *key, Document subdoc, uin
 // Path ops
 int document_delete_path(Document doc, const char *path, uint64_t global_version);
 char *document_get_path(Document doc, const char *path, uint64_t local_version);
-int document_list_versions(Document doc, const char *path);
+int document_list_versions(Document doc, const char *path, FILE *out);
+/* The subdocument at path through the latest versions, retained; NULL when absent. */
+Document document_get_subdocument_path(Document root, const char *path);
+/* Install subdoc at path as a new version, creating missing parents. */
+int document_set_subdocument_path(Document root, const char *path, Document subdoc,
+                                  uint64_t global_version);
 
 // Stubs rn
 int document_compact(Document doc, const char *path);
 int document_load(Document doc, const char *path);
 int document_save(Document doc, const char *filename, const char *path);
 
+// The database root
+/* The Document root holds, retained for the caller (document_free); NULL
+ * when there is none. No lock is taken: a reclaim section covers loading
+ * the pointer and retaining it, so a reader never waits for a publish and
+ * a publish never waits for a reader. */
+Document document_pin_root(VersionNode root);
+/* Install doc, whose reference passes to root, with one atomic exchange.
+ * The tree it replaces is retired through reclaim, so it is released once
+ * no reader can still be pinning it, and freed once the last pin is
+ * dropped. Callers publishing from several threads serialize themselves. */
+int document_publish_root(VersionNode root, Document doc);
+
 // Path traversal helpers
 int resolve_parent_and_key(Document root,
                                   const char *path,
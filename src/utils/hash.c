@@ -1,4 +1,5 @@
 #define _GNU_SOURCE
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include "hash.h"
@@ -26,6 +27,8 @@ Hashmap hashmap_create(uint64_t bucket_count) {
     if (!map) return NULL;
 
     map->datapoints   = 0;
+    map->history_versions = 0;
+    map->history_bytes    = 0;
     map->bucket_count = bucket_count;
     map->size         = 0;
     map->head         = NULL;
@@ -38,6 +41,38 @@ Hashmap hashmap_create(uint64_t bucket_count) {
     return map;
 }
 
+/* Strings and bytes are held outside their node; anything else is counted
+ * by its node alone. */
+static uint64_t version_bytes(VersionNode v) {
+    uint64_t bytes = sizeof(struct VersionNode);
+    if (v->type == VALUE_STRING || v->type == VALUE_BYTES) bytes += v->payload.length + 1;
+    return bytes;
+}
+
+static void counter_sub(_Atomic uint64_t *counter, uint64_t n) {
+    uint64_t old = atomic_load(counter);
+    while (!atomic_compare_exchange_weak(counter, &old, n < old ? old - n : 0)) {
+    }
+}
+
+uint64_t hashmap_account_history(Hashmap map, VersionNode run, int added) {
+    uint64_t versions = 0, bytes = 0;
+    for (VersionNode v = run; v; v = v->prev) {
+        versions++;
+        bytes += version_bytes(v);
+    }
+    if (!map) return bytes;
+    if (added) {
+        atomic_fetch_add(&map->history_versions, versions);
+        atomic_fetch_add(&map->history_bytes, bytes);
+    } else {
+        /* History loaded lazily after a drop is never counted; clamp. */
+        counter_sub(&map->history_versions, versions);
+        counter_sub(&map->history_bytes, bytes);
+    }
+    return bytes;
+}
+
 static void entry_free(Entry entry) {
     while (entry) {
         Entry next = entry->next;
@@ -78,10 +113,42 @@ static int hashmap_rehash(Hashmap map, uint64_t new_bucket_count) {
     return 0;
 }
 
+int hashmap_reserve(Hashmap map, uint64_t count) {
+    if (!map) return -1;
+    double needed = (double)count / LOAD_FACTOR;
+    uint64_t buckets = map->bucket_count ? map->bucket_count : 1;
+    if (needed <= (double)buckets) return 0;
+    if (needed > (double)(UINT64_MAX / sizeof(Entry)) / 2) return -1;
+    while ((double)buckets < needed) buckets *= 2;
+    return hashmap_rehash(map, buckets);
+}
+
 int hashmap_put(Hashmap map, const char *key, void *value,
                 uint64_t global_version, void (free_value)(void *)) {
     /* DELETED is a deliberate non-NULL sentinel whose address is 1. */
     if (!map || !key || (!value && value != DELETED)) return -1;
+    VersionNode node = version_node_create(value, global_version, 1, NULL, free_value);
+    if (!node) return -1;
+    if (hashmap_put_node(map, key, node) != 0) {
+        node->free_value = NULL;    /* value stays the caller's */
+        version_node_free(node);
+        return -1;
+    }
+    return 0;
+}
+
+static VersionNode given_node(VersionNode head, void *node) {
+    (void)head;
+    return node;
+}
+
+int hashmap_put_node(Hashmap map, const char *key, VersionNode node) {
+    if (!node) return -1;
+    return hashmap_update(map, key, given_node, node);
+}
+
+int hashmap_update(Hashmap map, const char *key, HashmapBuildFn build, void *ctx) {
+    if (!map || !key || !build) return -1;
 
     /* Grow if load factor exceeded */
     if ((double)(map->size + 1) / (double)map->bucket_count > LOAD_FACTOR) {
@@ -94,36 +161,41 @@ int hashmap_put(Hashmap map, const char *key, void *value,
     /* Update existing key */
     while (current) {
         if (strcmp(current->key, key) == 0) {
-            VersionNode old_head   = (VersionNode)current->value;
-            uint64_t local_version = old_head ? old_head->local_version + 1 : 1;
-            VersionNode new_head = version_node_create(value, global_version,
-                                                       local_version, old_head, free_value);
-            if (!new_head) return -1;
-            current->value = new_head;
+            VersionNode old_head = (VersionNode)current->value;
+            VersionNode node = build(old_head, ctx);
+            if (!node) return -1;
+            node->local_version  = old_head ? old_head->local_version + 1 : 1;
+            node->prev = old_head;
+            current->value = node;
+            if (old_head) {
+                map->history_versions++;
+                map->history_bytes += version_bytes(old_head);
+            }
             return 0;
         }
         current = current->next;
     }
 
-    /* Insert new key */
-    VersionNode new_head = version_node_create(value, global_version, 1, NULL, free_value);
-    if (!new_head) return -1;
-
+    /* Insert new key; the entry comes first so nothing can fail once the
+     * node is built. */
     Entry new_entry = malloc(sizeof(struct Entry));
-    if (!new_entry) {
-        version_node_free(new_head);
-        return -1;
-    }
+    if (!new_entry) return -1;
 
     new_entry->key = strdup(key);
     if (!new_entry->key) {
-        version_node_free(new_head);
+        free(new_entry);
+        return -1;
+    }
+    VersionNode node = build(NULL, ctx);
+    if (!node) {
+        free(new_entry->key);
         free(new_entry);
         return -1;
     }
 
-    index = hash(key) % map->bucket_count; /* re-evaluate in case rehash occurred */
-    new_entry->value = new_head;
+    node->local_version = 1;
+    node->prev = NULL;
+    new_entry->value = node;
     new_entry->next  = map->buckets[index];
     map->buckets[index] = new_entry;
     map->size++;
@@ -172,19 +244,64 @@ int hashmap_set_raw(Hashmap map, const char *key, void *value_chain) {
     new_entry->next = map->buckets[index];
     map->buckets[index] = new_entry;
     map->size++;
+    if (value_chain) hashmap_account_history(map, ((VersionNode)value_chain)->prev, 1);
     return 0;
 }
 
-Entry hashmap_find_entry(Hashmap map, const char *key) {
+VersionNode hashmap_unlink(Hashmap map, Entry *link) {
+    if (!map || !link || !*link) return NULL;
+    Entry dead = *link;
+    VersionNode chain = (VersionNode)dead->value;
+    *link = dead->next;
+    map->size--;
+    if (chain) hashmap_account_history(map, chain->prev, 0);
+    free(dead->key);
+    free(dead);
+    return chain;
+}
+
+Entry *hashmap_find_link(Hashmap map, const char *key) {
+    Entry *link = &map->buckets[hash(key) % map->bucket_count];
+    while (*link && strcmp((*link)->key, key) != 0) link = &(*link)->next;
+    return link;
+}
+
+VersionNode hashmap_remove(Hashmap map, const char *key) {
     if (!map || !key) return NULL;
-    for (uint64_t i = 0; i < map->bucket_count; i++) {
-        Entry e = map->buckets[i];
-        while (e) {
-            if (strcmp(e->key, key) == 0) return e;
-            e = e->next;
-        }
+    return hashmap_unlink(map, hashmap_find_link(map, key));
+}
+
+static uint64_t shrunk_bucket_count(Hashmap map, uint64_t min_buckets) {
+    uint64_t buckets = map->bucket_count;
+    while (buckets / 2 >= min_buckets &&
+           (double)map->size / (double)buckets < LOAD_FACTOR / 4) {
+        buckets /= 2;
     }
-    return NULL;
+    return buckets;
+}
+
+int hashmap_shrink(Hashmap map, uint64_t min_buckets) {
+    if (!map) return -1;
+    uint64_t buckets = shrunk_bucket_count(map, min_buckets);
+    if (buckets == map->bucket_count) return 0;
+    return hashmap_rehash(map, buckets);
+}
+
+int hashmap_wants_shrink(Hashmap map, uint64_t min_buckets) {
+    return map && shrunk_bucket_count(map, min_buckets) != map->bucket_count;
+}
+
+Entry hashmap_find_entry(Hashmap map, const char *key) {
+    if (!map || !key) return NULL;
+    return *hashmap_find_link(map, key);
+}
+
+VersionNode hashmap_get_node(Hashmap map, const char *key, uint64_t local_version) {
+    Entry e = hashmap_find_entry(map, key);
+    VersionNode node = e ? (VersionNode)e->value : NULL;
+    if (local_version == 0 || local_version == UINT64_MAX) return node;
+    while (node && node->local_version > local_version) node = node->prev;
+    return node && node->local_version == local_version ? node : NULL;
 }
 
 // Document get path helpers
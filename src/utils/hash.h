@@ -12,6 +12,12 @@ struct Hashmap {
     uint64_t size;
 
     uint64_t datapoints;
+    /* Versions below the heads and their approximate heap bytes, i.e. what
+     * compaction could reclaim. Kept by hashmap_put, hashmap_set_raw and
+     * hashmap_account_history; atomic since compaction cuts history under
+     * the owner's read lock. */
+    _Atomic uint64_t history_versions;
+    _Atomic uint64_t history_bytes;
     //using versionnode as a linked list, not how it was directly intended for versioning
     VersionNode head;
     VersionNode tail;
@@ -29,9 +35,42 @@ struct Entry {
 Hashmap hashmap_create(uint64_t bucket_count);
 void hashmap_free(Hashmap map);
 int hashmap_put(Hashmap map, const char *key, void *value, uint64_t global_version, void (*free_value)(void *));
+/* Link node, created with no prev, in as key's newest version, setting
+ * its local version and prev. On failure node is still the caller's. */
+int hashmap_put_node(Hashmap map, const char *key, VersionNode node);
+/* Read-modify-write in one lookup: build gets key's current head, NULL
+ * when key is absent, and returns the node to link in as its newest
+ * version, created with no prev, or NULL to leave the map as it was.
+ * Returns 0 once the node is linked, -1 when build or an allocation
+ * failed. The caller's lock on the map covers both the read and the put. */
+typedef VersionNode (*HashmapBuildFn)(VersionNode head, void *ctx);
+int hashmap_update(Hashmap map, const char *key, HashmapBuildFn build, void *ctx);
+/* Looking up an older version walks history compaction may cut: do it, and
+ * copy what it returns, inside a reclaim section (reclaim.h). */
 void *hashmap_get(Hashmap map, const char *key, uint64_t local_version);
 int hashmap_set_raw(Hashmap map, const char *key, void *value_chain);
+/* Grow the bucket array up front so count entries stay under the load factor. */
+int hashmap_reserve(Hashmap map, uint64_t count);
 Entry hashmap_find_entry(Hashmap map, const char *key);
+/* Unlink the entry *link points at (a bucket head or an Entry's next) and
+ * return its chain for the caller to free. */
+VersionNode hashmap_unlink(Hashmap map, Entry *link);
+/* The link pointing at key's entry, or at the NULL ending its bucket. */
+Entry *hashmap_find_link(Hashmap map, const char *key);
+/* Remove key's entry and return its chain; NULL when key is absent. */
+VersionNode hashmap_remove(Hashmap map, const char *key);
+/* Halve the bucket array, down to min_buckets, while the map is under a
+ * quarter of the load factor. */
+int hashmap_shrink(Hashmap map, uint64_t min_buckets);
+/* 1 when hashmap_shrink(map, min_buckets) would rehash. */
+int hashmap_wants_shrink(Hashmap map, uint64_t min_buckets);
+/* Count the versions from run down as history that joined (added != 0) or
+ * left the map's chains. Returns their bytes. */
+uint64_t hashmap_account_history(Hashmap map, VersionNode run, int added);
+
+/* The node holding key's version local_version, 0 or UINT64_MAX for the
+ * latest; NULL when there is none. Same reclaim rule as hashmap_get. */
+VersionNode hashmap_get_node(Hashmap map, const char *key, uint64_t local_version);
 
 // Helpers for document get path
 void *hashmap_get_version(Hashmap map, const char *key, uint64_t local_version);
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+/* Format rules: the last 5 bytes are always literals and the last match
+ * starts at least 12 bytes before the end. */
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+size_t lz_compress_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+/* Length values of 15 or more spill into extra bytes of 255 plus a tail. */
+static unsigned char *put_length(unsigned char *op, const unsigned char *end, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op == end) return NULL;
+        *op++ = 255;
+    }
+    if (op == end) return NULL;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* One sequence: token, literals, then the match unless this is the last. */
+static unsigned char *put_sequence(unsigned char *op, const unsigned char *end,
+                                   const unsigned char *literals, size_t lit_len,
+                                   size_t offset, size_t match_len) {
+    if (op == end) return NULL;
+    unsigned char *token = op++;
+    *token = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15 && !(op = put_length(op, end, lit_len - 15))) return NULL;
+    if ((size_t)(end - op) < lit_len) return NULL;
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+    if (match_len == 0) return op;
+
+    if (end - op < 2) return NULL;
+    *op++ = (unsigned char)(offset & 0xff);
+    *op++ = (unsigned char)(offset >> 8);
+    size_t code = match_len - LZ_MIN_MATCH;
+    *token |= (unsigned char)(code < 15 ? code : 15);
+    if (code >= 15 && !(op = put_length(op, end, code - 15))) return NULL;
+    return op;
+}
+
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap) {
+    uint32_t table[1u << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    unsigned char *op = dst;
+    const unsigned char *end = dst + cap;
+    size_t ip = 0, anchor = 0;
+
+    if (n > LZ_MF_LIMIT) {
+        size_t limit = n - LZ_MF_LIMIT;
+        size_t match_limit = n - LZ_LAST_LITERALS;
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = lz_hash(seq);
+            size_t ref = table[h];
+            table[h] = (uint32_t)ip;
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(src + ref) != seq) {
+                /* Step faster through data that keeps missing. */
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            size_t len = LZ_MIN_MATCH;
+            while (ip + len < match_limit && src[ip + len] == src[ref + len]) len++;
+
+            op = put_sequence(op, end, src + anchor, ip - anchor, ip - ref, len);
+            if (!op) return 0;
+            ip += len;
+            anchor = ip;
+            if (ip < limit) table[lz_hash(read32(src + ip - 2))] = (uint32_t)(ip - 2);
+        }
+    }
+
+    op = put_sequence(op, end, src + anchor, n - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+static int get_length(const unsigned char **ip, const unsigned char *end, size_t *len) {
+    unsigned char b;
+    do {
+        if (*ip == end) return -1;
+        b = *(*ip)++;
+        if (*len > SIZE_MAX - b) return -1;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t expected) {
+    const unsigned char *ip = src, *iend = src + n;
+    unsigned char *op = dst, *oend = dst + expected;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && get_length(&ip, iend, &lit_len) != 0) return -1;
+        if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len) return -1;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend) break;  /* the last sequence has no match */
+
+        if (iend - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+        size_t match_len = token & 15;
+        if (match_len == 15 && get_length(&ip, iend, &match_len) != 0) return -1;
+        match_len += LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < match_len) return -1;
+
+        const unsigned char *match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            /* Overlapping copy repeats the last `offset` bytes. */
+            for (size_t i = 0; i < match_len; i++) *op++ = match[i];
+        }
+    }
+    return op == oend ? 0 : -1;
+}
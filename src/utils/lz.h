@@ -0,0 +1,20 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/* In-tree LZ77 codec producing the LZ4 block format: greedy single-probe
+ * hash matching, 64 KiB window, no entropy stage. Built for speed over ratio. */
+
+/* Worst-case compressed size for n input bytes. */
+size_t lz_compress_bound(size_t n);
+
+/* Compress src into dst. Returns the compressed length, or 0 when the result
+ * would not fit in cap bytes. */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+/* Decompress exactly `expected` bytes into dst. Returns 0 on success, -1 on
+ * malformed input or a size mismatch. Never reads or writes out of bounds. */
+int lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t expected);
+
+#endif /* LZ_H */
@@ -0,0 +1,225 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+struct parallel_job {
+    parallel_fn fn;
+    void *ctx;
+    size_t count;
+    atomic_size_t next;
+    atomic_int failed;
+};
+
+struct parallel_worker {
+    struct parallel_job *job;
+    size_t id;
+};
+
+size_t parallel_default_workers(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+}
+
+static void parallel_drain(struct parallel_job *job, size_t worker) {
+    while (!atomic_load_explicit(&job->failed, memory_order_relaxed)) {
+        size_t index = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed);
+        if (index >= job->count) return;
+        if (job->fn(job->ctx, worker, index) != 0) {
+            atomic_store_explicit(&job->failed, 1, memory_order_relaxed);
+        }
+    }
+}
+
+static void *parallel_thread(void *arg) {
+    struct parallel_worker *w = arg;
+    parallel_drain(w->job, w->id);
+    return NULL;
+}
+
+int parallel_for(size_t count, size_t workers, parallel_fn fn, void *ctx) {
+    if (!fn) return -1;
+    if (count == 0) return 0;
+    if (workers == 0) workers = parallel_default_workers();
+    if (workers > count) workers = count;
+
+    struct parallel_job job = {.fn = fn, .ctx = ctx, .count = count};
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, 0);
+
+    /* The calling thread is worker 0; only the extra workers are spawned. */
+    pthread_t *threads = NULL;
+    struct parallel_worker *args = NULL;
+    size_t started = 0;
+    if (workers > 1) {
+        threads = malloc((workers - 1) * sizeof(*threads));
+        args = malloc((workers - 1) * sizeof(*args));
+        if (!threads || !args) {
+            free(threads);
+            free(args);
+            threads = NULL;
+            args = NULL;
+        }
+    }
+    for (size_t i = 1; threads && i < workers; i++) {
+        args[i - 1].job = &job;
+        args[i - 1].id = i;
+        if (pthread_create(&threads[i - 1], NULL, parallel_thread, &args[i - 1]) != 0) break;
+        started++;
+    }
+
+    parallel_drain(&job, 0);
+    for (size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    free(args);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
+
+/* A ring buffer; the owner works at the back, thieves at the front. */
+struct parallel_deque {
+    pthread_mutex_t lock;
+    void **tasks;
+    size_t front;
+    size_t count;
+    size_t cap;
+};
+
+struct ParallelPool {
+    parallel_task_fn fn;
+    void *ctx;
+    struct parallel_deque *deques;
+    size_t workers;
+    atomic_size_t pending;      /* queued or running */
+    atomic_int failed;
+};
+
+struct pool_worker {
+    ParallelPool pool;
+    size_t id;
+};
+
+static int deque_push(struct parallel_deque *d, void *task) {
+    pthread_mutex_lock(&d->lock);
+    if (d->count == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 64;
+        void **tasks = malloc(cap * sizeof(*tasks));
+        if (!tasks) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < d->count; i++) tasks[i] = d->tasks[(d->front + i) % d->cap];
+        free(d->tasks);
+        d->tasks = tasks;
+        d->front = 0;
+        d->cap = cap;
+    }
+    d->tasks[(d->front + d->count++) % d->cap] = task;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+static void *deque_take(struct parallel_deque *d, int steal) {
+    pthread_mutex_lock(&d->lock);
+    void *task = NULL;
+    if (d->count > 0) {
+        if (steal) {
+            task = d->tasks[d->front];
+            d->front = (d->front + 1) % d->cap;
+        } else {
+            task = d->tasks[(d->front + d->count - 1) % d->cap];
+        }
+        d->count--;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return task;
+}
+
+int parallel_spawn(ParallelPool pool, size_t worker, void *task) {
+    if (!pool || worker >= pool->workers) return -1;
+    atomic_fetch_add(&pool->pending, 1);
+    if (deque_push(&pool->deques[worker], task) != 0) {
+        atomic_fetch_sub(&pool->pending, 1);
+        return -1;
+    }
+    return 0;
+}
+
+/* Runs until nothing is queued or running anywhere, since a running task
+ * may still spawn more. */
+static void pool_drain(ParallelPool pool, size_t worker) {
+    while (atomic_load(&pool->pending) > 0) {
+        void *task = deque_take(&pool->deques[worker], 0);
+        for (size_t i = 1; !task && i < pool->workers; i++) {
+            task = deque_take(&pool->deques[(worker + i) % pool->workers], 1);
+        }
+        if (!task) {
+            sched_yield();
+            continue;
+        }
+        if (pool->fn(pool->ctx, pool, worker, task) != 0) atomic_store(&pool->failed, 1);
+        atomic_fetch_sub(&pool->pending, 1);
+    }
+}
+
+static void *pool_thread(void *arg) {
+    struct pool_worker *w = arg;
+    pool_drain(w->pool, w->id);
+    return NULL;
+}
+
+int parallel_run(void **tasks, size_t count, size_t workers, parallel_task_fn fn, void *ctx) {
+    if (!fn || (count && !tasks)) return -1;
+    if (count == 0) return 0;
+    if (workers == 0) workers = parallel_default_workers();
+
+    struct ParallelPool pool = {.fn = fn, .ctx = ctx, .workers = workers};
+    atomic_init(&pool.pending, 0);
+    atomic_init(&pool.failed, 0);
+    pool.deques = calloc(workers, sizeof(*pool.deques));
+    if (!pool.deques) return -1;
+    /* Room for the initial share up front, so queueing it cannot fail
+     * halfway and the caller owns every task when this returns -1. */
+    size_t share = count / workers + 1, inited = 0;
+    for (; inited < workers; inited++) {
+        struct parallel_deque *d = &pool.deques[inited];
+        d->cap = share < 64 ? 64 : share;
+        d->tasks = malloc(d->cap * sizeof(*d->tasks));
+        if (!d->tasks || pthread_mutex_init(&d->lock, NULL) != 0) {
+            free(d->tasks);
+            break;
+        }
+    }
+    if (inited < workers) {
+        for (size_t i = 0; i < inited; i++) {
+            free(pool.deques[i].tasks);
+            pthread_mutex_destroy(&pool.deques[i].lock);
+        }
+        free(pool.deques);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) (void)parallel_spawn(&pool, i % workers, tasks[i]);
+
+    /* The calling thread is worker 0; only the extra workers are spawned. */
+    pthread_t *threads = workers > 1 ? malloc((workers - 1) * sizeof(*threads)) : NULL;
+    struct pool_worker *args = workers > 1 ? malloc((workers - 1) * sizeof(*args)) : NULL;
+    size_t started = 0;
+    for (size_t i = 1; threads && args && i < workers; i++) {
+        args[i - 1] = (struct pool_worker){&pool, i};
+        if (pthread_create(&threads[i - 1], NULL, pool_thread, &args[i - 1]) != 0) break;
+        started++;
+    }
+    /* Deques of workers that did not start are stolen from by the rest. */
+    pool_drain(&pool, 0);
+    for (size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    free(args);
+    for (size_t i = 0; i < workers; i++) {
+        free(pool.deques[i].tasks);
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.deques);
+    return atomic_load(&pool.failed) ? -1 : 0;
+}
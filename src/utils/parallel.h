@@ -0,0 +1,36 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+/* Called once per index. `worker` identifies the calling thread in
+ * [0, workers) so callers can keep per-thread state (open files, buffers). */
+typedef int (*parallel_fn)(void *ctx, size_t worker, size_t index);
+
+/* Number of online processors, at least 1. */
+size_t parallel_default_workers(void);
+
+/* Run fn for every index in [0, count) on up to `workers` threads. Indices are
+ * handed out dynamically, so uneven work items balance themselves. Passing
+ * workers == 0 uses parallel_default_workers(). Returns 0 when every call
+ * returned 0, otherwise -1; remaining indices are skipped after a failure. */
+int parallel_for(size_t count, size_t workers, parallel_fn fn, void *ctx);
+
+/* Work-stealing pool for work that finds more work as it goes, such as a
+ * tree walk. Every worker owns a deque: it pushes and pops the tasks it
+ * spawns at the back, depth first, while idle workers steal from the front,
+ * where the oldest and usually largest tasks sit. */
+typedef struct ParallelPool *ParallelPool;
+typedef int (*parallel_task_fn)(void *ctx, ParallelPool pool, size_t worker, void *task);
+
+/* Run fn on tasks[0, count) and on everything they spawn, on up to
+ * `workers` threads (0: parallel_default_workers()). Every task runs even
+ * after a failure, so tasks can always release what they hold. Returns 0
+ * when every call returned 0, otherwise -1. */
+int parallel_run(void **tasks, size_t count, size_t workers, parallel_task_fn fn, void *ctx);
+
+/* Queue task on the calling worker's deque; only valid inside fn. Returns -1
+ * when it could not be queued, and the caller still owns task. */
+int parallel_spawn(ParallelPool pool, size_t worker, void *task);
+
+#endif
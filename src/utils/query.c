@@ -0,0 +1,344 @@
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "query.h"
+#include "hash.h"
+#include "parallel.h"
+
+/* The pattern runs as an NFA over path components: bit i of a state set
+ * means components [0, i) have been matched, and bit count means all have.
+ * Tracking sets rather than one position per branch visits each Document
+ * once, however many ways "**" could match its path. */
+typedef uint64_t StateSet;
+
+enum { LITERAL, GLOB, ANY_DEPTH };
+
+struct PathPattern {
+    char *buf;                      /* parts point into it */
+    char *parts[QUERY_MAX_COMPONENTS];
+    unsigned char kinds[QUERY_MAX_COMPONENTS];
+    size_t count;
+    char *text;
+};
+
+struct query {
+    const struct PathPattern *p;
+    QueryMatchFn fn;
+    void *ctx;
+    pthread_mutex_t emit_lock;      /* one fn call at a time */
+    atomic_int stopped;
+    atomic_int failed;
+};
+
+/* One Document still to visit. */
+struct query_task {
+    Document doc;                   /* retained */
+    char *path;                     /* "" for the root */
+    StateSet states;
+};
+
+struct match {
+    char *path;
+    char *value;
+};
+
+struct child {
+    Document doc;                   /* retained */
+    char *path;
+    StateSet states;
+};
+
+/* What one Document contributed, gathered under its lock. */
+struct harvest {
+    struct match *matches;
+    size_t match_count, match_cap;
+    struct child *children;
+    size_t child_count, child_cap;
+};
+
+static StateSet closure(const struct PathPattern *p, StateSet states) {
+    for (size_t i = 0; i < p->count; i++) {
+        if ((states >> i & 1) && p->kinds[i] == ANY_DEPTH) states |= (StateSet)1 << (i + 1);
+    }
+    return states;
+}
+
+static StateSet step(const struct PathPattern *p, StateSet states, const char *name) {
+    StateSet next = 0;
+    for (size_t i = 0; i < p->count; i++) {
+        if (!(states >> i & 1)) continue;
+        switch (p->kinds[i]) {
+            case ANY_DEPTH:
+                next |= (StateSet)1 << i;
+                break;
+            case LITERAL:
+                if (strcmp(p->parts[i], name) == 0) next |= (StateSet)1 << (i + 1);
+                break;
+            default:
+                if (fnmatch(p->parts[i], name, 0) == 0) next |= (StateSet)1 << (i + 1);
+                break;
+        }
+    }
+    return closure(p, next);
+}
+
+static char *join(const char *prefix, const char *name) {
+    size_t a = strlen(prefix), b = strlen(name);
+    char *path = malloc(a + b + 2);
+    if (!path) return NULL;
+    memcpy(path, prefix, a);
+    if (a) path[a++] = '/';
+    memcpy(path + a, name, b + 1);
+    return path;
+}
+
+static int add_match(struct harvest *h, const char *prefix, const char *name, VersionNode field) {
+    if (h->match_count == h->match_cap) {
+        size_t cap = h->match_cap ? h->match_cap * 2 : 16;
+        struct match *grown = realloc(h->matches, cap * sizeof(*grown));
+        if (!grown) return -1;
+        h->matches = grown;
+        h->match_cap = cap;
+    }
+    char *path = join(prefix, name), *copy = version_node_text(field);
+    if (!path || !copy) {
+        free(path);
+        free(copy);
+        return -1;
+    }
+    h->matches[h->match_count++] = (struct match){path, copy};
+    return 0;
+}
+
+static int add_child(struct harvest *h, const char *prefix, const char *name, Document doc,
+                     StateSet states) {
+    if (h->child_count == h->child_cap) {
+        size_t cap = h->child_cap ? h->child_cap * 2 : 16;
+        struct child *grown = realloc(h->children, cap * sizeof(*grown));
+        if (!grown) return -1;
+        h->children = grown;
+        h->child_cap = cap;
+    }
+    char *path = join(prefix, name);
+    Document retained = path ? document_retain(doc) : NULL;
+    if (!retained) {
+        free(path);
+        return -1;
+    }
+    h->children[h->child_count++] = (struct child){retained, path, states};
+    return 0;
+}
+
+/* A live head, or NULL for a tombstone or an empty chain. */
+static VersionNode live(Entry e) {
+    VersionNode head = e ? (VersionNode)e->value : NULL;
+    return head && head->value && head->value != DELETED ? head : NULL;
+}
+
+static int consider(const struct query *q, struct harvest *h, const struct query_task *t,
+                    Entry field, Entry sub, const char *name) {
+    StateSet next = step(q->p, t->states, name);
+    StateSet done = (StateSet)1 << q->p->count;
+    VersionNode value = live(field);
+    if (value && (next & done) && add_match(h, t->path, name, value) != 0) return -1;
+    VersionNode doc = live(sub);
+    if (doc && (next & ~done) && add_child(h, t->path, name, doc->value, next) != 0) return -1;
+    return 0;
+}
+
+/* Under t->doc's read lock: the matching fields and the subdocuments worth
+ * entering. Plain names are looked up; anything else scans both maps. */
+static int harvest_locked(const struct query *q, const struct query_task *t, struct harvest *h) {
+    const struct PathPattern *p = q->p;
+    Document doc = t->doc;
+    int direct = 1;
+    for (size_t i = 0; i < p->count; i++) {
+        if ((t->states >> i & 1) && p->kinds[i] != LITERAL) direct = 0;
+    }
+    if (direct) {
+        for (size_t i = 0; i < p->count; i++) {
+            if (!(t->states >> i & 1)) continue;
+            size_t j = 0;
+            while (j < i && !((t->states >> j & 1) && strcmp(p->parts[j], p->parts[i]) == 0)) j++;
+            if (j < i) continue;    /* the same name from an earlier state */
+            const char *name = p->parts[i];
+            if (consider(q, h, t, hashmap_find_entry(doc->fields, name),
+                         hashmap_find_entry(doc->subdocuments, name), name) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    for (uint64_t b = 0; b < doc->fields->bucket_count; b++) {
+        for (Entry e = doc->fields->buckets[b]; e; e = e->next) {
+            if (consider(q, h, t, e, NULL, e->key) != 0) return -1;
+        }
+    }
+    for (uint64_t b = 0; b < doc->subdocuments->bucket_count; b++) {
+        for (Entry e = doc->subdocuments->buckets[b]; e; e = e->next) {
+            if (consider(q, h, t, NULL, e, e->key) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static void task_free(struct query_task *t) {
+    document_free(t->doc);
+    free(t->path);
+    free(t);
+}
+
+static int visit(void *ctx, ParallelPool pool, size_t worker, void *arg) {
+    struct query *q = ctx;
+    struct query_task *t = arg;
+    struct harvest h = {0};
+    int ret = 0;
+    if (atomic_load(&q->stopped) || atomic_load(&q->failed)) goto out;
+
+    if (document_materialize(t->doc) != 0 || pthread_rwlock_rdlock(&t->doc->lock) != 0) {
+        ret = -1;
+        goto out;
+    }
+    ret = harvest_locked(q, t, &h);
+    pthread_rwlock_unlock(&t->doc->lock);
+
+    if (ret == 0 && h.match_count) {
+        pthread_mutex_lock(&q->emit_lock);
+        for (size_t i = 0; i < h.match_count && !atomic_load(&q->stopped); i++) {
+            if (q->fn(q->ctx, h.matches[i].path, h.matches[i].value) != 0) {
+                atomic_store(&q->stopped, 1);
+            }
+        }
+        pthread_mutex_unlock(&q->emit_lock);
+    }
+
+    for (size_t i = 0; i < h.child_count; i++) {
+        struct query_task *child = malloc(sizeof(*child));
+        if (ret == 0 && child) {
+            *child = (struct query_task){h.children[i].doc, h.children[i].path,
+                                         h.children[i].states};
+            if (parallel_spawn(pool, worker, child) != 0 && visit(q, pool, worker, child) != 0) {
+                ret = -1;
+            }
+        } else {
+            free(child);
+            document_free(h.children[i].doc);
+            free(h.children[i].path);
+            ret = -1;
+        }
+    }
+
+out:
+    for (size_t i = 0; i < h.match_count; i++) {
+        free(h.matches[i].path);
+        free(h.matches[i].value);
+    }
+    free(h.matches);
+    free(h.children);
+    if (ret != 0) atomic_store(&q->failed, 1);
+    task_free(t);
+    return ret;
+}
+
+/* Components of pattern, with runs of "**" folded into one. */
+static int compile(struct PathPattern *p, char *pattern) {
+    char *save = NULL;
+    for (char *part = strtok_r(pattern, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        int kind = strcmp(part, "**") == 0 ? ANY_DEPTH : strpbrk(part, "*?[\\") ? GLOB : LITERAL;
+        if (kind == ANY_DEPTH && p->count && p->kinds[p->count - 1] == ANY_DEPTH) continue;
+        if (p->count == QUERY_MAX_COMPONENTS) return -1;
+        p->parts[p->count] = part;
+        p->kinds[p->count++] = (unsigned char)kind;
+    }
+    return p->count ? 0 : -1;
+}
+
+PathPattern path_pattern_compile(const char *pattern) {
+    if (!pattern) return NULL;
+    PathPattern p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    size_t len = strlen(pattern);
+    p->buf = strdup(pattern);
+    p->text = malloc(len + 1);
+    if (!p->buf || !p->text || compile(p, p->buf) != 0) {
+        path_pattern_free(p);
+        return NULL;
+    }
+    char *end = p->text;
+    for (size_t i = 0; i < p->count; i++) {
+        size_t n = strlen(p->parts[i]);
+        if (i) *end++ = '/';
+        memcpy(end, p->parts[i], n);
+        end += n;
+    }
+    *end = '\0';
+    return p;
+}
+
+void path_pattern_free(PathPattern pattern) {
+    if (!pattern) return;
+    free(pattern->buf);
+    free(pattern->text);
+    free(pattern);
+}
+
+const char *path_pattern_text(PathPattern pattern) {
+    return pattern ? pattern->text : NULL;
+}
+
+/* The states left after reading path's components; 0 once none are. */
+static StateSet walk(PathPattern p, const char *path) {
+    char *copy = strdup(path);
+    if (!copy) return 0;
+    StateSet states = closure(p, 1);
+    char *save = NULL;
+    for (char *part = strtok_r(copy, "/", &save); part && states;
+         part = strtok_r(NULL, "/", &save)) {
+        states = step(p, states, part);
+    }
+    free(copy);
+    return states;
+}
+
+int path_pattern_match(PathPattern pattern, const char *path) {
+    if (!pattern || !path) return 0;
+    return (int)(walk(pattern, path) >> pattern->count & 1);
+}
+
+int path_pattern_reaches_below(PathPattern pattern, const char *path) {
+    if (!pattern || !path) return 0;
+    return (walk(pattern, path) & ~((StateSet)1 << pattern->count)) != 0;
+}
+
+int document_query(Document root, const char *pattern, size_t workers, QueryMatchFn fn,
+                   void *ctx) {
+    if (!root || !pattern || !fn) return -1;
+    PathPattern p = path_pattern_compile(pattern);
+    if (!p) return -1;
+    struct query q = {.p = p, .fn = fn, .ctx = ctx};
+    pthread_mutex_init(&q.emit_lock, NULL);
+    atomic_init(&q.stopped, 0);
+    atomic_init(&q.failed, 0);
+
+    struct query_task *t = malloc(sizeof(*t));
+    int ret = -1;
+    if (t) {
+        *t = (struct query_task){document_retain(root), strdup(""), closure(p, 1)};
+        if (t->doc && t->path) {
+            void *task = t;
+            ret = parallel_run(&task, 1, workers, visit, &q);
+        } else {
+            if (t->doc) document_free(t->doc);
+            free(t->path);
+            free(t);
+        }
+    }
+    pthread_mutex_destroy(&q.emit_lock);
+    path_pattern_free(p);
+    if (ret != 0 || atomic_load(&q.failed)) return -1;
+    return atomic_load(&q.stopped) ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stddef.h>
+#include "document.h"
+
+#define QUERY_MAX_COMPONENTS 63
+
+/* Called once per matching field with its full path and latest value, both
+ * valid only during the call. Calls never overlap, but come in no
+ * particular order. Returning nonzero stops the query. */
+typedef int (*QueryMatchFn)(void *ctx, const char *path, const char *value);
+
+/* Every live field whose path matches pattern. A pattern is slash
+ * separated like a path: "*" matches one whole component, "**" any number
+ * of them (none included), and other components are fnmatch globs such as
+ * "user-?" or "[ab]*", or plain names. Subtrees are walked on up to
+ * workers threads (0: one per core), and each Document's matches are
+ * handed to fn as soon as it has been read, under its read lock only for
+ * the copy. Returns 0 when the walk finished, 1 when fn stopped it, and
+ * -1 for a pattern with no components or more than QUERY_MAX_COMPONENTS,
+ * or on failure. */
+int document_query(Document root, const char *pattern, size_t workers, QueryMatchFn fn,
+                   void *ctx);
+
+/* A pattern compiled once to test single paths against, as the write path
+ * does for indexes. */
+typedef struct PathPattern *PathPattern;
+
+/* NULL for a pattern document_query would reject. */
+PathPattern path_pattern_compile(const char *pattern);
+void path_pattern_free(PathPattern pattern);
+/* The components joined by single slashes with "**" runs folded, so two
+ * spellings of one pattern compare equal. */
+const char *path_pattern_text(PathPattern pattern);
+/* 1 when the field at path matches. */
+int path_pattern_match(PathPattern pattern, const char *path);
+/* 1 when some field below the subdocument at path could match. */
+int path_pattern_reaches_below(PathPattern pattern, const char *path);
+
+#endif
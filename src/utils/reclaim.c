@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "reclaim.h"
+
+/* Collect after this many retirements so the list stays short even when
+ * nobody calls reclaim_collect. */
+#define RECLAIM_BATCH 64
+
+/* One per thread that has entered a section, reused after the thread
+ * exits. epoch is 0 outside a section, else the global epoch seen on entry. */
+struct reclaim_thread {
+    atomic_uint_fast64_t epoch;
+    atomic_int in_use;
+    struct reclaim_thread *next;
+};
+
+struct retired {
+    VersionNode chain;
+    uint64_t epoch;
+    struct retired *next;
+};
+
+static atomic_uint_fast64_t global_epoch = 1;
+static _Atomic(struct reclaim_thread *) threads;
+/* Readers that could not register pin every epoch instead. */
+static atomic_uint pinned;
+static pthread_key_t thread_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct reclaim_thread *self;
+static _Thread_local unsigned nesting;
+
+static pthread_mutex_t limbo_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct retired *limbo;
+static size_t limbo_count;
+static size_t since_collect;
+static uint64_t collected_epoch;
+
+static void thread_exit(void *arg) {
+    struct reclaim_thread *t = arg;
+    atomic_store(&t->epoch, 0);
+    atomic_store(&t->in_use, 0);
+}
+
+static void make_key(void) {
+    (void)pthread_key_create(&thread_key, thread_exit);
+}
+
+static struct reclaim_thread *register_thread(void) {
+    pthread_once(&key_once, make_key);
+    struct reclaim_thread *t;
+    for (t = atomic_load(&threads); t; t = t->next) {
+        int idle = 0;
+        if (atomic_compare_exchange_strong(&t->in_use, &idle, 1)) break;
+    }
+    if (!t) {
+        t = calloc(1, sizeof(*t));
+        if (!t) return NULL;
+        atomic_init(&t->epoch, 0);
+        atomic_init(&t->in_use, 1);
+        t->next = atomic_load(&threads);
+        while (!atomic_compare_exchange_weak(&threads, &t->next, t)) {
+        }
+    }
+    (void)pthread_setspecific(thread_key, t);
+    return t;
+}
+
+void reclaim_enter(void) {
+    if (nesting++ > 0) return;
+    if (!self) self = register_thread();
+    if (!self) {
+        atomic_fetch_add(&pinned, 1);
+        return;
+    }
+    /* Sequentially consistent, so the store is visible before any chain
+     * pointer this thread goes on to load. */
+    atomic_store(&self->epoch, atomic_load(&global_epoch));
+}
+
+void reclaim_exit(void) {
+    if (nesting == 0 || --nesting > 0) return;
+    if (!self) {
+        atomic_fetch_sub(&pinned, 1);
+        return;
+    }
+    atomic_store_explicit(&self->epoch, 0, memory_order_release);
+}
+
+/* The epoch moves on once every thread inside a section has seen it. A
+ * chain retired in epoch e is unreachable from epoch e + 2 on. */
+static uint64_t try_advance(void) {
+    uint64_t epoch = atomic_load(&global_epoch);
+    if (atomic_load(&pinned)) return epoch;
+    for (struct reclaim_thread *t = atomic_load(&threads); t; t = t->next) {
+        uint64_t seen = atomic_load(&t->epoch);
+        if (seen && seen != epoch) return epoch;
+    }
+    if (atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1)) return epoch + 1;
+    return epoch;
+}
+
+int reclaim_retire(VersionNode chain) {
+    if (!chain) return 0;
+    struct retired *r = malloc(sizeof(*r));
+    if (!r) return -1;
+    r->chain = chain;
+    pthread_mutex_lock(&limbo_lock);
+    r->epoch = atomic_load(&global_epoch);
+    r->next = limbo;
+    limbo = r;
+    limbo_count++;
+    int collect = ++since_collect >= RECLAIM_BATCH;
+    pthread_mutex_unlock(&limbo_lock);
+    if (collect) (void)reclaim_collect();
+    return 0;
+}
+
+size_t reclaim_collect(void) {
+    uint64_t epoch = try_advance();
+    struct retired *safe = NULL;
+    pthread_mutex_lock(&limbo_lock);
+    since_collect = 0;
+    /* Nothing became safe unless the epoch moved. Otherwise the list is
+     * newest first, so everything from the first safe entry on is safe too. */
+    if (epoch > collected_epoch) {
+        collected_epoch = epoch;
+        struct retired **link = &limbo;
+        while (*link && (*link)->epoch + 2 > epoch) link = &(*link)->next;
+        safe = *link;
+        *link = NULL;
+        for (struct retired *r = safe; r; r = r->next) limbo_count--;
+    }
+    size_t left = limbo_count;
+    pthread_mutex_unlock(&limbo_lock);
+
+    while (safe) {
+        struct retired *next = safe->next;
+        version_node_free(safe->chain);
+        free(safe);
+        safe = next;
+    }
+    return left;
+}
+
+void reclaim_barrier(void) {
+    if (nesting > 0) {
+        (void)reclaim_collect();
+        return;
+    }
+    uint64_t target = atomic_load(&global_epoch) + 2;
+    while (try_advance() < target) sched_yield();
+    (void)reclaim_collect();
+}
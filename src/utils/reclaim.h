@@ -0,0 +1,27 @@
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stddef.h>
+#include "version_node.h"
+
+/* Deferred reclamation of version chains (epoch based). Compaction cuts a
+ * chain with an atomic store while readers may still be walking the part it
+ * cut off. That part is retired here and freed once every thread that was
+ * inside a read section at the time has left it. Sections nest and cost an
+ * atomic store on entry and exit; any code that follows prev pointers
+ * without holding the chain's Document for writing must be inside one. */
+void reclaim_enter(void);
+void reclaim_exit(void);
+
+/* Free chain with version_node_free once no reader can reach it. Returns
+ * -1 when it could not be queued; the caller still owns chain then. */
+int reclaim_retire(VersionNode chain);
+
+/* Free what is already safe. Returns the number of chains still waiting. */
+size_t reclaim_collect(void);
+
+/* Wait until everything retired so far is freed. Inside a read section the
+ * caller's own section would hold it back, so this only collects there. */
+void reclaim_barrier(void);
+
+#endif
@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "value.h"
+
+static const char *const type_names[] = {
+    [VALUE_STRING] = "string",
+    [VALUE_BYTES] = "bytes",
+    [VALUE_INT64] = "int",
+    [VALUE_DOUBLE] = "double",
+    [VALUE_BOOL] = "bool",
+};
+
+const char *value_type_name(ValueType type) {
+    if (type <= VALUE_NONE || type > VALUE_BOOL) return NULL;
+    return type_names[type];
+}
+
+int value_type_parse(const char *name, ValueType *out) {
+    for (ValueType t = VALUE_STRING; t <= VALUE_BOOL; t++) {
+        if (strcmp(name, type_names[t]) == 0) {
+            *out = t;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int parse_hex(const char *text, Value *out) {
+    if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) text += 2;
+    size_t digits = strlen(text);
+    if (digits % 2) return -1;
+    unsigned char *bytes = malloc(digits / 2 + 1);
+    if (!bytes) return -1;
+    for (size_t i = 0; i < digits / 2; i++) {
+        int hi = hex_digit(text[2 * i]), lo = hex_digit(text[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            free(bytes);
+            return -1;
+        }
+        bytes[i] = (unsigned char)(hi << 4 | lo);
+    }
+    bytes[digits / 2] = '\0';
+    out->data = bytes;
+    out->length = digits / 2;
+    return 0;
+}
+
+int value_parse(ValueType type, const char *text, Value *out) {
+    if (!text || !out) return -1;
+    *out = (Value){.type = type};
+    char *end = NULL;
+    switch (type) {
+        case VALUE_STRING: {
+            size_t len = strlen(text);
+            char *copy = malloc(len + 1);
+            if (!copy) return -1;
+            out->data = memcpy(copy, text, len + 1);
+            out->length = len;
+            return 0;
+        }
+        case VALUE_BYTES:
+            return parse_hex(text, out);
+        case VALUE_INT64: {
+            errno = 0;
+            long long i = strtoll(text, &end, 10);
+            if (end == text || *end || errno == ERANGE) return -1;
+            out->i = i;
+            return 0;
+        }
+        case VALUE_DOUBLE:
+            out->d = strtod(text, &end);
+            return end != text && !*end && !isnan(out->d) ? 0 : -1;
+        case VALUE_BOOL:
+            if (strcmp(text, "true") == 0) out->b = 1;
+            else if (strcmp(text, "false") == 0) out->b = 0;
+            else return -1;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+void value_clear(Value *value) {
+    if (!value) return;
+    if (value->type == VALUE_STRING || value->type == VALUE_BYTES) free((void *)value->data);
+    value->data = NULL;
+    value->length = 0;
+}
+
+char *value_format(const Value *value) {
+    if (!value) return NULL;
+    char buf[32], *out;
+    switch (value->type) {
+        case VALUE_STRING:
+            out = malloc(value->length + 1);
+            if (!out) return NULL;
+            memcpy(out, value->data, value->length);
+            out[value->length] = '\0';
+            return out;
+        case VALUE_BYTES: {
+            static const char digits[] = "0123456789abcdef";
+            const unsigned char *bytes = value->data;
+            out = malloc(2 * value->length + 3);
+            if (!out) return NULL;
+            out[0] = '0';
+            out[1] = 'x';
+            for (size_t i = 0; i < value->length; i++) {
+                out[2 + 2 * i] = digits[bytes[i] >> 4];
+                out[3 + 2 * i] = digits[bytes[i] & 0xf];
+            }
+            out[2 + 2 * value->length] = '\0';
+            return out;
+        }
+        case VALUE_INT64:
+            snprintf(buf, sizeof(buf), "%lld", (long long)value->i);
+            break;
+        case VALUE_DOUBLE:
+            snprintf(buf, sizeof(buf), "%.15g", value->d);
+            if (strtod(buf, NULL) != value->d) snprintf(buf, sizeof(buf), "%.17g", value->d);
+            break;
+        case VALUE_BOOL:
+            snprintf(buf, sizeof(buf), "%s", value->b ? "true" : "false");
+            break;
+        default:
+            return NULL;
+    }
+    return strdup(buf);
+}
+
+int value_number(const Value *value, double *out) {
+    if (!value || !out) return 0;
+    switch (value->type) {
+        case VALUE_INT64:
+            *out = (double)value->i;
+            return 1;
+        case VALUE_DOUBLE:
+            *out = value->d;
+            return !isnan(value->d);
+        case VALUE_STRING: {
+            const char *text = value->data;
+            char *end = NULL;
+            *out = strtod(text, &end);
+            return end != text && *end == '\0' && !isnan(*out);
+        }
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The type of a field's value, which its VersionNode carries as a tag.
+ * Strings are NUL-terminated text, as every value used to be; bytes carry
+ * their length and may hold NULs; numbers and booleans are stored natively,
+ * so nothing reparses them. Documents, the DELETED tombstone and whatever
+ * else a chain holds are VALUE_NONE. */
+typedef enum {
+    VALUE_NONE,
+    VALUE_STRING,
+    VALUE_BYTES,
+    VALUE_INT64,
+    VALUE_DOUBLE,
+    VALUE_BOOL
+} ValueType;
+
+/* A field value outside the tree, as typed writes take it and typed reads
+ * hand it back. data and length are the payload of a string, without its
+ * NUL, or of bytes. */
+typedef struct Value {
+    ValueType type;
+    union {
+        int64_t i;          /* VALUE_INT64 */
+        double d;           /* VALUE_DOUBLE */
+        int b;              /* VALUE_BOOL: 0 or 1 */
+    };
+    const void *data;       /* VALUE_STRING, VALUE_BYTES */
+    size_t length;
+} Value;
+
+/* "string", "bytes", "int", "double" or "bool"; NULL for VALUE_NONE. */
+const char *value_type_name(ValueType type);
+/* The type value_type_name spells name; -1 for any other name. */
+int value_type_parse(const char *name, ValueType *out);
+
+/* text read as a value of type: a whole decimal int64, a number strtod
+ * takes whole other than NaN, true or false, hex digits after an optional
+ * 0x, or the string itself. A string's or bytes' data is a copy, NUL
+ * terminated, for value_clear to free. Returns -1 when text is not one. */
+int value_parse(ValueType type, const char *text, Value *out);
+/* Frees what value_parse or a typed read allocated. */
+void value_clear(Value *value);
+
+/* value as text, caller-owned: a string as it is, an int in decimal, a
+ * double in as few digits as read back the same, true or false, and bytes
+ * as 0x and two hex digits each. */
+char *value_format(const Value *value);
+
+/* 1 with value as a number in *out: ints and doubles as they are, strings
+ * (NUL-terminated at length) when they parse whole and are not NaN.
+ * 0 for anything else. */
+int value_number(const Value *value, double *out);
+
+#endif
@@ -0,0 +1,862 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "value_index.h"
+
+#define INDEX_MIN_BUCKETS 64
+#define RANGE_MAX_HEIGHT  16        /* skip list levels; each is 1/4 as full */
+
+/* The paths whose latest value is value. */
+struct group {
+    char *value;
+    struct posting *first;
+    struct group *chain;            /* next in its value bucket */
+};
+
+struct posting {
+    char *path;
+    struct posting *chain;          /* next in its path bucket */
+    /* Equality indexes. */
+    struct group *group;
+    struct posting *prev, *next;    /* within the group */
+    /* Range indexes: the value as written and as ordered, and height links
+     * in the skip list, which is sorted by number and then path. */
+    char *value;
+    double number;
+    int height;
+    struct posting *forward[];
+};
+
+/* A path table, path -> posting, finds what a write replaces. Equality
+ * indexes answer from a second table, value -> group, and range indexes
+ * from a skip list headed by head. */
+struct value_index {
+    PathPattern pattern;
+    IndexKind kind;
+    pthread_rwlock_t lock;
+    struct posting **paths;
+    struct group **values;
+    size_t buckets;                 /* in each table */
+    size_t size;                    /* postings */
+    struct posting *head;           /* range: RANGE_MAX_HEIGHT links */
+    int height;                     /* range: levels in use */
+    uint32_t seed;
+    struct value_index *next;
+};
+
+struct IndexSet {
+    /* Held shared by single-field writes and exclusively while a subtree or
+     * the whole tree is reindexed, so nothing changes between collecting
+     * paths and refreshing them. */
+    pthread_rwlock_t lock;
+    struct value_index *head;
+};
+
+// FNV-1a, as for the document maps
+static uint64_t hash(const char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    while (*key) {
+        hash ^= (unsigned char)(*key++);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static struct posting **find_posting(struct value_index *ix, const char *path) {
+    struct posting **link = &ix->paths[hash(path) % ix->buckets];
+    while (*link && strcmp((*link)->path, path) != 0) link = &(*link)->chain;
+    return link;
+}
+
+static struct group **find_group(struct value_index *ix, const char *value) {
+    struct group **link = &ix->values[hash(value) % ix->buckets];
+    while (*link && strcmp((*link)->value, value) != 0) link = &(*link)->chain;
+    return link;
+}
+
+/* Double both tables. Failing only leaves the chains longer. */
+static void grow(struct value_index *ix) {
+    size_t buckets = ix->buckets * 2;
+    struct posting **paths = calloc(buckets, sizeof(*paths));
+    struct group **values = calloc(buckets, sizeof(*values));
+    if (!paths || !values) {
+        free(paths);
+        free(values);
+        return;
+    }
+    for (size_t b = 0; b < ix->buckets; b++) {
+        for (struct posting *p = ix->paths[b], *next; p; p = next) {
+            next = p->chain;
+            struct posting **head = &paths[hash(p->path) % buckets];
+            p->chain = *head;
+            *head = p;
+        }
+        for (struct group *g = ix->values[b], *next; g; g = next) {
+            next = g->chain;
+            struct group **head = &values[hash(g->value) % buckets];
+            g->chain = *head;
+            *head = g;
+        }
+    }
+    free(ix->paths);
+    free(ix->values);
+    ix->paths = paths;
+    ix->values = values;
+    ix->buckets = buckets;
+}
+
+/* Take p out of its group, freeing the group once it is empty. */
+static void leave_group(struct value_index *ix, struct posting *p) {
+    struct group *g = p->group;
+    if (p->prev) p->prev->next = p->next;
+    else g->first = p->next;
+    if (p->next) p->next->prev = p->prev;
+    p->group = NULL;
+    if (g->first) return;
+    struct group **link = find_group(ix, g->value);
+    *link = g->chain;
+    free(g->value);
+    free(g);
+}
+
+/* Ordered by number, then path. */
+static int before(const struct posting *p, double number, const char *path) {
+    return p->number < number || (p->number == number && strcmp(p->path, path) < 0);
+}
+
+/* The last posting on each level ordered before (number, path). */
+static void skip_search(struct value_index *ix, double number, const char *path,
+                        struct posting **update) {
+    struct posting *x = ix->head;
+    for (int level = ix->height - 1; level >= 0; level--) {
+        while (x->forward[level] && before(x->forward[level], number, path)) {
+            x = x->forward[level];
+        }
+        update[level] = x;
+    }
+}
+
+static void skip_unlink(struct value_index *ix, struct posting *p) {
+    struct posting *update[RANGE_MAX_HEIGHT];
+    skip_search(ix, p->number, p->path, update);
+    for (int level = 0; level < p->height; level++) update[level]->forward[level] = p->forward[level];
+    while (ix->height > 1 && !ix->head->forward[ix->height - 1]) ix->height--;
+}
+
+static void skip_link(struct value_index *ix, struct posting *p) {
+    struct posting *update[RANGE_MAX_HEIGHT];
+    while (ix->height < p->height) ix->head->forward[ix->height++] = NULL;
+    skip_search(ix, p->number, p->path, update);
+    for (int level = 0; level < p->height; level++) {
+        p->forward[level] = update[level]->forward[level];
+        update[level]->forward[level] = p;
+    }
+}
+
+static int random_height(struct value_index *ix) {
+    int height = 1;
+    while (height < RANGE_MAX_HEIGHT) {
+        ix->seed ^= ix->seed << 13;
+        ix->seed ^= ix->seed >> 17;
+        ix->seed ^= ix->seed << 5;
+        if (ix->seed & 3) break;
+        height++;
+    }
+    return height;
+}
+
+/* The whole of value as a number; NaN and partial parses are not. */
+static int parse_number(const char *value, double *out) {
+    char *end = NULL;
+    *out = strtod(value, &end);
+    return end != value && *end == '\0' && !isnan(*out);
+}
+
+static void index_remove(struct value_index *ix, const char *path) {
+    struct posting **link = find_posting(ix, path);
+    struct posting *p = *link;
+    if (!p) return;
+    *link = p->chain;
+    if (ix->kind == INDEX_RANGE) skip_unlink(ix, p);
+    else leave_group(ix, p);
+    free(p->path);
+    free(p->value);
+    free(p);
+    ix->size--;
+}
+
+/* A posting for path, linked into the path table at link. */
+static struct posting *add_posting(struct value_index *ix, struct posting **link,
+                                   const char *path, int height) {
+    struct posting *p = calloc(1, sizeof(*p) + (size_t)height * sizeof(p->forward[0]));
+    if (!p || !(p->path = strdup(path))) {
+        free(p);
+        return NULL;
+    }
+    p->height = height;
+    p->chain = *link;
+    *link = p;
+    ix->size++;
+    return p;
+}
+
+/* Values that are not numbers, number NULL, are left out. */
+static int range_put(struct value_index *ix, const char *path, const char *value,
+                     const double *number) {
+    if (!number) {
+        index_remove(ix, path);
+        return 0;
+    }
+    if (ix->size >= ix->buckets / 4 * 3) grow(ix);
+    struct posting **link = find_posting(ix, path);
+    struct posting *p = *link;
+    if (p && strcmp(p->value, value) == 0) return 0;
+    char *copy = strdup(value);
+    if (!copy) return -1;
+    if (p) {
+        skip_unlink(ix, p);
+        free(p->value);
+    } else if (!(p = add_posting(ix, link, path, random_height(ix)))) {
+        free(copy);
+        return -1;
+    }
+    p->value = copy;
+    p->number = *number;
+    skip_link(ix, p);
+    return 0;
+}
+
+/* An equality index's entry for path. */
+static int index_put(struct value_index *ix, const char *path, const char *value) {
+    if (ix->size >= ix->buckets / 4 * 3) grow(ix);
+    struct posting **link = find_posting(ix, path);
+    struct posting *p = *link;
+    if (p && strcmp(p->group->value, value) == 0) return 0;
+    if (p) leave_group(ix, p);
+    else if (!(p = add_posting(ix, link, path, 0))) return -1;
+
+    struct group **glink = find_group(ix, value);
+    struct group *g = *glink;
+    if (!g) {
+        g = calloc(1, sizeof(*g));
+        if (!g || !(g->value = strdup(value))) {
+            free(g);
+            index_remove(ix, path);
+            return -1;
+        }
+        *glink = g;
+    }
+    p->group = g;
+    p->prev = NULL;
+    p->next = g->first;
+    if (g->first) g->first->prev = p;
+    g->first = p;
+    return 0;
+}
+
+static void index_clear(struct value_index *ix) {
+    for (size_t b = 0; b < ix->buckets; b++) {
+        for (struct posting *p = ix->paths[b], *next; p; p = next) {
+            next = p->chain;
+            free(p->path);
+            free(p->value);
+            free(p);
+        }
+        for (struct group *g = ix->values[b], *next; g; g = next) {
+            next = g->chain;
+            free(g->value);
+            free(g);
+        }
+        ix->paths[b] = NULL;
+        ix->values[b] = NULL;
+    }
+    ix->size = 0;
+    if (ix->head) {
+        memset(ix->head->forward, 0, RANGE_MAX_HEIGHT * sizeof(ix->head->forward[0]));
+        ix->height = 1;
+    }
+}
+
+/* Takes ownership of pattern, even on failure. */
+static struct value_index *index_create(PathPattern pattern, IndexKind kind) {
+    struct value_index *ix = calloc(1, sizeof(*ix));
+    if (ix) {
+        ix->buckets = INDEX_MIN_BUCKETS;
+        ix->paths = calloc(ix->buckets, sizeof(*ix->paths));
+        ix->values = calloc(ix->buckets, sizeof(*ix->values));
+        if (kind == INDEX_RANGE) {
+            ix->head = calloc(1, sizeof(*ix->head) + RANGE_MAX_HEIGHT * sizeof(ix->head->forward[0]));
+        }
+    }
+    if (!ix || !ix->paths || !ix->values || (kind == INDEX_RANGE && !ix->head) ||
+        pthread_rwlock_init(&ix->lock, NULL) != 0) {
+        if (ix) {
+            free(ix->paths);
+            free(ix->values);
+            free(ix->head);
+        }
+        free(ix);
+        path_pattern_free(pattern);
+        return NULL;
+    }
+    ix->pattern = pattern;
+    ix->kind = kind;
+    ix->height = 1;
+    ix->seed = 2463534242u;
+    return ix;
+}
+
+static void index_free(struct value_index *ix) {
+    index_clear(ix);
+    free(ix->paths);
+    free(ix->values);
+    free(ix->head);
+    path_pattern_free(ix->pattern);
+    pthread_rwlock_destroy(&ix->lock);
+    free(ix);
+}
+
+/* A range index is filled unsorted, then sorted and linked in one pass,
+ * rather than paying a skip list search per field. */
+struct build {
+    struct value_index *ix;
+    struct posting **staged;
+    size_t count, cap;
+};
+
+static int build_match(void *ctx, const char *path, const char *value) {
+    struct build *b = ctx;
+    struct value_index *ix = b->ix;
+    if (ix->kind != INDEX_RANGE) return index_put(ix, path, value);
+    double number;
+    if (!parse_number(value, &number)) return 0;
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 256;
+        struct posting **grown = realloc(b->staged, cap * sizeof(*grown));
+        if (!grown) return -1;
+        b->staged = grown;
+        b->cap = cap;
+    }
+    if (ix->size >= ix->buckets / 4 * 3) grow(ix);
+    struct posting *p = add_posting(ix, find_posting(ix, path), path, random_height(ix));
+    if (!p || !(p->value = strdup(value))) return -1;
+    p->number = number;
+    b->staged[b->count++] = p;
+    return 0;
+}
+
+static int compare_staged(const void *a, const void *b) {
+    const struct posting *p = *(struct posting *const *)a, *q = *(struct posting *const *)b;
+    if (p->number != q->number) return p->number < q->number ? -1 : 1;
+    return strcmp(p->path, q->path);
+}
+
+/* Fill an empty index from root; the query's calls never overlap. */
+static int build(struct value_index *ix, Document root) {
+    struct build b = {.ix = ix};
+    int ret = document_query(root, path_pattern_text(ix->pattern), 0, build_match, &b) == 0 ? 0 : -1;
+    if (ret == 0 && b.count) {
+        qsort(b.staged, b.count, sizeof(*b.staged), compare_staged);
+        struct posting *last[RANGE_MAX_HEIGHT];
+        for (int level = 0; level < RANGE_MAX_HEIGHT; level++) last[level] = ix->head;
+        for (size_t i = 0; i < b.count; i++) {
+            struct posting *p = b.staged[i];
+            for (int level = 0; level < p->height; level++) {
+                last[level]->forward[level] = p;
+                last[level] = p;
+            }
+            if (p->height > ix->height) ix->height = p->height;
+        }
+    }
+    free(b.staged);
+    return ret;
+}
+
+/* path as the document stores it: its components joined by single slashes. */
+static char *canonical(const char *path) {
+    char *out = malloc(strlen(path) + 1), *w = out;
+    if (!out) return NULL;
+    for (const char *r = path; *r;) {
+        while (*r == '/') r++;
+        if (!*r) break;
+        if (w != out) *w++ = '/';
+        while (*r && *r != '/') *w++ = *r++;
+    }
+    *w = '\0';
+    return out;
+}
+
+/* Set ix's entry for path to whatever root holds now. Reading under the
+ * index lock is what orders racing writers: the last to get here sees
+ * every write before it. */
+static int refresh(struct value_index *ix, Document root, const char *path) {
+    if (pthread_rwlock_wrlock(&ix->lock) != 0) return -1;
+    Value value;
+    int ret = document_get_value(root, path, UINT64_MAX, &value);
+    if (ret == 0) {
+        /* Typed numbers go in as they are; anything else is judged by its
+         * text, as the build and unindexed ranges judge it. */
+        char *text = value_format(&value);
+        double number;
+        int numeric = value.type == VALUE_INT64 || value.type == VALUE_DOUBLE
+                          ? value_number(&value, &number)
+                          : text && parse_number(text, &number);
+        if (!text) ret = -1;
+        else if (ix->kind == INDEX_RANGE) ret = range_put(ix, path, text, numeric ? &number : NULL);
+        else ret = index_put(ix, path, text);
+        free(text);
+        value_clear(&value);
+    } else if (ret == 1) {
+        index_remove(ix, path);
+        ret = 0;
+    }
+    pthread_rwlock_unlock(&ix->lock);
+    return ret;
+}
+
+/* Refresh path, canonical, in every index it matches. */
+static int refresh_all(IndexSet set, Document root, const char *path) {
+    int ret = 0;
+    for (struct value_index *ix = set->head; ix; ix = ix->next) {
+        if (path_pattern_match(ix->pattern, path) && refresh(ix, root, path) != 0) ret = -1;
+    }
+    return ret;
+}
+
+static int covers(IndexSet set, const char *path) {
+    for (struct value_index *ix = set->head; ix; ix = ix->next) {
+        if (path_pattern_match(ix->pattern, path)) return 1;
+    }
+    return 0;
+}
+
+IndexSet index_set_create(void) {
+    IndexSet set = calloc(1, sizeof(*set));
+    if (set && pthread_rwlock_init(&set->lock, NULL) != 0) {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void index_set_free(IndexSet set) {
+    if (!set) return;
+    for (struct value_index *ix = set->head, *next; ix; ix = next) {
+        next = ix->next;
+        index_free(ix);
+    }
+    pthread_rwlock_destroy(&set->lock);
+    free(set);
+}
+
+static struct value_index **find_index(IndexSet set, PathPattern pattern, IndexKind kind) {
+    struct value_index **link = &set->head;
+    while (*link && ((*link)->kind != kind ||
+                     strcmp(path_pattern_text((*link)->pattern), path_pattern_text(pattern)) != 0)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+int index_set_add(IndexSet set, Document root, const char *pattern, IndexKind kind,
+                  size_t *count_out) {
+    if (!set || !root) return -1;
+    PathPattern compiled = path_pattern_compile(pattern);
+    if (!compiled) return -1;
+    if (*find_index(set, compiled, kind)) {
+        path_pattern_free(compiled);
+        return 1;
+    }
+    struct value_index *ix = index_create(compiled, kind);
+    if (!ix) return -1;
+    if (build(ix, root) != 0 || pthread_rwlock_wrlock(&set->lock) != 0) {
+        index_free(ix);
+        return -1;
+    }
+    ix->next = set->head;
+    set->head = ix;
+    pthread_rwlock_unlock(&set->lock);
+    if (count_out) *count_out = ix->size;
+    return 0;
+}
+
+int index_set_drop(IndexSet set, const char *pattern, IndexKind kind) {
+    if (!set) return -1;
+    PathPattern compiled = path_pattern_compile(pattern);
+    if (!compiled) return -1;
+    struct value_index **link = find_index(set, compiled, kind);
+    path_pattern_free(compiled);
+    struct value_index *ix = *link;
+    if (!ix || pthread_rwlock_wrlock(&set->lock) != 0) return -1;
+    *link = ix->next;
+    pthread_rwlock_unlock(&set->lock);
+    index_free(ix);
+    return 0;
+}
+
+int index_set_set_field(IndexSet set, Document root, const char *path, const char *value,
+                        uint64_t global_version) {
+    if (!value) return -1;
+    Value string = {.type = VALUE_STRING, .data = value, .length = strlen(value)};
+    return index_set_set_value(set, root, path, &string, global_version);
+}
+
+int index_set_set_value(IndexSet set, Document root, const char *path, const Value *value,
+                        uint64_t global_version) {
+    if (!set || !path || !covers(set, path)) {
+        return document_set_value_path(root, path, value, global_version);
+    }
+    char *key = canonical(path);
+    if (!key || pthread_rwlock_rdlock(&set->lock) != 0) {
+        free(key);
+        return -1;
+    }
+    int ret = document_set_value_path(root, path, value, global_version);
+    if (ret == 0) ret = refresh_all(set, root, key);
+    pthread_rwlock_unlock(&set->lock);
+    free(key);
+    return ret;
+}
+
+int index_set_incr(IndexSet set, Document root, const char *path, int64_t delta,
+                   uint64_t global_version, int64_t *value_out) {
+    if (!set || !path || !covers(set, path)) {
+        return document_incr_path(root, path, delta, global_version, value_out);
+    }
+    char *key = canonical(path);
+    if (!key || pthread_rwlock_rdlock(&set->lock) != 0) {
+        free(key);
+        return -1;
+    }
+    int ret = document_incr_path(root, path, delta, global_version, value_out);
+    if (ret == 0) ret = refresh_all(set, root, key);
+    pthread_rwlock_unlock(&set->lock);
+    free(key);
+    return ret;
+}
+
+int index_set_append(IndexSet set, Document root, const char *path, const void *data,
+                     size_t length, uint64_t global_version, size_t *length_out) {
+    if (!set || !path || !covers(set, path)) {
+        return document_append_path(root, path, data, length, global_version, length_out);
+    }
+    char *key = canonical(path);
+    if (!key || pthread_rwlock_rdlock(&set->lock) != 0) {
+        free(key);
+        return -1;
+    }
+    int ret = document_append_path(root, path, data, length, global_version, length_out);
+    if (ret == 0) ret = refresh_all(set, root, key);
+    pthread_rwlock_unlock(&set->lock);
+    free(key);
+    return ret;
+}
+
+int index_set_delete_field(IndexSet set, Document root, const char *path,
+                           uint64_t global_version) {
+    if (!set || !path || !covers(set, path)) {
+        return document_delete_path(root, path, global_version);
+    }
+    char *key = canonical(path);
+    if (!key || pthread_rwlock_rdlock(&set->lock) != 0) {
+        free(key);
+        return -1;
+    }
+    int ret = document_delete_path(root, path, global_version);
+    if (ret == 0) ret = refresh_all(set, root, key);
+    pthread_rwlock_unlock(&set->lock);
+    free(key);
+    return ret;
+}
+
+/* Fields below a subtree that some index covers, as full paths. */
+struct collected {
+    IndexSet set;
+    const char *prefix;
+    char **paths;
+    size_t count, cap;
+};
+
+static int collect_match(void *ctx, const char *path, const char *value) {
+    (void)value;
+    struct collected *c = ctx;
+    size_t a = strlen(c->prefix), b = strlen(path);
+    char *full = malloc(a + b + 2);
+    if (!full) return -1;
+    memcpy(full, c->prefix, a);
+    full[a] = '/';
+    memcpy(full + a + 1, path, b + 1);
+    if (!covers(c->set, full)) {
+        free(full);
+        return 0;
+    }
+    if (c->count == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 16;
+        char **grown = realloc(c->paths, cap * sizeof(*grown));
+        if (!grown) {
+            free(full);
+            return -1;
+        }
+        c->paths = grown;
+        c->cap = cap;
+    }
+    c->paths[c->count++] = full;
+    return 0;
+}
+
+int index_set_set_subdocument(IndexSet set, Document root, const char *path, Document subdoc,
+                              uint64_t global_version) {
+    int reaches = 0;
+    for (struct value_index *ix = set && path ? set->head : NULL; ix; ix = ix->next) {
+        reaches |= path_pattern_reaches_below(ix->pattern, path);
+    }
+    if (!reaches || !subdoc) return document_set_subdocument_path(root, path, subdoc, global_version);
+
+    char *prefix = canonical(path);
+    if (!prefix || pthread_rwlock_wrlock(&set->lock) != 0) {
+        free(prefix);
+        return -1;
+    }
+    /* What the old subtree held and what the new one holds. */
+    struct collected c = {.set = set, .prefix = prefix};
+    int ret = 0;
+    Document old = document_get_subdocument_path(root, path);
+    if (old) {
+        ret = document_query(old, "**", 1, collect_match, &c);
+        document_free(old);
+    }
+    if (ret == 0) ret = document_query(subdoc, "**", 1, collect_match, &c);
+    if (ret == 0) ret = document_set_subdocument_path(root, path, subdoc, global_version);
+    else ret = -1;
+    for (size_t i = 0; i < c.count; i++) {
+        if (ret == 0 && refresh_all(set, root, c.paths[i]) != 0) ret = -1;
+        free(c.paths[i]);
+    }
+    free(c.paths);
+    pthread_rwlock_unlock(&set->lock);
+    free(prefix);
+    return ret;
+}
+
+int index_set_rebuild(IndexSet set, Document root) {
+    if (!set) return 0;
+    if (!root || pthread_rwlock_wrlock(&set->lock) != 0) return -1;
+    int ret = 0;
+    for (struct value_index *ix = set->head; ix; ix = ix->next) {
+        if (pthread_rwlock_wrlock(&ix->lock) != 0) {
+            ret = -1;
+            continue;
+        }
+        index_clear(ix);
+        if (build(ix, root) != 0) ret = -1;
+        pthread_rwlock_unlock(&ix->lock);
+    }
+    pthread_rwlock_unlock(&set->lock);
+    return ret;
+}
+
+int index_set_stage(IndexSet set, Document root, IndexSet *staged_out) {
+    if (!staged_out) return -1;
+    *staged_out = NULL;
+    if (!set) return 0;
+    if (!root) return -1;
+    IndexSet staged = index_set_create();
+    if (!staged) return -1;
+    /* Same order as set, so install can pair them up. */
+    struct value_index **tail = &staged->head;
+    for (struct value_index *ix = set->head; ix; ix = ix->next) {
+        PathPattern pattern = path_pattern_compile(path_pattern_text(ix->pattern));
+        struct value_index *copy = pattern ? index_create(pattern, ix->kind) : NULL;
+        if (!copy) {
+            index_set_free(staged);
+            return -1;
+        }
+        *tail = copy;
+        tail = &copy->next;
+        if (build(copy, root) != 0) {
+            index_set_free(staged);
+            return -1;
+        }
+    }
+    *staged_out = staged;
+    return 0;
+}
+
+static void swap_contents(struct value_index *a, struct value_index *b) {
+    struct posting **paths = a->paths, *head = a->head;
+    struct group **values = a->values;
+    size_t buckets = a->buckets, size = a->size;
+    int height = a->height;
+    uint32_t seed = a->seed;
+    a->paths = b->paths;
+    a->values = b->values;
+    a->buckets = b->buckets;
+    a->size = b->size;
+    a->head = b->head;
+    a->height = b->height;
+    a->seed = b->seed;
+    b->paths = paths;
+    b->values = values;
+    b->buckets = buckets;
+    b->size = size;
+    b->head = head;
+    b->height = height;
+    b->seed = seed;
+}
+
+int index_set_install(IndexSet set, IndexSet staged) {
+    if (!set || !staged) {
+        index_set_free(staged);
+        return !set && !staged ? 0 : -1;
+    }
+    if (pthread_rwlock_wrlock(&set->lock) != 0) {
+        index_set_free(staged);
+        return -1;
+    }
+    int ret = 0;
+    for (struct value_index *ix = set->head, *fresh = staged->head; ix && fresh;
+         ix = ix->next, fresh = fresh->next) {
+        if (pthread_rwlock_wrlock(&ix->lock) != 0) {
+            ret = -1;
+            continue;
+        }
+        swap_contents(ix, fresh);
+        pthread_rwlock_unlock(&ix->lock);
+    }
+    pthread_rwlock_unlock(&set->lock);
+    index_set_free(staged);         /* now holding the old contents */
+    return ret;
+}
+
+struct value_filter {
+    const char *value;
+    QueryMatchFn fn;
+    void *ctx;
+};
+
+static int filter_match(void *ctx, const char *path, const char *value) {
+    struct value_filter *f = ctx;
+    return strcmp(value, f->value) == 0 ? f->fn(f->ctx, path, value) : 0;
+}
+
+/* The paths are copied out, so fn runs with no index lock held. */
+static int find_indexed(struct value_index *ix, const char *value, QueryMatchFn fn, void *ctx) {
+    if (pthread_rwlock_rdlock(&ix->lock) != 0) return -1;
+    struct group *g = *find_group(ix, value);
+    size_t count = 0, bytes = 0;
+    for (struct posting *p = g ? g->first : NULL; p; p = p->next) {
+        count++;
+        bytes += strlen(p->path) + 1;
+    }
+    char **paths = malloc(count * sizeof(*paths) + 1);
+    char *buf = malloc(bytes + 1);
+    if (!paths || !buf) {
+        pthread_rwlock_unlock(&ix->lock);
+        free(paths);
+        free(buf);
+        return -1;
+    }
+    char *w = buf;
+    count = 0;
+    for (struct posting *p = g ? g->first : NULL; p; p = p->next) {
+        size_t len = strlen(p->path) + 1;
+        memcpy(w, p->path, len);
+        paths[count++] = w;
+        w += len;
+    }
+    pthread_rwlock_unlock(&ix->lock);
+
+    int ret = 0;
+    for (size_t i = 0; i < count && !ret; i++) ret = fn(ctx, paths[i], value) != 0;
+    free(paths);
+    free(buf);
+    return ret;
+}
+
+int index_set_find(IndexSet set, Document root, const char *pattern, const char *value,
+                   QueryMatchFn fn, void *ctx) {
+    if (!root || !pattern || !value || !fn) return -1;
+    struct value_index *ix = NULL;
+    if (set) {
+        PathPattern compiled = path_pattern_compile(pattern);
+        if (!compiled) return -1;
+        ix = *find_index(set, compiled, INDEX_EQUALITY);
+        path_pattern_free(compiled);
+    }
+    if (ix) return find_indexed(ix, value, fn, ctx);
+    struct value_filter f = {value, fn, ctx};
+    return document_query(root, pattern, 0, filter_match, &f);
+}
+
+struct range_filter {
+    double lo, hi;
+    size_t limit, emitted;
+    QueryMatchFn fn;
+    void *ctx;
+};
+
+static int range_match(void *ctx, const char *path, const char *value) {
+    struct range_filter *f = ctx;
+    double number;
+    if (!parse_number(value, &number) || number < f->lo || number > f->hi) return 0;
+    if (f->fn(f->ctx, path, value) != 0) return 1;
+    return f->limit && ++f->emitted == f->limit;
+}
+
+/* Seek to lo in O(log n), then copy out up to limit postings in order. */
+static int range_indexed(struct value_index *ix, double lo, double hi, size_t limit,
+                         QueryMatchFn fn, void *ctx) {
+    if (pthread_rwlock_rdlock(&ix->lock) != 0) return -1;
+    struct posting *x = ix->head;
+    for (int level = ix->height - 1; level >= 0; level--) {
+        while (x->forward[level] && x->forward[level]->number < lo) x = x->forward[level];
+    }
+    struct posting *first = x->forward[0];
+    size_t count = 0, bytes = 0;
+    for (struct posting *p = first; p && p->number <= hi && (!limit || count < limit);
+         p = p->forward[0]) {
+        count++;
+        bytes += strlen(p->path) + strlen(p->value) + 2;
+    }
+    char **strings = malloc(2 * count * sizeof(*strings) + 1);
+    char *buf = malloc(bytes + 1), *w = buf;
+    if (!strings || !buf) {
+        pthread_rwlock_unlock(&ix->lock);
+        free(strings);
+        free(buf);
+        return -1;
+    }
+    struct posting *p = first;
+    for (size_t i = 0; i < count; i++, p = p->forward[0]) {
+        size_t a = strlen(p->path) + 1, b = strlen(p->value) + 1;
+        strings[2 * i] = memcpy(w, p->path, a);
+        strings[2 * i + 1] = memcpy(w + a, p->value, b);
+        w += a + b;
+    }
+    pthread_rwlock_unlock(&ix->lock);
+
+    int ret = 0;
+    for (size_t i = 0; i < count && !ret; i++) ret = fn(ctx, strings[2 * i], strings[2 * i + 1]) != 0;
+    free(strings);
+    free(buf);
+    return ret;
+}
+
+int index_set_range(IndexSet set, Document root, const char *pattern, double lo, double hi,
+                    size_t limit, QueryMatchFn fn, void *ctx) {
+    if (!root || !pattern || !fn || isnan(lo) || isnan(hi)) return -1;
+    struct value_index *ix = NULL;
+    if (set) {
+        PathPattern compiled = path_pattern_compile(pattern);
+        if (!compiled) return -1;
+        ix = *find_index(set, compiled, INDEX_RANGE);
+        path_pattern_free(compiled);
+    }
+    if (ix) return range_indexed(ix, lo, hi, limit, fn, ctx);
+    struct range_filter f = {lo, hi, limit, 0, fn, ctx};
+    int ret = document_query(root, pattern, 0, range_match, &f);
+    /* Stopping at the limit is finishing. */
+    return ret == 1 && f.limit && f.emitted == f.limit ? 0 : ret;
+}
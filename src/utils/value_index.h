@@ -0,0 +1,81 @@
+#ifndef VALUE_INDEX_H
+#define VALUE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "document.h"
+#include "query.h"
+
+/* Secondary indexes over the latest values of the fields a path pattern,
+ * as document_query takes them, matches. Writes that go through the
+ * index_set_* calls below keep every index covering their path in step,
+ * so a find or range on an indexed pattern costs what it returns rather
+ * than a walk of the database. A NULL IndexSet indexes nothing. */
+typedef struct IndexSet *IndexSet;
+
+/* Equality indexes answer find; range indexes keep the fields whose values
+ * are numbers, typed or text that parses whole, in order, and answer range.
+ * Both follow the latest value only, so history and its compaction do not
+ * affect them. */
+typedef enum {
+    INDEX_EQUALITY,
+    INDEX_RANGE
+} IndexKind;
+
+IndexSet index_set_create(void);
+void index_set_free(IndexSet set);
+
+/* Index every live field of root matching pattern. Returns 0 with the
+ * number of fields indexed in *count_out (may be NULL), 1 when pattern
+ * already has an index of that kind, -1 for a bad pattern or on failure.
+ * Adding and dropping must not run alongside writes. */
+int index_set_add(IndexSet set, Document root, const char *pattern, IndexKind kind,
+                  size_t *count_out);
+/* Returns -1 when pattern has no index of that kind. */
+int index_set_drop(IndexSet set, const char *pattern, IndexKind kind);
+
+/* The document_* writes, returning what they return, plus index upkeep.
+ * Callers hold root's VersionNode lock for reading as for the plain calls.
+ * Each index re-reads the path's latest value under its own lock, so
+ * racing writes to one path leave it agreeing with the tree. */
+int index_set_set_field(IndexSet set, Document root, const char *path, const char *value,
+                        uint64_t global_version);
+int index_set_set_value(IndexSet set, Document root, const char *path, const Value *value,
+                        uint64_t global_version);
+int index_set_incr(IndexSet set, Document root, const char *path, int64_t delta,
+                   uint64_t global_version, int64_t *value_out);
+int index_set_append(IndexSet set, Document root, const char *path, const void *data,
+                     size_t length, uint64_t global_version, size_t *length_out);
+int index_set_delete_field(IndexSet set, Document root, const char *path,
+                           uint64_t global_version);
+/* Also reindexes the fields of the subtree replaced and of subdoc. */
+int index_set_set_subdocument(IndexSet set, Document root, const char *path, Document subdoc,
+                              uint64_t global_version);
+/* After root has replaced the whole tree. */
+int index_set_rebuild(IndexSet set, Document root);
+/* A rebuild for a tree about to replace the indexed one, in two steps.
+ * index_set_stage builds every index of set over root, which nothing else
+ * may be writing, into *staged_out (NULL when set is), without blocking
+ * finds or writes. index_set_install swaps the staged contents in, each
+ * index under its lock, and frees staged. Callers hold off writes to the
+ * old tree from install until the new one is published, so finds move
+ * from the old tree's answers to the new one's with nothing in between. */
+int index_set_stage(IndexSet set, Document root, IndexSet *staged_out);
+int index_set_install(IndexSet set, IndexSet staged);
+
+/* Every live field matching pattern whose value is value, to fn as for
+ * document_query. An index on the same pattern answers it in time
+ * proportional to the matches; without one it is a query. Returns 0, 1
+ * when fn stopped it, -1 for a bad pattern or on failure. */
+int index_set_find(IndexSet set, Document root, const char *pattern, const char *value,
+                   QueryMatchFn fn, void *ctx);
+
+/* The live fields matching pattern whose values are numbers in [lo, hi],
+ * at most limit of them (0: all). A range index on pattern finds the first
+ * in O(log n) and hands them to fn in ascending order, ties by path, for
+ * O(log n + k) in all; without one every match is parsed, in no order.
+ * Returns as index_set_find. */
+int index_set_range(IndexSet set, Document root, const char *pattern, double lo, double hi,
+                    size_t limit, QueryMatchFn fn, void *ctx);
+
+#endif
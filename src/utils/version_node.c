@@ -1,6 +1,8 @@
 #include "version_node.h"
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include "document.h"
 VersionNode version_node_create(void *value, uint64_t global_version, uint64_t local_version, VersionNode prev, void (*free_value)(void *)) {
     VersionNode node = malloc(sizeof(struct VersionNode));
@@ -11,6 +13,9 @@ VersionNode version_node_create(void *value, uint64_t global_version, uint64_t l
     node->local_version = local_version;
     node->prev = prev;
     node->free_value = free_value;
+    node->created = (uint64_t)time(NULL);
+    node->type = VALUE_NONE;
+    node->payload.length = 0;
     if (pthread_rwlock_init(&node->lock, NULL) != 0) {
         free(node);
         return NULL;
@@ -25,6 +30,71 @@ VersionNode version_node_create(void *value, uint64_t global_version, uint64_t l
     return node;
 }
 
+VersionNode version_node_create_value(const Value *value, uint64_t global_version,
+                                      uint64_t local_version, VersionNode prev) {
+    if (!value) return NULL;
+    if (value->type == VALUE_STRING || value->type == VALUE_BYTES) {
+        if (value->length && !value->data) return NULL;
+        char *buf = malloc(value->length + 1);
+        if (!buf) return NULL;
+        if (value->length) memcpy(buf, value->data, value->length);
+        buf[value->length] = '\0';
+        VersionNode node = version_node_create_buffer(value->type, buf, value->length,
+                                                      global_version, local_version, prev);
+        if (!node) free(buf);
+        return node;
+    }
+    if (value->type != VALUE_INT64 && value->type != VALUE_DOUBLE && value->type != VALUE_BOOL) {
+        return NULL;
+    }
+    VersionNode node = version_node_create(NULL, global_version, local_version, prev, NULL);
+    if (!node) return NULL;
+    node->type = value->type;
+    if (value->type == VALUE_DOUBLE) node->payload.d = value->d;
+    else node->payload.i = value->type == VALUE_BOOL ? value->b != 0 : value->i;
+    node->value = &node->payload;
+    return node;
+}
+
+VersionNode version_node_create_buffer(ValueType type, char *buf, size_t length,
+                                       uint64_t global_version, uint64_t local_version,
+                                       VersionNode prev) {
+    VersionNode node = version_node_create(buf, global_version, local_version, prev, free);
+    if (!node) return NULL;
+    node->type = type;
+    node->payload.length = length;
+    return node;
+}
+
+int version_node_value(VersionNode node, Value *out) {
+    if (!node || !out || !node->value || node->value == DELETED) return -1;
+    *out = (Value){.type = node->type};
+    switch (node->type) {
+        case VALUE_STRING:
+        case VALUE_BYTES:
+            out->data = node->value;
+            out->length = node->payload.length;
+            return 0;
+        case VALUE_INT64:
+            out->i = node->payload.i;
+            return 0;
+        case VALUE_DOUBLE:
+            out->d = node->payload.d;
+            return 0;
+        case VALUE_BOOL:
+            out->b = (int)node->payload.i;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+char *version_node_text(VersionNode node) {
+    Value value;
+    if (version_node_value(node, &value) != 0) return NULL;
+    return value_format(&value);
+}
+
 VersionNode version_node_retain(VersionNode node) {
     if (!node) return NULL;
     if (pthread_mutex_lock(&node->ref_lock) != 0) return NULL;
@@ -37,36 +107,59 @@ VersionNode version_node_retain(VersionNode node) {
     return node;
 }
 
+/* Walks down the chain rather than recursing: a hot counter's history can
+ * run to millions of versions. */
 void version_node_release(VersionNode node) {
-    if (!node) return;
-    if (pthread_mutex_lock(&node->ref_lock) != 0) return;
-    if (node->references == 0) {
+    while (node) {
+        if (pthread_mutex_lock(&node->ref_lock) != 0) return;
+        if (node->references == 0) {
+            pthread_mutex_unlock(&node->ref_lock);
+            return;
+        }
+        node->references--;
+        if (node->references != 0) {
+            pthread_mutex_unlock(&node->ref_lock);
+            return;
+        }
+
+        VersionNode prev = node->prev;
+        void *value = node->value;
+        void (*free_value)(void *) = node->free_value;
+        node->prev = NULL;
         pthread_mutex_unlock(&node->ref_lock);
-        return;
-    }
-    node->references--;
-    if (node->references != 0) {
-        pthread_mutex_unlock(&node->ref_lock);
-        return;
-    }
-
-    VersionNode prev = node->prev;
-    void *value = node->value;
-    void (*free_value)(void *) = node->free_value;
-    node->prev = NULL;
-    pthread_mutex_unlock(&node->ref_lock);
 
-    if (free_value && value) free_value(value);
-    pthread_mutex_destroy(&node->ref_lock);
-    pthread_rwlock_destroy(&node->lock);
-    free(node);
-    version_node_release(prev);
+        if (free_value && value) free_value(value);
+        pthread_mutex_destroy(&node->ref_lock);
+        pthread_rwlock_destroy(&node->lock);
+        free(node);
+        node = prev;
+    }
 }
 
 void version_node_free(VersionNode head){
     version_node_release(head);
 }
 
+VersionNode *version_node_collect(VersionNode head, size_t *count_out) {
+    size_t count = 0, cap = 8;
+    VersionNode *nodes = malloc(cap * sizeof(*nodes));
+    if (!nodes) return NULL;
+    for (VersionNode v = head; v; v = v->prev) {
+        if (count == cap) {
+            VersionNode *grown = realloc(nodes, cap * 2 * sizeof(*nodes));
+            if (!grown) {
+                free(nodes);
+                return NULL;
+            }
+            nodes = grown;
+            cap *= 2;
+        }
+        nodes[count++] = v;
+    }
+    *count_out = count;
+    return nodes;
+}
+
 int version_node_compact_locked(VersionNode head) {
     if (!head) return(1);
     if (head->prev) {
@@ -1,6 +1,7 @@
 #ifndef VERSION_NODE_H
 #define VERSION_NODE_H
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #if defined(_WIN32)
@@ -8,16 +9,26 @@
 #else
 #include <pthread.h>
 #endif
+#include "value.h"
 
 typedef struct VersionNode *VersionNode;
 
 //value should be data or pointer
+/* prev is atomic: compaction cuts chains while readers walk them (see
+ * reclaim.h). */
 struct VersionNode {
     void *value;
     uint64_t global_version;
     uint64_t local_version;
-    VersionNode prev;
+    _Atomic(VersionNode) prev;
     void (*free_value)(void *);
+    uint64_t created;           /* wall-clock seconds, for retention windows */
+    ValueType type;             /* of a field's value; VALUE_NONE otherwise */
+    union {
+        int64_t i;              /* VALUE_INT64 and VALUE_BOOL, with value */
+        double d;               /* VALUE_DOUBLE         pointing here */
+        size_t length;          /* VALUE_STRING and VALUE_BYTES: bytes at value */
+    } payload;
     pthread_rwlock_t lock;
     pthread_mutex_t ref_lock;
     size_t references;
@@ -29,10 +40,31 @@ VersionNode version_node_create(void *value,
         VersionNode prev, 
         void (*free_value)(void *));
 
+/* A field version holding value: strings and bytes are copied, with a NUL
+ * after them, and numbers and booleans live in the node itself. */
+VersionNode version_node_create_value(const Value *value, uint64_t global_version,
+                                      uint64_t local_version, VersionNode prev);
+/* A VALUE_STRING or VALUE_BYTES version that takes over buf, which holds
+ * length bytes and a NUL, as loaders decode them. buf is not freed on
+ * failure. */
+VersionNode version_node_create_buffer(ValueType type, char *buf, size_t length,
+                                       uint64_t global_version, uint64_t local_version,
+                                       VersionNode prev);
+/* node's field value, borrowing its payload for as long as node lives.
+ * Returns -1 for a tombstone or anything that is not a field value. */
+int version_node_value(VersionNode node, Value *out);
+/* node's field value as value_format writes it, caller-owned; NULL for a
+ * tombstone. */
+char *version_node_text(VersionNode node);
+
 /* VersionNode references are required for nodes returned by lookup helpers. */
 VersionNode version_node_retain(VersionNode node);
 void version_node_release(VersionNode node);
 void version_node_free(VersionNode head);
+/* The nodes of head's chain, newest first, gathered in a single walk so a
+ * concurrent cut cannot change the count between passes. The caller frees
+ * the array and must stay in its reclaim section while using it. */
+VersionNode *version_node_collect(VersionNode head, size_t *count_out);
 /* Internal callers that already hold node->lock use this variant. */
 int version_node_compact_locked(VersionNode head);
 int version_node_compact(VersionNode head);
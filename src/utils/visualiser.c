@@ -1,69 +1,78 @@
 #include "visualiser.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include "reclaim.h"
 
-static void print_indent(int level) {
-    for (int i = 0; i < level; i++) printf("  ");
+static void print_indent(FILE *out, int level) {
+    for (int i = 0; i < level; i++) fputs("  ", out);
 }
 
-static void print_document(Document doc, int indent);
+static void print_document(FILE *out, Document doc, int indent);
 
-static void print_version_chain(VersionNode v) {
+static void print_version_chain(FILE *out, VersionNode v) {
     for (VersionNode node = v; node; node = node->prev) {
         if (!node) continue;
         if (node->value == DELETED) {
-            printf("[deleted]");
-        } else if (node->free_value == free) { // string
-            printf("\"%s\"", (char*)node->value);
+            fprintf(out, "[deleted]");
+        } else if (node->type == VALUE_STRING) {
+            fprintf(out, "\"%s\"", (char*)node->value);
+        } else if (node->type != VALUE_NONE) {
+            char *text = version_node_text(node);
+            fprintf(out, "%s", text ? text : "?");
+            free(text);
         } else { // subdocument
-            printf("{...}");
+            fprintf(out, "{...}");
         }
-        if (node->prev) printf(" -> ");
+        if (node->prev) fprintf(out, " -> ");
     }
 }
 
-static void print_document_locked(Document doc, int indent) {
+static void print_document_locked(FILE *out, Document doc, int indent) {
     if (!doc) return;
 
-    print_indent(indent);
-    printf("Fields:\n");
+    print_indent(out, indent);
+    fprintf(out, "Fields:\n");
     for (uint64_t i = 0; i < doc->fields->bucket_count; i++) {
         for (Entry e = doc->fields->buckets[i]; e; e = e->next) {
-            print_indent(indent + 1);
-            printf("%s: ", e->key);
-            print_version_chain((VersionNode)e->value);
-            printf("\n");
+            print_indent(out, indent + 1);
+            fprintf(out, "%s: ", e->key);
+            print_version_chain(out, (VersionNode)e->value);
+            fprintf(out, "\n");
         }
     }
 
-    print_indent(indent);
-    printf("Subdocuments:\n");
+    print_indent(out, indent);
+    fprintf(out, "Subdocuments:\n");
     for (uint64_t i = 0; i < doc->subdocuments->bucket_count; i++) {
         for (Entry e = doc->subdocuments->buckets[i]; e; e = e->next) {
-            print_indent(indent + 1);
-            printf("%s:\n", e->key);
+            print_indent(out, indent + 1);
+            fprintf(out, "%s:\n", e->key);
             VersionNode chain = (VersionNode)e->value;
             for (VersionNode node = chain; node; node = node->prev) {
-                if (node->value && node->free_value != free) { // subdocument
-                    print_document((Document)node->value, indent + 2);
+                if (node->value && node->value != DELETED) { // subdocument
+                    print_document(out, (Document)node->value, indent + 2);
                 }
             }
         }
     }
 }
 
-static void print_document(Document doc, int indent) {
-    if (!doc || pthread_rwlock_rdlock(&doc->lock) != 0) return;
-    print_document_locked(doc, indent);
+static void print_document(FILE *out, Document doc, int indent) {
+    if (!doc || document_materialize_history(doc) != 0) return;
+    if (pthread_rwlock_rdlock(&doc->lock) != 0) return;
+    print_document_locked(out, doc, indent);
     pthread_rwlock_unlock(&doc->lock);
 }
 
-void visualize_db(VersionNode root) {
-    if (!root || pthread_rwlock_rdlock(&root->lock) != 0) return;
-    printf("Database:\n");
+void visualize_db(VersionNode root, FILE *out) {
+    if (!root || !out) return;
+    fprintf(out, "Database:\n");
+    /* Covers both compaction cuts and a tree a load replaces. */
+    reclaim_enter();
     for (VersionNode v = root; v; v = v->prev) {
         Document doc = (Document)v->value;
-        print_document(doc, 1);
-        printf("------\n");
+        print_document(out, doc, 1);
+        fprintf(out, "------\n");
     }
-    pthread_rwlock_unlock(&root->lock);
+    reclaim_exit();
 }
@@ -1,10 +1,11 @@
 #ifndef VISUALISER_H
 #define VISUALISER_H
 
+#include <stdio.h>
 #include "document.h"
 #include "version_node.h"
 
-// Print the database root in a human-readable way
-void visualize_db(VersionNode root);
+// Print the database root to out in a human-readable way
+void visualize_db(VersionNode root, FILE *out);
 
 #endif // VISUALISER_H
@@ -0,0 +1,84 @@
+/* Whole-database compaction benchmark: wall time of compactor_compact_parallel
+ * against worker count on a tree whose subtrees are very unevenly sized, with
+ * the single-threaded incremental walk as the baseline. Times include
+ * freeing what was cut. Build with `make bench_compact`. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/storage/compactor.h"
+#include "../src/utils/document.h"
+#include "../src/utils/parallel.h"
+#include "../src/utils/reclaim.h"
+#include "../src/utils/version_node.h"
+
+#define DEFAULT_TENANTS 2000
+#define VERSIONS 4
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Tenant i holds about 2000 / (i + 1) records, so a few tenants dwarf the
+ * rest; every field is rewritten VERSIONS times. */
+static VersionNode build(int tenants, uint64_t *versions_out) {
+    Document root = document_create();
+    assert(root);
+    char path[128], value[32];
+    uint64_t gv = 1, versions = 0;
+    for (int t = 0; t < tenants; t++) {
+        int records = 1 + 2000 / (t + 1);
+        for (int r = 0; r < records; r++) {
+            for (int v = 0; v < VERSIONS; v++) {
+                snprintf(value, sizeof(value), "%llu", (unsigned long long)gv);
+                snprintf(path, sizeof(path), "tenants/t-%05d/records/r-%05d/status", t, r);
+                assert(document_set_field_path(root, path, value, gv++) == 0);
+                snprintf(path, sizeof(path), "tenants/t-%05d/records/r-%05d/seen", t, r);
+                assert(document_set_field_path(root, path, value, gv++) == 0);
+            }
+            versions += 2 * (VERSIONS - 1);
+        }
+    }
+    VersionNode node = version_node_create(root, gv, 1, NULL, (void (*)(void *))document_free);
+    assert(node);
+    *versions_out = versions;
+    return node;
+}
+
+int main(int argc, char **argv) {
+    int tenants = argc > 1 ? atoi(argv[1]) : DEFAULT_TENANTS;
+    if (tenants <= 0) tenants = DEFAULT_TENANTS;
+    size_t cores = parallel_default_workers();
+
+    uint64_t versions = 0;
+    VersionNode root = build(tenants, &versions);
+    double t0 = now_ms();
+    assert(compactor_compact(root) == 0);
+    reclaim_barrier();
+    double baseline = now_ms() - t0;
+    version_node_free(root);
+
+    printf("%d tenants, %llu versions to free, %zu cores\n", tenants,
+           (unsigned long long)versions, cores);
+    printf("%-10s %10s %10s %12s\n", "workers", "ms", "speedup", "max hold us");
+    printf("%-10s %10.1f %10s %12s\n", "serial", baseline, "1.00x", "-");
+    for (size_t workers = 1;; workers *= 2) {
+        if (workers > cores) workers = cores;
+        root = build(tenants, &versions);
+        CompactStats stats;
+        t0 = now_ms();
+        assert(compactor_compact_parallel(root, NULL, workers, &stats) == 0);
+        reclaim_barrier();
+        double ms = now_ms() - t0;
+        assert(stats.versions_freed == versions);
+        printf("%-10zu %10.1f %9.2fx %12llu\n", workers, ms, baseline / ms,
+               (unsigned long long)stats.max_hold_micros);
+        version_node_free(root);
+        if (workers == cores) break;
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+/* Equality lookup benchmark: find on users/<star>/status with and without
+ * an index, as the number of users grows while the matches stay fixed, and
+ * what the index adds to each write. Build with `make bench_find`. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/utils/document.h"
+#include "../src/utils/value_index.h"
+
+#define MATCHES 10
+#define LOOKUPS 200
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int count(void *ctx, const char *path, const char *value) {
+    (void)path;
+    (void)value;
+    ++*(size_t *)ctx;
+    return 0;
+}
+
+/* Mean ms per find. */
+static double time_find(IndexSet set, Document root, int lookups) {
+    size_t found = 0;
+    double t0 = now_ms();
+    for (int i = 0; i < lookups; i++) {
+        assert(index_set_find(set, root, "users/*/status", "banned", count, &found) == 0);
+    }
+    double ms = (now_ms() - t0) / lookups;
+    assert(found == (size_t)MATCHES * lookups);
+    return ms;
+}
+
+/* Mean us per write of users' status. */
+static double time_writes(IndexSet set, Document root, int users, uint64_t *gv) {
+    char path[64];
+    double t0 = now_ms();
+    for (int u = MATCHES; u < users; u++) {
+        snprintf(path, sizeof(path), "users/u%07d/status", u);
+        assert(index_set_set_field(set, root, path, u % 2 ? "active" : "idle", (*gv)++) == 0);
+    }
+    return (now_ms() - t0) * 1e3 / (users - MATCHES);
+}
+
+int main(int argc, char **argv) {
+    int max_users = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (max_users < 1000) max_users = 1000;
+    printf("%-10s %12s %12s %14s %14s\n", "users", "walk ms", "index ms", "write us",
+           "indexed us");
+    for (int users = 1000; users <= max_users; users *= 10) {
+        Document plain = document_create(), indexed = document_create();
+        IndexSet set = index_set_create();
+        assert(plain && indexed && set);
+        assert(index_set_add(set, indexed, "users/*/status", INDEX_EQUALITY, NULL) == 0);
+        char path[64];
+        uint64_t gv = 1;
+        for (int u = 0; u < MATCHES; u++) {
+            snprintf(path, sizeof(path), "users/u%07d/status", u);
+            assert(document_set_field_path(plain, path, "banned", gv) == 0);
+            assert(index_set_set_field(set, indexed, path, "banned", gv++) == 0);
+        }
+        double write = time_writes(NULL, plain, users, &gv);
+        double write_indexed = time_writes(set, indexed, users, &gv);
+        int walks = users >= 100000 ? 5 : 50;
+        printf("%-10d %12.3f %12.4f %14.2f %14.2f\n", users, time_find(NULL, plain, walks),
+               time_find(set, indexed, LOOKUPS), write, write_indexed);
+        index_set_free(set);
+        document_free(plain);
+        document_free(indexed);
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+/* Counter benchmark: threads bumping one hot counter, either with a get
+ * followed by a set, as clients had to, or with incr. Reports updates per
+ * second and how many updates the get-then-set pairs lost. Build with
+ * `make bench_incr`; the argument is the updates per run. */
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/utils/document.h"
+
+struct run {
+    Document root;
+    int updates;
+    int use_incr;
+};
+
+static _Atomic uint64_t next_version = 1;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *worker(void *arg) {
+    struct run *r = arg;
+    char value[32];
+    for (int i = 0; i < r->updates; i++) {
+        if (r->use_incr) {
+            assert(document_incr_path(r->root, "stats/hits", 1, next_version++, NULL) == 0);
+            continue;
+        }
+        char *current = document_get_field(r->root, "stats/hits", UINT64_MAX);
+        long long n = current && current != (char *)DELETED ? atoll(current) : 0;
+        if (current != (char *)DELETED) free(current);
+        snprintf(value, sizeof(value), "%lld", n + 1);
+        assert(document_set_field_path(r->root, "stats/hits", value, next_version++) == 0);
+    }
+    return NULL;
+}
+
+/* Updates per second; the counter's final value goes to *final_out. */
+static double time_run(int threads, int updates, int use_incr, long long *final_out) {
+    Document root = document_create();
+    assert(root);
+    pthread_t tids[64];
+    struct run r = {root, updates / threads, use_incr};
+    double t0 = now_ms();
+    for (int i = 0; i < threads; i++) assert(pthread_create(&tids[i], NULL, worker, &r) == 0);
+    for (int i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+    double ms = now_ms() - t0;
+    char *final = document_get_field(root, "stats/hits", UINT64_MAX);
+    *final_out = final ? atoll(final) : 0;
+    free(final);
+    document_free(root);
+    return r.updates * (double)threads / ms * 1e3;
+}
+
+int main(int argc, char **argv) {
+    int updates = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (updates < 1000) updates = 1000;
+    printf("%-8s %16s %10s %16s %10s\n", "threads", "get+set /s", "lost", "incr /s", "lost");
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        long long racy, atomic;
+        double pairs = time_run(threads, updates, 0, &racy);
+        double incrs = time_run(threads, updates, 1, &atomic);
+        long long expected = (long long)(updates / threads) * threads;
+        printf("%-8d %16.0f %10lld %16.0f %10lld\n", threads, pairs, expected - racy, incrs,
+               expected - atomic);
+    }
+    return 0;
+}
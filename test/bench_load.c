@@ -0,0 +1,85 @@
+/* Load benchmark: time to load a v1 snapshot against the number of workers
+ * decoding its top-level subtrees, best of a few runs each, with the
+ * speedup over one worker. Build with `make bench_load`; the argument is
+ * the number of top-level subtrees. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/utils/document.h"
+#include "../src/utils/parallel.h"
+#include "../src/utils/version_node.h"
+
+#define BENCH_FILE "bench-load.fortdb"
+#define DEFAULT_TENANTS 256
+#define USERS_PER_TENANT 200
+#define RUNS 5
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Tenants at the top level, each with users holding a few fields, some of
+ * them rewritten, so every segment has versions and nested Documents. */
+static VersionNode build(int tenants) {
+    Document root = document_create();
+    assert(root);
+    char path[128], value[64];
+    uint64_t gv = 1;
+    for (int t = 0; t < tenants; t++) {
+        for (int u = 0; u < USERS_PER_TENANT; u++) {
+            snprintf(path, sizeof(path), "tenant-%04d/user-%04d/name", t, u);
+            snprintf(value, sizeof(value), "User %d of tenant %d", u, t);
+            assert(document_set_field_path(root, path, value, gv++) == 0);
+            snprintf(path, sizeof(path), "tenant-%04d/user-%04d/plan", t, u);
+            assert(document_set_field_path(root, path, u % 3 ? "free" : "pro", gv++) == 0);
+            if (u % 4 == 0) assert(document_set_field_path(root, path, "team", gv++) == 0);
+        }
+    }
+    VersionNode node = version_node_create(root, gv, 1, NULL, (void (*)(void *))document_free);
+    assert(node);
+    return node;
+}
+
+static double time_load(size_t workers) {
+    double best = 0;
+    for (int run = 0; run < RUNS; run++) {
+        VersionNode loaded = NULL;
+        double t0 = now_ms();
+        assert(deserialize_db_with_workers(BENCH_FILE, workers, &loaded) == 0 && loaded);
+        double ms = now_ms() - t0;
+        version_node_free(loaded);
+        if (run == 0 || ms < best) best = ms;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int tenants = argc > 1 ? atoi(argv[1]) : DEFAULT_TENANTS;
+    if (tenants < 1) tenants = 1;
+    VersionNode root = build(tenants);
+    SerializeOptions v1 = {.format_version = 1};
+    assert(serialize_db_with_options(root, BENCH_FILE, &v1) == 0);
+    version_node_free(root);
+    struct stat st;
+    assert(stat(BENCH_FILE, &st) == 0);
+
+    size_t cores = parallel_default_workers();
+    printf("%d subtrees, %.1f MB, %zu cores\n", tenants, st.st_size / 1e6, cores);
+    printf("%-8s %12s %10s\n", "workers", "load ms", "speedup");
+    double one = time_load(1);
+    printf("%-8d %12.1f %10.2f\n", 1, one, 1.0);
+    for (size_t workers = 2; workers <= 8 || workers <= cores; workers *= 2) {
+        double ms = time_load(workers);
+        printf("%-8zu %12.1f %10.2f\n", workers, ms, one / ms);
+    }
+    remove(BENCH_FILE);
+    return 0;
+}
@@ -0,0 +1,77 @@
+/* Command parser benchmark: the single-pass tokenizer and table lookup
+ * against what the shell did before, strtok plus a malloc'd Instr per line,
+ * over a mix of commands. Build with `make bench_parser`. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/parser.h"
+
+#define DEFAULT_LINES 2000000
+#define LINE_CAP 96
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static const char *shapes[] = {
+    "set tenants/t-%05d/records/r-%05d/status active",
+    "get tenants/t-%05d/records/r-%05d/status",
+    "get tenants/t-%05d/records/r-%05d/status --v=2",
+    "delete tenants/t-%05d/records/r-%05d/status",
+    "list-versions tenants/t-%05d/records/r-%05d/seen",
+    "compact tenants/t-%05d/records/r-%05d",
+};
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : DEFAULT_LINES;
+    if (lines <= 0) lines = DEFAULT_LINES;
+    size_t shape_count = sizeof(shapes) / sizeof(shapes[0]);
+    char *text = malloc((size_t)lines * LINE_CAP), *work = malloc((size_t)lines * LINE_CAP);
+    assert(text && work);
+    for (int i = 0; i < lines; i++) {
+        snprintf(text + (size_t)i * LINE_CAP, LINE_CAP, shapes[i % shape_count], i % 997, i);
+    }
+
+    /* Both parsers write into their line, so each gets a fresh copy. */
+    memcpy(work, text, (size_t)lines * LINE_CAP);
+    double t0 = now_ms();
+    uint64_t ops = 0;
+    for (int i = 0; i < lines; i++) {
+        char *args[PARSE_MAX_ARGS];
+        int n = 0;
+        for (char *tok = strtok(work + (size_t)i * LINE_CAP, " "); tok && n < PARSE_MAX_ARGS;
+             tok = strtok(NULL, " ")) {
+            args[n++] = tok;
+        }
+        Instr instr = parse_args(n, args, (uint64_t)i);
+        assert(instr);
+        ops += instr->instr_type;
+        free(instr);
+    }
+    double before = now_ms() - t0;
+
+    memcpy(work, text, (size_t)lines * LINE_CAP);
+    t0 = now_ms();
+    uint64_t ops_now = 0;
+    for (int i = 0; i < lines; i++) {
+        struct Instr instr;
+        assert(parse_line(&instr, work + (size_t)i * LINE_CAP, (uint64_t)i) == 0);
+        ops_now += instr.instr_type;
+    }
+    double after = now_ms() - t0;
+    assert(ops == ops_now);
+
+    printf("%d lines\n", lines);
+    printf("%-24s %10s %12s\n", "parser", "ms", "ns/line");
+    printf("%-24s %10.1f %12.1f\n", "strtok + parse_args", before, before * 1e6 / lines);
+    printf("%-24s %10.1f %12.1f\n", "parse_line", after, after * 1e6 / lines);
+    free(text);
+    free(work);
+    return 0;
+}
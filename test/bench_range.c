@@ -0,0 +1,68 @@
+/* Range query benchmark: range on orders/<star>/total over a fixed band of
+ * values with and without a range index, as the number of orders grows
+ * while the matches stay near MATCHES. Build with `make bench_range`. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/utils/document.h"
+#include "../src/utils/value_index.h"
+
+#define MATCHES 100
+#define LOOKUPS 200
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int count(void *ctx, const char *path, const char *value) {
+    (void)path;
+    (void)value;
+    ++*(size_t *)ctx;
+    return 0;
+}
+
+/* Mean ms per range; totals are 0..orders-1, so the band holds MATCHES. */
+static double time_range(IndexSet set, Document root, int orders, int lookups) {
+    size_t found = 0;
+    double lo = orders / 2, hi = lo + MATCHES - 1;
+    double t0 = now_ms();
+    for (int i = 0; i < lookups; i++) {
+        assert(index_set_range(set, root, "orders/*/total", lo, hi, 0, count, &found) == 0);
+    }
+    double ms = (now_ms() - t0) / lookups;
+    assert(found == (size_t)MATCHES * lookups);
+    return ms;
+}
+
+int main(int argc, char **argv) {
+    int max_orders = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (max_orders < 1000) max_orders = 1000;
+    printf("%-10s %12s %12s %14s\n", "orders", "walk ms", "index ms", "index build ms");
+    for (int orders = 1000; orders <= max_orders; orders *= 10) {
+        Document root = document_create();
+        IndexSet set = index_set_create();
+        assert(root && set);
+        char path[64], value[32];
+        for (int o = 0; o < orders; o++) {
+            /* Scattered so insertion order says nothing about value order. */
+            int total = (int)((o * 7919ull) % (unsigned)orders);
+            snprintf(path, sizeof(path), "orders/o%07d/total", o);
+            snprintf(value, sizeof(value), "%d", total);
+            assert(document_set_field_path(root, path, value, (uint64_t)o + 1) == 0);
+        }
+        double walk = time_range(NULL, root, orders, orders >= 100000 ? 5 : 50);
+        double t0 = now_ms();
+        assert(index_set_add(set, root, "orders/*/total", INDEX_RANGE, NULL) == 0);
+        double build = now_ms() - t0;
+        printf("%-10d %12.3f %12.4f %14.1f\n", orders, walk, time_range(set, root, orders, LOOKUPS),
+               build);
+        index_set_free(set);
+        document_free(root);
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+/* Snapshot format benchmark: file size, save/load time and checksum verify
+ * time per format on a synthetic user-profile corpus, plain and
+ * block-compressed, plus raw CRC32C throughput. Build with
+ * `make bench_snapshot`. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../src/storage/checksum.h"
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/utils/crc32c.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define BENCH_FILE "bench-snapshot.fortdb"
+#define DEFAULT_USERS 20000
+
+static const char *cities[] = {"London", "Paris", "Berlin", "Madrid", "Rome", "Oslo"};
+static const char *plans[] = {"free", "pro", "team", "enterprise"};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Users with a handful of short fields, a few rewritten several times, and
+ * an order history under some of them. */
+static VersionNode build(int users) {
+    Document root = document_create();
+    assert(root);
+    char path[128], value[128];
+    uint64_t gv = 1;
+    srand(42);
+    for (int i = 0; i < users; i++) {
+        snprintf(path, sizeof(path), "users/user-%06d/name", i);
+        snprintf(value, sizeof(value), "User Number %d", i);
+        assert(document_set_field_path(root, path, value, gv++) == 0);
+        snprintf(path, sizeof(path), "users/user-%06d/email", i);
+        snprintf(value, sizeof(value), "user%d@example.com", i);
+        assert(document_set_field_path(root, path, value, gv++) == 0);
+        snprintf(path, sizeof(path), "users/user-%06d/city", i);
+        assert(document_set_field_path(root, path, cities[rand() % 6], gv++) == 0);
+        int logins = 1 + rand() % 4;
+        for (int v = 0; v < logins; v++) {
+            snprintf(path, sizeof(path), "users/user-%06d/last_login", i);
+            snprintf(value, sizeof(value), "%llu", (unsigned long long)(1700000000 + gv));
+            assert(document_set_field_path(root, path, value, gv++) == 0);
+            snprintf(path, sizeof(path), "users/user-%06d/plan", i);
+            assert(document_set_field_path(root, path, plans[rand() % 4], gv++) == 0);
+        }
+        if (i % 4 == 0) {
+            for (int o = 0; o < 3; o++) {
+                snprintf(path, sizeof(path), "users/user-%06d/orders/order-%d/total", i, o);
+                snprintf(value, sizeof(value), "%d.%02d", rand() % 500, rand() % 100);
+                assert(document_set_field_path(root, path, value, gv++) == 0);
+                snprintf(path, sizeof(path), "users/user-%06d/orders/order-%d/status", i, o);
+                assert(document_set_field_path(root, path, "shipped", gv++) == 0);
+            }
+        }
+    }
+    VersionNode node = version_node_create(root, gv, 1, NULL, (void (*)(void *))document_free);
+    assert(node);
+    return node;
+}
+
+/* Read every user's name so lazily loaded formats pay their decode cost. */
+static void touch(VersionNode root, int users) {
+    char path[128];
+    for (int i = 0; i < users; i += 97) {
+        snprintf(path, sizeof(path), "users/user-%06d/name", i);
+        char *val = document_get_field((Document)root->value, path, UINT64_MAX);
+        assert(val && val != (char *)DELETED);
+        free(val);
+    }
+}
+
+static void bench_crc(void) {
+    size_t len = 64u * 1024u * 1024u;
+    unsigned char *buf = malloc(len);
+    assert(buf);
+    for (size_t i = 0; i < len; i++) buf[i] = (unsigned char)(i * 131 + (i >> 9));
+    double t0 = now_ms();
+    uint32_t a = crc32c(0, buf, len);
+    double t1 = now_ms();
+    uint32_t b = crc32c_portable(0, buf, len);
+    double t2 = now_ms();
+    assert(a == b);
+    printf("crc32c: %.2f GB/s (%s), table %.2f GB/s\n", len / (t1 - t0) / 1e6,
+           crc32c_hardware() ? "sse4.2" : "table", len / (t2 - t1) / 1e6);
+    free(buf);
+}
+
+int main(int argc, char **argv) {
+    int users = argc > 1 ? atoi(argv[1]) : DEFAULT_USERS;
+    if (users <= 0) users = DEFAULT_USERS;
+    VersionNode root = build(users);
+
+    printf("%d users\n", users);
+    bench_crc();
+    printf("%-8s %12s %10s %10s %10s\n", "format", "bytes", "save ms", "load ms", "verify ms");
+    for (int i = 0; i < 6; i++) {
+        uint32_t format = 1 + i % 3;
+        SerializeOptions options = {.format_version = format, .compress = i >= 3};
+        double t0 = now_ms();
+        assert(serialize_db_with_options(root, BENCH_FILE, &options) == 0);
+        double t1 = now_ms();
+        VersionNode loaded = NULL;
+        assert(deserialize_db(BENCH_FILE, &loaded) == 0);
+        touch(loaded, users);
+        double t2 = now_ms();
+        VerifyReport report;
+        assert(checksum_verify_file(BENCH_FILE, &report) == 0 && report.bad_chunks == 0);
+        double t3 = now_ms();
+
+        struct stat st;
+        assert(stat(BENCH_FILE, &st) == 0);
+        printf("v%u%-6s %12lld %10.1f %10.1f %10.1f\n", format, options.compress ? "+lz" : "",
+               (long long)st.st_size, t1 - t0, t2 - t1, t3 - t2);
+        version_node_free(loaded);
+    }
+
+    remove(BENCH_FILE);
+    version_node_free(root);
+    return 0;
+}
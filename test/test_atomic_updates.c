@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/utils/document.h"
+#include "../src/utils/value_index.h"
+
+#define THREADS 8
+#define ROUNDS 20000
+
+struct worker {
+    Document root;
+    IndexSet set;
+    int id;
+};
+
+static _Atomic uint64_t next_version = 100;
+
+static void check_int(Document root, const char *path, uint64_t version, int64_t expected) {
+    Value v;
+    assert(document_get_value(root, path, version, &v) == 0);
+    assert(v.type == VALUE_INT64 && v.i == expected);
+}
+
+static void *hammer(void *arg) {
+    struct worker *w = arg;
+    char own[32];
+    snprintf(own, sizeof(own), "per/%d/hits", w->id);
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(index_set_incr(w->set, w->root, "hot/hits", 1, next_version++, NULL) == 0);
+        assert(index_set_incr(w->set, w->root, own, 2, next_version++, NULL) == 0);
+        if (i % 100 == 0) {
+            assert(index_set_append(w->set, w->root, "hot/log", "x", 1, next_version++,
+                                    NULL) == 0);
+        }
+    }
+    return NULL;
+}
+
+static int count_match(void *ctx, const char *path, const char *value) {
+    (void)path;
+    (void)value;
+    ++*(size_t *)ctx;
+    return 0;
+}
+
+static void test_types(void) {
+    Document root = document_create();
+    assert(root);
+    int64_t total = 0;
+
+    /* Absent fields count as 0, and the result is an int. */
+    assert(document_incr_path(root, "c/a", 5, 1, &total) == 0 && total == 5);
+    assert(document_incr_path(root, "c/a", -7, 2, &total) == 0 && total == -2);
+    check_int(root, "c/a", UINT64_MAX, -2);
+    check_int(root, "c/a", 1, 5);
+
+    /* A string holding an int is taken up; anything else is refused and
+     * leaves no version behind. */
+    assert(document_set_field_path(root, "c/text", "40", 3) == 0);
+    assert(document_incr_path(root, "c/text", 2, 4, &total) == 0 && total == 42);
+    check_int(root, "c/text", 2, 42);
+    assert(document_set_field_path(root, "c/word", "forty", 5) == 0);
+    assert(document_incr_path(root, "c/word", 1, 6, NULL) == 1);
+    assert(document_set_value_path(root, "c/flag", &(Value){.type = VALUE_BOOL, .b = 1}, 7) == 0);
+    assert(document_incr_path(root, "c/flag", 1, 8, NULL) == 1);
+    assert(document_set_value_path(root, "c/max", &(Value){.type = VALUE_INT64, .i = INT64_MAX},
+                                   9) == 0);
+    assert(document_incr_path(root, "c/max", 1, 10, NULL) == 1);
+    assert(document_incr_path(root, "c/max", INT64_MIN, 11, &total) == 0 && total == -1);
+    Value v;
+    assert(document_get_value(root, "c/word", 2, &v) == 1);
+    assert(document_get_value(root, "c/max", 2, &v) == 0 && v.i == -1);
+    assert(document_get_value(root, "c/max", 3, &v) == 1);
+
+    /* A deleted counter starts over. */
+    assert(document_delete_path(root, "c/a", 12) == 0);
+    assert(document_incr_path(root, "c/a", 3, 13, &total) == 0 && total == 3);
+    check_int(root, "c/a", 4, 3);
+
+    /* Appends keep the type, and bytes keep their NULs. */
+    size_t length = 0;
+    assert(document_append_path(root, "s/new", "ab", 2, 14, &length) == 0 && length == 2);
+    assert(document_append_path(root, "s/new", "cd", 2, 15, &length) == 0 && length == 4);
+    char *text = document_get_field(root, "s/new", UINT64_MAX);
+    assert(text && strcmp(text, "abcd") == 0);
+    free(text);
+    text = document_get_field(root, "s/new", 1);
+    assert(text && strcmp(text, "ab") == 0);
+    free(text);
+    static const unsigned char head[] = {0, 1}, tail[] = {0, 2};
+    assert(document_set_value_path(root, "s/blob", &(Value){.type = VALUE_BYTES, .data = head,
+                                                           .length = 2}, 16) == 0);
+    assert(document_append_path(root, "s/blob", tail, 2, 17, &length) == 0 && length == 4);
+    assert(document_get_value(root, "s/blob", UINT64_MAX, &v) == 0);
+    assert(v.type == VALUE_BYTES && v.length == 4 && memcmp(v.data, "\0\1\0\2", 4) == 0);
+    value_clear(&v);
+    assert(document_append_path(root, "c/max", "x", 1, 18, NULL) == 1);
+    assert(document_append_path(root, "s/new", "", 0, 19, &length) == 0 && length == 4);
+
+    document_free(root);
+}
+
+int main(void) {
+    test_types();
+
+    /* Racing increments and appends lose nothing, and indexes follow. */
+    Document root = document_create();
+    IndexSet set = index_set_create();
+    assert(root && set);
+    assert(index_set_add(set, root, "per/*/hits", INDEX_RANGE, NULL) == 0);
+    pthread_t threads[THREADS];
+    struct worker workers[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        workers[i] = (struct worker){root, set, i};
+        assert(pthread_create(&threads[i], NULL, hammer, &workers[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+
+    check_int(root, "hot/hits", UINT64_MAX, (int64_t)THREADS * ROUNDS);
+    /* One version per increment, each one more than the last. */
+    check_int(root, "hot/hits", (uint64_t)THREADS * ROUNDS, (int64_t)THREADS * ROUNDS);
+    check_int(root, "hot/hits", 1, 1);
+    check_int(root, "per/3/hits", UINT64_MAX, 2 * ROUNDS);
+    Value v;
+    assert(document_get_value(root, "hot/log", UINT64_MAX, &v) == 0);
+    assert(v.length == (size_t)THREADS * (ROUNDS / 100));
+    value_clear(&v);
+
+    size_t found = 0;
+    assert(index_set_range(set, root, "per/*/hits", 2 * ROUNDS, 2 * ROUNDS, 0, count_match,
+                           &found) == 0);
+    assert(found == THREADS);
+    found = 0;
+    assert(index_set_range(set, root, "per/*/hits", 0, 2 * ROUNDS - 1, 0, count_match,
+                           &found) == 0);
+    assert(found == 0);
+
+    index_set_free(set);
+    document_free(root);
+    puts("Atomic update tests passed.");
+    return 0;
+}
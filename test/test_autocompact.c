@@ -0,0 +1,200 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/storage/autocompact.h"
+#include "../src/storage/compactor.h"
+#include "../src/storage/deserializer.h"
+#include "../src/storage/retention.h"
+#include "../src/storage/serializer.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define TEST_FILE "autocompact.fortdb"
+#define TENANTS 16
+#define KEYS 32
+#define READERS 3
+
+static size_t chain_length(Document doc, const char *path) {
+    Document parent = NULL;
+    char *key = NULL;
+    assert(resolve_parent_and_key(doc, path, &parent, &key, 0, 0) == 0);
+    assert(document_materialize_history(parent) == 0);
+    Entry e = hashmap_find_entry(parent->fields, key);
+    assert(e);
+    size_t n = 0;
+    for (VersionNode v = e->value; v; v = v->prev) n++;
+    document_free(parent);
+    free(key);
+    return n;
+}
+
+static Document subtree(Document doc, const char *path) {
+    Document sub = document_get_subdocument_path(doc, path);
+    assert(sub);
+    return sub;
+}
+
+/* Every map counts the versions below its heads, however they got there. */
+static void test_accounting(void) {
+    Document doc = document_create();
+    assert(doc);
+    for (uint64_t gv = 1; gv <= 5; gv++) {
+        assert(document_set_field_path(doc, "users/alice/email", "alice@example.com", gv) == 0);
+    }
+    assert(document_set_field_path(doc, "users/bob/email", "bob@example.com", 6) == 0);
+    Document alice = subtree(doc, "users/alice");
+    assert(alice->fields->history_versions == 4);
+    uint64_t bytes = alice->fields->history_bytes;
+    assert(bytes >= 4 * (sizeof(struct VersionNode) + strlen("alice@example.com") + 1));
+    document_free(alice);
+
+    VersionNode root = version_node_create(doc, 6, 1, NULL, (void (*)(void *))document_free);
+    assert(root);
+    for (uint32_t format = 1; format <= 3; format++) {
+        SerializeOptions options = {.format_version = format};
+        assert(serialize_db_with_options(root, TEST_FILE, &options) == 0);
+        VersionNode loaded = NULL;
+        assert(deserialize_db(TEST_FILE, &loaded) == 0 && loaded);
+        Document copy = subtree((Document)loaded->value, "users/alice");
+        /* v2 links history in lazily; it is counted when it arrives. */
+        assert(document_materialize_history(copy) == 0);
+        assert(copy->fields->history_versions == 4 && copy->fields->history_bytes == bytes);
+        document_free(copy);
+        version_node_free(loaded);
+    }
+
+    CompactStats stats;
+    assert(compactor_compact_incremental(root, NULL, NULL, &stats) == 0);
+    assert(stats.versions_freed == 4 && stats.bytes_freed == bytes);
+    alice = subtree(doc, "users/alice");
+    assert(alice->fields->history_versions == 0 && alice->fields->history_bytes == 0);
+    document_free(alice);
+    version_node_free(root);
+    remove(TEST_FILE);
+}
+
+struct shared {
+    VersionNode root;
+    atomic_int stop;
+    atomic_uint_fast64_t reads;
+};
+
+static void *reader(void *arg) {
+    struct shared *s = arg;
+    char path[64];
+    unsigned seed = (unsigned)(uintptr_t)&path;
+    while (!atomic_load(&s->stop)) {
+        snprintf(path, sizeof(path), "t%02d/k%02d", rand_r(&seed) % TENANTS, rand_r(&seed) % KEYS);
+        assert(pthread_rwlock_rdlock(&s->root->lock) == 0);
+        char *val = document_get_path((Document)s->root->value, path, UINT64_MAX);
+        pthread_rwlock_unlock(&s->root->lock);
+        assert(val && val != (char *)DELETED);
+        free(val);
+        atomic_fetch_add(&s->reads, 1);
+    }
+    return NULL;
+}
+
+static void write_round(VersionNode root, uint64_t gv) {
+    char path[64], value[32];
+    snprintf(value, sizeof(value), "v%llu", (unsigned long long)gv);
+    assert(pthread_rwlock_rdlock(&root->lock) == 0);
+    for (int t = 0; t < TENANTS; t++) {
+        for (int k = 0; k < KEYS; k++) {
+            snprintf(path, sizeof(path), "t%02d/k%02d", t, k);
+            assert(document_set_field_path((Document)root->value, path, value, gv) == 0);
+        }
+    }
+    assert(document_set_field_path((Document)root->value, "top", value, gv) == 0);
+    pthread_rwlock_unlock(&root->lock);
+}
+
+static AutoCompactStatus wait_for(AutoCompact ac, uint64_t samples) {
+    AutoCompactStatus status;
+    for (int i = 0; i < 2000; i++) {
+        autocompact_status(ac, &status);
+        if (status.samples >= samples && !status.current[0]) return status;
+        autocompact_poke(ac);
+        nanosleep(&(struct timespec){0, 5 * 1000 * 1000}, NULL);
+    }
+    assert(!"autocompact made no progress");
+    return status;
+}
+
+/* The thread compacts while readers and a writer keep going, and what the
+ * policy keeps is neither freed nor compacted over and over. */
+static void test_background(void) {
+    Document doc = document_create();
+    assert(doc);
+    VersionNode root = version_node_create(doc, 0, 0, NULL, (void (*)(void *))document_free);
+    assert(root);
+    uint64_t gv = 1;
+    write_round(root, gv++);
+
+    RetentionPolicy policy = retention_policy_create();
+    RetentionRule keep = {.keep_versions = 3};
+    assert(policy && retention_policy_set(policy, "t00", &keep) == 0);
+
+    AutoCompactConfig config;
+    autocompact_config_defaults(&config);
+    config.max_history_versions = TENANTS * KEYS;
+    config.max_history_bytes = 0;
+    config.interval_millis = 5;
+    config.subtrees_per_round = 0;
+    config.budget.max_entries = 16;
+    AutoCompact ac = autocompact_start(root, policy, &config);
+    assert(ac);
+
+    struct shared s = {.root = root};
+    pthread_t threads[READERS];
+    for (int i = 0; i < READERS; i++) assert(pthread_create(&threads[i], NULL, reader, &s) == 0);
+    for (int round = 0; round < 40; round++) write_round(root, gv++);
+    AutoCompactStatus status = wait_for(ac, 1);
+    atomic_store(&s.stop, 1);
+    for (int i = 0; i < READERS; i++) pthread_join(threads[i], NULL);
+    assert(atomic_load(&s.reads) > 0);
+
+    /* Quiet now. What the last writes left may sit under the threshold, so
+     * one more round of writes crosses it; the first sample taken wholly
+     * after that round compacts everything. */
+    for (int i = 0; i < 5; i++) {
+        write_round(root, gv++);
+        autocompact_status(ac, &status);
+        status = wait_for(ac, status.samples + 2);
+        if (status.reclaimable_versions == 0) break;
+    }
+    assert(status.rounds > 0 && status.subtrees > 0);
+    assert(status.versions_freed > 0 && status.bytes_freed > 0);
+    assert(status.reclaimable_versions == 0);
+    assert(chain_length(doc, "t00/k00") == 3);
+    assert(chain_length(doc, "t05/k31") == 1);
+    assert(chain_length(doc, "top") == 1);
+    char expected[32];
+    snprintf(expected, sizeof(expected), "v%llu", (unsigned long long)(gv - 1));
+    char *val = document_get_path(doc, "t05/k31", UINT64_MAX);
+    assert(val && strcmp(val, expected) == 0);
+    free(val);
+
+    /* History the policy keeps does not trigger further rounds. */
+    uint64_t rounds = status.rounds;
+    status = wait_for(ac, status.samples + 3);
+    assert(status.rounds == rounds);
+    assert(status.history_versions == (KEYS * 2));
+
+    autocompact_stop(ac);
+    retention_policy_free(policy);
+    version_node_free(root);
+}
+
+int main(void) {
+    test_accounting();
+    test_background();
+    puts("Autocompact tests passed.");
+    return 0;
+}
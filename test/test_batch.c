@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/batch.h"
+#include "../src/utils/document.h"
+#include "../src/utils/reclaim.h"
+#include "../src/utils/version_node.h"
+
+#define LINES 60000
+
+static Session make_session(void) {
+    Document doc = document_create();
+    assert(doc);
+    VersionNode root = version_node_create(doc, 0, 0, NULL, (void (*)(void *))document_free);
+    assert(root);
+    Session session = {.root = root, .retention = retention_policy_create()};
+    assert(session.retention);
+    return session;
+}
+
+static void free_session(Session *session) {
+    autocompact_stop(session->autocompact);
+    if (session->snapshot) snapshot_release(session->snapshot);
+    retention_policy_free(session->retention);
+    version_node_free(session->root);
+    reclaim_barrier();
+}
+
+/* Run script, returning batch_run's result and what went to out and err. */
+static int run(Session *session, const char *script, char **out, char **err) {
+    FILE *in = fmemopen((void *)script, strlen(script), "r");
+    size_t out_len, err_len;
+    FILE *o = open_memstream(out, &out_len), *e = open_memstream(err, &err_len);
+    assert(in && o && e);
+    int ret = batch_run(session, in, "script", o, e);
+    fclose(in);
+    fclose(o);
+    fclose(e);
+    return ret;
+}
+
+/* Comments, blank lines, CRLF, a last line with no newline, and errors
+ * reported by line number. */
+static void test_script(void) {
+    Session session = make_session();
+    char *out, *err;
+    int ret = run(&session,
+                  "# fixture\n"
+                  "set users/alice/age 30\r\n"
+                  "\n"
+                  "   \n"
+                  "set users/alice/age 31\n"
+                  "frobnicate users\n"
+                  "list-versions users/alice/age\n"
+                  "get users/alice/age",
+                  &out, &err);
+    assert(ret == 1);
+    assert(strcmp(out, "OK\nOK\nv2: 31\nv1: 30\n31\n") == 0);
+    assert(strcmp(err, "script:6: Invalid command or arguments.\n") == 0);
+    free(out);
+    free(err);
+
+    /* exit stops the script. */
+    ret = run(&session, "delete users/alice/age\nexit\nset users/alice/age 32\n", &out, &err);
+    assert(ret == 0 && strcmp(out, "OK\n") == 0 && strcmp(err, "") == 0);
+    free(out);
+    free(err);
+    ret = run(&session, "get users/alice/age\n", &out, &err);
+    assert(ret == 0 && strcmp(out, "Value not found.\n") == 0);
+    free(out);
+    free(err);
+    free_session(&session);
+}
+
+/* A script several chunks long, with lines cut at the chunk boundaries and
+ * one line longer than a chunk. */
+static void test_chunks(void) {
+    Session session = make_session();
+    FILE *in = tmpfile();
+    assert(in);
+    for (int i = 0; i < LINES; i++) fprintf(in, "set keys/k%05d value-%d\n", i, i);
+    size_t long_len = BATCH_CHUNK + BATCH_CHUNK / 2;
+    char *value = malloc(long_len + 1);
+    assert(value);
+    memset(value, 'x', long_len);
+    value[long_len] = '\0';
+    fprintf(in, "set keys/long %s\nget keys/k%05d\n", value, LINES - 1);
+    rewind(in);
+
+    char *out;
+    size_t out_len;
+    FILE *o = open_memstream(&out, &out_len);
+    assert(o);
+    assert(batch_run(&session, in, "big", o, stderr) == 0);
+    fclose(o);
+    fclose(in);
+    char expected[32];
+    snprintf(expected, sizeof(expected), "OK\nvalue-%d\n", LINES - 1);
+    assert(out_len == 3 * (size_t)LINES + strlen(expected));
+    assert(strcmp(out + out_len - strlen(expected), expected) == 0);
+    free(out);
+
+    Document doc = (Document)session.root->value;
+    char path[32];
+    for (int i = 0; i < LINES; i += 997) {
+        snprintf(path, sizeof(path), "keys/k%05d", i);
+        char *val = document_get_field(doc, path, UINT64_MAX);
+        snprintf(expected, sizeof(expected), "value-%d", i);
+        assert(val && strcmp(val, expected) == 0);
+        free(val);
+    }
+    char *val = document_get_field(doc, "keys/long", UINT64_MAX);
+    assert(val && strcmp(val, value) == 0);
+    free(val);
+    free(value);
+    free_session(&session);
+}
+
+int main(void) {
+    test_script();
+    test_chunks();
+    puts("Batch tests passed.");
+    return 0;
+}
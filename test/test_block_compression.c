@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/storage/blocks.h"
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/storage/snapshot.h"
+#include "../src/utils/document.h"
+#include "../src/utils/lz.h"
+#include "../src/utils/version_node.h"
+
+#define PLAIN_FILE "blocks-plain.fortdb"
+#define PACKED_FILE "blocks-packed.fortdb"
+#define USERS 2000
+
+static void roundtrip(const unsigned char *src, size_t n) {
+    size_t cap = lz_compress_bound(n);
+    unsigned char *packed = malloc(cap);
+    unsigned char *out = malloc(n ? n : 1);
+    assert(packed && out);
+    size_t len = lz_compress(src, n, packed, cap);
+    assert(len > 0 && len <= cap);
+    assert(lz_decompress(packed, len, out, n) == 0);
+    assert(memcmp(src, out, n) == 0);
+    /* Wrong sizes and truncated input are rejected. */
+    if (n > 0) assert(lz_decompress(packed, len, out, n - 1) != 0);
+    if (len > 1) assert(lz_decompress(packed, len - 1, out, n) != 0);
+    free(packed);
+    free(out);
+}
+
+static void test_codec(void) {
+    static unsigned char buf[300000];
+    roundtrip(buf, 0);
+    roundtrip((const unsigned char *)"a", 1);
+    roundtrip((const unsigned char *)"abcdefghijklmnop", 16);
+    memset(buf, 'x', sizeof(buf));
+    roundtrip(buf, sizeof(buf));
+    srand(7);
+    for (size_t i = 0; i < sizeof(buf); i++) buf[i] = (unsigned char)rand();
+    roundtrip(buf, sizeof(buf));
+    for (size_t i = 0; i < sizeof(buf); i++) buf[i] = "users/alice/"[i % 12] + (i % 1000 == 0);
+    roundtrip(buf, sizeof(buf));
+
+    /* Repetitive data compresses, random data must not fit a tight cap. */
+    unsigned char *dst = malloc(sizeof(buf));
+    assert(dst);
+    memset(buf, 'x', sizeof(buf));
+    assert(lz_compress(buf, sizeof(buf), dst, sizeof(buf)) < sizeof(buf) / 100);
+    for (size_t i = 0; i < sizeof(buf); i++) buf[i] = (unsigned char)rand();
+    assert(lz_compress(buf, sizeof(buf), dst, sizeof(buf) / 2) == 0);
+    free(dst);
+}
+
+static long file_size(const char *file) {
+    struct stat st;
+    assert(stat(file, &st) == 0);
+    return (long)st.st_size;
+}
+
+static void check_field(Document doc, const char *path, uint64_t version, const char *expected) {
+    char *val = document_get_field(doc, path, version);
+    assert(val && val != (char *)DELETED);
+    assert(strcmp(val, expected) == 0);
+    free(val);
+}
+
+static void check_tree(VersionNode root) {
+    Document doc = (Document)root->value;
+    char path[96], value[64];
+    for (int i = 0; i < USERS; i += 37) {
+        snprintf(path, sizeof(path), "users/user-%05d/email", i);
+        snprintf(value, sizeof(value), "user%d@example.com", i);
+        check_field(doc, path, UINT64_MAX, value);
+        snprintf(path, sizeof(path), "users/user-%05d/plan", i);
+        check_field(doc, path, UINT64_MAX, "pro");
+        check_field(doc, path, 1, "free");
+    }
+    for (int i = 0; i < 20; i++) {
+        snprintf(path, sizeof(path), "tenant-%02d/owner", i);
+        snprintf(value, sizeof(value), "owner-%d", i);
+        check_field(doc, path, UINT64_MAX, value);
+    }
+}
+
+static size_t ready_blocks(BlockImage img) {
+    size_t n = 0;
+    for (uint64_t i = 0; i < img->block_count; i++) n += atomic_load(&img->ready[i]) != 0;
+    return n;
+}
+
+int main(void) {
+    test_codec();
+
+    Document doc = document_create();
+    assert(doc);
+    char path[96], value[64];
+    for (int i = 0; i < USERS; i++) {
+        snprintf(path, sizeof(path), "users/user-%05d/email", i);
+        snprintf(value, sizeof(value), "user%d@example.com", i);
+        assert(document_set_field_path(doc, path, value, 1) == 0);
+        snprintf(path, sizeof(path), "users/user-%05d/plan", i);
+        assert(document_set_field_path(doc, path, "free", 1) == 0);
+        assert(document_set_field_path(doc, path, "pro", 2) == 0);
+    }
+    for (int i = 0; i < 20; i++) {
+        snprintf(path, sizeof(path), "tenant-%02d/owner", i);
+        snprintf(value, sizeof(value), "owner-%d", i);
+        assert(document_set_field_path(doc, path, value, 1) == 0);
+    }
+    VersionNode root = version_node_create(doc, 1, 1, NULL, (void (*)(void *))document_free);
+    assert(root);
+
+    for (uint32_t format = 1; format <= 3; format++) {
+        SerializeOptions plain = {.format_version = format};
+        SerializeOptions packed = {.format_version = format, .compress = 1, .block_size = 4096};
+        assert(serialize_db_with_options(root, PLAIN_FILE, &plain) == 0);
+        assert(serialize_db_with_options(root, PACKED_FILE, &packed) == 0);
+        assert(file_size(PACKED_FILE) < file_size(PLAIN_FILE));
+
+        VersionNode loaded = NULL;
+        assert(deserialize_db(PACKED_FILE, &loaded) == 0 && loaded);
+        check_tree(loaded);
+        version_node_free(loaded);
+    }
+
+    /* A compressed v2 image stays lazy: one lookup decompresses a handful
+     * of blocks, not the file. */
+    SerializeOptions v2 = {.compress = 1, .block_size = 4096};
+    assert(serialize_db_with_options(root, PACKED_FILE, &v2) == 0);
+    Snapshot snap = NULL;
+    assert(snapshot_open(PACKED_FILE, &snap) == 0 && snap && snap->blocks);
+    char *val = NULL;
+    assert(snapshot_get_field(snap, "users/user-01234/email", UINT64_MAX, &val) == 0);
+    assert(strcmp(val, "user1234@example.com") == 0);
+    free(val);
+    assert(snap->blocks->block_count > 20);
+    assert(ready_blocks(snap->blocks) < snap->blocks->block_count / 4);
+    snapshot_release(snap);
+
+    /* Block sizes outside the supported range are refused. */
+    SerializeOptions tiny = {.compress = 1, .block_size = 16};
+    assert(serialize_db_with_options(root, PACKED_FILE, &tiny) != 0);
+
+    /* A truncated container is rejected. */
+    long size = file_size(PACKED_FILE);
+    assert(truncate(PACKED_FILE, size - 5) == 0);
+    VersionNode loaded = NULL;
+    assert(deserialize_db(PACKED_FILE, &loaded) != 0 && !loaded);
+
+    version_node_free(root);
+    remove(PLAIN_FILE);
+    remove(PACKED_FILE);
+    puts("Block compression tests passed.");
+    return 0;
+}
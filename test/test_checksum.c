@@ -0,0 +1,152 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/storage/checksum.h"
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/storage/snapshot.h"
+#include "../src/utils/crc32c.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define TEST_FILE "checksum.fortdb"
+#define USERS 4000
+
+static void test_crc32c(void) {
+    assert(crc32c(0, "123456789", 9) == 0xe3069283u);
+    assert(crc32c_portable(0, "123456789", 9) == 0xe3069283u);
+    assert(crc32c(0, "", 0) == 0);
+
+    /* Both paths agree at every length and alignment, and chain. */
+    static unsigned char buf[4096];
+    srand(11);
+    for (size_t i = 0; i < sizeof(buf); i++) buf[i] = (unsigned char)rand();
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t len = 0; len + off <= sizeof(buf); len += 61) {
+            uint32_t a = crc32c(0, buf + off, len);
+            assert(a == crc32c_portable(0, buf + off, len));
+            assert(a == crc32c(crc32c(0, buf + off, len / 3), buf + off + len / 3, len - len / 3));
+        }
+    }
+}
+
+static void check_field(Document doc, const char *path, const char *expected) {
+    char *val = document_get_field(doc, path, UINT64_MAX);
+    assert(val && val != (char *)DELETED);
+    assert(strcmp(val, expected) == 0);
+    free(val);
+}
+
+static uint64_t image_size(const char *file) {
+    FileImage img = NULL;
+    assert(file_image_open(file, &img) == 0 && img->crcs);
+    uint64_t size = img->size;
+    file_image_close(img);
+    return size;
+}
+
+static void flip_byte(const char *file, uint64_t offset) {
+    FILE *f = fopen(file, "r+b");
+    assert(f);
+    assert(fseeko(f, (off_t)offset, SEEK_SET) == 0);
+    int c = fgetc(f);
+    assert(c != EOF);
+    assert(fseeko(f, (off_t)offset, SEEK_SET) == 0);
+    assert(fputc(c ^ 0x20, f) != EOF);
+    assert(fclose(f) == 0);
+}
+
+/* Corrupt one byte in the middle of the image; the checksums must catch it
+ * before the decoder sees it. */
+static void test_corruption(VersionNode root, uint32_t format, int compress) {
+    SerializeOptions options = {.format_version = format, .compress = compress};
+    assert(serialize_db_with_options(root, TEST_FILE, &options) == 0);
+
+    VerifyReport report;
+    assert(checksum_verify_file(TEST_FILE, &report) == 0);
+    assert(report.has_checksums && report.chunks > 0 && report.bad_chunks == 0);
+
+    uint64_t size = image_size(TEST_FILE);
+    flip_byte(TEST_FILE, size / 2);
+    assert(checksum_verify_file(TEST_FILE, &report) == 0);
+    assert(report.bad_chunks == 1);
+    assert(report.first_bad == size / 2 / report.chunk_size);
+
+    VersionNode loaded = NULL;
+    if (format == 2) {
+        /* v2 loads lazily, so the damage surfaces on the reads that reach it. */
+        Snapshot snap = NULL;
+        assert(snapshot_open(TEST_FILE, &snap) == 0);
+        char path[96];
+        int failed = 0;
+        for (int i = 0; i < USERS; i++) {
+            char *val = NULL;
+            snprintf(path, sizeof(path), "users/user-%05d/email", i);
+            if (snapshot_get_field(snap, path, UINT64_MAX, &val) != 0) failed++;
+            else free(val);
+        }
+        assert(failed > 0 && failed < USERS);
+        snapshot_release(snap);
+    } else {
+        assert(deserialize_db(TEST_FILE, &loaded) != 0 && !loaded);
+    }
+
+    /* A damaged footer is refused outright. */
+    assert(serialize_db_with_options(root, TEST_FILE, &options) == 0);
+    flip_byte(TEST_FILE, image_size(TEST_FILE));
+    assert(deserialize_db(TEST_FILE, &loaded) != 0 && !loaded);
+    assert(checksum_verify_file(TEST_FILE, &report) != 0);
+}
+
+int main(void) {
+    test_crc32c();
+
+    Document doc = document_create();
+    assert(doc);
+    char path[96], value[64];
+    for (int i = 0; i < USERS; i++) {
+        snprintf(path, sizeof(path), "users/user-%05d/email", i);
+        snprintf(value, sizeof(value), "user%d@example.com", i);
+        assert(document_set_field_path(doc, path, value, 1) == 0);
+    }
+    VersionNode root = version_node_create(doc, 1, 1, NULL, (void (*)(void *))document_free);
+    assert(root);
+
+    for (uint32_t format = 1; format <= 3; format++) {
+        test_corruption(root, format, 0);
+        test_corruption(root, format, 1);
+    }
+
+    /* A v2 lookup verifies only the chunks it touches. */
+    SerializeOptions v2 = {.format_version = 2};
+    assert(serialize_db_with_options(root, TEST_FILE, &v2) == 0);
+    Snapshot snap = NULL;
+    assert(snapshot_open(TEST_FILE, &snap) == 0 && snap->file);
+    char *val = NULL;
+    assert(snapshot_get_field(snap, "users/user-01234/email", UINT64_MAX, &val) == 0);
+    assert(strcmp(val, "user1234@example.com") == 0);
+    free(val);
+    size_t verified = 0;
+    for (uint64_t i = 0; i < snap->file->chunk_count; i++) verified += snap->file->verified[i] == 1;
+    assert(snap->file->chunk_count > 4 && verified < snap->file->chunk_count / 2);
+    snapshot_release(snap);
+
+    /* Files written before checksums existed still load. */
+    uint64_t size = image_size(TEST_FILE);
+    assert(truncate(TEST_FILE, (off_t)size) == 0);
+    VerifyReport report;
+    assert(checksum_verify_file(TEST_FILE, &report) == 0 && !report.has_checksums);
+    VersionNode loaded = NULL;
+    assert(deserialize_db(TEST_FILE, &loaded) == 0 && loaded);
+    check_field((Document)loaded->value, "users/user-00042/email", "user42@example.com");
+    version_node_free(loaded);
+
+    version_node_free(root);
+    remove(TEST_FILE);
+    puts("Checksum tests passed.");
+    return 0;
+}
@@ -58,7 +58,7 @@ int main() {
     print_test_result("Post-deserialize Company Location Country latest", val && strcmp(val, "United States") == 0);
 
     printf("\nPost-deserialize versions for Name:\n");
-    document_list_versions(deserialized_doc, "Name");
+    document_list_versions(deserialized_doc, "Name", stdout);
 
     version_node_free(deserialized_root);
 
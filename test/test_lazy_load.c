@@ -0,0 +1,145 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/storage/compactor.h"
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define TEST_FILE "lazy-load.fortdb"
+#define RESAVE_FILE "lazy-resave.fortdb"
+
+static unsigned pending(Document doc) {
+    return atomic_load(&doc->pending);
+}
+
+static void check_field(Document doc, const char *path, uint64_t version, const char *expected) {
+    char *val = document_get_field(doc, path, version);
+    if (!expected) {
+        assert(val == NULL || val == (char *)DELETED);
+        return;
+    }
+    assert(val && val != (char *)DELETED);
+    assert(strcmp(val, expected) == 0);
+    free(val);
+}
+
+static VersionNode build(void) {
+    Document root = document_create();
+    assert(root);
+    assert(document_set_field(root, "name", "v1", 1) == 0);
+    assert(document_set_field(root, "name", "v2", 2) == 0);
+    assert(document_set_field_path(root, "users/alice/age", "29", 1) == 0);
+    assert(document_set_field_path(root, "users/alice/age", "30", 3) == 0);
+    assert(document_set_field_path(root, "users/alice/email", "a@example.com", 1) == 0);
+    assert(document_set_field_path(root, "users/bob/age", "41", 2) == 0);
+    assert(document_delete_path(root, "users/bob/age", 4) == 0);
+    assert(document_set_field_path(root, "config/mode", "fast", 1) == 0);
+    VersionNode node = version_node_create(root, 1, 1, NULL, (void (*)(void *))document_free);
+    assert(node);
+    return node;
+}
+
+static void check_all(Document root) {
+    check_field(root, "name", UINT64_MAX, "v2");
+    check_field(root, "name", 1, "v1");
+    check_field(root, "users/alice/age", UINT64_MAX, "30");
+    check_field(root, "users/alice/age", 1, "29");
+    check_field(root, "users/alice/email", UINT64_MAX, "a@example.com");
+    check_field(root, "users/bob/age", UINT64_MAX, NULL);
+    check_field(root, "users/bob/age", 1, "41");
+    check_field(root, "config/mode", UINT64_MAX, "fast");
+}
+
+static void *reader(void *arg) {
+    Document root = arg;
+    for (int i = 0; i < 200; i++) check_all(root);
+    return NULL;
+}
+
+int main(void) {
+    VersionNode original = build();
+    assert(serialize_db(original, TEST_FILE) == 0);
+    version_node_free(original);
+
+    /* Loading decodes nothing below the root chain. */
+    VersionNode loaded = NULL;
+    assert(deserialize_db(TEST_FILE, &loaded) == 0 && loaded);
+    Document root = (Document)loaded->value;
+    assert(pending(root) & DOCUMENT_PENDING_ENTRIES);
+
+    /* A latest read materializes only the documents on its path, and only
+     * the chain heads of those. */
+    check_field(root, "users/alice/email", UINT64_MAX, "a@example.com");
+    assert(!(pending(root) & DOCUMENT_PENDING_ENTRIES));
+    assert(pending(root) & DOCUMENT_PENDING_HISTORY);
+    Document users = document_get_subdocument(root, "users", UINT64_MAX);
+    Document alice = document_get_subdocument(users, "alice", UINT64_MAX);
+    assert(users && alice);
+    assert(pending(alice) & DOCUMENT_PENDING_HISTORY);
+    Entry age = hashmap_find_entry(alice->fields, "age");
+    assert(age && !((VersionNode)age->value)->prev);
+    Entry bob = hashmap_find_entry(users->subdocuments, "bob");
+    assert(bob && (pending((Document)((VersionNode)bob->value)->value) & DOCUMENT_PENDING_ENTRIES));
+    Entry config = hashmap_find_entry(root->subdocuments, "config");
+    assert(config && (pending((Document)((VersionNode)config->value)->value) & DOCUMENT_PENDING_ENTRIES));
+
+    /* Time travel faults the history in. */
+    check_field(root, "users/alice/age", 1, "29");
+    assert(!pending(alice));
+    assert(((VersionNode)age->value)->prev);
+    document_free(alice);
+    document_free(users);
+
+    /* Concurrent first access from many readers. */
+    version_node_free(loaded);
+    assert(deserialize_db(TEST_FILE, &loaded) == 0);
+    root = (Document)loaded->value;
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) assert(pthread_create(&threads[i], NULL, reader, root) == 0);
+    for (int i = 0; i < 4; i++) assert(pthread_join(threads[i], NULL) == 0);
+
+    /* Writes after load stack on top of the snapshot heads. */
+    assert(document_set_field_path(root, "config/mode", "safe", 5) == 0);
+    check_field(root, "config/mode", UINT64_MAX, "safe");
+    check_field(root, "config/mode", 1, "fast");
+
+    /* Saving a partially materialized tree writes the complete history, in
+     * either format. */
+    SerializeOptions v1 = {.format_version = 1};
+    assert(serialize_db_with_options(loaded, RESAVE_FILE, &v1) == 0);
+    VersionNode resaved = NULL;
+    assert(deserialize_db(RESAVE_FILE, &resaved) == 0);
+    check_field((Document)resaved->value, "users/alice/age", 1, "29");
+    check_field((Document)resaved->value, "config/mode", 2, "safe");
+    version_node_free(resaved);
+    version_node_free(loaded);
+
+    assert(deserialize_db(TEST_FILE, &loaded) == 0);
+    assert(serialize_db(loaded, RESAVE_FILE) == 0);
+    version_node_free(loaded);
+    assert(deserialize_db(RESAVE_FILE, &resaved) == 0);
+    check_all((Document)resaved->value);
+    version_node_free(resaved);
+
+    /* Compacting an unloaded tree discards history without decoding it. */
+    assert(deserialize_db(TEST_FILE, &loaded) == 0);
+    root = (Document)loaded->value;
+    assert(compactor_compact(loaded) == 0);
+    assert(pending(root) & DOCUMENT_PENDING_ENTRIES);
+    check_field(root, "users/alice/age", UINT64_MAX, "30");
+    check_field(root, "users/alice/age", 1, NULL);
+    check_field(root, "name", 1, NULL);
+    check_field(root, "name", UINT64_MAX, "v2");
+    version_node_free(loaded);
+
+    remove(TEST_FILE);
+    remove(RESAVE_FILE);
+    puts("Lazy snapshot load tests passed.");
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/fortdb.h"
+
+#define SAVE_PATH "test_library.fortdb"
+#define THREADS 4
+#define KEYS 500
+
+static void expect(FortDB db, const char *path, uint64_t version, const char *value) {
+    char *got = NULL;
+    int ret = fortdb_get_version(db, path, version, &got);
+    if (!value) {
+        assert(ret == FORTDB_NOT_FOUND && !got);
+        return;
+    }
+    assert(ret == 0 && got && strcmp(got, value) == 0);
+    fortdb_free(got);
+}
+
+static int count_match(void *ctx, const char *path, const char *value) {
+    (void)path;
+    (void)value;
+    return ++*(int *)ctx == 100;
+}
+
+static void test_calls(void) {
+    FortDB db = NULL;
+    assert(fortdb_open(NULL, &db) == 0 && db);
+    expect(db, "users/alice/age", FORTDB_LATEST, NULL);
+    assert(fortdb_set(db, "users/alice/age", "30") == 0);
+    assert(fortdb_set(db, "users/alice/age", "31") == 0);
+    assert(fortdb_set(db, "users/alice/bio", "likes long walks\nand C") == 0);
+    expect(db, "users/alice/age", FORTDB_LATEST, "31");
+    expect(db, "users/alice/age", 1, "30");
+    expect(db, "users/alice/bio", FORTDB_LATEST, "likes long walks\nand C");
+    assert(fortdb_delete(db, "users/alice/age") == 0);
+    expect(db, "users/alice/age", FORTDB_LATEST, NULL);
+    expect(db, "users/alice/age", 2, "31");
+
+    FortDBOp ops[] = {
+        {.type = FORTDB_OP_SET, .path = "users/bob/age", .value = "40"},
+        {.type = FORTDB_OP_GET, .path = "users/bob/age", .version = FORTDB_LATEST},
+        {.type = FORTDB_OP_SET, .path = "users/bob/age"},
+        {.type = FORTDB_OP_DELETE, .path = "users/bob/age"},
+        {.type = FORTDB_OP_GET, .path = "users/bob/age", .version = FORTDB_LATEST},
+        {.type = FORTDB_OP_GET, .path = "users/bob/age", .version = 1},
+    };
+    assert(fortdb_batch(db, ops, 6) == 1);
+    assert(ops[0].status == 0 && ops[1].status == 0 && strcmp(ops[1].result, "40") == 0);
+    assert(ops[2].status == -1 && ops[3].status == 0);
+    assert(ops[4].status == FORTDB_NOT_FOUND && !ops[4].result);
+    assert(ops[5].status == 0 && strcmp(ops[5].result, "40") == 0);
+    fortdb_free(ops[1].result);
+    fortdb_free(ops[5].result);
+
+    const char *record[] = {"users/bob/age", "users/alice/bio", "users/alice/age"};
+    char *values[3];
+    assert(fortdb_mget(db, record, 3, values) == 0);
+    assert(!values[0] && strcmp(values[1], "likes long walks\nand C") == 0 && !values[2]);
+    fortdb_free(values[1]);
+
+    int matches = 0;
+    assert(fortdb_query(db, "users/*/bio", count_match, &matches) == 0 && matches == 1);
+    matches = 0;
+    assert(fortdb_query(db, "**/age", count_match, &matches) == 0 && matches == 0);
+    assert(fortdb_query(db, "", count_match, &matches) == -1);
+
+    assert(fortdb_exec(db, "create-index users/*/bio", NULL) == 0);
+    assert(fortdb_exec(db, "create-index users/*/bio", NULL) != 0);
+    assert(fortdb_set(db, "users/carol/bio", "likes long walks\nand C") == 0);
+    matches = 0;
+    assert(fortdb_find(db, "users/*/bio", "likes long walks\nand C", count_match, &matches) == 0);
+    assert(matches == 2);
+    assert(fortdb_delete(db, "users/carol/bio") == 0);
+    matches = 0;
+    assert(fortdb_find(db, "users/*/bio", "likes long walks\nand C", count_match, &matches) == 0);
+    assert(matches == 1);
+
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    assert(out);
+    assert(fortdb_exec(db, "list-versions users/alice/age", out) == 0);
+    assert(fortdb_exec(db, "frobnicate", out) != 0);
+    assert(fortdb_exec(db, "compact_db", NULL) == 0);
+    fclose(out);
+    assert(strcmp(text, "v3: <deleted>\nv2: 31\nv1: 30\n") == 0);
+    free(text);
+
+    /* Ranges follow the latest values through rewrites and compaction,
+     * while older versions stay readable until it. */
+    assert(fortdb_exec(db, "create-index orders/*/total --range", NULL) == 0);
+    assert(fortdb_set(db, "orders/o1/total", "120") == 0);
+    assert(fortdb_set(db, "orders/o1/total", "900") == 0);
+    assert(fortdb_set(db, "orders/o2/total", "450") == 0);
+    matches = 0;
+    assert(fortdb_range(db, "orders/*/total", 100, 500, 0, count_match, &matches) == 0);
+    assert(matches == 1);
+    expect(db, "orders/o1/total", 1, "120");
+    assert(fortdb_exec(db, "compact_db", NULL) == 0);
+    matches = 0;
+    assert(fortdb_range(db, "orders/*/total", 100, 1000, 0, count_match, &matches) == 0);
+    assert(matches == 2);
+    assert(fortdb_exec(db, "drop-index orders/*/total --range", NULL) == 0);
+
+    /* Typed values read back as written, and as text everywhere else. */
+    FortDBValue typed;
+    assert(fortdb_set_int(db, "stats/visits", 41) == 0);
+    assert(fortdb_set_bytes(db, "stats/key", "\0\1", 2) == 0);
+    assert(fortdb_exec(db, "set stats/ratio 0.5 --type=double", NULL) == 0);
+    assert(fortdb_exec(db, "set stats/ratio half --type=double", NULL) != 0);
+    expect(db, "stats/visits", FORTDB_LATEST, "41");
+    expect(db, "stats/key", FORTDB_LATEST, "0x0001");
+    assert(fortdb_get_value(db, "stats/ratio", FORTDB_LATEST, &typed) == 0);
+    assert(typed.type == FORTDB_DOUBLE && typed.d == 0.5 && !typed.data);
+    assert(fortdb_get_value(db, "stats/none", FORTDB_LATEST, &typed) == FORTDB_NOT_FOUND);
+
+    /* Increments and appends happen inside the database, in one version. */
+    int64_t visits = 0;
+    size_t length = 0;
+    assert(fortdb_incr(db, "stats/visits", 1, &visits) == 0 && visits == 42);
+    assert(fortdb_exec(db, "incr stats/visits 8", NULL) == 0);
+    assert(fortdb_incr(db, "stats/ratio", 1, NULL) == FORTDB_WRONG_TYPE);
+    assert(fortdb_append(db, "stats/key", "\2", 1, &length) == 0 && length == 3);
+    assert(fortdb_append(db, "stats/visits", "0", 1, NULL) == FORTDB_WRONG_TYPE);
+    expect(db, "stats/visits", FORTDB_LATEST, "50");
+    expect(db, "stats/visits", 2, "42");
+
+    /* Saved and reopened, and served from a snapshot of the file. */
+    assert(fortdb_save(db, SAVE_PATH, 0) == 0);
+    fortdb_close(db);
+    assert(fortdb_open(SAVE_PATH, &db) == 0);
+    expect(db, "users/alice/bio", FORTDB_LATEST, "likes long walks\nand C");
+    assert(fortdb_exec(db, "open-snapshot " SAVE_PATH, NULL) == 0);
+    expect(db, "users/alice/bio", FORTDB_LATEST, "likes long walks\nand C");
+    assert(fortdb_get_value(db, "stats/key", FORTDB_LATEST, &typed) == 0);
+    assert(typed.type == FORTDB_BYTES && typed.length == 3 &&
+           memcmp(typed.data, "\0\1\2", 3) == 0);
+    fortdb_free(typed.data);
+    assert(fortdb_get_value(db, "stats/visits", FORTDB_LATEST, &typed) == 0);
+    assert(typed.type == FORTDB_INT64 && typed.i == 50);
+    assert(fortdb_set(db, "users/carol/age", "22") != 0);
+    assert(fortdb_incr(db, "stats/visits", 1, NULL) != 0);
+    FortDBOp write = {.type = FORTDB_OP_SET, .path = "users/carol/age", .value = "22"};
+    assert(fortdb_batch(db, &write, 1) == 1);
+    assert(fortdb_exec(db, "close-snapshot", NULL) == 0);
+    assert(fortdb_set(db, "users/carol/age", "22") == 0);
+    fortdb_close(db);
+    unlink(SAVE_PATH);
+
+    assert(fortdb_open("no-such-file.fortdb", &db) != 0 && !db);
+}
+
+struct worker {
+    FortDB db;
+    int id;
+};
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    char path[64], value[32];
+    for (int k = 0; k < KEYS; k++) {
+        snprintf(path, sizeof(path), "w%d/k%03d", w->id, k);
+        snprintf(value, sizeof(value), "%d", k);
+        assert(fortdb_set(w->db, path, value) == 0);
+        expect(w->db, path, FORTDB_LATEST, value);
+    }
+    return NULL;
+}
+
+/* One handle shared by threads writing, reading and compacting. */
+static void test_threads(void) {
+    FortDB db = NULL;
+    assert(fortdb_open(NULL, &db) == 0);
+    pthread_t threads[THREADS];
+    struct worker workers[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        workers[i] = (struct worker){db, i};
+        assert(pthread_create(&threads[i], NULL, worker_main, &workers[i]) == 0);
+    }
+    for (int i = 0; i < 5; i++) assert(fortdb_exec(db, "compact_db", NULL) == 0);
+    for (int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+    expect(db, "w3/k499", FORTDB_LATEST, "499");
+    fortdb_close(db);
+}
+
+int main(void) {
+    test_calls();
+    test_threads();
+    puts("Library tests passed.");
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/utils/document.h"
+#include "../src/utils/reclaim.h"
+
+#define RECORDS 20
+#define FIELDS 50
+
+static void fill(Document doc) {
+    char path[64], value[32];
+    uint64_t gv = 1;
+    for (int r = 0; r < RECORDS; r++) {
+        for (int f = 0; f < FIELDS; f++) {
+            snprintf(path, sizeof(path), "db/records/r%02d/f%02d", r, f);
+            for (int v = 0; v < 3; v++) {
+                snprintf(value, sizeof(value), "r%d-f%d-v%d", r, f, v);
+                assert(document_set_field_path(doc, path, value, gv++) == 0);
+            }
+            if (f % 7 == 0) assert(document_delete_path(doc, path, gv++) == 0);
+        }
+        snprintf(path, sizeof(path), "db/records/r%02d/nested/deep/leaf", r);
+        assert(document_set_field_path(doc, path, "leaf", gv++) == 0);
+    }
+    assert(document_set_field_path(doc, "top", "level", gv++) == 0);
+    assert(document_set_field_path(doc, "db/records-index", "x", gv++) == 0);
+}
+
+/* Each answer is what document_get_field gives for that path alone. */
+static void check(Document doc, const char **paths, size_t count, uint64_t version) {
+    char **values = malloc(count * sizeof(*values));
+    assert(values);
+    assert(document_get_fields(doc, paths, count, version, values) == 0);
+    for (size_t i = 0; i < count; i++) {
+        char *one = document_get_field(doc, paths[i], version);
+        if (!one || one == DELETED) {
+            assert(!values[i]);
+        } else {
+            assert(values[i] && strcmp(values[i], one) == 0);
+            free(one);
+        }
+        free(values[i]);
+    }
+    free(values);
+}
+
+/* Whole records in scrambled order, mixed with missing, deleted, nested,
+ * top-level, duplicate and oddly slashed paths. */
+static void test_matches_single_gets(void) {
+    Document doc = document_create();
+    assert(doc);
+    fill(doc);
+
+    size_t count = RECORDS * FIELDS + 16;
+    const char **paths = malloc(count * sizeof(*paths));
+    char (*storage)[64] = malloc(count * sizeof(*storage));
+    assert(paths && storage);
+    size_t n = 0;
+    for (int i = 0; i < RECORDS * FIELDS; i++) {
+        int k = (i * 7919) % (RECORDS * FIELDS);
+        snprintf(storage[n], sizeof(storage[n]), "db/records/r%02d/f%02d", k / FIELDS, k % FIELDS);
+        paths[n] = storage[n];
+        n++;
+    }
+    const char *extra[] = {"top", "db/records-index", "db/records/r03/nested/deep/leaf",
+                           "db/records/r99/f00", "db/records/r01/missing", "db/records/r01",
+                           "nope/a/b", "db//records/r02/f01", "db/records/r02/f01/",
+                           "db/records/r02/f01", "", "/", "db/records/r04/nested/deep/leaf",
+                           "db/records/r04/nested/deep", "db/records/r04/f01/deeper", "top/"};
+    for (size_t i = 0; i < sizeof(extra) / sizeof(extra[0]); i++) paths[n++] = extra[i];
+    assert(n == count);
+
+    check(doc, paths, count, UINT64_MAX);
+    check(doc, paths, count, 1);
+    check(doc, paths, count, 3);
+    check(doc, paths, count, 4);
+    check(doc, paths, 1, UINT64_MAX);
+    assert(document_get_fields(doc, paths, 0, UINT64_MAX, NULL) == 0);
+
+    char *values[2];
+    const char *record[] = {"db/records/r05/f03", "db/records/r05/f07"};
+    assert(document_get_fields(doc, record, 2, UINT64_MAX, values) == 0);
+    assert(strcmp(values[0], "r5-f3-v2") == 0 && !values[1]);
+    free(values[0]);
+
+    free(storage);
+    free(paths);
+    document_free(doc);
+}
+
+struct churn {
+    Document doc;
+    atomic_int *stop;
+};
+
+static void *writer(void *arg) {
+    struct churn *c = arg;
+    char path[64];
+    uint64_t gv = 100000;
+    for (int round = 0; !atomic_load(c->stop); round++) {
+        snprintf(path, sizeof(path), "db/records/r%02d/f%02d", round % RECORDS, round % FIELDS);
+        assert(document_set_field_path(c->doc, path, "new", gv++) == 0);
+        snprintf(path, sizeof(path), "db/records/r%02d/extra%d", round % RECORDS, round % 5);
+        assert(document_delete_path(c->doc, path, gv++) == 0);
+    }
+    return NULL;
+}
+
+/* Readers see every field either before or after a concurrent write. */
+static void test_concurrent_writer(void) {
+    Document doc = document_create();
+    assert(doc);
+    fill(doc);
+    atomic_int stop = 0;
+    struct churn c = {doc, &stop};
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, writer, &c) == 0);
+
+    const char *paths[FIELDS];
+    char storage[FIELDS][64];
+    char *values[FIELDS];
+    for (int round = 0; round < 500; round++) {
+        int r = round % RECORDS;
+        for (int f = 0; f < FIELDS; f++) {
+            snprintf(storage[f], sizeof(storage[f]), "db/records/r%02d/f%02d", r, f);
+            paths[f] = storage[f];
+        }
+        assert(document_get_fields(doc, paths, FIELDS, UINT64_MAX, values) == 0);
+        for (int f = 0; f < FIELDS; f++) {
+            char expected[32];
+            snprintf(expected, sizeof(expected), "r%d-f%d-v2", r, f);
+            assert(!values[f] ? f % 7 == 0 : strcmp(values[f], "new") == 0 ||
+                                                 strcmp(values[f], expected) == 0);
+            free(values[f]);
+        }
+    }
+    atomic_store(&stop, 1);
+    pthread_join(thread, NULL);
+    document_free(doc);
+    reclaim_barrier();
+}
+
+int main(void) {
+    test_matches_single_gets();
+    test_concurrent_writer();
+    puts("Multi-get tests passed.");
+    return 0;
+}
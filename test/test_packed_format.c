@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define PACKED_FILE "packed-format.fortdb"
+#define V1_FILE "packed-format-v1.fortdb"
+#define TENANTS 50
+
+static void check_field(Document doc, const char *path, uint64_t version, const char *expected) {
+    char *val = document_get_field(doc, path, version);
+    if (!expected) {
+        assert(val == NULL || val == (char *)DELETED);
+        return;
+    }
+    assert(val && val != (char *)DELETED);
+    assert(strcmp(val, expected) == 0);
+    free(val);
+}
+
+static long file_size(const char *file) {
+    struct stat st;
+    assert(stat(file, &st) == 0);
+    return (long)st.st_size;
+}
+
+static char big[100000];
+
+static void check_tree(VersionNode root) {
+    Document doc = (Document)root->value;
+    char path[96], value[64];
+    check_field(doc, "name", UINT64_MAX, "root-2");
+    check_field(doc, "name", 1, "root-1");
+    check_field(doc, "empty", UINT64_MAX, "");
+    check_field(doc, "blob", UINT64_MAX, big);
+    for (int i = 0; i < TENANTS; i++) {
+        snprintf(path, sizeof(path), "tenants/tenant-%03d/settings/colour", i);
+        check_field(doc, path, UINT64_MAX, "blue");
+        check_field(doc, path, 1, "red");
+        snprintf(path, sizeof(path), "tenant-%03d/count", i);
+        snprintf(value, sizeof(value), "%d", i);
+        check_field(doc, path, UINT64_MAX, value);
+    }
+    check_field(doc, "tenant-000/removed", UINT64_MAX, NULL);
+    check_field(doc, "tenant-000/removed", 1, "x");
+    /* Versions that do not shrink along the chain still round-trip. */
+    check_field(doc, "odd", 1, "early");
+    check_field(doc, "odd", 2, "late");
+
+    assert(root->prev && !root->prev->prev);
+    assert(root->global_version == 1000000 && root->prev->global_version == 7);
+    check_field((Document)root->prev->value, "name", UINT64_MAX, "old");
+}
+
+int main(void) {
+    memset(big, 'z', sizeof(big) - 1);
+    Document doc = document_create();
+    assert(doc);
+    assert(document_set_field(doc, "name", "root-1", 1) == 0);
+    assert(document_set_field(doc, "name", "root-2", 2) == 0);
+    assert(document_set_field(doc, "empty", "", 3) == 0);
+    assert(document_set_field(doc, "blob", big, 4) == 0);
+    assert(document_set_field(doc, "odd", "early", 900) == 0);
+    assert(document_set_field(doc, "odd", "late", 5) == 0);
+    char path[96], value[64];
+    for (int i = 0; i < TENANTS; i++) {
+        snprintf(path, sizeof(path), "tenants/tenant-%03d/settings/colour", i);
+        assert(document_set_field_path(doc, path, "red", 1) == 0);
+        assert(document_set_field_path(doc, path, "blue", 2) == 0);
+        snprintf(path, sizeof(path), "tenant-%03d/count", i);
+        snprintf(value, sizeof(value), "%d", i);
+        assert(document_set_field_path(doc, path, value, 1) == 0);
+    }
+    assert(document_set_field_path(doc, "tenant-000/removed", "x", 1) == 0);
+    assert(document_delete_path(doc, "tenant-000/removed", 2) == 0);
+
+    Document old_doc = document_create();
+    assert(old_doc);
+    assert(document_set_field(old_doc, "name", "old", 1) == 0);
+    VersionNode old_root = version_node_create(old_doc, 7, 1, NULL, (void (*)(void *))document_free);
+    VersionNode root = version_node_create(doc, 1000000, 2, old_root, (void (*)(void *))document_free);
+    assert(old_root && root);
+
+    SerializeOptions packed = {.format_version = 3};
+    SerializeOptions v1 = {.format_version = 1};
+    assert(serialize_db_with_options(root, PACKED_FILE, &packed) == 0);
+    assert(serialize_db_with_options(root, V1_FILE, &v1) == 0);
+    version_node_free(root);
+    assert(file_size(PACKED_FILE) < file_size(V1_FILE));
+
+    VersionNode loaded = NULL;
+    assert(deserialize_db(PACKED_FILE, &loaded) == 0 && loaded);
+    check_tree(loaded);
+
+    /* Re-saving what was loaded is byte-for-byte stable in size. */
+    long size = file_size(PACKED_FILE);
+    assert(serialize_db_with_options(loaded, PACKED_FILE, &packed) == 0);
+    assert(file_size(PACKED_FILE) == size);
+    version_node_free(loaded);
+
+    /* Truncation anywhere is rejected rather than misread. */
+    FILE *f = fopen(PACKED_FILE, "rb");
+    assert(f);
+    char *bytes = malloc((size_t)size);
+    assert(bytes && fread(bytes, 1, (size_t)size, f) == (size_t)size);
+    fclose(f);
+    for (long cut = 0; cut < size; cut += size / 97 + 1) {
+        f = fopen(PACKED_FILE, "wb");
+        assert(f && fwrite(bytes, 1, (size_t)cut, f) == (size_t)cut);
+        fclose(f);
+        loaded = NULL;
+        assert(deserialize_db(PACKED_FILE, &loaded) != 0 && !loaded);
+    }
+    free(bytes);
+
+    remove(PACKED_FILE);
+    remove(V1_FILE);
+    puts("Packed format tests passed.");
+    return 0;
+}
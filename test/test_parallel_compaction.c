@@ -0,0 +1,183 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/storage/compactor.h"
+#include "../src/storage/retention.h"
+#include "../src/utils/document.h"
+#include "../src/utils/reclaim.h"
+#include "../src/utils/version_node.h"
+
+#define TENANTS 64
+#define WRITERS 2
+
+static VersionNode make_root(Document *doc_out) {
+    Document doc = document_create();
+    assert(doc);
+    VersionNode root = version_node_create(doc, 0, 0, NULL, (void (*)(void *))document_free);
+    assert(root);
+    *doc_out = doc;
+    return root;
+}
+
+/* Tenant t has 1 + 512 / (t + 1) records, each rewritten three times; every
+ * third tenant also deletes all its records again. */
+static uint64_t fill(Document doc, uint64_t gv) {
+    char path[96], value[16];
+    for (int t = 0; t < TENANTS; t++) {
+        int records = 1 + 512 / (t + 1);
+        for (int r = 0; r < records; r++) {
+            snprintf(path, sizeof(path), "t%02d/r%03d/deep/v", t, r);
+            for (int v = 0; v < 3; v++) {
+                snprintf(value, sizeof(value), "%d", v);
+                assert(document_set_field_path(doc, path, value, gv++) == 0);
+            }
+            if (t % 3 == 0) assert(document_delete_path(doc, path, gv++) == 0);
+        }
+        snprintf(path, sizeof(path), "t%02d/name", t);
+        assert(document_set_field_path(doc, path, "old", gv++) == 0);
+        assert(document_set_field_path(doc, path, "new", gv++) == 0);
+    }
+    return gv;
+}
+
+static void check(Document doc) {
+    char path[96];
+    for (int t = 0; t < TENANTS; t++) {
+        snprintf(path, sizeof(path), "t%02d/name", t);
+        char *val = document_get_field(doc, path, UINT64_MAX);
+        assert(val && strcmp(val, "new") == 0);
+        free(val);
+        snprintf(path, sizeof(path), "t%02d/r000/deep/v", t);
+        val = document_get_path(doc, path, UINT64_MAX);
+        if (t % 3 == 0) {
+            assert(!val);
+        } else {
+            assert(val && strcmp(val, "2") == 0);
+            free(val);
+        }
+        snprintf(path, sizeof(path), "t%02d", t);
+        Document tenant = document_get_subdocument_path(doc, path);
+        assert(tenant && tenant->fields->history_versions == 0);
+        assert(tenant->subdocuments->size == (t % 3 == 0 ? 0u : 1u + 512u / (t + 1)));
+        document_free(tenant);
+    }
+}
+
+/* Any worker count frees and purges exactly what the sequential walk does. */
+static void test_matches_sequential(void) {
+    Document doc = NULL;
+    VersionNode root = make_root(&doc);
+    fill(doc, 1);
+    CompactStats serial;
+    assert(compactor_compact_incremental(root, NULL, NULL, &serial) == 0);
+    check(doc);
+    version_node_free(root);
+
+    size_t workers[] = {1, 2, 4, 0};
+    for (size_t i = 0; i < sizeof(workers) / sizeof(workers[0]); i++) {
+        root = make_root(&doc);
+        fill(doc, 1);
+        CompactStats stats;
+        assert(compactor_compact_parallel(root, NULL, workers[i], &stats) == 0);
+        check(doc);
+        assert(stats.versions_freed == serial.versions_freed);
+        assert(stats.bytes_freed == serial.bytes_freed);
+        assert(stats.entries_purged == serial.entries_purged);
+        assert(stats.documents == serial.documents);
+        version_node_free(root);
+    }
+}
+
+/* Retention rules still apply per subtree. */
+static void test_policy(void) {
+    Document doc = NULL;
+    VersionNode root = make_root(&doc);
+    fill(doc, 1);
+    RetentionPolicy policy = retention_policy_create();
+    RetentionRule keep = {.keep_versions = 2};
+    assert(policy && retention_policy_set(policy, "t05", &keep) == 0);
+    assert(compactor_compact_parallel(root, policy, 4, NULL) == 0);
+
+    Document kept = document_get_subdocument_path(doc, "t05");
+    assert(kept && kept->fields->history_versions == 1);
+    document_free(kept);
+    Document other = document_get_subdocument_path(doc, "t04");
+    assert(other && other->fields->history_versions == 0);
+    document_free(other);
+    retention_policy_free(policy);
+    version_node_free(root);
+}
+
+struct churn {
+    VersionNode root;
+    int id;
+    atomic_int *done;
+};
+
+static void *writer(void *arg) {
+    struct churn *c = arg;
+    char path[64], value[16];
+    uint64_t gv = 1;
+    for (int round = 0; round < 20; round++) {
+        snprintf(value, sizeof(value), "%d", round);
+        for (int i = 0; i < 100; i++) {
+            assert(pthread_rwlock_rdlock(&c->root->lock) == 0);
+            Document doc = (Document)c->root->value;
+            snprintf(path, sizeof(path), "w%d/d%03d/tmp", c->id, i);
+            assert(document_set_field_path(doc, path, value, gv++) == 0);
+            assert(document_delete_path(doc, path, gv++) == 0);
+            snprintf(path, sizeof(path), "w%d/d%03d/last", c->id, i);
+            assert(document_set_field_path(doc, path, value, gv++) == 0);
+            pthread_rwlock_unlock(&c->root->lock);
+        }
+    }
+    atomic_fetch_add(c->done, 1);
+    return NULL;
+}
+
+/* Writers keep going while the workers compact around them. */
+static void test_concurrent_writers(void) {
+    Document doc = NULL;
+    VersionNode root = make_root(&doc);
+    atomic_int done = 0;
+    pthread_t threads[WRITERS];
+    struct churn args[WRITERS];
+    for (int i = 0; i < WRITERS; i++) {
+        args[i] = (struct churn){root, i, &done};
+        assert(pthread_create(&threads[i], NULL, writer, &args[i]) == 0);
+    }
+    uint64_t passes = 0;
+    while (atomic_load(&done) < WRITERS) {
+        assert(compactor_compact_parallel(root, NULL, 4, NULL) == 0);
+        passes++;
+    }
+    for (int i = 0; i < WRITERS; i++) pthread_join(threads[i], NULL);
+    assert(compactor_compact_parallel(root, NULL, 4, NULL) == 0);
+
+    char path[64];
+    for (int w = 0; w < WRITERS; w++) {
+        for (int i = 0; i < 100; i++) {
+            snprintf(path, sizeof(path), "w%d/d%03d", w, i);
+            Document d = document_get_subdocument_path(doc, path);
+            assert(d && d->fields->size == 1 && d->fields->history_versions == 0);
+            document_free(d);
+        }
+    }
+    reclaim_barrier();
+    assert(reclaim_collect() == 0);
+    printf("%llu parallel passes during churn\n", (unsigned long long)passes);
+    version_node_free(root);
+}
+
+int main(void) {
+    test_matches_sequential();
+    test_policy();
+    test_concurrent_writers();
+    puts("Parallel compaction tests passed.");
+    return 0;
+}
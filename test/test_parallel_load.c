@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define TEST_FILE "parallel-load.fortdb"
+#define SUBTREES 200
+
+static void check_field(Document doc, const char *path, uint64_t version, const char *expected) {
+    char *val = document_get_field(doc, path, version);
+    assert(val && val != (char *)DELETED);
+    assert(strcmp(val, expected) == 0);
+    free(val);
+}
+
+static void check_tree(Document root) {
+    char path[64], value[64];
+    check_field(root, "name", UINT64_MAX, "root-2");
+    check_field(root, "name", 1, "root-1");
+    for (int i = 0; i < SUBTREES; i++) {
+        snprintf(path, sizeof(path), "tenant%d/count", i);
+        snprintf(value, sizeof(value), "%d", i * 2);
+        check_field(root, path, UINT64_MAX, value);
+        snprintf(value, sizeof(value), "%d", i);
+        check_field(root, path, 1, value);
+        snprintf(path, sizeof(path), "tenant%d/profile/owner", i);
+        snprintf(value, sizeof(value), "owner-%d", i);
+        check_field(root, path, UINT64_MAX, value);
+    }
+}
+
+/* Clear the header flags so the file reads as a plain sequential stream. */
+/* Clear the header flags. The checksums no longer match, so drop the footer
+ * too; the file then reads as one written before checksums existed. */
+static void clear_flags(const char *file) {
+    FILE *f = fopen(file, "r+b");
+    assert(f);
+    unsigned char footer[8];
+    assert(fseek(f, -24, SEEK_END) == 0);
+    assert(fread(footer, sizeof(footer), 1, f) == 1);
+    off_t image_size = 0;
+    for (int i = 0; i < 8; i++) image_size = (image_size << 8) | footer[i];
+    uint32_t zero = 0;
+    assert(fseek(f, 8, SEEK_SET) == 0);
+    assert(fwrite(&zero, sizeof(zero), 1, f) == 1);
+    assert(fclose(f) == 0);
+    assert(truncate(file, image_size) == 0);
+}
+
+int main(void) {
+    Document root_doc = document_create();
+    assert(root_doc);
+    assert(document_set_field(root_doc, "name", "root-1", 1) == 0);
+    assert(document_set_field(root_doc, "name", "root-2", 2) == 0);
+
+    char path[64], value[64];
+    for (int i = 0; i < SUBTREES; i++) {
+        snprintf(path, sizeof(path), "tenant%d/count", i);
+        snprintf(value, sizeof(value), "%d", i);
+        assert(document_set_field_path(root_doc, path, value, 1) == 0);
+        snprintf(value, sizeof(value), "%d", i * 2);
+        assert(document_set_field_path(root_doc, path, value, 2) == 0);
+        snprintf(path, sizeof(path), "tenant%d/profile/owner", i);
+        snprintf(value, sizeof(value), "owner-%d", i);
+        assert(document_set_field_path(root_doc, path, value, 2) == 0);
+    }
+
+    /* An older root version after the segmented head must still be read. */
+    Document old_doc = document_create();
+    assert(old_doc);
+    assert(document_set_field(old_doc, "name", "old", 1) == 0);
+    VersionNode old_root = version_node_create(old_doc, 1, 1, NULL,
+                                               (void (*)(void *))document_free);
+    VersionNode root = version_node_create(root_doc, 2, 2, old_root,
+                                           (void (*)(void *))document_free);
+    assert(old_root && root);
+
+    SerializeOptions v1 = {.format_version = 1};
+    assert(serialize_db_with_options(root, TEST_FILE, &v1) == 0);
+    version_node_free(root);
+
+    VersionNode loaded = NULL;
+    assert(deserialize_db(TEST_FILE, &loaded) == 0 && loaded);
+    check_tree((Document)loaded->value);
+    assert(loaded->prev && !loaded->prev->prev);
+    check_field((Document)loaded->prev->value, "name", UINT64_MAX, "old");
+    version_node_free(loaded);
+
+    /* The same tree on any number of workers. */
+    for (size_t workers = 1; workers <= 7; workers += 3) {
+        loaded = NULL;
+        assert(deserialize_db_with_workers(TEST_FILE, workers, &loaded) == 0 && loaded);
+        check_tree((Document)loaded->value);
+        assert(loaded->prev && !loaded->prev->prev);
+        version_node_free(loaded);
+    }
+
+    clear_flags(TEST_FILE);
+    loaded = NULL;
+    assert(deserialize_db(TEST_FILE, &loaded) == 0 && loaded);
+    check_tree((Document)loaded->value);
+    version_node_free(loaded);
+
+    remove(TEST_FILE);
+    puts("Parallel segment load tests passed.");
+    return 0;
+}
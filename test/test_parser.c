@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/parser.h"
+
+static int tokenize(const char *text, char *buf, char *args[]) {
+    strcpy(buf, text);
+    return parse_tokenize(buf, args, PARSE_MAX_ARGS);
+}
+
+static void test_tokenize(void) {
+    char buf[256], *args[PARSE_MAX_ARGS];
+
+    assert(tokenize("  set\tusers/alice/age   30 \r\n", buf, args) == 3);
+    assert(strcmp(args[0], "set") == 0 && strcmp(args[1], "users/alice/age") == 0 &&
+           strcmp(args[2], "30") == 0);
+    assert(tokenize("", buf, args) == 0);
+    assert(tokenize(" \t ", buf, args) == 0);
+
+    assert(tokenize("set notes/a \"buy milk\\n\\tand \\\"eggs\\\" \\\\\"", buf, args) == 3);
+    assert(strcmp(args[2], "buy milk\n\tand \"eggs\" \\") == 0);
+    assert(tokenize("set a 'it is \\n literal'", buf, args) == 3);
+    assert(strcmp(args[2], "it is \\n literal") == 0);
+    assert(tokenize("set a b\\ c\\\"d", buf, args) == 3);
+    assert(strcmp(args[2], "b c\"d") == 0);
+    /* Quoted pieces join the word around them, and "" is an empty word. */
+    assert(tokenize("set a pre\"mid dle\"'post' \"\"", buf, args) == 4);
+    assert(strcmp(args[2], "premid dlepost") == 0 && strcmp(args[3], "") == 0);
+
+    assert(tokenize("set a \"open", buf, args) == -1);
+    assert(tokenize("set a 'open", buf, args) == -1);
+    assert(tokenize("set a \"bad \\q\"", buf, args) == -1);
+    assert(tokenize("set a trailing\\", buf, args) == -1);
+
+    char many[256] = "";
+    for (int i = 0; i < PARSE_MAX_ARGS + 1; i++) strcat(many, "w ");
+    assert(tokenize(many, buf, args) == -1);
+}
+
+static void test_commands(void) {
+    static const struct {
+        const char *line;
+        INSTR_TYPE op;
+    } cases[] = {
+        {"set a 1", SET},
+        {"get a", GET},
+        {"load db.fort", LOAD},
+        {"save db.fort .", SAVE},
+        {"dump", DUMP},
+        {"mget a b", MGET},
+        {"query a/*", QUERY},
+        {"find a/* = 1", FIND},
+        {"incr a", INCR},
+        {"append a b", APPEND},
+        {"create-index a/*", CREATE_INDEX},
+        {"drop-index a/*", DROP_INDEX},
+        {"range a/* 1 2", RANGE},
+        {"delete a", DELETE},
+        {"verify db.fort", VERIFY},
+        {"retain audit 3", RETAIN},
+        {"compact a", COMPACT},
+        {"retention", RETENTION},
+        {"compact_db", COMPACT_DB},
+        {"autocompact", AUTOCOMPACT},
+        {"list-versions a", VERSIONS},
+        {"open-snapshot db.fort", OPEN_SNAPSHOT},
+        {"close-snapshot", CLOSE_SNAPSHOT},
+    };
+    char buf[64];
+    struct Instr instr;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        strcpy(buf, cases[i].line);
+        assert(parse_line(&instr, buf, 7) == 0);
+        assert(instr.instr_type == cases[i].op && instr.global_version == 7);
+    }
+
+    /* Words that share a length or first byte with a command. */
+    static const char *unknown[] = {"sex a", "gets a", "lead x", "mset a", "dumb", "quest a", "fine a", "rangy a",
+                                    "inch a", "appends a b",
+                                    "create-indez a", "drop-indey a", "deletes a",
+                                    "verity a", "retains", "compacts a", "list-version a",
+                                    "close-snapshots", "", "\"\""};
+    for (size_t i = 0; i < sizeof(unknown) / sizeof(unknown[0]); i++) {
+        strcpy(buf, unknown[i]);
+        assert(parse_line(&instr, buf, 0) != 0);
+    }
+
+    strcpy(buf, "set \"my notes\" \"two words\"");
+    assert(parse_line(&instr, buf, 0) == 0);
+    assert(strcmp(instr.set.path, "my notes") == 0 && strcmp(instr.set.value, "two words") == 0);
+    assert(instr.set.type == VALUE_STRING);
+    strcpy(buf, "get a --v=3");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.get.version == 3);
+    strcpy(buf, "set a");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "set a 0xff --type=bytes");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.set.type == VALUE_BYTES);
+    strcpy(buf, "set a 1 --type=float");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "set a 1 int");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "incr a");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.incr.delta == 1);
+    strcpy(buf, "incr a -42");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.incr.delta == -42);
+    strcpy(buf, "incr a 1.5");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "incr a 99999999999999999999");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "append a \" more\"");
+    assert(parse_line(&instr, buf, 0) == 0 && strcmp(instr.append.value, " more") == 0);
+    strcpy(buf, "append a");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "mget a/x --v=2 a/y");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.mget.count == 2 && instr.mget.version == 2);
+    assert(strcmp(instr.mget.paths[0], "a/x") == 0 && strcmp(instr.mget.paths[1], "a/y") == 0);
+    strcpy(buf, "mget --v=2");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "query a/* b");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "find a/* = \"two words\"");
+    assert(parse_line(&instr, buf, 0) == 0 && strcmp(instr.find.value, "two words") == 0);
+    strcpy(buf, "find a/* 1");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "range a/* -1.5 inf --limit=3");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.range.lo == -1.5 && instr.range.limit == 3);
+    strcpy(buf, "range a/* 1 2 --limit=abc");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "range a/* 1 2 --limit=");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "range a/* 1 2x");
+    assert(parse_line(&instr, buf, 0) != 0);
+    strcpy(buf, "create-index a/* --range");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.index.range);
+    strcpy(buf, "create-index a/* --ranged");
+    assert(parse_line(&instr, buf, 0) != 0);
+
+    strcpy(buf, "retain audit 3 --after=7 --window=60");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.retain.versions == 3 &&
+           instr.retain.after == 7 && instr.retain.seconds == 60);
+    static const char *bad_retain[] = {"retain audit 3o", "retain audit x", "retain audit -1",
+                                       "retain audit 3 --after=", "retain audit 3 --window=1m",
+                                       "retain audit 99999999999999999999"};
+    for (size_t i = 0; i < sizeof(bad_retain) / sizeof(bad_retain[0]); i++) {
+        strcpy(buf, bad_retain[i]);
+        assert(parse_line(&instr, buf, 0) != 0);
+    }
+
+    strcpy(buf, "autocompact on --versions=10 --interval=5");
+    assert(parse_line(&instr, buf, 0) == 0 && instr.autocompact.versions == 10 &&
+           instr.autocompact.interval == 5 && instr.autocompact.bytes == -1);
+    static const char *bad_autocompact[] = {"autocompact on --versions=abc",
+                                            "autocompact on --interval=abc",
+                                            "autocompact on --bytes=1k",
+                                            "autocompact on --versions=9223372036854775808"};
+    for (size_t i = 0; i < sizeof(bad_autocompact) / sizeof(bad_autocompact[0]); i++) {
+        strcpy(buf, bad_autocompact[i]);
+        assert(parse_line(&instr, buf, 0) != 0);
+    }
+
+    char *args[] = {"delete", "a"};
+    Instr heap = parse_args(2, args, 1);
+    assert(heap && heap->instr_type == DELETE && strcmp(heap->delete.path, "a") == 0);
+    free(heap);
+}
+
+int main(void) {
+    test_tokenize();
+    test_commands();
+    puts("Parser tests passed.");
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/utils/document.h"
+#include "../src/utils/query.h"
+#include "../src/utils/reclaim.h"
+
+#define TENANTS 40
+
+/* Matches gathered as "path=value" lines, sorted for comparison. */
+struct results {
+    char **lines;
+    size_t count, cap;
+    size_t stop_after;          /* 0: never stop */
+    pthread_t owner;
+    atomic_int overlapping;
+    atomic_int inside;
+};
+
+static int collect(void *ctx, const char *path, const char *value) {
+    struct results *r = ctx;
+    if (atomic_fetch_add(&r->inside, 1) != 0) atomic_store(&r->overlapping, 1);
+    if (r->count == r->cap) {
+        r->cap = r->cap ? 2 * r->cap : 64;
+        r->lines = realloc(r->lines, r->cap * sizeof(*r->lines));
+        assert(r->lines);
+    }
+    size_t len = strlen(path) + strlen(value) + 2;
+    r->lines[r->count] = malloc(len);
+    assert(r->lines[r->count]);
+    snprintf(r->lines[r->count++], len, "%s=%s", path, value);
+    atomic_fetch_sub(&r->inside, 1);
+    return r->stop_after && r->count == r->stop_after;
+}
+
+static int compare_lines(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void results_free(struct results *r) {
+    for (size_t i = 0; i < r->count; i++) free(r->lines[i]);
+    free(r->lines);
+}
+
+/* Run pattern and compare with expected, a NULL-terminated list of
+ * "path=value" in sorted order. */
+static void expect(Document doc, const char *pattern, size_t workers, const char **expected) {
+    struct results r = {0};
+    assert(document_query(doc, pattern, workers, collect, &r) == 0);
+    if (r.count) qsort(r.lines, r.count, sizeof(*r.lines), compare_lines);
+    size_t n = 0;
+    while (expected[n]) n++;
+    if (r.count != n) {
+        fprintf(stderr, "%s: %zu matches, expected %zu\n", pattern, r.count, n);
+        assert(0);
+    }
+    for (size_t i = 0; i < n; i++) assert(strcmp(r.lines[i], expected[i]) == 0);
+    assert(!r.overlapping);
+    results_free(&r);
+}
+
+static Document fixture(void) {
+    Document doc = document_create();
+    assert(doc);
+    const char *sets[][2] = {
+        {"users/alice/age", "30"},   {"users/alice/name", "Alice"},
+        {"users/bob/age", "40"},     {"users/bob/address/city", "Oslo"},
+        {"users/carol/age", "50"},   {"users/age", "top"},
+        {"orders/o1/status", "paid"}, {"orders/2024/o2/status", "new"},
+        {"orders/2024/q1/o3/status", "open"}, {"orders/status", "all"},
+        {"status", "root"},
+    };
+    uint64_t gv = 1;
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        assert(document_set_field_path(doc, sets[i][0], sets[i][1], gv++) == 0);
+    }
+    assert(document_set_field_path(doc, "users/carol/age", "51", gv++) == 0);
+    assert(document_delete_path(doc, "users/bob/age", gv++) == 0);
+    return doc;
+}
+
+static void test_patterns(void) {
+    Document doc = fixture();
+    for (size_t workers = 1; workers <= 4; workers *= 2) {
+        expect(doc, "users/*/age", workers,
+               (const char *[]){"users/alice/age=30", "users/carol/age=51", NULL});
+        expect(doc, "users/alice/age", workers, (const char *[]){"users/alice/age=30", NULL});
+        expect(doc, "users/bob/age", workers, (const char *[]){NULL});
+        expect(doc, "orders/**/status", workers,
+               (const char *[]){"orders/2024/o2/status=new", "orders/2024/q1/o3/status=open",
+                                "orders/o1/status=paid", "orders/status=all", NULL});
+        expect(doc, "**/status", workers,
+               (const char *[]){"orders/2024/o2/status=new", "orders/2024/q1/o3/status=open",
+                                "orders/o1/status=paid", "orders/status=all", "status=root",
+                                NULL});
+        /* Repeated ** still reports each field once. */
+        expect(doc, "**/**/o*/**", workers,
+               (const char *[]){"orders/2024/o2/status=new", "orders/2024/q1/o3/status=open",
+                                "orders/o1/status=paid", "orders/status=all", NULL});
+        expect(doc, "users/**", workers,
+               (const char *[]){"users/age=top", "users/alice/age=30", "users/alice/name=Alice",
+                                "users/bob/address/city=Oslo", "users/carol/age=51", NULL});
+        expect(doc, "users/[ab]*/*", workers,
+               (const char *[]){"users/alice/age=30", "users/alice/name=Alice", NULL});
+        expect(doc, "/users//?ob/*/city/", workers,
+               (const char *[]){"users/bob/address/city=Oslo", NULL});
+        expect(doc, "*", workers, (const char *[]){"status=root", NULL});
+        expect(doc, "nothing/*", workers, (const char *[]){NULL});
+    }
+
+    struct results r = {0};
+    assert(document_query(doc, "", 1, collect, &r) == -1);
+    assert(document_query(doc, "///", 1, collect, &r) == -1);
+    char deep[256] = "";
+    for (int i = 0; i < QUERY_MAX_COMPONENTS + 1; i++) strcat(deep, "a/");
+    assert(document_query(doc, deep, 1, collect, &r) == -1);
+    assert(r.count == 0);
+    document_free(doc);
+}
+
+static Document wide(void) {
+    Document doc = document_create();
+    assert(doc);
+    char path[96];
+    uint64_t gv = 1;
+    for (int t = 0; t < TENANTS; t++) {
+        for (int u = 0; u < 1 + 400 / (t + 1); u++) {
+            snprintf(path, sizeof(path), "tenants/t%02d/users/u%03d/age", t, u);
+            assert(document_set_field_path(doc, path, "1", gv++) == 0);
+            snprintf(path, sizeof(path), "tenants/t%02d/users/u%03d/prefs/theme", t, u);
+            assert(document_set_field_path(doc, path, "dark", gv++) == 0);
+        }
+    }
+    return doc;
+}
+
+/* A wide fan-out gives the same answer on any number of workers, and
+ * stops as soon as the callback asks. */
+static void test_fan_out(void) {
+    Document doc = wide();
+    size_t users = 0;
+    for (int t = 0; t < TENANTS; t++) users += 1 + 400 / (t + 1);
+
+    struct results first = {0};
+    assert(document_query(doc, "tenants/*/users/*/age", 1, collect, &first) == 0);
+    assert(first.count == users);
+    qsort(first.lines, first.count, sizeof(*first.lines), compare_lines);
+    size_t workers[] = {2, 4, 0};
+    for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); w++) {
+        struct results r = {0};
+        assert(document_query(doc, "tenants/*/users/*/age", workers[w], collect, &r) == 0);
+        assert(!r.overlapping && r.count == users);
+        qsort(r.lines, r.count, sizeof(*r.lines), compare_lines);
+        for (size_t i = 0; i < users; i++) assert(strcmp(r.lines[i], first.lines[i]) == 0);
+        results_free(&r);
+    }
+    results_free(&first);
+
+    struct results all = {0};
+    assert(document_query(doc, "tenants/**", 4, collect, &all) == 0 && all.count == 2 * users);
+    results_free(&all);
+
+    struct results some = {.stop_after = 10};
+    assert(document_query(doc, "**/theme", 4, collect, &some) == 1);
+    assert(some.count == 10);
+    results_free(&some);
+    document_free(doc);
+}
+
+struct churn {
+    Document doc;
+    atomic_int *stop;
+};
+
+static void *writer(void *arg) {
+    struct churn *c = arg;
+    char path[96];
+    uint64_t gv = 1000000;
+    for (int i = 0; !atomic_load(c->stop); i++) {
+        snprintf(path, sizeof(path), "tenants/t%02d/users/new%d/age", i % TENANTS, i % 50);
+        assert(document_set_field_path(c->doc, path, "2", gv++) == 0);
+        snprintf(path, sizeof(path), "tenants/t%02d/users/u000/age", i % TENANTS);
+        assert(document_delete_path(c->doc, path, gv++) == 0);
+        assert(document_set_field_path(c->doc, path, "1", gv++) == 0);
+    }
+    return NULL;
+}
+
+/* Queries run while a writer adds and deletes fields under them. */
+static void test_concurrent_writer(void) {
+    Document doc = wide();
+    atomic_int stop = 0;
+    struct churn c = {doc, &stop};
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, writer, &c) == 0);
+    for (int i = 0; i < 20; i++) {
+        struct results r = {0};
+        assert(document_query(doc, "tenants/*/users/*/age", 4, collect, &r) == 0);
+        for (size_t j = 0; j < r.count; j++) {
+            const char *value = strchr(r.lines[j], '=') + 1;
+            assert(strcmp(value, "1") == 0 || strcmp(value, "2") == 0);
+        }
+        results_free(&r);
+    }
+    atomic_store(&stop, 1);
+    pthread_join(thread, NULL);
+    document_free(doc);
+    reclaim_barrier();
+}
+
+int main(void) {
+    test_patterns();
+    test_fan_out();
+    test_concurrent_writer();
+    puts("Query tests passed.");
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/storage/compactor.h"
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/utils/document.h"
+#include "../src/utils/reclaim.h"
+#include "../src/utils/version_node.h"
+
+#define TEST_FILE "reader_transparent.fortdb"
+#define KEYS 16
+#define ROUNDS 300
+#define READERS 3
+
+static VersionNode make_root(Document *doc_out) {
+    Document doc = document_create();
+    assert(doc);
+    VersionNode root = version_node_create(doc, 0, 0, NULL, (void (*)(void *))document_free);
+    assert(root);
+    *doc_out = doc;
+    return root;
+}
+
+struct holder {
+    Document doc;
+    atomic_int locked;
+    atomic_int release;
+};
+
+static void *hold_read_lock(void *arg) {
+    struct holder *h = arg;
+    assert(pthread_rwlock_rdlock(&h->doc->lock) == 0);
+    atomic_store(&h->locked, 1);
+    while (!atomic_load(&h->release)) sched_yield();
+    pthread_rwlock_unlock(&h->doc->lock);
+    return NULL;
+}
+
+/* History is cut while a reader holds the Document: compaction no longer
+ * waits for it. */
+static void test_compact_under_reader(void) {
+    Document doc = NULL;
+    VersionNode root = make_root(&doc);
+    char value[16];
+    for (uint64_t gv = 1; gv <= 50; gv++) {
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)gv);
+        assert(document_set_field_path(doc, "held/a", value, gv) == 0);
+        assert(document_set_field_path(doc, "held/b", value, gv) == 0);
+    }
+    Document held = document_get_subdocument_path(doc, "held");
+    assert(held && held->fields->history_versions == 98);
+
+    struct holder h = {.doc = held};
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, hold_read_lock, &h) == 0);
+    while (!atomic_load(&h.locked)) sched_yield();
+
+    CompactStats stats;
+    assert(compactor_compact_incremental(root, NULL, NULL, &stats) == 0);
+    assert(stats.versions_freed == 98);
+    assert(held->fields->history_versions == 0);
+    assert(compactor_compact_path(root, "held/a") == 0);
+    assert(compactor_compact_path(root, "held/missing") == 1);
+
+    atomic_store(&h.release, 1);
+    pthread_join(thread, NULL);
+    char *val = document_get_field(doc, "held/a", UINT64_MAX);
+    assert(val && strcmp(val, "50") == 0);
+    free(val);
+    document_free(held);
+    version_node_free(root);
+}
+
+struct shared {
+    VersionNode root;
+    atomic_int stop;
+    atomic_uint_fast64_t written;   /* rounds every key has reached */
+    atomic_uint_fast64_t hits;
+};
+
+static void *writer(void *arg) {
+    struct shared *s = arg;
+    char path[32], value[16];
+    for (uint64_t round = 1; round <= ROUNDS; round++) {
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)round);
+        assert(pthread_rwlock_rdlock(&s->root->lock) == 0);
+        for (int k = 0; k < KEYS; k++) {
+            snprintf(path, sizeof(path), "docs/d%02d/k", k);
+            assert(document_set_field_path((Document)s->root->value, path, value, round) == 0);
+        }
+        pthread_rwlock_unlock(&s->root->lock);
+        atomic_store(&s->written, round);
+    }
+    return NULL;
+}
+
+/* Any older version a reader still finds holds what was written for it. */
+static void *reader(void *arg) {
+    struct shared *s = arg;
+    char path[32];
+    unsigned seed = (unsigned)(uintptr_t)&path;
+    while (!atomic_load(&s->stop)) {
+        uint64_t written = atomic_load(&s->written);
+        if (!written) continue;
+        uint64_t version = 1 + (uint64_t)rand_r(&seed) % written;
+        snprintf(path, sizeof(path), "docs/d%02d/k", rand_r(&seed) % KEYS);
+        assert(pthread_rwlock_rdlock(&s->root->lock) == 0);
+        char *val = document_get_field((Document)s->root->value, path, version);
+        pthread_rwlock_unlock(&s->root->lock);
+        if (!val) continue;
+        assert(val != (char *)DELETED && strtoull(val, NULL, 10) == version);
+        free(val);
+        atomic_fetch_add(&s->hits, 1);
+    }
+    return NULL;
+}
+
+static void *saver(void *arg) {
+    struct shared *s = arg;
+    for (uint32_t format = 1; !atomic_load(&s->stop); format = format % 3 + 1) {
+        SerializeOptions options = {.format_version = format};
+        assert(serialize_db_with_options(s->root, TEST_FILE, &options) == 0);
+        VersionNode loaded = NULL;
+        assert(deserialize_db(TEST_FILE, &loaded) == 0 && loaded);
+        version_node_free(loaded);
+    }
+    return NULL;
+}
+
+static void test_concurrent_readers(void) {
+    Document doc = NULL;
+    VersionNode root = make_root(&doc);
+    struct shared s = {.root = root};
+    pthread_t writer_thread, saver_thread, readers[READERS];
+    assert(pthread_create(&writer_thread, NULL, writer, &s) == 0);
+    assert(pthread_create(&saver_thread, NULL, saver, &s) == 0);
+    for (int i = 0; i < READERS; i++) assert(pthread_create(&readers[i], NULL, reader, &s) == 0);
+
+    CompactBudget budget = {.max_entries = 4};
+    uint64_t freed = 0;
+    while (atomic_load(&s.written) < ROUNDS) {
+        CompactStats stats;
+        assert(compactor_compact_incremental(root, NULL, &budget, &stats) == 0);
+        freed += stats.versions_freed;
+    }
+    pthread_join(writer_thread, NULL);
+    atomic_store(&s.stop, 1);
+    pthread_join(saver_thread, NULL);
+    for (int i = 0; i < READERS; i++) pthread_join(readers[i], NULL);
+
+    assert(compactor_compact(root) == 0);
+    char *val = document_get_field(doc, "docs/d03/k", UINT64_MAX);
+    assert(val && strtoull(val, NULL, 10) == ROUNDS);
+    free(val);
+    reclaim_barrier();
+    assert(reclaim_collect() == 0);
+    printf("freed %llu versions, %llu historical reads served\n",
+           (unsigned long long)freed, (unsigned long long)atomic_load(&s.hits));
+    version_node_free(root);
+    remove(TEST_FILE);
+}
+
+int main(void) {
+    test_compact_under_reader();
+    test_concurrent_readers();
+    puts("Reader-transparent compaction tests passed.");
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/storage/compactor.h"
+#include "../src/storage/deserializer.h"
+#include "../src/storage/retention.h"
+#include "../src/storage/serializer.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define TEST_FILE "retention.fortdb"
+
+static size_t chain_length(Document doc, const char *path) {
+    Document parent = NULL;
+    char *key = NULL;
+    assert(resolve_parent_and_key(doc, path, &parent, &key, 0, 0) == 0);
+    assert(document_materialize_history(parent) == 0);
+    Entry e = hashmap_find_entry(parent->fields, key);
+    if (!e) e = hashmap_find_entry(parent->subdocuments, key);
+    assert(e);
+    size_t n = 0;
+    for (VersionNode v = e->value; v; v = v->prev) n++;
+    document_free(parent);
+    free(key);
+    return n;
+}
+
+static void test_rules(void) {
+    RetentionPolicy policy = retention_policy_create();
+    assert(policy);
+    RetentionRule rule;
+    assert(retention_policy_match(policy, "audit/x", &rule) == 0 && rule.keep_versions == 1);
+
+    RetentionRule audit = {.keep_versions = 30};
+    RetentionRule deep = {.keep_versions = 2, .keep_after = 100};
+    RetentionRule all = {.keep_seconds = 60};
+    assert(retention_policy_set(policy, "audit/", &audit) == 0);
+    assert(retention_policy_set(policy, "/audit/eu", &deep) == 0);
+    assert(retention_policy_match(policy, "audit", &rule) == 1 && rule.keep_versions == 30);
+    assert(retention_policy_match(policy, "audit/us/log", &rule) == 1 && rule.keep_versions == 30);
+    assert(retention_policy_match(policy, "audit/eu/log", &rule) == 1 && rule.keep_after == 100);
+    /* Prefixes match whole components only. */
+    assert(retention_policy_match(policy, "auditing/x", &rule) == 0);
+    assert(retention_policy_match(policy, "audit/europe", &rule) == 1 && rule.keep_versions == 30);
+
+    assert(retention_policy_keeps_history(policy, "") == 1);
+    assert(retention_policy_keeps_history(policy, "audit/eu/x") == 1);
+    assert(retention_policy_keeps_history(policy, "users") == 0);
+    assert(retention_policy_set(policy, "", &all) == 0);
+    assert(retention_policy_match(policy, "users/x", &rule) == 1 && rule.keep_seconds == 60);
+    assert(retention_policy_keeps_history(policy, "users") == 1);
+
+    /* Replacing and clearing. */
+    audit.keep_versions = 5;
+    assert(retention_policy_set(policy, "audit", &audit) == 0);
+    assert(retention_policy_match(policy, "audit/us", &rule) == 1 && rule.keep_versions == 5);
+    assert(retention_policy_clear(policy, "audit") == 0);
+    assert(retention_policy_clear(policy, "audit") != 0);
+    assert(retention_policy_match(policy, "audit/us", &rule) == 1 && rule.keep_seconds == 60);
+    retention_policy_free(policy);
+}
+
+/* head (gv 10, now) -> gv 8 (now - 10s) -> gv 6 (now - 100s) -> gv 4 -> gv 2 */
+static void test_last_kept(void) {
+    uint64_t now = 1000000;
+    VersionNode chain = NULL;
+    for (uint64_t gv = 2; gv <= 10; gv += 2) {
+        chain = version_node_create(NULL, gv, gv / 2, chain, NULL);
+        assert(chain);
+    }
+    uint64_t ages[] = {0, 10, 100, 1000, 10000};
+    size_t i = 0;
+    for (VersionNode v = chain; v; v = v->prev) v->created = now - ages[i++];
+
+    RetentionRule head_only = {0};
+    assert(retention_last_kept(&head_only, chain, now) == chain);
+    RetentionRule three = {.keep_versions = 3};
+    assert(retention_last_kept(&three, chain, now)->global_version == 6);
+    RetentionRule after = {.keep_after = 3};
+    assert(retention_last_kept(&after, chain, now)->global_version == 4);
+    RetentionRule window = {.keep_seconds = 50};
+    assert(retention_last_kept(&window, chain, now)->global_version == 8);
+    /* Limits combine: whichever keeps more wins. */
+    RetentionRule mixed = {.keep_versions = 2, .keep_seconds = 500};
+    assert(retention_last_kept(&mixed, chain, now)->global_version == 6);
+    RetentionRule everything = {.keep_versions = 100};
+    assert(retention_last_kept(&everything, chain, now)->prev == NULL);
+    version_node_free(chain);
+}
+
+static Document build(void) {
+    Document doc = document_create();
+    assert(doc);
+    char value[16];
+    for (uint64_t v = 1; v <= 40; v++) {
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)v);
+        assert(document_set_field_path(doc, "audit/eu/log", value, v) == 0);
+        assert(document_set_field_path(doc, "audit/us/log", value, v) == 0);
+        assert(document_set_field_path(doc, "users/alice/plan", value, v) == 0);
+    }
+    return doc;
+}
+
+int main(void) {
+    test_rules();
+    test_last_kept();
+
+    /* 30 versions under audit/, 5 under audit/eu, heads elsewhere. */
+    RetentionPolicy policy = retention_policy_create();
+    assert(policy);
+    RetentionRule audit = {.keep_versions = 30};
+    RetentionRule eu = {.keep_versions = 5};
+    assert(retention_policy_set(policy, "audit", &audit) == 0);
+    assert(retention_policy_set(policy, "audit/eu", &eu) == 0);
+
+    Document doc = build();
+    VersionNode root = version_node_create(doc, 40, 1, NULL, (void (*)(void *))document_free);
+    assert(root);
+    CompactBudget small = {.max_entries = 2};
+    CompactStats stats;
+    assert(compactor_compact_incremental(root, policy, &small, &stats) == 0);
+    assert(chain_length(doc, "audit/us/log") == 30);
+    assert(chain_length(doc, "audit/eu/log") == 5);
+    assert(chain_length(doc, "users/alice/plan") == 1);
+    assert(stats.versions_freed == 10 + 35 + 39);
+    char *val = document_get_field(doc, "audit/us/log", 11);
+    assert(val && strcmp(val, "11") == 0);
+    free(val);
+    assert(document_get_field(doc, "audit/us/log", 10) == NULL);
+
+    /* Compacting again is a no-op. */
+    assert(compactor_compact_incremental(root, policy, NULL, &stats) == 0);
+    assert(stats.versions_freed == 0);
+
+    /* History of a lazily loaded v2 snapshot is loaded where the policy
+     * keeps it, rather than dropped unread. */
+    version_node_free(root);
+    root = version_node_create(build(), 40, 1, NULL, (void (*)(void *))document_free);
+    assert(root);
+    SerializeOptions v2 = {.format_version = 2};
+    assert(serialize_db_with_options(root, TEST_FILE, &v2) == 0);
+    version_node_free(root);
+    assert(deserialize_db(TEST_FILE, &root) == 0 && root);
+    assert(compactor_compact_incremental(root, policy, NULL, NULL) == 0);
+    doc = (Document)root->value;
+    assert(chain_length(doc, "audit/us/log") == 30);
+    assert(chain_length(doc, "audit/eu/log") == 5);
+    assert(chain_length(doc, "users/alice/plan") == 1);
+    val = document_get_field(doc, "audit/eu/log", 36);
+    assert(val && strcmp(val, "36") == 0);
+    free(val);
+
+    version_node_free(root);
+    retention_policy_free(policy);
+    remove(TEST_FILE);
+    puts("Retention tests passed.");
+    return 0;
+}
@@ -62,7 +62,7 @@ int main() {
     print_test_result("Pre-serialize get deleted field2", val == DELETED);
 
     printf("\nPre-serialize versions for field1:\n");
-    document_list_versions(root_doc, "field1");
+    document_list_versions(root_doc, "field1", stdout);
 
     // Serialize
     if (serialize_db(root, TEST_FILE) != 0) {
@@ -102,7 +102,7 @@ int main() {
 
     // List versions for field1
     printf("\nPost-deserialize versions for field1:\n");
-    document_list_versions(deserialized_doc, "field1");
+    document_list_versions(deserialized_doc, "field1", stdout);
 
     version_node_free(deserialized_root);
     remove(TEST_FILE);
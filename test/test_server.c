@@ -0,0 +1,730 @@
+#include <assert.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/decode_and_execute.h"
+#include "../src/server.h"
+#include "../src/utils/document.h"
+#include "../src/utils/reclaim.h"
+#include "../src/utils/version_node.h"
+
+#define SOCKET_PATH "test_server.sock"
+#define CLIENTS 8
+#define KEYS 100
+
+static Session make_session(void) {
+    Document doc = document_create();
+    assert(doc);
+    VersionNode root = version_node_create(doc, 0, 0, NULL, (void (*)(void *))document_free);
+    assert(root);
+    Session session = {.root = root, .retention = retention_policy_create()};
+    assert(session.retention);
+    return session;
+}
+
+static void free_session(Session *session) {
+    autocompact_stop(session->autocompact);
+    if (session->snapshot) snapshot_release(session->snapshot);
+    retention_policy_free(session->retention);
+    version_node_free(session->root);
+    reclaim_barrier();
+}
+
+static int connect_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons((uint16_t)port)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+static int connect_unix(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, path);
+    assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+static void send_all(int fd, const char *text) {
+    size_t len = strlen(text);
+    while (len) {
+        ssize_t n = send(fd, text, len, 0);
+        assert(n > 0);
+        text += n;
+        len -= (size_t)n;
+    }
+}
+
+/* Reads buffered per connection, since replies arrive in arbitrary pieces. */
+struct client {
+    int fd;
+    char buf[65536];
+    size_t len;
+};
+
+static int fill(struct client *c) {
+    assert(c->len < sizeof(c->buf));
+    ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+    if (n <= 0) return -1;
+    c->len += (size_t)n;
+    return 0;
+}
+
+/* Next reply's status ("ok" or "err") and body, NUL terminated. */
+static void read_reply(struct client *c, char *status, char *body, size_t body_cap) {
+    char *nl;
+    while (!(nl = memchr(c->buf, '\n', c->len))) assert(fill(c) == 0);
+    size_t n = 0;
+    assert(sscanf(c->buf, "%3s %zu", status, &n) == 2);
+    size_t header = (size_t)(nl - c->buf) + 1;
+    while (c->len < header + n) assert(fill(c) == 0);
+    assert(n < body_cap);
+    memcpy(body, c->buf + header, n);
+    body[n] = '\0';
+    c->len -= header + n;
+    memmove(c->buf, c->buf + header + n, c->len);
+}
+
+static void expect(struct client *c, const char *status, const char *body) {
+    char got_status[4], got[4096];
+    read_reply(c, got_status, got, sizeof(got));
+    if (strcmp(got_status, status) != 0 || strcmp(got, body) != 0) {
+        fprintf(stderr, "expected %s '%s', got %s '%s'\n", status, body, got_status, got);
+        assert(0);
+    }
+}
+
+/* Binary frames. The buffer a request is built in is sized for the test's
+ * largest; operands are appended with the put_ helpers. */
+struct frame {
+    unsigned char buf[4096];
+    size_t len;
+};
+
+static void put_le(struct frame *f, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) f->buf[f->len++] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_bytes(struct frame *f, const char *s, size_t len) {
+    put_le(f, len, 4);
+    memcpy(f->buf + f->len, s, len);
+    f->len += len;
+}
+
+static void put_string(struct frame *f, const char *s) { put_bytes(f, s, strlen(s)); }
+
+/* A SET operand: a type byte and the payload as a string. */
+static void put_value(struct frame *f, ValueType type, const char *data, size_t len) {
+    f->buf[f->len++] = (unsigned char)type;
+    put_bytes(f, data, len);
+}
+
+static void put_text(struct frame *f, const char *s) { put_value(f, VALUE_STRING, s, strlen(s)); }
+
+static void frame_begin(struct frame *f, uint32_t id, int op) {
+    f->len = 4;
+    put_le(f, id, 4);
+    f->buf[f->len++] = (unsigned char)op;
+}
+
+/* Patch in the length and send. */
+static void frame_send(int fd, struct frame *f) {
+    size_t len = f->len;
+    f->len = 0;
+    put_le(f, len - 4, 4);
+    f->len = len;
+    const unsigned char *p = f->buf;
+    while (len) {
+        ssize_t n = send(fd, p, len, 0);
+        assert(n > 0);
+        p += n;
+        len -= (size_t)n;
+    }
+}
+
+static uint32_t le32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24;
+}
+
+/* Next response frame: its id and status, and the payload NUL terminated
+ * with its length in *len. */
+static uint32_t read_frame_len(struct client *c, int *status, char *payload, size_t cap,
+                               size_t *len_out) {
+    while (c->len < 4) assert(fill(c) == 0);
+    size_t len = 4 + le32(c->buf);
+    assert(len >= SERVER_WIRE_HEADER);
+    while (c->len < len) assert(fill(c) == 0);
+    uint32_t id = le32(c->buf + 4);
+    *status = (unsigned char)c->buf[8];
+    size_t n = len - SERVER_WIRE_HEADER;
+    assert(n < cap);
+    memcpy(payload, c->buf + SERVER_WIRE_HEADER, n);
+    payload[n] = '\0';
+    *len_out = n;
+    c->len -= len;
+    memmove(c->buf, c->buf + len, c->len);
+    return id;
+}
+
+static uint32_t read_frame(struct client *c, int *status, char *payload, size_t cap) {
+    size_t len;
+    return read_frame_len(c, status, payload, cap, &len);
+}
+
+static void expect_frame(struct client *c, uint32_t id, int status, const char *payload) {
+    char got[4096];
+    int got_status;
+    uint32_t got_id = read_frame(c, &got_status, got, sizeof(got));
+    if (got_id != id || got_status != status || (payload && strcmp(got, payload) != 0)) {
+        fprintf(stderr, "expected #%u %d '%s', got #%u %d '%s'\n", id, status,
+                payload ? payload : "", got_id, got_status, got);
+        assert(0);
+    }
+}
+
+static void hello(struct client *c) {
+    send_all(c->fd, SERVER_WIRE_HELLO);
+    while (c->len < 4) assert(fill(c) == 0);
+    assert(memcmp(c->buf, SERVER_WIRE_HELLO, 4) == 0);
+    c->len -= 4;
+    memmove(c->buf, c->buf + 4, c->len);
+}
+
+static void send_command(struct client *c, uint32_t id, const char *line) {
+    struct frame f;
+    frame_begin(&f, id, SERVER_OP_COMMAND);
+    memcpy(f.buf + f.len, line, strlen(line));
+    f.len += strlen(line);
+    frame_send(c->fd, &f);
+}
+
+/* Commands, errors, blank lines, pipelining and quit on one connection. */
+static void test_protocol(void) {
+    Session session = make_session();
+    Server server = server_start(&session, SOCKET_PATH, 2);
+    assert(server && server_port(server) == 0);
+    struct client c = {.fd = connect_unix(SOCKET_PATH)};
+
+    send_all(c.fd, "set users/alice/age 30\r\nset users/alice/age 31\n\n   \nget users/alice/age\n");
+    expect(&c, "ok", "OK\n");
+    expect(&c, "ok", "OK\n");
+    expect(&c, "ok", "31\n");
+    send_all(c.fd, "list-versions users/alice/age\nfrobnicate\nlist-versions users/nobody\n");
+    expect(&c, "ok", "v2: 31\nv1: 30\n");
+    expect(&c, "err", "Invalid command or arguments.\n");
+    char status[4], body[4096];
+    read_reply(&c, status, body, sizeof(body));
+    assert(strcmp(status, "err") == 0);
+    send_all(c.fd, "compact_db\nretain audit 3\nretention\n");
+    expect(&c, "ok", "Compacted database\n");
+    expect(&c, "ok", "OK\n");
+    read_reply(&c, status, body, sizeof(body));
+    assert(strcmp(status, "ok") == 0 && strstr(body, "/audit: keep 3"));
+
+    /* A command split across writes is only run once it is complete. */
+    send_all(c.fd, "get users/ali");
+    nanosleep(&(struct timespec){0, 20 * 1000 * 1000}, NULL);
+    send_all(c.fd, "ce/age\nquit\nget users/alice/age\n");
+    expect(&c, "ok", "31\n");
+    assert(fill(&c) != 0 && c.len == 0);
+    close(c.fd);
+
+    /* A client that stops sending still gets its answers. */
+    c = (struct client){.fd = connect_unix(SOCKET_PATH)};
+    send_all(c.fd, "get users/alice/age\ndelete users/alice/age\nget users/alice/age\n");
+    shutdown(c.fd, SHUT_WR);
+    expect(&c, "ok", "31\n");
+    expect(&c, "ok", "OK\n");
+    expect(&c, "ok", "Value not found.\n");
+    assert(fill(&c) != 0);
+    close(c.fd);
+    server_stop(server);
+    assert(access(SOCKET_PATH, F_OK) != 0);
+
+    /* A last line without its ending is still run, as the prompt runs it;
+     * so is one short enough to be the start of the binary hello. */
+    server = server_start(&session, "127.0.0.1:0", 2);
+    assert(server);
+    c = (struct client){.fd = connect_tcp(server_port(server))};
+    send_all(c.fd, "set users/bob/age 40\nget users/bob/age");
+    shutdown(c.fd, SHUT_WR);
+    expect(&c, "ok", "OK\n");
+    expect(&c, "ok", "40\n");
+    assert(fill(&c) != 0);
+    close(c.fd);
+    c = (struct client){.fd = connect_tcp(server_port(server))};
+    send_all(c.fd, "FD");
+    shutdown(c.fd, SHUT_WR);
+    expect(&c, "err", "Invalid command or arguments.\n");
+    assert(fill(&c) != 0);
+    close(c.fd);
+    server_stop(server);
+    free_session(&session);
+}
+
+struct worker_args {
+    int port;
+    int id;
+};
+
+/* Each client pipelines batches of writes and reads of its own keys, and
+ * every reply must come back in order and match. */
+static void *client_main(void *arg) {
+    struct worker_args *w = arg;
+    struct client *c = calloc(1, sizeof(*c));
+    assert(c);
+    c->fd = connect_tcp(w->port);
+    char line[128], expected[64];
+    for (int round = 0; round < 3; round++) {
+        for (int k = 0; k < KEYS; k++) {
+            snprintf(line, sizeof(line), "set c%d/k%03d v%d-%d\nget c%d/k%03d\n", w->id, k,
+                     round, k, w->id, k);
+            send_all(c->fd, line);
+        }
+        for (int k = 0; k < KEYS; k++) {
+            expect(c, "ok", "OK\n");
+            snprintf(expected, sizeof(expected), "v%d-%d\n", round, k);
+            expect(c, "ok", expected);
+        }
+    }
+    snprintf(line, sizeof(line), "list-versions c%d/k007\n", w->id);
+    send_all(c->fd, line);
+    expect(c, "ok", "v3: v2-7\nv2: v1-7\nv1: v0-7\n");
+    close(c->fd);
+    free(c);
+    return NULL;
+}
+
+static void test_concurrent_clients(void) {
+    Session session = make_session();
+    Server server = server_start(&session, "127.0.0.1:0", 4);
+    assert(server && server_port(server) > 0);
+
+    pthread_t threads[CLIENTS];
+    struct worker_args args[CLIENTS];
+    for (int i = 0; i < CLIENTS; i++) {
+        args[i] = (struct worker_args){server_port(server), i};
+        assert(pthread_create(&threads[i], NULL, client_main, &args[i]) == 0);
+    }
+    for (int i = 0; i < CLIENTS; i++) pthread_join(threads[i], NULL);
+
+    /* Everything the clients wrote is in the tree the server was given. */
+    char path[32];
+    for (int i = 0; i < CLIENTS; i++) {
+        snprintf(path, sizeof(path), "c%d/k099", i);
+        char *val = document_get_field((Document)session.root->value, path, UINT64_MAX);
+        assert(val && strcmp(val, "v2-99") == 0);
+        free(val);
+    }
+
+    /* Stopping with clients still connected closes them. */
+    struct client idle = {.fd = connect_tcp(server_port(server))};
+    send_all(idle.fd, "get c0/k000\n");
+    expect(&idle, "ok", "v2-0\n");
+    server_stop(server);
+    assert(fill(&idle) != 0);
+    close(idle.fd);
+    free_session(&session);
+}
+
+/* Values with spaces and newlines, versions, absent paths, commands and
+ * bad frames over the binary protocol. */
+static void test_binary(void) {
+    Session session = make_session();
+    Server server = server_start(&session, SOCKET_PATH, 2);
+    assert(server);
+    struct client c = {.fd = connect_unix(SOCKET_PATH)};
+    hello(&c);
+
+    /* One write after another's reply: each sees the last. */
+    struct frame f;
+    frame_begin(&f, 1, SERVER_OP_SET);
+    put_string(&f, "notes/today");
+    put_text(&f, "buy milk\nand eggs, twice");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 1, SERVER_STATUS_OK, "");
+    frame_begin(&f, 2, SERVER_OP_SET);
+    put_string(&f, "notes/today");
+    put_text(&f, "  ");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 2, SERVER_STATUS_OK, "");
+
+    frame_begin(&f, 3, SERVER_OP_GET);
+    put_le(&f, UINT64_MAX, 8);
+    put_string(&f, "notes/today");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 3, SERVER_STATUS_OK, "\x01" "  ");
+    frame_begin(&f, 4, SERVER_OP_GET);
+    put_le(&f, 1, 8);
+    put_string(&f, "notes/today");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 4, SERVER_STATUS_OK, "\x01" "buy milk\nand eggs, twice");
+
+    frame_begin(&f, 5, SERVER_OP_DELETE);
+    put_string(&f, "notes/today");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 5, SERVER_STATUS_OK, "");
+    frame_begin(&f, 6, SERVER_OP_GET);
+    put_le(&f, UINT64_MAX, 8);
+    put_string(&f, "notes/today");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 6, SERVER_STATUS_NOT_FOUND, "");
+
+    frame_begin(&f, 7, SERVER_OP_COMMAND);
+    memcpy(f.buf + f.len, "list-versions notes/today", 25);
+    f.len += 25;
+    frame_send(c.fd, &f);
+    expect_frame(&c, 7, SERVER_STATUS_OK, "v3: <deleted>\nv2:   \nv1: buy milk\nand eggs, twice\n");
+
+    /* Errors answer the request and leave the connection open. */
+    frame_begin(&f, 8, SERVER_OP_SET);
+    put_string(&f, "truncated");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 8, SERVER_STATUS_ERROR, "Malformed request.\n");
+    frame_begin(&f, 9, SERVER_OP_SET);
+    put_bytes(&f, "a\0b", 3);
+    put_text(&f, "x");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 9, SERVER_STATUS_ERROR, "Malformed request.\n");
+    frame_begin(&f, 10, 99);
+    frame_send(c.fd, &f);
+    expect_frame(&c, 10, SERVER_STATUS_ERROR, "Unknown op 99.\n");
+
+    /* A frame too short to hold a header, or too long to accept, ends the
+     * connection. */
+    assert(send(c.fd, "\x02\x00\x00\x00" "ab", 6, 0) == 6);
+    assert(fill(&c) != 0);
+    close(c.fd);
+    c = (struct client){.fd = connect_unix(SOCKET_PATH)};
+    hello(&c);
+    assert(send(c.fd, "\xff\xff\xff\x7f", 4, 0) == 4);
+    assert(fill(&c) != 0);
+    close(c.fd);
+
+    /* The hello is detected across writes, and text still works beside it. */
+    c = (struct client){.fd = connect_unix(SOCKET_PATH)};
+    send_all(c.fd, "FD");
+    nanosleep(&(struct timespec){0, 20 * 1000 * 1000}, NULL);
+    send_all(c.fd, "B\x01");
+    while (c.len < 4) assert(fill(&c) == 0);
+    assert(memcmp(c.buf, SERVER_WIRE_HELLO, 4) == 0);
+    close(c.fd);
+    c = (struct client){.fd = connect_unix(SOCKET_PATH)};
+    send_all(c.fd, "FOO\n");
+    expect(&c, "err", "Invalid command or arguments.\n");
+    close(c.fd);
+
+    server_stop(server);
+    free_session(&session);
+}
+
+/* Typed values go over the wire as they are stored: bytes with NULs in
+ * them, and numbers and bools in binary, never as formatted text. */
+static void test_binary_typed(void) {
+    Session session = make_session();
+    Server server = server_start(&session, SOCKET_PATH, 2);
+    assert(server);
+    struct client c = {.fd = connect_unix(SOCKET_PATH)};
+    hello(&c);
+
+    static const char blob[] = {'a', 0, 'b', (char)0xff, 0};
+    unsigned char num[8];
+    int64_t minus_five = -5;
+    double two_and_a_half = 2.5;
+    uint64_t bits;
+    struct {
+        const char *path;
+        ValueType type;
+        const char *data;
+        size_t len;
+    } values[] = {
+        {"t/blob", VALUE_BYTES, blob, sizeof(blob)},
+        {"t/empty", VALUE_BYTES, "", 0},
+        {"t/int", VALUE_INT64, (const char *)num, 8},
+        {"t/double", VALUE_DOUBLE, NULL, 8},
+        {"t/bool", VALUE_BOOL, "\x01", 1},
+        {"t/text", VALUE_STRING, "plain", 5},
+    };
+    unsigned char doubled[8];
+    for (int i = 0; i < 8; i++) num[i] = (unsigned char)((uint64_t)minus_five >> (8 * i));
+    memcpy(&bits, &two_and_a_half, sizeof(bits));
+    for (int i = 0; i < 8; i++) doubled[i] = (unsigned char)(bits >> (8 * i));
+    values[3].data = (const char *)doubled;
+
+    struct frame f;
+    size_t count = sizeof(values) / sizeof(values[0]);
+    for (uint32_t i = 0; i < count; i++) {
+        frame_begin(&f, i, SERVER_OP_SET);
+        put_string(&f, values[i].path);
+        put_value(&f, values[i].type, values[i].data, values[i].len);
+        frame_send(c.fd, &f);
+        expect_frame(&c, i, SERVER_STATUS_OK, "");
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        frame_begin(&f, i, SERVER_OP_GET);
+        put_le(&f, UINT64_MAX, 8);
+        put_string(&f, values[i].path);
+        frame_send(c.fd, &f);
+        char payload[64];
+        int status;
+        size_t len;
+        assert(read_frame_len(&c, &status, payload, sizeof(payload), &len) == i);
+        assert(status == SERVER_STATUS_OK && len == 1 + values[i].len);
+        assert(payload[0] == (char)values[i].type);
+        assert(memcmp(payload + 1, values[i].data, values[i].len) == 0);
+    }
+
+    /* The shell still sees them as text. */
+    send_command(&c, 50, "get t/blob");
+    expect_frame(&c, 50, SERVER_STATUS_OK, "0x610062ff00\n");
+    send_command(&c, 51, "get t/int");
+    expect_frame(&c, 51, SERVER_STATUS_OK, "-5\n");
+
+    /* Operands that do not fit their type are refused. */
+    struct {
+        ValueType type;
+        const char *data;
+        size_t len;
+    } bad[] = {
+        {VALUE_STRING, "a\0b", 3},
+        {VALUE_INT64, "1234", 4},
+        {VALUE_DOUBLE, "", 0},
+        {VALUE_BOOL, "\x02", 1},
+        {VALUE_NONE, "x", 1},
+        {9, "x", 1},
+    };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        frame_begin(&f, 100 + i, SERVER_OP_SET);
+        put_string(&f, "t/bad");
+        put_value(&f, bad[i].type, bad[i].data, bad[i].len);
+        frame_send(c.fd, &f);
+        expect_frame(&c, 100 + i, SERVER_STATUS_ERROR, "Malformed request.\n");
+    }
+    frame_begin(&f, 200, SERVER_OP_GET);
+    put_le(&f, UINT64_MAX, 8);
+    put_string(&f, "t/bad");
+    frame_send(c.fd, &f);
+    expect_frame(&c, 200, SERVER_STATUS_NOT_FOUND, "");
+
+    close(c.fd);
+    server_stop(server);
+    free_session(&session);
+}
+
+#define PIPELINED 2000
+
+/* Thousands of requests in flight on one connection; the replies may come
+ * back in any order and each is matched up by its id. */
+static void test_binary_pipelining(void) {
+    Session session = make_session();
+    Server server = server_start(&session, "127.0.0.1:0", 4);
+    assert(server);
+    struct client *c = calloc(1, sizeof(*c));
+    assert(c);
+    c->fd = connect_tcp(server_port(server));
+    hello(c);
+
+    struct frame f;
+    char path[32], value[32];
+    for (uint32_t i = 0; i < PIPELINED; i++) {
+        snprintf(path, sizeof(path), "keys/k%04u", i);
+        snprintf(value, sizeof(value), "value %u", i);
+        frame_begin(&f, i, SERVER_OP_SET);
+        put_string(&f, path);
+        put_text(&f, value);
+        frame_send(c->fd, &f);
+    }
+    unsigned char *seen = calloc(PIPELINED, 1);
+    assert(seen);
+    for (int i = 0; i < PIPELINED; i++) {
+        char payload[64];
+        int status;
+        uint32_t id = read_frame(c, &status, payload, sizeof(payload));
+        assert(id < PIPELINED && !seen[id] && status == SERVER_STATUS_OK);
+        seen[id] = 1;
+    }
+
+    memset(seen, 0, PIPELINED);
+    for (uint32_t i = 0; i < PIPELINED; i++) {
+        snprintf(path, sizeof(path), "keys/k%04u", i);
+        frame_begin(&f, i, SERVER_OP_GET);
+        put_le(&f, UINT64_MAX, 8);
+        put_string(&f, path);
+        frame_send(c->fd, &f);
+    }
+    for (int i = 0; i < PIPELINED; i++) {
+        char payload[64];
+        int status;
+        uint32_t id = read_frame(c, &status, payload, sizeof(payload));
+        assert(id < PIPELINED && !seen[id] && status == SERVER_STATUS_OK);
+        snprintf(value, sizeof(value), "%cvalue %u", VALUE_STRING, id);
+        assert(strcmp(payload, value) == 0);
+        seen[id] = 1;
+    }
+
+    /* Writes to one key apply in the order sent, and a read sent after
+     * them sees the last, without waiting for their replies. */
+    for (uint32_t i = 0; i < PIPELINED; i++) {
+        snprintf(value, sizeof(value), "value %u", i);
+        frame_begin(&f, i, SERVER_OP_SET);
+        put_string(&f, "keys/hot");
+        put_text(&f, value);
+        frame_send(c->fd, &f);
+    }
+    frame_begin(&f, PIPELINED, SERVER_OP_GET);
+    put_le(&f, UINT64_MAX, 8);
+    put_string(&f, "keys/hot");
+    frame_send(c->fd, &f);
+    memset(seen, 0, PIPELINED);
+    for (int i = 0; i < PIPELINED; i++) {
+        char payload[64];
+        int status;
+        uint32_t id = read_frame(c, &status, payload, sizeof(payload));
+        assert(id < PIPELINED && !seen[id] && status == SERVER_STATUS_OK);
+        seen[id] = 1;
+    }
+    snprintf(value, sizeof(value), "%cvalue %u", VALUE_STRING, PIPELINED - 1);
+    expect_frame(c, PIPELINED, SERVER_STATUS_OK, value);
+    frame_begin(&f, 0, SERVER_OP_GET);
+    put_le(&f, UINT64_MAX, 8);
+    put_string(&f, "keys/hot");
+    frame_send(c->fd, &f);
+    expect_frame(c, 0, SERVER_STATUS_OK, value);
+
+    free(seen);
+    close(c->fd);
+    free(c);
+    server_stop(server);
+    free_session(&session);
+}
+
+#define STREAMED 3000
+#define WIDE 1500
+#define WIDE_VALUE 3000
+
+/* The payload of reply id, put together from its pieces; how many MORE
+ * frames there were goes to *pieces. Other replies must not come first. */
+static char *read_streamed(struct client *c, uint32_t id, int *status, size_t *pieces) {
+    size_t cap = 8u << 20, len = 0;
+    char *all = malloc(cap), *piece = malloc(SERVER_REPLY_CHUNK + 1);
+    assert(all && piece);
+    *pieces = 0;
+    while (1) {
+        assert(read_frame(c, status, piece, SERVER_REPLY_CHUNK + 1) == id);
+        size_t n = strlen(piece);
+        assert(len + n < cap);
+        memcpy(all + len, piece, n);
+        len += n;
+        if (*status != SERVER_STATUS_MORE) break;
+        assert(n == SERVER_REPLY_CHUNK);
+        ++*pieces;
+    }
+    all[len] = '\0';
+    free(piece);
+    return all;
+}
+
+/* A query's matches outgrow one frame and come back as MORE pieces, in
+ * order, then the final status. A client slow to read holds the server
+ * back instead of having the rest queued for it. */
+static void test_binary_streaming(void) {
+    Session session = make_session();
+    Server server = server_start(&session, SOCKET_PATH, 2);
+    assert(server);
+    struct client *c = calloc(1, sizeof(*c));
+    assert(c);
+    c->fd = connect_unix(SOCKET_PATH);
+    hello(c);
+
+    struct frame f;
+    char path[32], value[64];
+    for (uint32_t i = 0; i < STREAMED; i++) {
+        snprintf(path, sizeof(path), "big/k%05u", i);
+        snprintf(value, sizeof(value), "a value long enough to add up %u", i);
+        frame_begin(&f, i, SERVER_OP_SET);
+        put_string(&f, path);
+        put_text(&f, value);
+        frame_send(c->fd, &f);
+    }
+    char wide[WIDE_VALUE + 1];
+    memset(wide, 'w', WIDE_VALUE);
+    wide[WIDE_VALUE] = '\0';
+    for (uint32_t i = 0; i < WIDE; i++) {
+        snprintf(path, sizeof(path), "wide/k%04u", i);
+        frame_begin(&f, STREAMED + i, SERVER_OP_SET);
+        put_string(&f, path);
+        put_text(&f, wide);
+        frame_send(c->fd, &f);
+    }
+    for (int i = 0; i < STREAMED + WIDE; i++) {
+        int status;
+        assert(read_frame(c, &status, value, sizeof(value)) < STREAMED + WIDE);
+        assert(status == SERVER_STATUS_OK);
+    }
+
+    /* A GET behind the query is answered after it. */
+    send_command(c, 1, "query big/*");
+    frame_begin(&f, 2, SERVER_OP_GET);
+    put_le(&f, UINT64_MAX, 8);
+    put_string(&f, "big/k00007");
+    frame_send(c->fd, &f);
+    int status;
+    size_t pieces;
+    char *all = read_streamed(c, 1, &status, &pieces);
+    assert(status == SERVER_STATUS_OK && pieces >= 3);
+    size_t lines = 0;
+    for (char *line = all; *line; line = strchr(line, '\n') + 1) {
+        unsigned k, v;
+        assert(sscanf(line, "big/k%05u: a value long enough to add up %u", &k, &v) == 2);
+        assert(k == v);
+        lines++;
+    }
+    assert(lines == STREAMED);
+    free(all);
+    expect_frame(c, 2, SERVER_STATUS_OK, "\x01" "a value long enough to add up 7");
+
+    /* More than SERVER_MAX_UNSENT, read only after a pause. */
+    send_command(c, 3, "query wide/*");
+    nanosleep(&(struct timespec){0, 100 * 1000 * 1000}, NULL);
+    all = read_streamed(c, 3, &status, &pieces);
+    assert(status == SERVER_STATUS_OK);
+    assert(strlen(all) == WIDE * (strlen("wide/k0000: \n") + WIDE_VALUE));
+    free(all);
+
+    close(c->fd);
+    free(c);
+    server_stop(server);
+    free_session(&session);
+}
+
+static void test_bad_address(void) {
+    Session session = make_session();
+    assert(!server_start(&session, "no-such-dir/x.sock", 1));
+    assert(!server_start(&session, "127.0.0.1:99999", 1));
+    free_session(&session);
+}
+
+int main(void) {
+    test_protocol();
+    test_concurrent_clients();
+    test_binary();
+    test_binary_typed();
+    test_binary_pipelining();
+    test_binary_streaming();
+    test_bad_address();
+    puts("Server tests passed.");
+    return 0;
+}
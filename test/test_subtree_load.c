@@ -0,0 +1,121 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/storage/snapshot.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define TEST_FILE "subtree-load.fortdb"
+#define TENANTS 3000
+
+static void check_field(Document doc, const char *path, uint64_t version, const char *expected) {
+    char *val = document_get_field(doc, path, version);
+    assert(val && val != (char *)DELETED);
+    assert(strcmp(val, expected) == 0);
+    free(val);
+}
+
+static void check_acme(Document acme) {
+    check_field(acme, "name", UINT64_MAX, "Acme");
+    check_field(acme, "plan", UINT64_MAX, "team");
+    check_field(acme, "plan", 1, "free");
+    check_field(acme, "users/alice/email", UINT64_MAX, "alice@acme.test");
+}
+
+static VersionNode build(void) {
+    Document doc = document_create();
+    assert(doc);
+    char path[96], value[64];
+    for (int i = 0; i < TENANTS; i++) {
+        snprintf(path, sizeof(path), "tenants/t-%05d/name", i);
+        snprintf(value, sizeof(value), "Tenant %d", i);
+        assert(document_set_field_path(doc, path, value, 1) == 0);
+    }
+    assert(document_set_field_path(doc, "tenants/acme/name", "Acme", 1) == 0);
+    assert(document_set_field_path(doc, "tenants/acme/plan", "free", 1) == 0);
+    assert(document_set_field_path(doc, "tenants/acme/plan", "team", 2) == 0);
+    assert(document_set_field_path(doc, "tenants/acme/users/alice/email", "alice@acme.test", 2) == 0);
+    assert(document_set_field_path(doc, "config/mode", "on", 1) == 0);
+    VersionNode root = version_node_create(doc, 2, 1, NULL, (void (*)(void *))document_free);
+    assert(root);
+    return root;
+}
+
+int main(void) {
+    VersionNode saved = build();
+
+    for (uint32_t format = 1; format <= 3; format++) {
+        for (int compress = 0; compress <= 1; compress++) {
+            SerializeOptions options = {.format_version = format, .compress = compress};
+            assert(serialize_db_with_options(saved, TEST_FILE, &options) == 0);
+
+            Document acme = NULL;
+            assert(deserialize_subtree(TEST_FILE, "tenants/acme", &acme) == 0 && acme);
+            check_acme(acme);
+            document_free(acme);
+
+            Document missing = NULL;
+            assert(deserialize_subtree(TEST_FILE, "tenants/nobody", &missing) != 0 && !missing);
+            assert(deserialize_subtree(TEST_FILE, "config/mode", &missing) != 0 && !missing);
+        }
+    }
+
+    /* v2 reaches the subtree through the key directories: restoring one
+     * tenant reads a small fraction of the file. */
+    SerializeOptions v2 = {.format_version = 2};
+    assert(serialize_db_with_options(saved, TEST_FILE, &v2) == 0);
+    Snapshot snap = NULL;
+    assert(snapshot_open(TEST_FILE, &snap) == 0 && snap->file && snap->file->crcs);
+    Document acme = NULL;
+    assert(snapshot_get_subdocument(snap, "/tenants/acme/", &acme) == 0);
+    check_acme(acme);
+    size_t verified = 0;
+    for (uint64_t i = 0; i < snap->file->chunk_count; i++) verified += snap->file->verified[i] == 1;
+    assert(snap->file->chunk_count > 4 && verified <= 4);
+    document_free(acme);
+    snapshot_release(snap);
+
+    /* Grafting into a live database replaces only that subtree, as a new
+     * version of its path; siblings and the old subtree stay reachable. */
+    Document live = document_create();
+    assert(live);
+    assert(document_set_field_path(live, "tenants/acme/name", "Acme (edited)", 1) == 0);
+    assert(document_set_field_path(live, "tenants/acme/extra", "x", 2) == 0);
+    assert(document_set_field_path(live, "tenants/beta/name", "Beta", 3) == 0);
+    assert(deserialize_subtree(TEST_FILE, "tenants/acme", &acme) == 0);
+    assert(document_set_subdocument_path(live, "tenants/acme", acme, 4) == 0);
+    document_free(acme);
+
+    Document restored = document_get_subdocument_path(live, "tenants/acme");
+    assert(restored);
+    check_acme(restored);
+    char *gone = document_get_field(restored, "extra", UINT64_MAX);
+    assert(!gone);
+    document_free(restored);
+    check_field(live, "tenants/beta/name", UINT64_MAX, "Beta");
+
+    Document tenants = document_get_subdocument_path(live, "tenants");
+    assert(tenants);
+    Document before = document_get_subdocument(tenants, "acme", 1);
+    assert(before);
+    check_field(before, "name", UINT64_MAX, "Acme (edited)");
+    document_free(before);
+    document_free(tenants);
+
+    /* Missing parents are created. */
+    assert(deserialize_subtree(TEST_FILE, "tenants/acme/users", &acme) == 0);
+    assert(document_set_subdocument_path(live, "archive/acme-users", acme, 5) == 0);
+    document_free(acme);
+    check_field(live, "archive/acme-users/alice/email", UINT64_MAX, "alice@acme.test");
+
+    document_free(live);
+    version_node_free(saved);
+    remove(TEST_FILE);
+    puts("Subtree load tests passed.");
+    return 0;
+}
@@ -10,6 +10,7 @@
 #include "../src/storage/deserializer.h"
 #include "../src/storage/serializer.h"
 #include "../src/utils/document.h"
+#include "../src/utils/reclaim.h"
 #include "../src/utils/version_node.h"
 
 struct state {
@@ -83,6 +84,91 @@ static void *loader(void *arg) {
     return NULL;
 }
 
+/* Readers pin the root Document around each pair of lookups, as the shell
+ * does, while a loader parses files and publishes them. Every pair must
+ * see one complete tree, and the replaced trees must be freed only once
+ * drained. */
+struct swap_state {
+    VersionNode root;
+    const char *file;
+    atomic_int done;
+    atomic_int errors;
+    atomic_int reads;
+};
+
+static void *swap_reader(void *arg) {
+    struct swap_state *s = arg;
+    while (!atomic_load(&s->done)) {
+        Document root = document_pin_root(s->root);
+        if (!root) break;
+        char *value = document_get_field(root, "key", UINT64_MAX);
+        char *other = document_get_field(root, "nested/key", UINT64_MAX);
+        if (!valid_value(value) || !other || other == (char *)DELETED ||
+            strcmp(value, other) != 0) {
+            atomic_fetch_add(&s->errors, 1);
+        }
+        document_free(root);
+        if (value != (char *)DELETED) free(value);
+        if (other != (char *)DELETED) free(other);
+        atomic_fetch_add(&s->reads, 1);
+    }
+    return NULL;
+}
+
+static void test_load_swap(void) {
+    const char *file = "swap.fortdb";
+    Document doc = document_create();
+    assert(doc);
+    assert(document_set_field(doc, "key", "initial", 1) == 0);
+    assert(document_set_field_path(doc, "nested/key", "initial", 1) == 0);
+    VersionNode root = version_node_create(doc, 1, 1, NULL, (void (*)(void *))document_free);
+    assert(root);
+
+    struct swap_state state = {.root = root, .file = file};
+    pthread_t readers[3];
+    for (size_t i = 0; i < 3; i++) assert(pthread_create(&readers[i], NULL, swap_reader, &state) == 0);
+
+    char value[64];
+    for (int i = 0; i < 50; i++) {
+        Document next = document_create();
+        assert(next);
+        snprintf(value, sizeof(value), "value-%d", i);
+        assert(document_set_field(next, "key", value, 1) == 0);
+        assert(document_set_field_path(next, "nested/key", value, 1) == 0);
+        VersionNode saved = version_node_create(next, 1, 1, NULL, (void (*)(void *))document_free);
+        assert(saved && serialize_db(saved, file) == 0);
+        version_node_free(saved);
+
+        VersionNode loaded = NULL;
+        assert(deserialize_db(file, &loaded) == 0 && loaded);
+        assert(document_publish_root(root, (Document)loaded->value) == 0);
+        loaded->value = NULL;
+        version_node_free(loaded);
+    }
+    atomic_store(&state.done, 1);
+    for (size_t i = 0; i < 3; i++) assert(pthread_join(readers[i], NULL) == 0);
+
+    /* A publish does not wait for a pinned reader, which keeps reading the
+     * tree it pinned until it lets go. */
+    Document pinned = document_pin_root(root);
+    Document next = document_create();
+    assert(pinned && next && document_set_field(next, "key", "value-49", 1) == 0);
+    assert(document_publish_root(root, next) == 0);
+    reclaim_barrier();
+    char *held = document_get_field(pinned, "key", UINT64_MAX);
+    assert(held && strcmp(held, "value-49") == 0);
+    free(held);
+    document_free(pinned);
+
+    assert(atomic_load(&state.errors) == 0 && atomic_load(&state.reads) > 0);
+    char *last = document_get_field((Document)root->value, "key", UINT64_MAX);
+    assert(last && strcmp(last, "value-49") == 0);
+    free(last);
+    version_node_free(root);
+    reclaim_barrier();      /* the replaced trees */
+    unlink(file);
+}
+
 static void test_immutable_reads_and_pinned_documents(void) {
     Document cycle_a = document_create();
     Document cycle_b = document_create();
@@ -128,6 +214,7 @@ static void test_immutable_reads_and_pinned_documents(void) {
 
 int main(void) {
     test_immutable_reads_and_pinned_documents();
+    test_load_swap();
 
     const char *file = "thread-safety.fortdb";
     unlink(file);
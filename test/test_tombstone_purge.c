@@ -0,0 +1,193 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/storage/compactor.h"
+#include "../src/storage/retention.h"
+#include "../src/utils/document.h"
+#include "../src/utils/version_node.h"
+
+#define CHURN 2000
+#define WRITERS 2
+#define DOCS_PER_WRITER 200
+
+static VersionNode make_root(Document *doc_out) {
+    Document doc = document_create();
+    assert(doc);
+    VersionNode root = version_node_create(doc, 0, 0, NULL, (void (*)(void *))document_free);
+    assert(root);
+    *doc_out = doc;
+    return root;
+}
+
+static void check_field(Document doc, const char *path, const char *expected) {
+    char *val = document_get_field(doc, path, UINT64_MAX);
+    assert(val && val != (char *)DELETED);
+    assert(strcmp(val, expected) == 0);
+    free(val);
+}
+
+/* Deleted fields, then the documents they leave empty, are removed and the
+ * maps shrink back. */
+static void test_purge_and_shrink(int incremental) {
+    Document doc = NULL;
+    VersionNode root = make_root(&doc);
+    char path[64];
+    uint64_t gv = 1;
+    for (int i = 0; i < CHURN; i++) {
+        snprintf(path, sizeof(path), "users/u-%04d/name", i);
+        assert(document_set_field_path(doc, path, "x", gv++) == 0);
+        snprintf(path, sizeof(path), "flat-%04d", i);
+        assert(document_set_field_path(doc, path, "x", gv++) == 0);
+    }
+    assert(document_set_field_path(doc, "users/u-0007/keep", "yes", gv++) == 0);
+    for (int i = 0; i < CHURN; i++) {
+        snprintf(path, sizeof(path), "users/u-%04d/name", i);
+        assert(document_delete_path(doc, path, gv++) == 0);
+        snprintf(path, sizeof(path), "flat-%04d", i);
+        assert(document_delete_path(doc, path, gv++) == 0);
+    }
+    Document users = document_get_subdocument_path(doc, "users");
+    assert(users && users->subdocuments->size == CHURN);
+    uint64_t grown = users->subdocuments->bucket_count;
+    document_free(users);
+    assert(doc->fields->size == CHURN && grown > 16);
+
+    if (incremental) {
+        CompactStats stats;
+        CompactBudget budget = {.max_entries = 64};
+        assert(compactor_compact_incremental(root, NULL, &budget, &stats) == 0);
+        assert(stats.entries_purged == 3 * CHURN - 1);
+    } else {
+        assert(compactor_compact(root) == 0);
+    }
+
+    assert(doc->fields->size == 0 && doc->fields->bucket_count == 16);
+    users = document_get_subdocument_path(doc, "users");
+    assert(users && users->subdocuments->size == 1 && users->subdocuments->bucket_count == 16);
+    document_free(users);
+    check_field(doc, "users/u-0007/keep", "yes");
+    char *gone = document_get_path(doc, "users/u-0008/name", UINT64_MAX);
+    assert(!gone);
+
+    /* Deleting the last field lets the whole branch go. */
+    assert(document_delete_path(doc, "users/u-0007/keep", gv++) == 0);
+    assert(compactor_compact(root) == 0);
+    assert(doc->subdocuments->size == 0);
+    version_node_free(root);
+}
+
+/* A document someone still holds, and history the policy keeps, stay. */
+static void test_pinned(void) {
+    Document doc = NULL;
+    VersionNode root = make_root(&doc);
+    assert(document_set_field_path(doc, "pinned/a", "1", 1) == 0);
+    assert(document_set_field_path(doc, "audit/a", "1", 2) == 0);
+    assert(document_delete_path(doc, "pinned/a", 3) == 0);
+    assert(document_delete_path(doc, "audit/a", 4) == 0);
+
+    Document pinned = document_get_subdocument_path(doc, "pinned");
+    assert(pinned);
+    RetentionPolicy policy = retention_policy_create();
+    RetentionRule keep = {.keep_versions = 2};
+    assert(policy && retention_policy_set(policy, "audit", &keep) == 0);
+    assert(compactor_compact_incremental(root, policy, NULL, NULL) == 0);
+
+    assert(doc->subdocuments->size == 2);
+    assert(pinned->fields->size == 0);
+    Document again = document_get_subdocument_path(doc, "pinned");
+    assert(again == pinned);
+    document_free(again);
+    Document audit = document_get_subdocument_path(doc, "audit");
+    assert(audit && audit->fields->size == 1);
+    char *old = document_get_field(audit, "a", 1);
+    assert(old && strcmp(old, "1") == 0);
+    free(old);
+    document_free(audit);
+
+    /* Once released, the empty document goes on the next pass. */
+    document_free(pinned);
+    assert(compactor_compact_incremental(root, policy, NULL, NULL) == 0);
+    assert(doc->subdocuments->size == 1);
+    retention_policy_free(policy);
+    version_node_free(root);
+}
+
+/* Writers churn documents while compaction keeps purging: a write into a
+ * document must never land in one that was just unlinked. */
+struct churn {
+    VersionNode root;
+    int id;
+    atomic_int *done;
+};
+
+static void *writer(void *arg) {
+    struct churn *c = arg;
+    char path[64];
+    uint64_t gv = 1;
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < DOCS_PER_WRITER; i++) {
+            assert(pthread_rwlock_rdlock(&c->root->lock) == 0);
+            Document doc = (Document)c->root->value;
+            snprintf(path, sizeof(path), "w%d/d-%03d/tmp", c->id, i);
+            assert(document_set_field_path(doc, path, "t", gv++) == 0);
+            assert(document_delete_path(doc, path, gv++) == 0);
+            snprintf(path, sizeof(path), "w%d/d-%03d/last", c->id, i);
+            char value[16];
+            snprintf(value, sizeof(value), "%d", round);
+            assert(document_set_field_path(doc, path, value, gv++) == 0);
+            if (round < 19) assert(document_delete_path(doc, path, gv++) == 0);
+            pthread_rwlock_unlock(&c->root->lock);
+        }
+    }
+    atomic_fetch_add(c->done, 1);
+    return NULL;
+}
+
+static void test_concurrent_churn(void) {
+    Document doc = NULL;
+    VersionNode root = make_root(&doc);
+    atomic_int done = 0;
+    pthread_t threads[WRITERS];
+    struct churn args[WRITERS];
+    for (int i = 0; i < WRITERS; i++) {
+        args[i] = (struct churn){root, i, &done};
+        assert(pthread_create(&threads[i], NULL, writer, &args[i]) == 0);
+    }
+    CompactBudget budget = {.max_entries = 16};
+    uint64_t purged = 0;
+    while (atomic_load(&done) < WRITERS) {
+        CompactStats stats;
+        assert(compactor_compact_incremental(root, NULL, &budget, &stats) == 0);
+        purged += stats.entries_purged;
+    }
+    for (int i = 0; i < WRITERS; i++) pthread_join(threads[i], NULL);
+    assert(compactor_compact_incremental(root, NULL, NULL, NULL) == 0);
+
+    char path[64];
+    for (int w = 0; w < WRITERS; w++) {
+        for (int i = 0; i < DOCS_PER_WRITER; i++) {
+            snprintf(path, sizeof(path), "w%d/d-%03d/last", w, i);
+            check_field(doc, path, "19");
+            snprintf(path, sizeof(path), "w%d/d-%03d", w, i);
+            Document d = document_get_subdocument_path(doc, path);
+            assert(d && d->fields->size == 1);
+            document_free(d);
+        }
+    }
+    printf("purged %llu entries during churn\n", (unsigned long long)purged);
+    version_node_free(root);
+}
+
+int main(void) {
+    test_purge_and_shrink(0);
+    test_purge_and_shrink(1);
+    test_pinned();
+    test_concurrent_churn();
+    puts("Tombstone purge tests passed.");
+    return 0;
+}
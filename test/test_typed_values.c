@@ -0,0 +1,222 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../src/storage/deserializer.h"
+#include "../src/storage/serializer.h"
+#include "../src/storage/snapshot.h"
+#include "../src/utils/document.h"
+#include "../src/utils/query.h"
+#include "../src/utils/value_index.h"
+#include "../src/utils/version_node.h"
+
+#define TYPED_FILE "typed-values.fortdb"
+#define TEXT_FILE "typed-values-text.fortdb"
+
+static const unsigned char blob[] = {'a', 0, 'b', 0xff};
+
+static void check_text(Document doc, const char *path, uint64_t version, const char *expected) {
+    char *val = document_get_field(doc, path, version);
+    assert(val && val != (char *)DELETED);
+    assert(strcmp(val, expected) == 0);
+    free(val);
+}
+
+static void check_values(Document doc) {
+    Value v;
+    assert(document_get_value(doc, "n/int", UINT64_MAX, &v) == 0);
+    assert(v.type == VALUE_INT64 && v.i == 9000000000LL);
+    assert(document_get_value(doc, "n/int", 1, &v) == 0);
+    assert(v.type == VALUE_INT64 && v.i == -7);
+    assert(document_get_value(doc, "n/dbl", UINT64_MAX, &v) == 0);
+    assert(v.type == VALUE_DOUBLE && v.d == 0.1);
+    assert(document_get_value(doc, "n/flag", UINT64_MAX, &v) == 0);
+    assert(v.type == VALUE_BOOL && v.b == 1);
+    assert(document_get_value(doc, "n/blob", UINT64_MAX, &v) == 0);
+    assert(v.type == VALUE_BYTES && v.length == sizeof(blob));
+    assert(memcmp(v.data, blob, sizeof(blob)) == 0);
+    value_clear(&v);
+    assert(document_get_value(doc, "n/text", UINT64_MAX, &v) == 0);
+    assert(v.type == VALUE_STRING && v.length == 5 && strcmp(v.data, "hello") == 0);
+    value_clear(&v);
+
+    /* One field may change type from version to version. */
+    assert(document_get_value(doc, "n/mixed", 1, &v) == 0);
+    assert(v.type == VALUE_STRING && strcmp(v.data, "5") == 0);
+    value_clear(&v);
+    assert(document_get_value(doc, "n/mixed", 2, &v) == 0);
+    assert(v.type == VALUE_INT64 && v.i == 6);
+    assert(document_get_value(doc, "n/mixed", UINT64_MAX, &v) == 1);
+    assert(document_get_value(doc, "n/missing", UINT64_MAX, &v) == 1);
+
+    /* Text reads see every type formatted. */
+    check_text(doc, "n/int", UINT64_MAX, "9000000000");
+    check_text(doc, "n/dbl", UINT64_MAX, "0.1");
+    check_text(doc, "n/flag", UINT64_MAX, "true");
+    check_text(doc, "n/blob", UINT64_MAX, "0x610062ff");
+    check_text(doc, "n/mixed", 2, "6");
+}
+
+static int first_match(void *ctx, const char *path, const char *value) {
+    (void)path;
+    snprintf(ctx, 32, "%s", value);
+    return 1;
+}
+
+struct ranged {
+    char paths[8][32];
+    size_t count;
+};
+
+static int collect_range(void *ctx, const char *path, const char *value) {
+    (void)value;
+    struct ranged *r = ctx;
+    assert(r->count < 8);
+    snprintf(r->paths[r->count++], sizeof(r->paths[0]), "%s", path);
+    return 0;
+}
+
+static long file_size(const char *file) {
+    struct stat st;
+    assert(stat(file, &st) == 0);
+    return (long)st.st_size;
+}
+
+static VersionNode wrap(Document doc) {
+    VersionNode root = version_node_create(doc, 10, 1, NULL, (void (*)(void *))document_free);
+    assert(root);
+    return root;
+}
+
+static void test_parse_and_format(void) {
+    Value v;
+    assert(value_parse(VALUE_INT64, "-42", &v) == 0 && v.i == -42);
+    assert(value_parse(VALUE_INT64, "99999999999999999999", &v) != 0);
+    assert(value_parse(VALUE_INT64, "4x", &v) != 0);
+    assert(value_parse(VALUE_DOUBLE, "nan", &v) != 0);
+    assert(value_parse(VALUE_BOOL, "yes", &v) != 0);
+    assert(value_parse(VALUE_BYTES, "0x0", &v) != 0);
+    assert(value_parse(VALUE_BYTES, "zz", &v) != 0);
+    assert(value_parse(VALUE_BYTES, "0x00ff", &v) == 0 && v.length == 2);
+    char *text = value_format(&v);
+    assert(strcmp(text, "0x00ff") == 0);
+    free(text);
+    value_clear(&v);
+    assert(value_parse(VALUE_DOUBLE, "2.5e-3", &v) == 0);
+    text = value_format(&v);
+    assert(strcmp(text, "0.0025") == 0);
+    free(text);
+    v = (Value){.type = VALUE_DOUBLE, .d = 1.0 / 3};
+    text = value_format(&v);
+    assert(strtod(text, NULL) == v.d);
+    free(text);
+
+    ValueType type;
+    assert(value_type_parse("int", &type) == 0 && type == VALUE_INT64);
+    assert(value_type_parse("float", &type) != 0);
+    assert(strcmp(value_type_name(VALUE_BYTES), "bytes") == 0);
+}
+
+int main(void) {
+    test_parse_and_format();
+
+    Document doc = document_create();
+    assert(doc);
+    assert(document_set_value_path(doc, "n/int", &(Value){.type = VALUE_INT64, .i = -7}, 1) == 0);
+    assert(document_set_value_path(doc, "n/int", &(Value){.type = VALUE_INT64, .i = 9000000000LL},
+                                   2) == 0);
+    assert(document_set_value_path(doc, "n/dbl", &(Value){.type = VALUE_DOUBLE, .d = 0.1}, 3) == 0);
+    assert(document_set_value_path(doc, "n/flag", &(Value){.type = VALUE_BOOL, .b = 1}, 4) == 0);
+    assert(document_set_value_path(doc, "n/blob", &(Value){.type = VALUE_BYTES, .data = blob,
+                                                           .length = sizeof(blob)}, 5) == 0);
+    assert(document_set_field_path(doc, "n/text", "hello", 6) == 0);
+    assert(document_set_field_path(doc, "n/mixed", "5", 7) == 0);
+    assert(document_set_value_path(doc, "n/mixed", &(Value){.type = VALUE_INT64, .i = 6}, 8) == 0);
+    assert(document_delete_path(doc, "n/mixed", 9) == 0);
+    check_values(doc);
+
+    char value[32] = "";
+    assert(document_query(doc, "n/flag", 1, first_match, value) == 1);
+    assert(strcmp(value, "true") == 0);
+
+    /* Every format, and blocks, keeps the types. */
+    VersionNode root = wrap(doc);
+    SerializeOptions formats[] = {{.format_version = 1}, {.format_version = 2},
+                                  {.format_version = 3}, {.format_version = 3, .compress = 1}};
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        assert(serialize_db_with_options(root, TYPED_FILE, &formats[i]) == 0);
+        VersionNode loaded = NULL;
+        assert(deserialize_db(TYPED_FILE, &loaded) == 0 && loaded);
+        check_values((Document)loaded->value);
+        version_node_free(loaded);
+    }
+
+    /* Cold reads from a v2 mapping decode them too. */
+    assert(serialize_db(root, TYPED_FILE) == 0);
+    Snapshot snap = NULL;
+    assert(snapshot_open(TYPED_FILE, &snap) == 0);
+    Value v;
+    assert(snapshot_get_value(snap, "n/blob", UINT64_MAX, &v) == 0);
+    assert(v.type == VALUE_BYTES && v.length == sizeof(blob) && memcmp(v.data, blob, 4) == 0);
+    value_clear(&v);
+    assert(snapshot_get_value(snap, "n/dbl", UINT64_MAX, &v) == 0 && v.d == 0.1);
+    assert(snapshot_get_value(snap, "n/mixed", UINT64_MAX, &v) == 1);
+    char *text = NULL;
+    assert(snapshot_get_field(snap, "n/int", 1, &text) == 0 && strcmp(text, "-7") == 0);
+    free(text);
+    snapshot_release(snap);
+    version_node_free(root);
+
+    /* Numbers take less room typed than as text: v2 keeps them in the
+     * version record, packed as varints. */
+    Document typed = document_create(), plain = document_create();
+    assert(typed && plain);
+    char path[32], number[32];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(path, sizeof(path), "c/%d", i);
+        snprintf(number, sizeof(number), "%d", 100000 + i);
+        assert(document_set_value_path(typed, path,
+                                       &(Value){.type = VALUE_INT64, .i = 100000 + i}, 1) == 0);
+        assert(document_set_field_path(plain, path, number, 1) == 0);
+    }
+    VersionNode typed_root = wrap(typed), plain_root = wrap(plain);
+    for (uint32_t format = 2; format <= 3; format++) {
+        SerializeOptions options = {.format_version = format};
+        assert(serialize_db_with_options(typed_root, TYPED_FILE, &options) == 0);
+        assert(serialize_db_with_options(plain_root, TEXT_FILE, &options) == 0);
+        assert(file_size(TYPED_FILE) < file_size(TEXT_FILE));
+    }
+    version_node_free(typed_root);
+    version_node_free(plain_root);
+
+    /* A range index takes typed numbers as they are. */
+    Document items = document_create();
+    assert(items);
+    assert(document_set_value_path(items, "items/a/price", &(Value){.type = VALUE_DOUBLE, .d = 2.5},
+                                   1) == 0);
+    assert(document_set_value_path(items, "items/b/price", &(Value){.type = VALUE_INT64, .i = 1},
+                                   1) == 0);
+    assert(document_set_value_path(items, "items/c/price", &(Value){.type = VALUE_BOOL, .b = 1},
+                                   1) == 0);
+    IndexSet set = index_set_create();
+    size_t count = 0;
+    assert(index_set_add(set, items, "items/*/price", INDEX_RANGE, &count) == 0 && count == 2);
+    assert(index_set_set_value(set, items, "items/c/price",
+                               &(Value){.type = VALUE_INT64, .i = 2}, 2) == 0);
+    struct ranged r = {0};
+    assert(index_set_range(set, items, "items/*/price", 0, 10, 0, collect_range, &r) == 0);
+    assert(r.count == 3);
+    assert(strcmp(r.paths[0], "items/b/price") == 0);
+    assert(strcmp(r.paths[1], "items/c/price") == 0);
+    assert(strcmp(r.paths[2], "items/a/price") == 0);
+    index_set_free(set);
+    document_free(items);
+
+    remove(TYPED_FILE);
+    remove(TEXT_FILE);
+    puts("Typed value tests passed.");
+    return 0;
+}
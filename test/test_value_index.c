@@ -0,0 +1,323 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/utils/document.h"
+#include "../src/utils/query.h"
+#include "../src/utils/reclaim.h"
+#include "../src/utils/value_index.h"
+
+#define WRITERS 4
+#define HOT_PATHS 16
+
+/* Paths found, sorted and joined with spaces for comparison. */
+struct found {
+    char *paths[512];
+    size_t count;
+};
+
+static int collect(void *ctx, const char *path, const char *value) {
+    (void)value;
+    struct found *f = ctx;
+    assert(f->count < sizeof(f->paths) / sizeof(f->paths[0]));
+    f->paths[f->count++] = strdup(path);
+    return 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void expect(IndexSet set, Document root, const char *pattern, const char *value,
+                   const char *joined) {
+    struct found f = {0};
+    assert(index_set_find(set, root, pattern, value, collect, &f) == 0);
+    qsort(f.paths, f.count, sizeof(f.paths[0]), compare_paths);
+    char buf[1024] = "";
+    for (size_t i = 0; i < f.count; i++) {
+        if (i) strcat(buf, " ");
+        strcat(buf, f.paths[i]);
+        free(f.paths[i]);
+    }
+    if (strcmp(buf, joined) != 0) {
+        fprintf(stderr, "find %s = %s: '%s', expected '%s'\n", pattern, value, buf, joined);
+        assert(0);
+    }
+}
+
+static void test_upkeep(void) {
+    Document root = document_create();
+    IndexSet set = index_set_create();
+    assert(root && set);
+    uint64_t gv = 1;
+    assert(index_set_set_field(set, root, "users/ann/status", "active", gv++) == 0);
+    assert(index_set_set_field(set, root, "users/bob/status", "idle", gv++) == 0);
+    assert(index_set_set_field(set, root, "users/cat/status", "active", gv++) == 0);
+    assert(index_set_set_field(set, root, "users/dan/status", "active", gv++) == 0);
+    assert(index_set_delete_field(set, root, "users/dan/status", gv++) == 0);
+    assert(index_set_set_field(set, root, "admins/eve/status", "active", gv++) == 0);
+
+    size_t count = 0;
+    assert(index_set_add(set, root, "users/*/status", INDEX_EQUALITY, &count) == 0);
+    assert(count == 3);
+    assert(index_set_add(set, root, "/users//*/status/", INDEX_EQUALITY, &count) == 1);
+    assert(index_set_add(set, root, "", INDEX_EQUALITY, &count) == -1);
+    expect(set, root, "users/*/status", "active", "users/ann/status users/cat/status");
+    expect(set, root, "users/*/status", "idle", "users/bob/status");
+    expect(set, root, "users/*/status", "gone", "");
+
+    /* Writes move paths between values, and spelling does not matter. */
+    assert(index_set_set_field(set, root, "users/bob/status", "active", gv++) == 0);
+    assert(index_set_set_field(set, root, "users/ann/status", "active", gv++) == 0);
+    assert(index_set_delete_field(set, root, "users/cat/status", gv++) == 0);
+    assert(index_set_delete_field(set, root, "users/nobody/status", gv++) == 0);
+    assert(index_set_set_field(set, root, "//users/fay//status", "active", gv++) == 0);
+    assert(index_set_set_field(set, root, "users/fay/name", "active", gv++) == 0);
+    expect(set, root, "users/*/status", "active",
+           "users/ann/status users/bob/status users/fay/status");
+    expect(set, root, "users/*/status", "idle", "");
+
+    /* Other patterns are answered by a walk, with the same result. */
+    expect(set, root, "users/**", "active",
+           "users/ann/status users/bob/status users/fay/name users/fay/status");
+    expect(set, root, "*/*/status", "active",
+           "admins/eve/status users/ann/status users/bob/status users/fay/status");
+    assert(index_set_find(set, root, "///", "active", collect, NULL) == -1);
+
+    /* A subtree replaced wholesale. */
+    Document sub = document_create();
+    assert(sub);
+    assert(document_set_field_path(sub, "ann/status", "idle", 1) == 0);
+    assert(document_set_field_path(sub, "gus/status", "active", 1) == 0);
+    assert(index_set_set_subdocument(set, root, "users", sub, gv++) == 0);
+    document_free(sub);
+    expect(set, root, "users/*/status", "active", "users/gus/status");
+    expect(set, root, "users/*/status", "idle", "users/ann/status");
+
+    /* And the whole tree, as after a load. */
+    Document other = document_create();
+    assert(other);
+    assert(document_set_field_path(other, "users/hal/status", "idle", 1) == 0);
+    assert(index_set_rebuild(set, other) == 0);
+    expect(set, other, "users/*/status", "idle", "users/hal/status");
+    expect(set, other, "users/*/status", "active", "");
+
+    /* Indexes staged over a tree not yet published change nothing until
+     * they are installed. */
+    Document third = document_create();
+    IndexSet staged = NULL;
+    assert(third);
+    assert(document_set_field_path(third, "users/ivy/status", "active", 1) == 0);
+    assert(index_set_stage(set, third, &staged) == 0 && staged);
+    expect(set, other, "users/*/status", "idle", "users/hal/status");
+    assert(index_set_install(set, staged) == 0);
+    expect(set, third, "users/*/status", "active", "users/ivy/status");
+    expect(set, third, "users/*/status", "idle", "");
+    assert(index_set_stage(NULL, third, &staged) == 0 && !staged);
+    assert(index_set_install(NULL, NULL) == 0);
+    document_free(third);
+
+    assert(index_set_drop(set, "users/*/status/", INDEX_EQUALITY) == 0);
+    assert(index_set_drop(set, "users/*/status", INDEX_EQUALITY) == -1);
+    expect(set, root, "users/*/status", "active", "users/gus/status");
+    index_set_free(set);
+    document_free(other);
+    document_free(root);
+}
+
+/* A NULL set passes writes through and finds by walking. */
+static void test_no_indexes(void) {
+    Document root = document_create();
+    assert(root);
+    assert(index_set_set_field(NULL, root, "a/b", "1", 1) == 0);
+    assert(index_set_set_field(NULL, root, "a/c", "1", 2) == 0);
+    assert(index_set_delete_field(NULL, root, "a/c", 3) == 0);
+    expect(NULL, root, "a/*", "1", "a/b");
+    document_free(root);
+}
+
+/* Paths and values in the order range gave them. */
+struct ranged {
+    char lines[4096];
+    size_t count;
+};
+
+static int append(void *ctx, const char *path, const char *value) {
+    struct ranged *r = ctx;
+    size_t len = strlen(r->lines);
+    snprintf(r->lines + len, sizeof(r->lines) - len, "%s%s=%s", len ? " " : "", path, value);
+    r->count++;
+    return 0;
+}
+
+static void expect_range(IndexSet set, Document root, double lo, double hi, size_t limit,
+                         const char *lines) {
+    struct ranged r = {0};
+    assert(index_set_range(set, root, "orders/*/total", lo, hi, limit, append, &r) == 0);
+    if (strcmp(r.lines, lines) != 0) {
+        fprintf(stderr, "range [%g, %g]: '%s', expected '%s'\n", lo, hi, r.lines, lines);
+        assert(0);
+    }
+}
+
+static void test_range(void) {
+    Document root = document_create();
+    IndexSet set = index_set_create();
+    assert(root && set);
+    const char *totals[][2] = {
+        {"a", "250"}, {"b", "99.5"}, {"c", "1e3"}, {"d", "n/a"}, {"e", "400"}, {"f", "250"},
+        {"g", "-3"}, {"h", "12abc"}, {"i", ""},
+    };
+    char path[64];
+    uint64_t gv = 1;
+    for (size_t i = 0; i < sizeof(totals) / sizeof(totals[0]); i++) {
+        snprintf(path, sizeof(path), "orders/%s/total", totals[i][0]);
+        assert(index_set_set_field(set, root, path, totals[i][1], gv++) == 0);
+    }
+    size_t count = 0;
+    assert(index_set_add(set, root, "orders/*/total", INDEX_RANGE, &count) == 0 && count == 6);
+    assert(index_set_add(set, root, "orders/*/total", INDEX_RANGE, NULL) == 1);
+    assert(index_set_add(set, root, "orders/*/total", INDEX_EQUALITY, NULL) == 0);
+
+    /* Inclusive bounds, ascending, ties by path. */
+    expect_range(set, root, 100, 400, 0, "orders/a/total=250 orders/f/total=250 orders/e/total=400");
+    expect_range(set, root, -1.0 / 0.0, 1.0 / 0.0, 3,
+                 "orders/g/total=-3 orders/b/total=99.5 orders/a/total=250");
+    expect_range(set, root, 1001, 2000, 0, "");
+    expect_range(set, root, 1000, 1000, 0, "orders/c/total=1e3");
+
+    /* Writes move fields, and values that stop being numbers drop out. */
+    assert(index_set_set_field(set, root, "orders/a/total", "5", gv++) == 0);
+    assert(index_set_set_field(set, root, "orders/c/total", "soon", gv++) == 0);
+    assert(index_set_set_field(set, root, "orders/d/total", "300", gv++) == 0);
+    assert(index_set_delete_field(set, root, "orders/e/total", gv++) == 0);
+    expect_range(set, root, 0, 1e9, 0,
+                 "orders/a/total=5 orders/b/total=99.5 orders/f/total=250 orders/d/total=300");
+    expect(set, root, "orders/*/total", "soon", "orders/c/total");
+
+    /* Without a range index the same fields come back, in no order. */
+    struct ranged r = {0};
+    assert(index_set_range(NULL, root, "orders/*/total", 0, 1e9, 0, append, &r) == 0);
+    assert(r.count == 4);
+    r = (struct ranged){0};
+    assert(index_set_range(NULL, root, "orders/*/total", 0, 1e9, 2, append, &r) == 0);
+    assert(r.count == 2);
+    assert(index_set_range(set, root, "orders/*/total", 0.0 / 0.0, 1, 0, append, &r) == -1);
+
+    assert(index_set_drop(set, "orders/*/total", INDEX_RANGE) == 0);
+    assert(index_set_drop(set, "orders/*/total", INDEX_RANGE) == -1);
+    expect(set, root, "orders/*/total", "soon", "orders/c/total");
+    index_set_free(set);
+    document_free(root);
+}
+
+/* Many updates in random order against a walk of the same tree. */
+static void test_range_matches_walk(void) {
+    Document root = document_create();
+    IndexSet set = index_set_create();
+    assert(root && set);
+    assert(index_set_add(set, root, "orders/*/total", INDEX_RANGE, NULL) == 0);
+    char path[64], value[32];
+    unsigned seed = 7;
+    for (int i = 0; i < 20000; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int order = (int)(seed >> 16) % 500;
+        snprintf(path, sizeof(path), "orders/o%03d/total", order);
+        if (seed % 7 == 0) {
+            assert(index_set_delete_field(set, root, path, (uint64_t)i + 1) == 0);
+        } else {
+            snprintf(value, sizeof(value), "%d", (int)(seed >> 8) % 1000);
+            assert(index_set_set_field(set, root, path, value, (uint64_t)i + 1) == 0);
+        }
+    }
+    for (int lo = 0; lo < 1000; lo += 97) {
+        struct ranged indexed = {0}, walked = {0};
+        assert(index_set_range(set, root, "orders/*/total", lo, lo + 150, 0, append, &indexed) == 0);
+        assert(index_set_range(NULL, root, "orders/*/total", lo, lo + 150, 0, append, &walked) == 0);
+        assert(indexed.count == walked.count);
+        /* Ascending: each value at least the one before. */
+        double last = -1;
+        for (char *save = NULL, *tok = strtok_r(indexed.lines, " ", &save); tok;
+             tok = strtok_r(NULL, " ", &save)) {
+            double v = strtod(strchr(tok, '=') + 1, NULL);
+            assert(v >= last && v >= lo && v <= lo + 150);
+            last = v;
+        }
+    }
+    index_set_free(set);
+    document_free(root);
+}
+
+struct racer {
+    IndexSet set;
+    Document root;
+    int id;
+};
+
+static void *race(void *arg) {
+    struct racer *r = arg;
+    char path[64], value[16];
+    for (int i = 0; i < 4000; i++) {
+        int n = (i * 7 + r->id) % HOT_PATHS;
+        snprintf(path, sizeof(path), "hot/p%02d/v", n);
+        snprintf(value, sizeof(value), "w%d", (i + r->id) % 3);
+        if (i % 5 == 4) {
+            assert(index_set_delete_field(r->set, r->root, path, 0) == 0);
+        } else {
+            assert(index_set_set_field(r->set, r->root, path, value, 0) == 0);
+        }
+        if (i % 100 == 0) {
+            struct found f = {0};
+            assert(index_set_find(r->set, r->root, "hot/*/v", value, collect, &f) == 0);
+            for (size_t j = 0; j < f.count; j++) free(f.paths[j]);
+        }
+    }
+    return NULL;
+}
+
+/* Writers racing on the same paths leave the index agreeing with the
+ * tree. */
+static void test_racing_writers(void) {
+    Document root = document_create();
+    IndexSet set = index_set_create();
+    assert(root && set);
+    assert(index_set_add(set, root, "hot/*/v", INDEX_EQUALITY, NULL) == 0);
+    pthread_t threads[WRITERS];
+    struct racer args[WRITERS];
+    for (int i = 0; i < WRITERS; i++) {
+        args[i] = (struct racer){set, root, i};
+        assert(pthread_create(&threads[i], NULL, race, &args[i]) == 0);
+    }
+    for (int i = 0; i < WRITERS; i++) pthread_join(threads[i], NULL);
+
+    const char *values[] = {"w0", "w1", "w2"};
+    for (size_t v = 0; v < 3; v++) {
+        struct found indexed = {0}, walked = {0};
+        assert(index_set_find(set, root, "hot/*/v", values[v], collect, &indexed) == 0);
+        assert(index_set_find(NULL, root, "hot/*/v", values[v], collect, &walked) == 0);
+        assert(indexed.count == walked.count);
+        qsort(indexed.paths, indexed.count, sizeof(char *), compare_paths);
+        qsort(walked.paths, walked.count, sizeof(char *), compare_paths);
+        for (size_t i = 0; i < indexed.count; i++) {
+            assert(strcmp(indexed.paths[i], walked.paths[i]) == 0);
+            free(indexed.paths[i]);
+            free(walked.paths[i]);
+        }
+    }
+    index_set_free(set);
+    document_free(root);
+    reclaim_barrier();
+}
+
+int main(void) {
+    test_upkeep();
+    test_no_indexes();
+    test_range();
+    test_range_matches_walk();
+    test_racing_writers();
+    puts("Value index tests passed.");
+    return 0;
+}